@@ -0,0 +1,200 @@
+#include "arena.h"
+
+#include <new>
+#include <string.h>
+#include <pthread.h>
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1))
+
+static __thread Arena *currentArena = NULL;
+
+static pthread_key_t threadArenaKey;
+static pthread_once_t threadArenaKeyOnce = PTHREAD_ONCE_INIT;
+
+static void deleteThreadArena(void *arena) {
+  delete (Arena*) arena;
+}
+
+static void createThreadArenaKey(void) {
+  pthread_key_create(&threadArenaKey, &deleteThreadArena);
+}
+
+Arena::Arena(size_t blockSize): firstBlock(NULL), currentBlock(NULL),
+  lastBlock(NULL), blockSize(blockSize),
+  maxRetainedSize(ARENA_DEFAULT_MAX_RETAINED_SIZE) {
+}
+
+Arena::~Arena(void) {
+  Block *block = firstBlock;
+
+  while (block != NULL) {
+    Block *next = block->next;
+    free(block);
+    block = next;
+  }
+}
+
+char *Arena::getBlockData(Block *block) {
+  return &(((char*) block)[ARENA_ALIGN(sizeof(Block))]);
+}
+
+Arena::Block *Arena::newBlock(size_t minSize) {
+  Block *block;
+  size_t size = (minSize > blockSize) ? minSize : blockSize;
+
+  block = (Block*) malloc(ARENA_ALIGN(sizeof(Block)) + size);
+  if (block == NULL) {
+    throw std::bad_alloc();
+  }
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+
+  if (lastBlock == NULL) {
+    firstBlock = block;
+  } else {
+    lastBlock->next = block;
+  }
+  lastBlock = block;
+
+  return block;
+}
+
+void *Arena::allocate(size_t size) {
+  char *ptr;
+
+  size = ARENA_ALIGN(size);
+  if ((currentBlock == NULL) || (currentBlock->used + size > currentBlock->size)) {
+    // Blocks after the current one are unused: take the first large enough
+    Block *block = (currentBlock == NULL) ? firstBlock : currentBlock->next;
+
+    while ((block != NULL) && (block->size < size)) {
+      block = block->next;
+    }
+    if (block == NULL) {
+      block = newBlock(size);
+    }
+    currentBlock = block;
+  }
+
+  ptr = &(getBlockData(currentBlock)[currentBlock->used]);
+  currentBlock->used += size;
+
+  return ptr;
+}
+
+void *Arena::reallocate(void *ptr, size_t oldSize, size_t newSize) {
+  void *newPtr;
+
+  if (ptr == NULL) {
+    return allocate(newSize);
+  }
+
+  oldSize = ARENA_ALIGN(oldSize);
+  if (ARENA_ALIGN(newSize) <= oldSize) {
+    return ptr;
+  }
+
+  // Last allocation of the current block: grow in place
+  if ((currentBlock != NULL)
+    && (&(getBlockData(currentBlock)[currentBlock->used - oldSize]) == ptr)
+    && (currentBlock->used - oldSize + ARENA_ALIGN(newSize) <= currentBlock->size)) {
+    currentBlock->used += ARENA_ALIGN(newSize) - oldSize;
+    return ptr;
+  }
+
+  newPtr = allocate(newSize);
+  memcpy(newPtr, ptr, oldSize);
+
+  return newPtr;
+}
+
+bool Arena::owns(const void *ptr) const {
+  const char *cptr = (const char*) ptr;
+
+  for (Block *block = firstBlock; block != NULL; block = block->next) {
+    char *data = getBlockData(block);
+    if ((cptr >= data) && (cptr < &(data[block->size]))) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void Arena::reset(void) {
+  Block *block = firstBlock;
+  size_t retainedSize = 0;
+
+  firstBlock = lastBlock = currentBlock = NULL;
+
+  while (block != NULL) {
+    Block *next = block->next;
+
+    if (retainedSize + block->size <= maxRetainedSize) {
+      retainedSize += block->size;
+      block->used = 0;
+      block->next = NULL;
+      if (lastBlock == NULL) {
+        firstBlock = block;
+      } else {
+        lastBlock->next = block;
+      }
+      lastBlock = block;
+    } else {
+      free(block);
+    }
+    block = next;
+  }
+}
+
+size_t Arena::getBlockSize(void) const {
+  return blockSize;
+}
+
+void Arena::setBlockSize(size_t size) {
+  blockSize = size;
+}
+
+size_t Arena::getMaxRetainedSize(void) const {
+  return maxRetainedSize;
+}
+
+void Arena::setMaxRetainedSize(size_t size) {
+  maxRetainedSize = size;
+}
+
+Arena *Arena::getThreadArena(void) {
+  Arena *arena;
+
+  pthread_once(&threadArenaKeyOnce, &createThreadArenaKey);
+  arena = (Arena*) pthread_getspecific(threadArenaKey);
+  if (arena == NULL) {
+    arena = new Arena();
+    pthread_setspecific(threadArenaKey, arena);
+  }
+
+  return arena;
+}
+
+Arena *Arena::getCurrentArena(void) {
+  return currentArena;
+}
+
+Arena *Arena::setCurrentArena(Arena *arena) {
+  Arena *previousArena = currentArena;
+  currentArena = arena;
+  return previousArena;
+}
+
+ArenaScope::ArenaScope(Arena *arena): arena(arena) {
+  previousArena = Arena::setCurrentArena(arena);
+}
+
+ArenaScope::~ArenaScope(void) {
+  Arena::setCurrentArena(previousArena);
+  if (previousArena != arena) {
+    arena->reset();
+  }
+}
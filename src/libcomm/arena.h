@@ -0,0 +1,120 @@
+//! \file arena.h
+//! \brief Bump allocator
+//!
+//! File containing the declarations of the classes Arena and ArenaScope.
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdlib.h>
+
+#define ARENA_DEFAULT_BLOCK_SIZE 65536
+#define ARENA_DEFAULT_MAX_RETAINED_SIZE 1048576
+
+//! \class Arena libcomm/arena.h
+//! \brief Bump allocator
+//!
+//! An Arena hands out memory from big blocks by moving a pointer forward.
+//! Memory is never freed individually: reset releases everything at once and
+//! keeps the blocks (up to getMaxRetainedSize() bytes) for the next use, so
+//! that a steady state needs no real allocation at all.
+//! Each thread has its own arena (see getThreadArena). NetMessages created
+//! while an arena is current (see ArenaScope) draw all their internal memory
+//! from it.
+class Arena {
+  private:
+    struct Block {
+      Block *next;
+      size_t size;
+      size_t used;
+    };
+
+    Block *firstBlock;
+    Block *currentBlock;
+    Block *lastBlock;
+    size_t blockSize;
+    size_t maxRetainedSize;
+
+    Arena(const Arena &arena);
+    Arena &operator=(const Arena &arena);
+
+    static char *getBlockData(Block *block);
+    Block *newBlock(size_t minSize);
+
+  public:
+    //! \brief Arena constructor
+    //! \param[in] blockSize the size of the blocks allocated by the arena
+    //!
+    //! Creates a new Arena. No memory is allocated until the first call to
+    //! allocate.
+    Arena(size_t blockSize = ARENA_DEFAULT_BLOCK_SIZE);
+
+    //! \brief Arena destructor
+    //!
+    //! Frees all the blocks of the arena.
+    ~Arena(void);
+
+    //! \brief Allocates memory
+    //! \param[in] size the number of bytes to allocate
+    //! \return the memory, suitably aligned for any type
+    void *allocate(size_t size);
+
+    //! \brief Resizes memory previously allocated by the arena
+    //! \param[in] ptr the memory, or NULL
+    //! \param[in] oldSize the size given when ptr was allocated
+    //! \param[in] newSize the new size
+    //! \return the memory, which may have moved
+    //!
+    //! The last allocation is grown in place when the block has enough room,
+    //! otherwise the data is copied to a new location.
+    void *reallocate(void *ptr, size_t oldSize, size_t newSize);
+
+    //! \brief Checks if memory comes from this arena
+    //! \param[in] ptr the memory
+    //! \return true if ptr has been allocated by this arena
+    bool owns(const void *ptr) const;
+
+    //! \brief Releases all the memory allocated by the arena
+    //!
+    //! All the pointers returned by the arena become invalid. Blocks are kept
+    //! for later allocations up to getMaxRetainedSize() bytes.
+    void reset(void);
+
+    size_t getBlockSize(void) const;
+    void setBlockSize(size_t size);
+    size_t getMaxRetainedSize(void) const;
+    void setMaxRetainedSize(size_t size);
+
+    //! \brief Gets the arena of the calling thread
+    //! \return the arena, created on first call and deleted with the thread
+    static Arena *getThreadArena(void);
+
+    //! \brief Gets the current arena of the calling thread
+    //! \return the arena, or NULL if memory should come from the heap
+    static Arena *getCurrentArena(void);
+
+    //! \brief Sets the current arena of the calling thread
+    //! \param[in] arena the new current arena, or NULL for the heap
+    //! \return the previous current arena
+    static Arena *setCurrentArena(Arena *arena);
+};
+
+//! \class ArenaScope libcomm/arena.h
+//! \brief Makes an arena current for the lifetime of the scope
+//!
+//! When the scope ends, the previous current arena is restored, and the arena
+//! is reset unless it was already current when the scope began (nested use).
+class ArenaScope {
+  private:
+    Arena *arena;
+    Arena *previousArena;
+
+    ArenaScope(const ArenaScope &scope);
+    ArenaScope &operator=(const ArenaScope &scope);
+
+  public:
+    ArenaScope(Arena *arena);
+    ~ArenaScope(void);
+};
+
+#endif
@@ -0,0 +1,811 @@
+#include "async_event_loop.h"
+#include "tcp_socket.h"
+#include "input_stream.h"
+#include "output_stream.h"
+#include "thread.h"
+
+#include <new>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+AsyncResult::AsyncResult(Type type, NetSocket *socket): type(type),
+  socket(socket), acceptedSocket(NULL), object(NULL), size(0) {
+}
+
+bool AsyncResult::failed(void) {
+  return (e.getCode() != 0);
+}
+
+AsyncCallback::~AsyncCallback(void) {
+}
+
+AsyncFuture::AsyncFuture(void): done(false),
+  result(AsyncResult::CONNECT, NULL) {
+  condition = mutex.getNewCondition();
+}
+
+AsyncFuture::~AsyncFuture(void) {
+  delete condition;
+}
+
+void AsyncFuture::completed(AsyncResult &result) {
+  mutex.lock();
+  this->result = result;
+  done = true;
+  condition->notifyAll();
+  mutex.unlock();
+}
+
+bool AsyncFuture::isDone(void) {
+  bool isDone;
+
+  mutex.lock();
+  isDone = done;
+  mutex.unlock();
+
+  return isDone;
+}
+
+AsyncResult AsyncFuture::get(void) {
+  mutex.lock();
+  while (!done) {
+    condition->wait();
+  }
+  mutex.unlock();
+
+  return result;
+}
+
+class AsyncEventLoop::LoopThread: public Thread {
+  private:
+    AsyncEventLoop *loop;
+
+  public:
+    LoopThread(AsyncEventLoop *loop): loop(loop) {
+    }
+
+  protected:
+    void *run(void) {
+      loop->run();
+      return NULL;
+    }
+};
+
+class AsyncEventLoop::Worker: public Thread {
+  private:
+    AsyncEventLoop *loop;
+
+  public:
+    Worker(AsyncEventLoop *loop): loop(loop) {
+    }
+
+  protected:
+    void *run(void) {
+      while (loop->runWorker());
+      return NULL;
+    }
+};
+
+AsyncEventLoop::AsyncEventLoop(int nbWorkers): stopped(false),
+  loopThread(NULL), workersStopped(false) {
+  wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeFd == -1) {
+    throw AsyncEventLoopException(errno);
+  }
+  readBuffer = (char*) malloc(OBJECT_PARSER_READ_SIZE);
+  if (readBuffer == NULL) {
+    close(wakeFd);
+    throw std::bad_alloc();
+  }
+  loop.add(wakeFd, STREAM_WFR_READ, NULL);
+
+  workersCondition = workersMutex.getNewCondition();
+  for (int i = 0; i < nbWorkers; ++i) {
+    Thread *worker = new Worker(this);
+    worker->start();
+    workers.push_back(worker);
+  }
+}
+
+AsyncEventLoop::~AsyncEventLoop(void) {
+  std::map<int, Registration*>::iterator it;
+
+  stop();
+  join();
+
+  workersMutex.lock();
+  workersStopped = true;
+  workersCondition->notifyAll();
+  workersMutex.unlock();
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i]->join();
+    delete workers[i];
+  }
+  delete workersCondition;
+
+  for (it = registrations.begin(); it != registrations.end(); ++it) {
+    Registration *registration = it->second;
+
+    while (!registration->reads.empty()) {
+      free(registration->reads.front()->data);
+      delete registration->reads.front();
+      registration->reads.pop_front();
+    }
+    while (!registration->writes.empty()) {
+      free(registration->writes.front()->data);
+      delete registration->writes.front();
+      registration->writes.pop_front();
+    }
+    delete registration;
+  }
+  while (!submitted.empty()) {
+    free(submitted.front()->data);
+    delete submitted.front();
+    submitted.pop_front();
+  }
+
+  free(readBuffer);
+  close(wakeFd);
+}
+
+int AsyncEventLoop::getFd(NetSocket *socket) {
+  return socket->getSocketId();
+}
+
+void AsyncEventLoop::submit(Operation *operation) {
+  bool wasEmpty;
+
+  mutex.lock();
+  wasEmpty = submitted.empty();
+  submitted.push_back(operation);
+  mutex.unlock();
+
+  // The loop takes all the submitted operations at once
+  if (wasEmpty) wake();
+}
+
+void AsyncEventLoop::wake(void) {
+  uint64_t one = 1;
+
+  while ((::write(wakeFd, &one, sizeof(one)) == -1) && (errno == EINTR));
+}
+
+void AsyncEventLoop::run(void) {
+  for (;;) {
+    bool isStopped;
+
+    mutex.lock();
+    isStopped = stopped;
+    mutex.unlock();
+    if (isStopped) break;
+
+    iterate(true, 0);
+  }
+}
+
+int AsyncEventLoop::runOnce(uint64_t nanosec) {
+  return iterate(false, nanosec);
+}
+
+void AsyncEventLoop::start(void) {
+  if (loopThread != NULL) return;
+  loopThread = new LoopThread(this);
+  loopThread->start();
+}
+
+void AsyncEventLoop::stop(void) {
+  mutex.lock();
+  stopped = true;
+  mutex.unlock();
+  wake();
+}
+
+void AsyncEventLoop::join(void) {
+  if (loopThread == NULL) return;
+  loopThread->join();
+  delete loopThread;
+  loopThread = NULL;
+}
+
+int AsyncEventLoop::iterate(bool block, uint64_t nanosec) {
+  std::deque<Operation*> operations;
+  std::vector<EventLoopEvent> events;
+  int nbCompleted;
+
+  mutex.lock();
+  operations.swap(submitted);
+  mutex.unlock();
+  for (size_t i = 0; i < operations.size(); ++i) {
+    startOperation(operations[i]);
+  }
+
+  // Operations completed at once are not delayed by the wait
+  if (!completions.empty()) {
+    loop.wait(&events, (uint64_t) 0);
+  } else if (block) {
+    loop.wait(&events);
+  } else {
+    loop.wait(&events, nanosec);
+  }
+
+  for (size_t i = 0; i < events.size(); ++i) {
+    Registration *registration = (Registration*) events[i].data;
+    std::map<int, Registration*>::iterator it;
+
+    if (registration == NULL) {
+      uint64_t value;
+
+      while ((::read(wakeFd, &value, sizeof(value)) == -1) && (errno == EINTR));
+      continue;
+    }
+
+    // The registration may have been dropped by a previous event
+    it = registrations.find(events[i].fd);
+    if ((it == registrations.end()) || (it->second != registration)) continue;
+
+    if (events[i].setIsRead()) processReads(registration);
+    if (events[i].setIsWrite()) processWrites(registration);
+    updateRegistration(registration);
+  }
+
+  nbCompleted = completions.size();
+  dispatch();
+
+  return nbCompleted;
+}
+
+void AsyncEventLoop::startOperation(Operation *operation) {
+  Registration *registration;
+  std::map<int, Registration*>::iterator it;
+
+  if (operation->type == AsyncResult::CANCEL) {
+    it = registrations.find(getFd(operation->socket));
+    if ((it != registrations.end()) && (it->second->socket == operation->socket)) {
+      cancelRegistration(it->second);
+    }
+    if (operation->callback != NULL) {
+      AsyncResult result(AsyncResult::CANCEL, operation->socket);
+
+      complete(operation, result);
+    } else {
+      delete operation;
+    }
+    return;
+  }
+  if (operation->type == AsyncResult::POSTED) {
+    AsyncResult result(operation->type, NULL);
+
+    complete(operation, result);
+    return;
+  }
+
+  registration = getRegistration(operation->socket);
+  if (registration == NULL) {
+    Exception e(errno);
+    fail(operation, e);
+    return;
+  }
+
+  switch (operation->type) {
+    case AsyncResult::CONNECT: {
+      struct sockaddr_in address;
+      long flags;
+
+      flags = fcntl(registration->fd, F_GETFL, NULL);
+      if ((flags == -1) || (fcntl(registration->fd, F_SETFL, flags | O_NONBLOCK) == -1)) {
+        Exception e(errno);
+        fail(operation, e);
+        break;
+      }
+      operation->fileFlags = flags;
+
+      operation->address.getSockAddr(&address);
+      if (::connect(registration->fd, (sockaddr*) &address, sizeof(address)) == -1) {
+        if (errno == EINPROGRESS) {
+          // Completed when the socket becomes writable
+          registration->writes.push_back(operation);
+          break;
+        }
+        Exception e(errno);
+        fcntl(registration->fd, F_SETFL, flags);
+        fail(operation, e);
+      } else {
+        AsyncResult result(operation->type, operation->socket);
+
+        fcntl(registration->fd, F_SETFL, flags);
+        complete(operation, result);
+      }
+      break;
+    }
+    case AsyncResult::ACCEPT: {
+      long flags;
+
+      // A connection may vanish between the readiness and the accept. The
+      // flags are given back when the last accept leaves the queue.
+      if (!registration->reads.empty()) {
+        operation->fileFlags = registration->reads.front()->fileFlags;
+        registration->reads.push_back(operation);
+        break;
+      }
+      flags = fcntl(registration->fd, F_GETFL, NULL);
+      if ((flags == -1) || (fcntl(registration->fd, F_SETFL, flags | O_NONBLOCK) == -1)) {
+        Exception e(errno);
+        fail(operation, e);
+        break;
+      }
+      operation->fileFlags = flags;
+      registration->reads.push_back(operation);
+      break;
+    }
+    case AsyncResult::READ_OBJECT:
+    case AsyncResult::READ_STRING:
+    case AsyncResult::READ_BYTES:
+      registration->reads.push_back(operation);
+      if (!registration->datagram) processPending(registration);
+      break;
+    case AsyncResult::WRITE_OBJECT:
+      registration->writes.push_back(operation);
+      // Tried at once, most writes do not have to wait
+      if ((registration->writes.size() == 1)
+        && writeOperation(registration, operation)) {
+        registration->writes.pop_front();
+      }
+      break;
+    case AsyncResult::POSTED:
+    case AsyncResult::CANCEL:
+      break;
+  }
+
+  updateRegistration(registration);
+}
+
+AsyncEventLoop::Registration *AsyncEventLoop::getRegistration(NetSocket *socket) {
+  Registration *registration;
+  std::map<int, Registration*>::iterator it;
+  int fd = getFd(socket);
+  int type;
+  socklen_t size = sizeof(type);
+
+  it = registrations.find(fd);
+  if (it != registrations.end()) {
+    if (it->second->socket == socket) return it->second;
+    // The descriptor of a deleted socket has been reused
+    cancelRegistration(it->second);
+  }
+
+  if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &size) == -1) {
+    return NULL;
+  }
+
+  registration = new Registration();
+  registration->socket = socket;
+  registration->fd = fd;
+  registration->datagram = (type == SOCK_DGRAM);
+  registration->pendingOffset = 0;
+  registration->sets = STREAM_WFR_NONE;
+  registrations[fd] = registration;
+
+  return registration;
+}
+
+void AsyncEventLoop::updateRegistration(Registration *registration) {
+  int sets = STREAM_WFR_NONE;
+
+  if (!registration->reads.empty()) sets |= STREAM_WFR_READ;
+  if (!registration->writes.empty()) sets |= STREAM_WFR_WRITE;
+
+  if (sets != registration->sets) {
+    if (sets == STREAM_WFR_NONE) {
+      loop.remove(registration->fd);
+    } else if (registration->sets == STREAM_WFR_NONE) {
+      loop.add(registration->fd, (StreamWFRSet) sets, registration);
+    } else {
+      loop.modify(registration->fd, (StreamWFRSet) sets, registration);
+    }
+    registration->sets = (StreamWFRSet) sets;
+  }
+
+  // Idle sockets are forgotten, unless bytes have been received ahead
+  if ((sets == STREAM_WFR_NONE) && registration->pending.empty()
+    && !registration->parser.isParsing() && !registration->parser.hasObject()) {
+    registrations.erase(registration->fd);
+    delete registration;
+  }
+}
+
+void AsyncEventLoop::cancelRegistration(Registration *registration) {
+  Exception e(ECANCELED);
+
+  failReads(registration, e);
+  while (!registration->writes.empty()) {
+    Operation *operation = registration->writes.front();
+
+    if (operation->type == AsyncResult::CONNECT) {
+      fcntl(registration->fd, F_SETFL, operation->fileFlags);
+    }
+    fail(operation, e);
+    registration->writes.pop_front();
+  }
+  registration->parser.reset();
+  registration->pending.clear();
+  registration->pendingOffset = 0;
+  updateRegistration(registration);
+}
+
+void AsyncEventLoop::processReads(Registration *registration) {
+  if (registration->reads.empty()) return;
+
+  if (registration->reads.front()->type == AsyncResult::ACCEPT) {
+    acceptConnections(registration);
+  } else if (registration->datagram) {
+    readDatagrams(registration);
+  } else {
+    readStream(registration);
+  }
+}
+
+void AsyncEventLoop::processWrites(Registration *registration) {
+  while (!registration->writes.empty()) {
+    Operation *operation = registration->writes.front();
+    bool done;
+
+    if (operation->type == AsyncResult::CONNECT) {
+      done = finishConnect(registration, operation);
+    } else {
+      done = writeOperation(registration, operation);
+    }
+    if (!done) break;
+    registration->writes.pop_front();
+  }
+}
+
+void AsyncEventLoop::readStream(Registration *registration) {
+  ssize_t sizeRead;
+
+  // One read per readiness, the loop reports the socket again if more bytes
+  // are pending
+  sizeRead = recv(registration->fd, readBuffer, OBJECT_PARSER_READ_SIZE, MSG_DONTWAIT);
+  if (sizeRead == -1) {
+    if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+    InputStream::InputStreamException e(errno);
+
+    failReads(registration, e);
+    return;
+  }
+
+  if (registration->pendingOffset == registration->pending.size()) {
+    registration->pending.clear();
+    registration->pendingOffset = 0;
+  }
+  registration->pending.append(readBuffer, sizeRead);
+  processPending(registration);
+
+  if (sizeRead == 0) {
+    InputStream::InputStreamException e(EX_STREAM_CLOSED, "Stream has been closed.");
+
+    failReads(registration, e);
+  }
+}
+
+void AsyncEventLoop::processPending(Registration *registration) {
+  std::string &pending = registration->pending;
+
+  while (!registration->reads.empty()) {
+    Operation *operation = registration->reads.front();
+    AsyncResult result(operation->type, operation->socket);
+    const char *data = pending.data() + registration->pendingOffset;
+    size_t size = pending.size() - registration->pendingOffset;
+
+    if (operation->type == AsyncResult::READ_OBJECT) {
+      if (!registration->parser.hasObject()) {
+        if (size == 0) break;
+        try {
+          registration->pendingOffset +=
+            registration->parser.feedUntilObject(data, size);
+        } catch (Exception &e) {
+          // The stream is out of sync
+          registration->parser.reset();
+          pending.clear();
+          registration->pendingOffset = 0;
+          failReads(registration, e);
+          break;
+        }
+        // Objects of unknown types are dropped
+        continue;
+      }
+      result.object = registration->parser.nextObject();
+    } else if (operation->type == AsyncResult::READ_STRING) {
+      const char *end = (const char*) memmem(data, size, "\r\n", 2);
+
+      if (end == NULL) break;
+      result.object = new String(data, end - data);
+      registration->pendingOffset += end - data + 2;
+    } else {
+      Buffer<char> *bytes;
+
+      if (size == 0) break;
+      if (size > operation->size) size = operation->size;
+      bytes = new Buffer<char>(size);
+      bytes->copyIn(0, data, size);
+      result.object = bytes;
+      registration->pendingOffset += size;
+    }
+
+    registration->reads.pop_front();
+    complete(operation, result);
+  }
+
+  if (registration->pendingOffset == pending.size()) {
+    pending.clear();
+    registration->pendingOffset = 0;
+  }
+}
+
+void AsyncEventLoop::failReads(Registration *registration, Exception &e) {
+  while (!registration->reads.empty()) {
+    Operation *operation = registration->reads.front();
+
+    if ((operation->type == AsyncResult::ACCEPT) && (registration->reads.size() == 1)) {
+      fcntl(registration->fd, F_SETFL, operation->fileFlags);
+    }
+    fail(operation, e);
+    registration->reads.pop_front();
+  }
+}
+
+void AsyncEventLoop::readDatagrams(Registration *registration) {
+  while (!registration->reads.empty()) {
+    Operation *operation = registration->reads.front();
+    AsyncResult result(operation->type, operation->socket);
+    struct sockaddr_in address;
+    socklen_t sizeAddress = sizeof(address);
+    ssize_t sizeRead;
+
+    sizeRead = recvfrom(registration->fd, readBuffer, OBJECT_PARSER_READ_SIZE,
+      MSG_DONTWAIT, (sockaddr*) &address, &sizeAddress);
+    if (sizeRead == -1) {
+      if (errno == EINTR) continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+      result.e = InputStream::InputStreamException(errno);
+    } else if (operation->type == AsyncResult::READ_OBJECT) {
+      // Each datagram holds a single object
+      try {
+        registration->parser.feed(readBuffer, sizeRead);
+        if (registration->parser.isParsing()) {
+          throw Exception(EX_MALFORMED_MESSAGE, "Truncated datagram");
+        }
+        result.object = registration->parser.nextObject();
+        result.address = NetAddress(address);
+      } catch (Exception &e) {
+        result.e = e;
+      }
+      registration->parser.reset();
+    } else if (operation->type == AsyncResult::READ_STRING) {
+      const char *end = (const char*) memmem(readBuffer, sizeRead, "\r\n", 2);
+
+      // The datagram up to its line end, the whole datagram without one
+      result.object = new String(readBuffer,
+        (end != NULL) ? (size_t) (end - readBuffer) : (size_t) sizeRead);
+      result.address = NetAddress(address);
+    } else {
+      Buffer<char> *bytes;
+      size_t size = ((size_t) sizeRead < operation->size) ? sizeRead : operation->size;
+
+      bytes = new Buffer<char>(size);
+      bytes->copyIn(0, readBuffer, size);
+      result.object = bytes;
+      result.address = NetAddress(address);
+    }
+
+    registration->reads.pop_front();
+    complete(operation, result);
+  }
+}
+
+void AsyncEventLoop::acceptConnections(Registration *registration) {
+  TcpServerSocket *server = (TcpServerSocket*) registration->socket;
+
+  while (!registration->reads.empty()) {
+    Operation *operation = registration->reads.front();
+    AsyncResult result(operation->type, operation->socket);
+
+    try {
+      result.acceptedSocket = server->acceptConnection();
+    } catch (Exception &e) {
+      if ((e.getCode() == EAGAIN) || (e.getCode() == EWOULDBLOCK)
+        || (e.getCode() == EINTR) || (e.getCode() == ECONNABORTED)) {
+        break;
+      }
+      result.e = e;
+    }
+
+    registration->reads.pop_front();
+    if (registration->reads.empty()) {
+      fcntl(registration->fd, F_SETFL, operation->fileFlags);
+    }
+    complete(operation, result);
+  }
+}
+
+bool AsyncEventLoop::finishConnect(Registration *registration, Operation *operation) {
+  AsyncResult result(operation->type, operation->socket);
+  int error = 0;
+  socklen_t size = sizeof(error);
+
+  if (getsockopt(registration->fd, SOL_SOCKET, SO_ERROR, &error, &size) == -1) {
+    error = errno;
+  }
+  fcntl(registration->fd, F_SETFL, operation->fileFlags);
+
+  if (error != 0) {
+    result.e = NetSocket::NetException(error);
+  }
+  complete(operation, result);
+
+  return true;
+}
+
+bool AsyncEventLoop::writeOperation(Registration *registration, Operation *operation) {
+  AsyncResult result(operation->type, operation->socket);
+
+  while (operation->written < operation->size) {
+    ssize_t written;
+
+    if (operation->hasAddress) {
+      struct sockaddr_in address;
+
+      operation->address.getSockAddr(&address);
+      written = sendto(registration->fd, operation->data, operation->size,
+        MSG_DONTWAIT | MSG_NOSIGNAL, (sockaddr*) &address, sizeof(address));
+    } else {
+      written = send(registration->fd, &(operation->data[operation->written]),
+        operation->size - operation->written, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+
+    if (written == -1) {
+      if (errno == EINTR) continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return false;
+      result.e = OutputStream::OutputStreamException(errno,
+        operation->size - operation->written);
+      break;
+    }
+    operation->written += written;
+    // A datagram is sent whole or not at all
+    if (registration->datagram) break;
+  }
+
+  result.size = operation->written;
+  complete(operation, result);
+
+  return true;
+}
+
+void AsyncEventLoop::complete(Operation *operation, AsyncResult &result) {
+  Completion completion = { operation->callback, result };
+
+  completions.push_back(completion);
+  free(operation->data);
+  delete operation;
+}
+
+void AsyncEventLoop::fail(Operation *operation, Exception &e) {
+  AsyncResult result(operation->type, operation->socket);
+
+  result.e = e;
+  complete(operation, result);
+}
+
+void AsyncEventLoop::dispatch(void) {
+  std::vector<Completion> toDispatch;
+
+  if (completions.empty()) return;
+  toDispatch.swap(completions);
+
+  if (workers.empty()) {
+    for (size_t i = 0; i < toDispatch.size(); ++i) {
+      toDispatch[i].callback->completed(toDispatch[i].result);
+    }
+  } else {
+    workersMutex.lock();
+    for (size_t i = 0; i < toDispatch.size(); ++i) {
+      workersQueue.push_back(toDispatch[i]);
+    }
+    workersCondition->notifyAll();
+    workersMutex.unlock();
+  }
+}
+
+bool AsyncEventLoop::runWorker(void) {
+  workersMutex.lock();
+  while (workersQueue.empty() && !workersStopped) {
+    workersCondition->wait();
+  }
+  if (workersQueue.empty()) {
+    workersMutex.unlock();
+    return false;
+  }
+  Completion completion = workersQueue.front();
+  workersQueue.pop_front();
+  workersMutex.unlock();
+
+  completion.callback->completed(completion.result);
+
+  return true;
+}
+
+void AsyncEventLoop::post(AsyncCallback *callback) {
+  Operation *operation = new Operation();
+
+  operation->type = AsyncResult::POSTED;
+  operation->callback = callback;
+  submit(operation);
+}
+
+void AsyncEventLoop::cancel(NetSocket *socket, AsyncCallback *callback) {
+  Operation *operation = new Operation();
+
+  operation->type = AsyncResult::CANCEL;
+  operation->socket = socket;
+  operation->callback = callback;
+  submit(operation);
+}
+
+void AsyncEventLoop::connect(IONetSocket *socket, const NetAddress &address,
+  AsyncCallback *callback) {
+  Operation *operation = new Operation();
+
+  operation->type = AsyncResult::CONNECT;
+  operation->socket = socket;
+  operation->callback = callback;
+  operation->address = address;
+  submit(operation);
+}
+
+void AsyncEventLoop::accept(TcpServerSocket *server, AsyncCallback *callback) {
+  Operation *operation = new Operation();
+
+  operation->type = AsyncResult::ACCEPT;
+  operation->socket = server;
+  operation->callback = callback;
+  submit(operation);
+}
+
+void AsyncEventLoop::read(IONetSocket *socket, AsyncResult::Type type, size_t size,
+  AsyncCallback *callback) {
+  Operation *operation = new Operation();
+
+  operation->type = type;
+  operation->socket = socket;
+  operation->callback = callback;
+  operation->size = size;
+  submit(operation);
+}
+
+void AsyncEventLoop::writeObject(IONetSocket *socket, char *data, size_t size,
+  const NetAddress *address, AsyncCallback *callback) {
+  Operation *operation = new Operation();
+
+  operation->type = AsyncResult::WRITE_OBJECT;
+  operation->socket = socket;
+  operation->callback = callback;
+  operation->data = data;
+  operation->size = size;
+  if (address != NULL) {
+    operation->address = *address;
+    operation->hasAddress = true;
+  }
+  submit(operation);
+}
+
+AsyncEventLoop::AsyncEventLoopException::AsyncEventLoopException(int code)
+  : Exception(code) {
+}
+
+AsyncEventLoop::AsyncEventLoopException::AsyncEventLoopException(int code,
+  std::string message): Exception(code, message) {
+}
@@ -0,0 +1,276 @@
+//! \file async_event_loop.h
+//! \brief Asynchronous socket operations
+//!
+//! File containing the declarations of the classes AsyncEventLoop,
+//! AsyncResult, AsyncCallback and AsyncFuture.
+
+#ifndef ASYNC_EVENT_LOOP_H
+#define ASYNC_EVENT_LOOP_H
+
+#include <deque>
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+#include "event_loop.h"
+#include "net_socket.h"
+#include "object_parser.h"
+#include "mutex.h"
+#include "condition.h"
+
+class TcpSocket;
+class TcpServerSocket;
+class Thread;
+
+//! \class AsyncResult libcomm/async_event_loop.h
+//! \brief Outcome of an asynchronous operation
+class AsyncResult {
+  public:
+    enum Type {
+      CONNECT,
+      ACCEPT,
+      READ_OBJECT,
+      READ_STRING,
+      READ_BYTES,
+      WRITE_OBJECT,
+      POSTED,
+      CANCEL
+    };
+
+    //! The operation
+    Type type;
+    //! The socket the operation has been started on
+    NetSocket *socket;
+    //! The accepted connection (ACCEPT), to be deleted by the callback
+    TcpSocket *acceptedSocket;
+    //! The object read, to be deleted by the callback: a String for
+    //! READ_STRING and a Buffer<char> for READ_BYTES
+    Serializable *object;
+    //! The sender of the object, for datagram sockets
+    NetAddress address;
+    //! The number of bytes written (WRITE_OBJECT)
+    size_t size;
+    //! The error, with the code 0 if the operation has succeeded
+    Exception e;
+
+    AsyncResult(Type type, NetSocket *socket);
+
+    bool failed(void);
+};
+
+//! \class AsyncCallback libcomm/async_event_loop.h
+//! \brief Receives the completion of asynchronous operations
+class AsyncCallback {
+  public:
+    virtual ~AsyncCallback(void);
+
+    //! \brief Called once when the operation is done
+    //! \param[in] result the outcome, whose object or accepted socket belongs
+    //!            to the callback
+    //!
+    //! Called by the thread running the loop, or by one of its workers. It
+    //! may start new operations.
+    virtual void completed(AsyncResult &result) = 0;
+};
+
+//! \class AsyncFuture libcomm/async_event_loop.h
+//! \brief Callback which lets a thread wait for an operation
+//!
+//! A future must not be waited for by the thread running the loop, and is
+//! used for a single operation.
+class AsyncFuture: public AsyncCallback {
+  private:
+    Mutex mutex;
+    Condition *condition;
+    bool done;
+    AsyncResult result;
+
+    AsyncFuture(const AsyncFuture &future);
+    AsyncFuture &operator=(const AsyncFuture &future);
+
+  public:
+    AsyncFuture(void);
+    ~AsyncFuture(void);
+
+    void completed(AsyncResult &result);
+
+    //! \brief Checks if the operation is done
+    //! \return true if get will not block
+    bool isDone(void);
+
+    //! \brief Waits for the operation
+    //! \return the outcome
+    AsyncResult get(void);
+};
+
+//! \class AsyncEventLoop libcomm/async_event_loop.h
+//! \brief Drives the asynchronous operations of many sockets
+//!
+//! Operations are started from any thread with the async methods of the
+//! sockets (IONetSocket::asyncConnect, TcpServerSocket::asyncAccept,
+//! IONetSocket::asyncReadObject, IONetSocket::asyncWriteObject...). They are
+//! handed to the loop, which waits for all the sockets at once with an
+//! EventLoop and does the I/O without blocking as they become ready. Each
+//! operation then completes through its callback, so a few threads serve any
+//! number of peers.
+//!
+//! The loop runs either in a thread calling run, or in its own thread with
+//! start. Callbacks are called by that thread, unless workers are given: they
+//! then run on a pool of that many threads, and the completions of different
+//! operations may run concurrently and in any order.
+//!
+//! The operations of a socket are done in the order they have been started
+//! in. Bytes received by asyncReadObject are not seen by the synchronous reads
+//! and the other way around, so both must not be mixed on a socket. Before a
+//! socket is closed or deleted, its pending operations must be canceled and
+//! their callbacks called.
+class AsyncEventLoop {
+  private:
+    struct Operation {
+      AsyncResult::Type type;
+      NetSocket *socket;
+      AsyncCallback *callback;
+      NetAddress address;
+      bool hasAddress;
+      char *data;
+      size_t size;
+      size_t written;
+      long fileFlags;
+    };
+
+    // Operations of one socket, reads or accepts first, then writes or
+    // connects. Bytes of a stream socket not taken by a read yet are kept
+    // from pendingOffset on.
+    struct Registration {
+      NetSocket *socket;
+      int fd;
+      bool datagram;
+      std::deque<Operation*> reads;
+      std::deque<Operation*> writes;
+      ObjectParser parser;
+      std::string pending;
+      size_t pendingOffset;
+      StreamWFRSet sets;
+    };
+
+    struct Completion {
+      AsyncCallback *callback;
+      AsyncResult result;
+    };
+
+    class LoopThread;
+    class Worker;
+
+    EventLoop loop;
+    int wakeFd;
+    std::map<int, Registration*> registrations;
+    std::vector<Completion> completions;
+    char *readBuffer;
+
+    // Protects submitted and stopped
+    Mutex mutex;
+    std::deque<Operation*> submitted;
+    bool stopped;
+
+    Thread *loopThread;
+    std::vector<Thread*> workers;
+    Mutex workersMutex;
+    Condition *workersCondition;
+    std::deque<Completion> workersQueue;
+    bool workersStopped;
+
+    AsyncEventLoop(const AsyncEventLoop &loop);
+    AsyncEventLoop &operator=(const AsyncEventLoop &loop);
+
+    void submit(Operation *operation);
+    void wake(void);
+    int iterate(bool block, uint64_t nanosec);
+    void startOperation(Operation *operation);
+    Registration *getRegistration(NetSocket *socket);
+    void updateRegistration(Registration *registration);
+    void cancelRegistration(Registration *registration);
+
+    void processReads(Registration *registration);
+    void processWrites(Registration *registration);
+    void readStream(Registration *registration);
+    void processPending(Registration *registration);
+    void failReads(Registration *registration, Exception &e);
+    void readDatagrams(Registration *registration);
+    void acceptConnections(Registration *registration);
+    bool finishConnect(Registration *registration, Operation *operation);
+    bool writeOperation(Registration *registration, Operation *operation);
+
+    void complete(Operation *operation, AsyncResult &result);
+    void fail(Operation *operation, Exception &e);
+    void dispatch(void);
+    bool runWorker(void);
+
+    static int getFd(NetSocket *socket);
+
+  public:
+    //! \brief AsyncEventLoop constructor
+    //! \param[in] nbWorkers the number of threads calling the callbacks, 0
+    //!            for the thread running the loop
+    AsyncEventLoop(int nbWorkers = 0);
+
+    //! \brief AsyncEventLoop destructor
+    //!
+    //! Stops the loop and the workers, which first call the callbacks already
+    //! queued. Pending operations are dropped without their callbacks being
+    //! called.
+    ~AsyncEventLoop(void);
+
+    //! \brief Runs the loop until stop is called
+    void run(void);
+
+    //! \brief Runs one iteration of the loop
+    //! \param[in] nanosec the maximum time to wait for a socket
+    //! \return the number of operations completed
+    int runOnce(uint64_t nanosec);
+
+    //! \brief Runs the loop in a thread of its own
+    void start(void);
+
+    //! \brief Stops the loop
+    //!
+    //! Can be called from any thread, including callbacks. run returns after
+    //! the current iteration, and a stopped loop can not be run again.
+    void stop(void);
+
+    //! \brief Waits for the thread started by start to return
+    //!
+    //! Must be called after stop, from another thread than the loop.
+    void join(void);
+
+    //! \brief Calls a callback from the loop
+    //! \param[in] callback called with a POSTED result, by the loop or one of
+    //!            its workers
+    void post(AsyncCallback *callback);
+
+    //! \brief Cancels the pending operations of a socket
+    //! \param[in] socket the socket
+    //! \param[in] callback if not NULL, called with a CANCEL result once the
+    //!            operations have been canceled
+    //!
+    //! The operations complete with the code ECANCELED, and the bytes
+    //! received for a partly read object are dropped. The socket must stay
+    //! valid until the cancellation has been done.
+    void cancel(NetSocket *socket, AsyncCallback *callback = NULL);
+
+    // Used by the sockets to start the operations
+    void connect(IONetSocket *socket, const NetAddress &address,
+      AsyncCallback *callback);
+    void accept(TcpServerSocket *server, AsyncCallback *callback);
+    void read(IONetSocket *socket, AsyncResult::Type type, size_t size,
+      AsyncCallback *callback);
+    void writeObject(IONetSocket *socket, char *data, size_t size,
+      const NetAddress *address, AsyncCallback *callback);
+
+    class AsyncEventLoopException : public Exception {
+      public :
+        AsyncEventLoopException(int code);
+        AsyncEventLoopException(int code, std::string message);
+    };
+};
+
+#endif
@@ -37,6 +37,10 @@ class Condition {
 
       t.tv_sec = tv.tv_sec + sec;
       t.tv_nsec = tv.tv_usec * 1000 + nanosec;
+      if (t.tv_nsec >= NB_NSEC_IN_SEC) {
+        t.tv_sec += t.tv_nsec / NB_NSEC_IN_SEC;
+        t.tv_nsec %= NB_NSEC_IN_SEC;
+      }
       
       int res = pthread_cond_timedwait(&c,&(m->m),&t);
 
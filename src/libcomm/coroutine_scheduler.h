@@ -0,0 +1,368 @@
+//! \file coroutine_scheduler.h
+//! \brief Coroutines on top of AsyncEventLoop
+//!
+//! File containing the declarations of the classes CoroutineScheduler and
+//! CoroutineTask, and of the awaitables of the socket operations. Only
+//! available when compiled with coroutine support (-std=c++20).
+
+#ifndef COROUTINE_SCHEDULER_H
+#define COROUTINE_SCHEDULER_H
+
+#ifdef __cpp_impl_coroutine
+
+#include <coroutine>
+#include <exception>
+
+#include "async_event_loop.h"
+#include "tcp_socket.h"
+#include "udp_socket.h"
+
+//! \class CoroutineTask libcomm/coroutine_scheduler.h
+//! \brief Coroutine returned by the protocol handlers
+//!
+//! A task starts suspended. It is either run on its own with
+//! CoroutineScheduler::spawn, or awaited by another coroutine, which is
+//! resumed when the task returns and gets the exception it may throw.
+//! Exceptions escaping a spawned task are printed, and end it.
+class CoroutineTask {
+  public:
+    class promise_type: public AsyncCallback {
+      private:
+        std::coroutine_handle<> continuation;
+        std::exception_ptr exception;
+        bool detached;
+
+        friend class CoroutineTask;
+        friend class CoroutineScheduler;
+
+        struct FinalAwaiter {
+          bool await_ready(void) noexcept {
+            return false;
+          }
+
+          std::coroutine_handle<> await_suspend(
+            std::coroutine_handle<promise_type> handle) noexcept {
+            promise_type &promise = handle.promise();
+
+            if (promise.continuation) return promise.continuation;
+            if (promise.detached) {
+              if (promise.exception) {
+                try {
+                  std::rethrow_exception(promise.exception);
+                } catch (Exception &e) {
+                  e.printCodeAndMessage();
+                } catch (...) {
+                }
+              }
+              handle.destroy();
+            }
+            return std::noop_coroutine();
+          }
+
+          void await_resume(void) noexcept {
+          }
+        };
+
+      public:
+        promise_type(void): detached(false) {
+        }
+
+        CoroutineTask get_return_object(void) {
+          return CoroutineTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend(void) noexcept {
+          return std::suspend_always();
+        }
+
+        FinalAwaiter final_suspend(void) noexcept {
+          return FinalAwaiter();
+        }
+
+        void return_void(void) {
+        }
+
+        void unhandled_exception(void) {
+          exception = std::current_exception();
+        }
+
+        // Starts the task when posted to the loop
+        void completed(AsyncResult &result) {
+          std::coroutine_handle<promise_type>::from_promise(*this).resume();
+        }
+    };
+
+  private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit CoroutineTask(std::coroutine_handle<promise_type> handle)
+      : handle(handle) {
+    }
+
+    CoroutineTask(const CoroutineTask &task);
+    CoroutineTask &operator=(const CoroutineTask &task);
+
+    friend class CoroutineScheduler;
+
+  public:
+    CoroutineTask(CoroutineTask &&task) noexcept: handle(task.handle) {
+      task.handle = nullptr;
+    }
+
+    ~CoroutineTask(void) {
+      if (handle) handle.destroy();
+    }
+
+    bool await_ready(void) noexcept {
+      return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+      handle.promise().continuation = awaiting;
+      return handle;
+    }
+
+    void await_resume(void) {
+      if (handle.promise().exception) {
+        std::rethrow_exception(handle.promise().exception);
+      }
+    }
+};
+
+//! \class AsyncAwaitable libcomm/coroutine_scheduler.h
+//! \brief Suspends a coroutine during an asynchronous operation
+//!
+//! The coroutine is resumed by the thread completing the operation: the loop
+//! or one of its workers. Failed operations throw their Exception from the
+//! co_await.
+class AsyncAwaitable: public AsyncCallback {
+  private:
+    std::coroutine_handle<> handle;
+
+  protected:
+    AsyncEventLoop &loop;
+    AsyncResult result;
+
+    AsyncAwaitable(AsyncEventLoop &loop): loop(loop),
+      result(AsyncResult::POSTED, NULL) {
+    }
+
+    // Starts the operation, with this as the callback
+    virtual void start(void) = 0;
+
+    void check(void) {
+      if (result.failed()) throw result.e;
+    }
+
+  public:
+    bool await_ready(void) noexcept {
+      return false;
+    }
+
+    // The operation may complete, and the coroutine go on in another thread,
+    // before start returns: nothing of the awaitable is used after it
+    void await_suspend(std::coroutine_handle<> handle) {
+      this->handle = handle;
+      start();
+    }
+
+    void completed(AsyncResult &result) {
+      this->result = result;
+      handle.resume();
+    }
+};
+
+class ConnectAwaitable: public AsyncAwaitable {
+  private:
+    IONetSocket &socket;
+    NetAddress address;
+
+    void start(void) {
+      socket.asyncConnect(loop, address, this);
+    }
+
+  public:
+    ConnectAwaitable(AsyncEventLoop &loop, IONetSocket &socket,
+      const NetAddress &address): AsyncAwaitable(loop), socket(socket),
+      address(address) {
+    }
+
+    void await_resume(void) {
+      check();
+    }
+};
+
+class AcceptAwaitable: public AsyncAwaitable {
+  private:
+    TcpServerSocket &server;
+
+    void start(void) {
+      server.asyncAccept(loop, this);
+    }
+
+  public:
+    AcceptAwaitable(AsyncEventLoop &loop, TcpServerSocket &server)
+      : AsyncAwaitable(loop), server(server) {
+    }
+
+    TcpSocket *await_resume(void) {
+      check();
+      return result.acceptedSocket;
+    }
+};
+
+//! \class ReadAwaitable libcomm/coroutine_scheduler.h
+//! \brief Reads an object, a String or a Buffer<char>
+template <typename T>
+class ReadAwaitable: public AsyncAwaitable {
+  private:
+    IONetSocket &socket;
+    AsyncResult::Type type;
+    size_t size;
+    NetAddress *from;
+
+    void start(void) {
+      switch (type) {
+        case AsyncResult::READ_STRING:
+          socket.asyncReadString(loop, this);
+          break;
+        case AsyncResult::READ_BYTES:
+          socket.asyncReadBytes(loop, size, this);
+          break;
+        default:
+          socket.asyncReadObject(loop, this);
+          break;
+      }
+    }
+
+  public:
+    ReadAwaitable(AsyncEventLoop &loop, IONetSocket &socket,
+      AsyncResult::Type type, size_t size, NetAddress *from)
+      : AsyncAwaitable(loop), socket(socket), type(type), size(size),
+      from(from) {
+    }
+
+    T *await_resume(void) {
+      check();
+      if (from != NULL) *from = result.address;
+      return (T*) result.object;
+    }
+};
+
+class WriteAwaitable: public AsyncAwaitable {
+  private:
+    IONetSocket &socket;
+    const Serializable &object;
+    const NetAddress *address;
+
+    void start(void) {
+      if (address != NULL) {
+        ((UdpSocket&) socket).asyncWriteObject(loop, object, *address, this);
+      } else {
+        socket.asyncWriteObject(loop, object, this);
+      }
+    }
+
+  public:
+    WriteAwaitable(AsyncEventLoop &loop, IONetSocket &socket,
+      const Serializable &object, const NetAddress *address)
+      : AsyncAwaitable(loop), socket(socket), object(object),
+      address(address) {
+    }
+
+    size_t await_resume(void) {
+      check();
+      return result.size;
+    }
+};
+
+//! \class CoroutineScheduler libcomm/coroutine_scheduler.h
+//! \brief Runs coroutines on an AsyncEventLoop
+//!
+//! Handlers keep the sequential style of the blocking calls, with co_await
+//! in front of each of them:
+//! \code
+//! CoroutineTask serve(CoroutineScheduler &scheduler, TcpSocket *socket) {
+//!   for (;;) {
+//!     String *request = co_await scheduler.readString(*socket);
+//!     co_await scheduler.writeObject(*socket, *request);
+//!     delete request;
+//!   }
+//! }
+//! \endcode
+//! Each co_await suspends the coroutine until the socket is ready, and the
+//! thread goes on with the other coroutines, so a loop with a few workers
+//! serves thousands of sessions. A coroutine is resumed by a single thread at
+//! a time, but not always the same one. The rules of AsyncEventLoop apply:
+//! a socket must not be used by two coroutines for reading (or for writing)
+//! at once.
+class CoroutineScheduler {
+  private:
+    AsyncEventLoop &loop;
+
+  public:
+    //! \brief CoroutineScheduler constructor
+    //! \param[in] loop the loop, which must be run by the caller
+    CoroutineScheduler(AsyncEventLoop &loop): loop(loop) {
+    }
+
+    AsyncEventLoop &getLoop(void) {
+      return loop;
+    }
+
+    //! \brief Runs a task on its own
+    //! \param[in] task the task, started from the loop
+    //!
+    //! The task is destroyed when it returns.
+    void spawn(CoroutineTask task) {
+      CoroutineTask::promise_type &promise = task.handle.promise();
+
+      promise.detached = true;
+      task.handle = nullptr;
+      loop.post(&promise);
+    }
+
+    ConnectAwaitable connect(IONetSocket &socket, const NetAddress &address) {
+      return ConnectAwaitable(loop, socket, address);
+    }
+
+    AcceptAwaitable acceptConnection(TcpServerSocket &server) {
+      return AcceptAwaitable(loop, server);
+    }
+
+    //! \brief Reads an object
+    //! \param[in] socket the socket
+    //! \param[out] from the sender, for datagram sockets
+    ReadAwaitable<Serializable> readObject(IONetSocket &socket,
+      NetAddress *from = NULL) {
+      return ReadAwaitable<Serializable>(loop, socket, AsyncResult::READ_OBJECT,
+        0, from);
+    }
+
+    ReadAwaitable<String> readString(IONetSocket &socket, NetAddress *from = NULL) {
+      return ReadAwaitable<String>(loop, socket, AsyncResult::READ_STRING, 0,
+        from);
+    }
+
+    ReadAwaitable<Buffer<char> > readBytes(IONetSocket &socket, size_t size,
+      NetAddress *from = NULL) {
+      return ReadAwaitable<Buffer<char> >(loop, socket, AsyncResult::READ_BYTES,
+        size, from);
+    }
+
+    //! \brief Writes an object
+    //! \param[in] socket the socket
+    //! \param[in] object the object, serialized when the coroutine suspends
+    WriteAwaitable writeObject(IONetSocket &socket, const Serializable &object) {
+      return WriteAwaitable(loop, socket, object, NULL);
+    }
+
+    WriteAwaitable writeObject(UdpSocket &socket, const Serializable &object,
+      const NetAddress &address) {
+      return WriteAwaitable(loop, socket, object, &address);
+    }
+};
+
+#endif
+
+#endif
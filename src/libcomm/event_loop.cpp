@@ -0,0 +1,202 @@
+#include "event_loop.h"
+#include "types_utils.h"
+
+#include <new>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+
+static uint32_t setsToEpollEvents(StreamWFRSet sets, bool edgeTriggered) {
+  uint32_t events = 0;
+
+  if ((sets & STREAM_WFR_READ) != 0) events |= EPOLLIN | EPOLLRDHUP;
+  if ((sets & STREAM_WFR_WRITE) != 0) events |= EPOLLOUT;
+  if ((sets & STREAM_WFR_ERROR) != 0) events |= EPOLLPRI;
+  if (edgeTriggered) events |= EPOLLET;
+
+  return events;
+}
+
+static StreamWFRSet epollEventsToSets(uint32_t events) {
+  int sets = STREAM_WFR_NONE;
+
+  if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0) sets |= STREAM_WFR_READ;
+  if ((events & (EPOLLOUT | EPOLLERR)) != 0) sets |= STREAM_WFR_WRITE;
+  if ((events & EPOLLPRI) != 0) sets |= STREAM_WFR_ERROR;
+
+  return (StreamWFRSet) sets;
+}
+
+EventLoopEvent::EventLoopEvent(Stream *stream, int fd, void *data, StreamWFRSet sets)
+  : stream(stream), fd(fd), data(data), sets(sets) {
+}
+
+bool EventLoopEvent::setIsRead(void) const {
+  return ((sets & STREAM_WFR_READ) != 0);
+}
+
+bool EventLoopEvent::setIsWrite(void) const {
+  return ((sets & STREAM_WFR_WRITE) != 0);
+}
+
+bool EventLoopEvent::setIsError(void) const {
+  return ((sets & STREAM_WFR_ERROR) != 0);
+}
+
+EventLoop::EventLoop(int maxEvents): maxEvents(maxEvents), count(0) {
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd == -1) {
+    throw EventLoopException(errno);
+  }
+  events = (struct epoll_event*) malloc(maxEvents * sizeof(struct epoll_event));
+  if (events == NULL) {
+    close(epollFd);
+    throw std::bad_alloc();
+  }
+}
+
+EventLoop::~EventLoop(void) {
+  for (size_t i = 0; i < registrations.size(); ++i) {
+    delete registrations[i];
+  }
+  free(events);
+  close(epollFd);
+}
+
+void EventLoop::add2(Stream *stream, int fd, StreamWFRSet sets, void *data,
+  bool edgeTriggered) {
+  struct epoll_event event;
+  Registration *registration;
+
+  if (fd < 0) {
+    throw EventLoopException(EBADF);
+  }
+  if (contains(fd)) {
+    throw EventLoopException(EEXIST, "File descriptor already registered.");
+  }
+
+  registration = new Registration;
+  registration->stream = stream;
+  registration->fd = fd;
+  registration->data = data;
+
+  event.events = setsToEpollEvents(sets, edgeTriggered);
+  event.data.ptr = registration;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+    int error = errno;
+    delete registration;
+    throw EventLoopException(error);
+  }
+
+  if ((size_t) fd >= registrations.size()) {
+    registrations.resize(fd + 1, NULL);
+  }
+  registrations[fd] = registration;
+  ++count;
+}
+
+void EventLoop::modify2(int fd, StreamWFRSet sets, void *data, bool edgeTriggered) {
+  struct epoll_event event;
+
+  if (!contains(fd)) {
+    throw EventLoopException(ENOENT, "File descriptor not registered.");
+  }
+
+  event.events = setsToEpollEvents(sets, edgeTriggered);
+  event.data.ptr = registrations[fd];
+  if (epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) == -1) {
+    throw EventLoopException(errno);
+  }
+  registrations[fd]->data = data;
+}
+
+int EventLoop::wait2(std::vector<EventLoopEvent> *result, timespec *timeout) {
+  int timeoutMs = -1;
+  int nbEvents;
+
+  // epoll counts in milliseconds: round up so as not to return early
+  if (timeout != NULL) {
+    uint64_t ms = timeout->tv_sec * 1000ULL + (timeout->tv_nsec + 999999) / 1000000;
+    timeoutMs = (ms > INT_MAX) ? INT_MAX : (int) ms;
+  }
+
+  nbEvents = epoll_wait(epollFd, events, maxEvents, timeoutMs);
+  if (nbEvents == -1) {
+    if (errno == EINTR) return 0;
+    throw EventLoopException(errno);
+  }
+
+  for (int i = 0; i < nbEvents; ++i) {
+    Registration *registration = (Registration*) events[i].data.ptr;
+    result->push_back(EventLoopEvent(registration->stream, registration->fd,
+      registration->data, epollEventsToSets(events[i].events)));
+  }
+
+  return nbEvents;
+}
+
+void EventLoop::add(Stream *stream, StreamWFRSet sets, void *data, bool edgeTriggered) {
+  add2(stream, stream->fd, sets, data, edgeTriggered);
+}
+
+void EventLoop::add(int fd, StreamWFRSet sets, void *data, bool edgeTriggered) {
+  add2(NULL, fd, sets, data, edgeTriggered);
+}
+
+void EventLoop::modify(Stream *stream, StreamWFRSet sets, void *data, bool edgeTriggered) {
+  modify2(stream->fd, sets, data, edgeTriggered);
+}
+
+void EventLoop::modify(int fd, StreamWFRSet sets, void *data, bool edgeTriggered) {
+  modify2(fd, sets, data, edgeTriggered);
+}
+
+void EventLoop::remove(Stream *stream) {
+  remove(stream->fd);
+}
+
+void EventLoop::remove(int fd) {
+  if (!contains(fd)) {
+    throw EventLoopException(ENOENT, "File descriptor not registered.");
+  }
+
+  // The file descriptor may already be closed, which removed it from epoll
+  if ((epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL) == -1) && (errno != EBADF)
+    && (errno != ENOENT)) {
+    throw EventLoopException(errno);
+  }
+  delete registrations[fd];
+  registrations[fd] = NULL;
+  --count;
+}
+
+bool EventLoop::contains(int fd) const {
+  return (fd >= 0) && ((size_t) fd < registrations.size())
+    && (registrations[fd] != NULL);
+}
+
+size_t EventLoop::size(void) const {
+  return count;
+}
+
+int EventLoop::wait(std::vector<EventLoopEvent> *result) {
+  return wait2(result, NULL);
+}
+
+int EventLoop::wait(std::vector<EventLoopEvent> *result, uint64_t nanosec) {
+  timespec ts;
+  nanosecToSecNsec(nanosec, &(ts.tv_sec), &(ts.tv_nsec));
+  return wait2(result, &ts);
+}
+
+int EventLoop::wait(std::vector<EventLoopEvent> *result, time_t sec, long nanosec) {
+  timespec ts = {sec, nanosec};
+  return wait2(result, &ts);
+}
+
+EventLoop::EventLoopException::EventLoopException(int code)
+  : Exception(code) {}
+
+EventLoop::EventLoopException::EventLoopException(int code, std::string message)
+  : Exception(code, message) {}
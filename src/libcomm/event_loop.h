@@ -0,0 +1,149 @@
+//! \file event_loop.h
+//! \brief Readiness notification based on epoll
+//!
+//! File containing the declarations of the classes EventLoop and
+//! EventLoopEvent.
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <vector>
+#include <time.h>
+#include <sys/epoll.h>
+#include <stdint.h>
+
+#include "stream.h"
+
+#define EVENT_LOOP_DEFAULT_MAX_EVENTS 256
+
+//! \class EventLoopEvent libcomm/event_loop.h
+//! \brief Readiness of one file descriptor
+class EventLoopEvent {
+  public:
+    //! The stream, or NULL if a raw file descriptor has been registered
+    Stream *stream;
+    //! The file descriptor
+    int fd;
+    //! The data given at registration
+    void *data;
+    //! The sets the file descriptor is ready for
+    StreamWFRSet sets;
+
+    EventLoopEvent(Stream *stream, int fd, void *data, StreamWFRSet sets);
+
+    bool setIsRead(void) const;
+    bool setIsWrite(void) const;
+    bool setIsError(void) const;
+};
+
+//! \class EventLoop libcomm/event_loop.h
+//! \brief Waits for many streams at once
+//!
+//! Streams (or raw file descriptors, such as the one of a server socket) are
+//! registered once with the sets they are watched for, and each call to wait
+//! returns only those which are ready. Unlike select, the cost of a wait does
+//! not depend on the number of registered streams, and there is no limit on
+//! file descriptor values.
+//!
+//! A registration is level triggered by default: a stream is reported as
+//! long as it is ready. When edge triggered, it is reported once each time it
+//! becomes ready, and must then be read or written until EAGAIN (see
+//! ObjectParser::readFrom).
+//!
+//! STREAM_WFR_ERROR watches for out of band data, as with select. Errors and
+//! hang ups are reported as read or write readiness, so that the next read
+//! or write gives the error.
+//! An EventLoop is not thread safe.
+class EventLoop {
+  private:
+    struct Registration {
+      Stream *stream;
+      int fd;
+      void *data;
+    };
+
+    int epollFd;
+    struct epoll_event *events;
+    int maxEvents;
+    // Indexed by file descriptor
+    std::vector<Registration*> registrations;
+    size_t count;
+
+    EventLoop(const EventLoop &loop);
+    EventLoop &operator=(const EventLoop &loop);
+
+    void add2(Stream *stream, int fd, StreamWFRSet sets, void *data, bool edgeTriggered);
+    void modify2(int fd, StreamWFRSet sets, void *data, bool edgeTriggered);
+    int wait2(std::vector<EventLoopEvent> *result, timespec *timeout);
+
+  public:
+    //! \brief EventLoop constructor
+    //! \param[in] maxEvents the maximum number of events returned by a wait
+    EventLoop(int maxEvents = EVENT_LOOP_DEFAULT_MAX_EVENTS);
+
+    //! \brief EventLoop destructor
+    //!
+    //! The registered streams are not closed.
+    ~EventLoop(void);
+
+    //! \brief Registers a stream
+    //! \param[in] stream the stream
+    //! \param[in] sets the sets to watch
+    //! \param[in] data any data, given back with the events of the stream
+    //! \param[in] edgeTriggered true to be notified only on changes
+    //!
+    //! A stream can be registered only once. It must be removed before being
+    //! closed.
+    void add(Stream *stream, StreamWFRSet sets, void *data = NULL,
+      bool edgeTriggered = false);
+
+    //! \brief Registers a raw file descriptor
+    //! \param[in] fd the file descriptor
+    //! \param[in] sets the sets to watch
+    //! \param[in] data any data, given back with the events of fd
+    //! \param[in] edgeTriggered true to be notified only on changes
+    void add(int fd, StreamWFRSet sets, void *data = NULL,
+      bool edgeTriggered = false);
+
+    //! \brief Changes the registration of a stream
+    //! \param[in] stream the stream
+    //! \param[in] sets the sets to watch
+    //! \param[in] data any data, given back with the events of the stream
+    //! \param[in] edgeTriggered true to be notified only on changes
+    void modify(Stream *stream, StreamWFRSet sets, void *data = NULL,
+      bool edgeTriggered = false);
+    void modify(int fd, StreamWFRSet sets, void *data = NULL,
+      bool edgeTriggered = false);
+
+    //! \brief Unregisters a stream
+    //! \param[in] stream the stream
+    //!
+    //! Events of the stream already returned by wait stay in the result.
+    void remove(Stream *stream);
+    void remove(int fd);
+
+    //! \brief Checks if a file descriptor is registered
+    //! \param[in] fd the file descriptor
+    //! \return true if registered
+    bool contains(int fd) const;
+
+    //! \brief Gets the number of registered file descriptors
+    //! \return the number of registrations
+    size_t size(void) const;
+
+    //! \brief Waits until a registered stream is ready
+    //! \param[out] result the events, appended to the vector
+    //! \return the number of events, 0 if the wait has been interrupted by a
+    //!         signal or has timed out
+    int wait(std::vector<EventLoopEvent> *result);
+    int wait(std::vector<EventLoopEvent> *result, uint64_t nanosec);
+    int wait(std::vector<EventLoopEvent> *result, time_t sec, long nanosec);
+
+    class EventLoopException : public Exception {
+      public :
+        EventLoopException(int code);
+        EventLoopException(int code, std::string message);
+    };
+};
+
+#endif
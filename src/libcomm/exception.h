@@ -14,6 +14,8 @@
 #define EX_EOF -4
 #define EX_OSTREAM_TOO_MUCH_DATA -5
 #define EX_ISTREAM_VIRTUAL_CALL -6
+#define EX_MALFORMED_MESSAGE -7
+#define EX_ISTREAM_LINE_TOO_LONG -8
 #define EX_CONDITION_TIMEOUT ETIMEDOUT
 
 #include <string>
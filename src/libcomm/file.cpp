@@ -3,6 +3,8 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "io_uring_engine.h"
+
 const int MAX_IOV = sysconf(_SC_IOV_MAX);
 
 void File::openFile(const char *path, int access, int flags, mode_t mode) {
@@ -206,11 +208,23 @@ BufferedFile::BufferedFile(std::string path, int access, int flags, mode_t mode)
 
 ssize_t BufferedFile::writeRawData(  const struct iovec *iov, int iovcnt,
                                       const NetAddress *addr) {
+  IoUringEngine *engine = getWriteEngine();
   int currentIovCnt;
   int totalIovCnt = 0;
   size_t totalQuantityWritten = 0;
   ssize_t quantityWritten = 0;
 
+  if (engine != NULL) {
+    if (engine->writev(iov, iovcnt, &totalQuantityWritten) == -1) {
+      size_t toWrite;
+      char *dataLeft;
+
+      dataLeft = generateRemainingData(iov, iovcnt, totalQuantityWritten, &toWrite);
+      throw OutputStream::OutputStreamException(errno, toWrite, dataLeft, totalQuantityWritten);
+    }
+    return totalQuantityWritten;
+  }
+
   while (totalIovCnt < iovcnt) {
     currentIovCnt = iovcnt - totalIovCnt;
     if (currentIovCnt > MAX_IOV) currentIovCnt = MAX_IOV;
@@ -232,8 +246,21 @@ ssize_t BufferedFile::writeRawData(  const struct iovec *iov, int iovcnt,
 
 ssize_t BufferedFile::readRawData(   char *buffer, size_t size, int flags,
                           NetAddress *addr) {
+  struct iovec iov;
+
+  iov.iov_base = buffer;
+  iov.iov_len = size;
+  return readRawData(&iov, 1, flags, addr);
+}
+
+ssize_t BufferedFile::readRawData(   const struct iovec *iov, int iovcnt,
+                          int flags, NetAddress *addr) {
+  IoUringEngine *engine = getReadEngine();
   ssize_t bytesRead;
-  bytesRead = read(fd, buffer, size);
+
+  // The engine reads into a single buffer
+  bytesRead = (engine != NULL) ? engine->read((char*) iov[0].iov_base, iov[0].iov_len)
+    : readv(fd, iov, iovcnt);
  
   switch (bytesRead) {
     case -1:
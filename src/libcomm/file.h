@@ -122,6 +122,8 @@ class BufferedFile : public File, public BufferedInputStream, public BufferedOut
   private:
     ssize_t readRawData(  char *buffer, size_t size, int flags,
                           NetAddress *addr);
+    ssize_t readRawData(  const struct iovec *iov, int iovcnt, int flags,
+                          NetAddress *addr);
     ssize_t writeRawData( const struct iovec *iov, int iovcnt,
                           const NetAddress *addr);
   public:
@@ -1,11 +1,17 @@
 #include "input_stream.h"
 #include "net_message.h"
+#include "arena.h"
+#include "types_utils.h"
+
+#include <errno.h>
+#include <new>
 
 #define DEFAULT_READ_BUFFER_SIZE 1500
-#define MAX_BUFFER_SIZE 15000
 
 
-InputStream::InputStream(void): readBufferSize(DEFAULT_READ_BUFFER_SIZE) {}
+InputStream::InputStream(void): readBufferSize(DEFAULT_READ_BUFFER_SIZE),
+  maxLineLength(0), maxMessageSize(DEFAULT_MAX_MESSAGE_SIZE),
+  zeroCopyParsing(false) {}
 
 InputStream::~InputStream(void) {};
 
@@ -17,6 +23,46 @@ void InputStream::setReadBufferSize(size_t bs) {
   readBufferSize = bs;
 }
 
+size_t InputStream::getMaxLineLength(void) const {
+  return maxLineLength;
+}
+
+void InputStream::setMaxLineLength(size_t length) {
+  maxLineLength = length;
+}
+
+size_t InputStream::getMaxMessageSize(void) const {
+  return maxMessageSize;
+}
+
+void InputStream::setMaxMessageSize(size_t size) {
+  maxMessageSize = size;
+}
+
+void InputStream::setZeroCopyParsing(bool enable) {
+  zeroCopyParsing = enable;
+}
+
+bool InputStream::getZeroCopyParsing(void) const {
+  return zeroCopyParsing;
+}
+
+bool InputStream::hasBufferedBytes(void) {
+  return false;
+}
+
+bool InputStream::hasBufferedLine(void) {
+  return false;
+}
+
+bool InputStream::hasBufferedDelimiter(const std::string &delimiters) {
+  return false;
+}
+
+bool InputStream::hasBufferedObject(void) {
+  return false;
+}
+
 char *InputStream::readDataForced(size_t size, NetAddress *addr) {
   char *buffer;
   ssize_t sizeRead = 0;
@@ -36,24 +82,24 @@ void InputStream::readDataForced(char * buffer, size_t size, NetAddress *addr) {
   size_t totalRead = 0;
   
   while (totalRead != size) {
-    sizeRead = readData(&(buffer[sizeRead]), size-totalRead, 0, addr);
+    sizeRead = readData(&(buffer[totalRead]), size-totalRead, 0, addr);
     totalRead += sizeRead;
   }
 }
 
 
 bool InputStream::containsCRLF(const char *buff, off_t start, off_t end, size_t *index) {
-  off_t i;
-
-  for (i = start; i < end; ++i) {
-    if (buff[i] == '\r') {
-      if (i < (end-1)) {
-        if (buff[i+1] == '\n') {
-          *index = i+2;
-          return true;
-        }
-      }
+  const char *cr;
+
+  while (start < end) {
+    cr = findDelimiter(&(buff[start]), end - start, "\r", 1);
+    if (cr == NULL) return false;
+    start = cr - buff;
+    if ((start < (end-1)) && (buff[start+1] == '\n')) {
+      *index = start+2;
+      return true;
     }
+    ++start;
   }
   return false;
 }
@@ -80,6 +126,12 @@ void InputStream::parseNetMessageContent(NetMessage *netMessage, size_t netMessa
   
   while (totalSize < netMessageSize) {
     childNetMessage = parseBlockHeader(netMessage, &blockSize, &headerSize, &toFree);
+    // Blocks stay within their message, the size of which has been checked
+    if ((headerSize > (netMessageSize - totalSize))
+      || (blockSize > (netMessageSize - totalSize - headerSize))) {
+      if (childNetMessage != NULL) delete childNetMessage;
+      throw InputStreamException(EX_MALFORMED_MESSAGE, "Block bigger than its message.");
+    }
     if (childNetMessage != NULL) {
       // NetMessage
       netMessage->addMessage(childNetMessage); 
@@ -87,8 +139,14 @@ void InputStream::parseNetMessageContent(NetMessage *netMessage, size_t netMessa
         parseNetMessageContent(childNetMessage, blockSize);
       }
     } else {
-      // BlockData
-      blockData = readDataForced(blockSize, NULL);
+      // BlockData. Blocks not freed by the NetMessage are given to the
+      // deserialized object and must come from the heap.
+      if (toFree) {
+        blockData = netMessage->allocateDataBlock(blockSize);
+        readDataForced(blockData, blockSize, NULL);
+      } else {
+        blockData = readDataForced(blockSize, NULL);
+      }
       netMessage->addDataBlock(blockData, blockSize,toFree, false);
     }
     totalSize += (blockSize + headerSize);
@@ -106,9 +164,16 @@ NetMessage *InputStream::parseBlockHeader(NetMessage *netMessage, size_t *blockS
     size_t sizeFlags = NetMessage::getFlagsHeaderSize();
     readDataForced(buff, sizeFlags, addr); 
     newNetMessage = netMessage->parseFlags(buff, &nextSize, toFree);
-    if (headerSize != NULL) *headerSize = sizeFlags + nextSize;
 
     readDataForced(buff, nextSize, NULL); 
+    if ((newNetMessage != NULL) && newNetMessage->getVarintEncoding()) {
+      // A varint ends with the first byte without the high bit
+      while ((buff[nextSize - 1] & 0x80) && (nextSize < VARINT_MAX_SIZE)) {
+        readDataForced(&(buff[nextSize]), 1, NULL);
+        ++nextSize;
+      }
+    }
+    if (headerSize != NULL) *headerSize = sizeFlags + nextSize;
     if (newNetMessage == NULL) {
       //Block
       netMessage->parseTypeSize(buff, false, nextSize, blockSize);
@@ -137,6 +202,7 @@ Buffer<char> *InputStream::readBytes2(Buffer<char> *buff, int flags, NetAddress
     buff = new Buffer<char>(size);
   } else {
     size = buff->size();
+    buff->detach();
   }
   
   try {
@@ -159,15 +225,27 @@ String *InputStream::readString2(NetAddress *addr) {
   ssize_t sizeRead = 0;
   String *str = NULL;
 
+  // Without access to a buffer, the line is peeked again in a buffer doubled
+  // while full, the scan going on from where it stopped
   while (str == NULL) {
-    sizeBuff += readBufferSize;
+    if (sizeBuff == 0) {
+      sizeBuff = readBufferSize;
+    } else if (totalRead == sizeBuff) {
+      sizeBuff *= 2;
+    }
     buff = (char*) realloc(buff, sizeBuff);
 
     try {
+      // The peek gives everything from the start, a CR may end the previous one
       sizeRead = peekData(buff, sizeBuff, addr);
-      str = tryBuildString(buff, totalRead, totalRead + sizeRead, &endIndex);
-      totalRead += sizeRead;
+      str = tryBuildString(buff, (totalRead > 0) ? totalRead - 1 : 0, sizeRead, &endIndex);
+      totalRead = sizeRead;
+      if ((maxLineLength != 0) && (((str != NULL) && (str->size() > maxLineLength))
+        || ((str == NULL) && (totalRead > maxLineLength + 1)))) {
+        throw InputStreamException(EX_ISTREAM_LINE_TOO_LONG, "Line too long.");
+      }
     } catch (Exception &e) {
+      if (str != NULL) delete str;
       free(buff);
       throw e;
     }
@@ -179,21 +257,77 @@ String *InputStream::readString2(NetAddress *addr) {
   return str;
 }
 
+String *InputStream::readUntil2(const std::string &delimiters, NetAddress *addr) {
+  char *buff = NULL;
+  const char *found = NULL;
+  size_t sizeBuff = 0;
+  size_t totalRead = 0;
+  ssize_t sizeRead = 0;
+  String *str;
+
+  // Same peek loop as readString2
+  while (found == NULL) {
+    if (sizeBuff == 0) {
+      sizeBuff = readBufferSize;
+    } else if (totalRead == sizeBuff) {
+      sizeBuff *= 2;
+    }
+    buff = (char*) realloc(buff, sizeBuff);
+
+    try {
+      sizeRead = peekData(buff, sizeBuff, addr);
+      found = findDelimiter(&(buff[totalRead]), sizeRead - totalRead,
+        delimiters.data(), delimiters.size());
+      totalRead = sizeRead;
+      if ((maxLineLength != 0) && (((found != NULL) && ((size_t) (found - buff) > maxLineLength))
+        || ((found == NULL) && (totalRead > maxLineLength)))) {
+        throw InputStreamException(EX_ISTREAM_LINE_TOO_LONG, "Line too long.");
+      }
+    } catch (Exception &e) {
+      free(buff);
+      throw e;
+    }
+  }
+
+  str = new String(buff, found - buff + 1);
+  readData(buff, str->size(), 0, addr);
+  free(buff);
+
+  return str;
+}
+
 Serializable *InputStream::readObject2(NetAddress *addr) {
   size_t netMessageSize;
   NetMessage *netMessage;
   SerializationManager *serManager;
   void *object = NULL;
+  ArenaScope arenaScope(Arena::getThreadArena());
 
   netMessage = new NetMessage();
   try {
     parseBlockHeader(netMessage, &netMessageSize, NULL, NULL, addr);
-    parseNetMessageContent(netMessage, netMessageSize);
+    if ((maxMessageSize != 0) && (netMessageSize > maxMessageSize)) {
+      throw InputStreamException(EX_MALFORMED_MESSAGE, "Message too big.");
+    }
+    if (zeroCopyParsing) {
+      // Read the whole message once, and parse it in memory
+      SharedBlock *block = new SharedBlock(netMessageSize);
+      netMessage->setSharedBlock(block);
+      block->unref();
+      readDataForced(block->getData(), netMessageSize, NULL);
+      netMessage->parseContent(block->getData(), netMessageSize);
+    } else {
+      parseNetMessageContent(netMessage, netMessageSize);
+    }
 
   } catch (Exception &e) {
     netMessage->deleteAllData();
     delete netMessage;
     throw e;
+  } catch (std::bad_alloc &e) {
+    netMessage->deleteAllData();
+    delete netMessage;
+    throw InputStreamException(ENOMEM, "Not enough memory for the message.");
   }
 
   serManager = SerializationManager::getSerializationManager();
@@ -220,6 +354,9 @@ Buffer<char> *InputStream::readBytes(Buffer<char> *buff, uint64_t nanosec, int f
 
 
 Buffer<char> *InputStream::readBytes(Buffer<char> *buff, time_t sec, long nanosec, int flags) {
+  // The data already read ahead is not seen by waitForReady
+  if (hasBufferedBytes()) return readBytes(buff, flags);
+
   StreamWFRResult waitResult =
     waitForReady((StreamWFRSet) (STREAM_WFR_READ | STREAM_WFR_ERROR), sec, nanosec);
   // timeout || error
@@ -243,6 +380,9 @@ String *InputStream::readString(uint64_t nanosec) {
 }
 
 String *InputStream::readString(time_t sec, long nanosec) {
+  // The data already read ahead is not seen by waitForReady
+  if (hasBufferedLine()) return readString();
+
   StreamWFRResult waitResult =
     waitForReady((StreamWFRSet) (STREAM_WFR_READ | STREAM_WFR_ERROR), sec, nanosec);
   // timeout || error
@@ -253,6 +393,35 @@ String *InputStream::readString(time_t sec, long nanosec) {
   }
 }
 
+String *InputStream::readUntil(const std::string &delimiters) {
+  if (delimiters.empty()) {
+    throw InputStreamException(EINVAL, "No delimiter.");
+  }
+  return readUntil2(delimiters, NULL);
+}
+
+String *InputStream::readUntil(const std::string &delimiters, uint64_t nanosec) {
+  time_t sec;
+  long nsec;
+
+  nanosecToSecNsec(nanosec, &sec, &nsec);
+  return readUntil(delimiters, sec, nsec);
+}
+
+String *InputStream::readUntil(const std::string &delimiters, time_t sec, long nanosec) {
+  // The data already read ahead is not seen by waitForReady
+  if (hasBufferedDelimiter(delimiters)) return readUntil(delimiters);
+
+  StreamWFRResult waitResult =
+    waitForReady((StreamWFRSet) (STREAM_WFR_READ | STREAM_WFR_ERROR), sec, nanosec);
+  // timeout || error
+  if ((waitResult.setIsNone()) || (waitResult.setIsError())) {
+    throw waitResult.e;
+  } else {
+    return readUntil(delimiters);
+  }
+}
+
 Serializable *InputStream::readObject(void) {
   return readObject2(NULL);
 }
@@ -266,6 +435,9 @@ Serializable *InputStream::readObject(uint64_t nanosec) {
 }
 
 Serializable *InputStream::readObject(time_t sec, long nanosec) {
+  // The data already read ahead is not seen by waitForReady
+  if (hasBufferedObject()) return readObject();
+
   StreamWFRResult waitResult = 
     waitForReady((StreamWFRSet) (STREAM_WFR_READ | STREAM_WFR_ERROR), sec, nanosec);
   // timeout || error
@@ -285,8 +457,9 @@ InputStream::InputStreamException::InputStreamException(int code, std::string me
 
 
 
-BufferedInputStream::BufferedInputStream(void) : buf(NULL), bufferSize(0),
-  offset(0) {}
+BufferedInputStream::BufferedInputStream(void) : buf(NULL), capacity(0),
+  bufferCapacity(DEFAULT_READ_BUFFER_CAPACITY), head(0), count(0),
+  directRead(true) {}
 
 BufferedInputStream::~BufferedInputStream(void) {
   if (buf != NULL) free(buf);
@@ -328,34 +501,126 @@ Serializable *InputStreamInterface::readObject(time_t sec, long nanosec){
     "InputStreamInterface::readObject shall not be called directly");}
 */
 
+bool BufferedInputStream::hasBufferedBytes(void) {
+  return (count != 0);
+}
+
+bool BufferedInputStream::hasBufferedLine(void) {
+  size_t scanned = 0;
+
+  return findLineEnd(&scanned);
+}
+
+bool BufferedInputStream::hasBufferedDelimiter(const std::string &delimiters) {
+  size_t scanned = 0;
+
+  return findDelimiterInBuffer(delimiters.data(), delimiters.size(), &scanned);
+}
+
+bool BufferedInputStream::hasBufferedObject(void) {
+  char header[32];
+  size_t size = (count < sizeof(header)) ? count : sizeof(header);
+  size_t sizeFlags = NetMessage::getFlagsHeaderSize();
+  size_t nextSize;
+  size_t blockSize;
+  NetMessage scratch;
+  NetMessage *netMessage = NULL;
+  bool complete = false;
+
+  // The headers are parsed from a copy, the message size then tells if the
+  // whole message is there
+  if (size < sizeFlags) return false;
+  copyBuffer(header, size);
+  try {
+    netMessage = scratch.parseFlags(header, &nextSize, NULL);
+    if ((netMessage != NULL) && netMessage->getVarintEncoding()) {
+      while (((sizeFlags + nextSize) <= size) && (nextSize < VARINT_MAX_SIZE)
+        && (header[sizeFlags + nextSize - 1] & 0x80)) {
+        ++nextSize;
+      }
+    }
+    if ((sizeFlags + nextSize) <= size) {
+      if (netMessage == NULL) {
+        scratch.parseTypeSize(&(header[sizeFlags]), false, nextSize, &blockSize);
+      } else {
+        netMessage->parseTypeSize(&(header[sizeFlags]), true, nextSize, &blockSize);
+      }
+      complete = ((count - sizeFlags - nextSize) >= blockSize);
+    }
+  } catch (Exception &e) {
+    // Malformed: readObject reports it without waiting
+    complete = true;
+  }
+  if ((netMessage != NULL) && (netMessage != &scratch)) delete netMessage;
+
+  return complete;
+}
+
+size_t BufferedInputStream::getReadBufferCapacity(void) const {
+  return bufferCapacity;
+}
+
+void BufferedInputStream::setReadBufferCapacity(size_t capacity) {
+  bufferCapacity = capacity;
+}
+
 void BufferedInputStream::fillBuffer(size_t size, int flags, bool netAddress) {
   ssize_t readBytes;
-  size_t toAllocateMore = ((size / readBufferSize) 
+  size_t toRead = ((size / readBufferSize)
     + (((size % readBufferSize) != 0) ? 1 : 0)) * readBufferSize;
+  size_t tail;
+  size_t freeSize;
+  struct iovec iov[2];
+  int iovcnt = 1;
+
+  if ((capacity - count) < toRead) growBuffer(count + toRead);
+
+  // The whole free space is offered, on both sides of the wrap-around
+  tail = (head + count) % capacity;
+  freeSize = capacity - count;
+  iov[0].iov_base = &(buf[tail]);
+  iov[0].iov_len = ((capacity - tail) < freeSize) ? (capacity - tail) : freeSize;
+  if (iov[0].iov_len < freeSize) {
+    iov[1].iov_base = buf;
+    iov[1].iov_len = freeSize - iov[0].iov_len;
+    iovcnt = 2;
+  }
 
-  buf = (char*) realloc(buf, bufferSize + toAllocateMore);
-  readBytes = readRawData(&(buf[bufferSize]), toAllocateMore, flags, (netAddress) ? &lastNetAddress : NULL);
-  
-  bufferSize += readBytes;
-  if ((size_t) readBytes < toAllocateMore) buf = (char*) realloc(buf, bufferSize);
+  readBytes = readRawData(iov, iovcnt, flags, (netAddress) ? &lastNetAddress : NULL);
+  count += readBytes;
+}
+
+void BufferedInputStream::growBuffer(size_t size) {
+  size_t newCapacity = (capacity * 2 > bufferCapacity) ? capacity * 2 : bufferCapacity;
+  char *newBuf;
+
+  if (newCapacity < size) newCapacity = size;
+  newBuf = (char*) malloc(newCapacity);
+  copyBuffer(newBuf, count);
+  if (buf != NULL) free(buf);
+  buf = newBuf;
+  capacity = newCapacity;
+  head = 0;
+}
+
+void BufferedInputStream::copyBuffer(char *buffer, size_t size) {
+  size_t firstPart;
+
+  if (size == 0) return;
+  firstPart = ((capacity - head) < size) ? (capacity - head) : size;
+  memcpy(buffer, &(buf[head]), firstPart);
+  if (firstPart < size) memcpy(&(buffer[firstPart]), buf, size - firstPart);
 }
 
 void BufferedInputStream::clearBuffer(void) {
-  size_t sizeData = bufferSize-offset;
-  if (sizeData == 0){
-    if (buf != NULL) free(buf);
+  if (count != 0) return;
+
+  // Drained: the next reads start at the beginning, in a single piece
+  head = 0;
+  if (capacity > bufferCapacity) {
+    free(buf);
     buf = NULL;
-    bufferSize = offset = 0;
-  } else {
-    if ((sizeData != bufferSize) && (bufferSize > MAX_BUFFER_SIZE)) {
-      char *bufTemp = (char*) malloc(sizeData);
-      
-      memcpy(bufTemp, &(buf[offset]), sizeData);
-      free(buf);
-      buf = bufTemp;
-      offset = 0;
-      bufferSize = sizeData;
-    }
+    capacity = 0;
   }
 }
 
@@ -363,11 +628,20 @@ ssize_t BufferedInputStream::readData(  char *buffer, size_t size, int flags,
                                         NetAddress *addr) {
   size_t sizeToCopy;
 
-  if ((bufferSize - offset) < size) fillBuffer((size-(bufferSize-offset)), flags, (addr != NULL));
-  sizeToCopy = ((bufferSize - offset) < size) ? (bufferSize - offset) : size;
+  // Nothing buffered and a big read: no need to copy through the buffer
+  if ((directRead) && (count == 0) && (size >= readBufferSize)) {
+    ssize_t readBytes = readRawData(buffer, size, flags, (addr != NULL) ? &lastNetAddress : NULL);
+    if (addr != NULL) *addr = lastNetAddress;
+    return readBytes;
+  }
+
+  if (count < size) fillBuffer(size - count, flags, (addr != NULL));
+  sizeToCopy = (count < size) ? count : size;
 
-  memcpy(buffer, &(buf[offset]), sizeToCopy);
-  offset += sizeToCopy;
+  copyBuffer(buffer, sizeToCopy);
+  head += sizeToCopy;
+  if (head >= capacity) head -= capacity;
+  count -= sizeToCopy;
   if (addr != NULL) *addr = lastNetAddress;
   
   clearBuffer();
@@ -378,11 +652,101 @@ ssize_t BufferedInputStream::readData(  char *buffer, size_t size, int flags,
 ssize_t BufferedInputStream::peekData(  char *buffer, size_t size, NetAddress *addr) {
   size_t sizeToCopy;
 
-  if ((bufferSize - offset) < size) fillBuffer((size-(bufferSize-offset)), 0, (addr != NULL));
-  sizeToCopy = ((bufferSize - offset) < size) ? (bufferSize - offset) : size;
+  if (count < size) fillBuffer(size - count, 0, (addr != NULL));
+  sizeToCopy = (count < size) ? count : size;
 
-  memcpy(buffer, &(buf[offset]), sizeToCopy);
+  copyBuffer(buffer, sizeToCopy);
   if (addr != NULL) *addr = lastNetAddress;
   
   return sizeToCopy;
 }
+
+bool BufferedInputStream::findDelimiterInBuffer(const char *delimiters,
+  size_t nbDelimiters, size_t *scanned) {
+  while (*scanned < count) {
+    size_t start = head + *scanned;
+    size_t span;
+    const char *found;
+
+    if (start >= capacity) start -= capacity;
+    span = ((capacity - start) < (count - *scanned)) ? (capacity - start) : (count - *scanned);
+    found = findDelimiter(&(buf[start]), span, delimiters, nbDelimiters);
+    if (found != NULL) {
+      *scanned += (found - &(buf[start]));
+      return true;
+    }
+    *scanned += span;
+  }
+
+  return false;
+}
+
+bool BufferedInputStream::findLineEnd(size_t *scanned) {
+  while (findDelimiterInBuffer("\r", 1, scanned)) {
+    size_t index;
+
+    // The LF may not be read yet, or be on the other side of the wrap-around
+    if ((*scanned + 1) == count) return false;
+    index = head + *scanned + 1;
+    if (index >= capacity) index -= capacity;
+    if (buf[index] == '\n') return true;
+    ++(*scanned);
+  }
+
+  return false;
+}
+
+String *BufferedInputStream::extractString(size_t size, size_t consumed,
+  NetAddress *addr) {
+  String *str;
+
+  // The string is copied once, from one or both sides of the wrap-around
+  if ((capacity - head) >= size) {
+    str = new String(&(buf[head]), size);
+  } else {
+    str = new String(size, '\0');
+    copyBuffer(&((*str)[0]), size);
+  }
+
+  head += consumed;
+  if (head >= capacity) head -= capacity;
+  count -= consumed;
+  if (addr != NULL) *addr = lastNetAddress;
+
+  clearBuffer();
+  return str;
+}
+
+String *BufferedInputStream::readString2(NetAddress *addr) {
+  size_t scanned = 0;
+
+  // Only the bytes read since the previous scan are searched
+  while (!findLineEnd(&scanned)) {
+    if ((maxLineLength != 0) && (scanned > maxLineLength)) {
+      throw InputStreamException(EX_ISTREAM_LINE_TOO_LONG, "Line too long.");
+    }
+    fillBuffer(1, 0, (addr != NULL));
+  }
+  if ((maxLineLength != 0) && (scanned > maxLineLength)) {
+    throw InputStreamException(EX_ISTREAM_LINE_TOO_LONG, "Line too long.");
+  }
+
+  return extractString(scanned, scanned + 2, addr);
+}
+
+String *BufferedInputStream::readUntil2(const std::string &delimiters,
+  NetAddress *addr) {
+  size_t scanned = 0;
+
+  while (!findDelimiterInBuffer(delimiters.data(), delimiters.size(), &scanned)) {
+    if ((maxLineLength != 0) && (scanned > maxLineLength)) {
+      throw InputStreamException(EX_ISTREAM_LINE_TOO_LONG, "Line too long.");
+    }
+    fillBuffer(1, 0, (addr != NULL));
+  }
+  if ((maxLineLength != 0) && (scanned > maxLineLength)) {
+    throw InputStreamException(EX_ISTREAM_LINE_TOO_LONG, "Line too long.");
+  }
+
+  return extractString(scanned + 1, scanned + 1, addr);
+}
@@ -7,12 +7,21 @@
 #include "structs/string_serializable.h"
 #include "structs/buffer_serializable.h"
 
+#include <sys/uio.h>
+
+#define DEFAULT_READ_BUFFER_CAPACITY 16384
+// Same limit as ObjectParser
+#define DEFAULT_MAX_MESSAGE_SIZE (64 * 1024 * 1024)
+
 class NetMessage;
 class InputStreamInterface;
 
 class InputStream: virtual public Stream {
   protected:
     size_t readBufferSize;
+    size_t maxLineLength;
+    size_t maxMessageSize;
+    bool zeroCopyParsing;
 
     InputStream(void);
 
@@ -31,8 +40,16 @@ class InputStream: virtual public Stream {
     NetMessage *parseBlockHeader( NetMessage *netMessage, size_t *blockSize,
                                   size_t *headerSize, bool *toFree, NetAddress *addr = NULL);
 
+    // True if a whole unit to read has been read ahead from the stream: the
+    // timed reads then skip waitForReady, which does not see it
+    virtual bool hasBufferedBytes(void);
+    virtual bool hasBufferedLine(void);
+    virtual bool hasBufferedDelimiter(const std::string &delimiters);
+    virtual bool hasBufferedObject(void);
+
     Buffer<char> *readBytes2(Buffer<char> *buff, int flags, NetAddress *addr);
-    String *readString2(NetAddress *addr);
+    virtual String *readString2(NetAddress *addr);
+    virtual String *readUntil2(const std::string &delimiters, NetAddress *addr);
     Serializable *readObject2(NetAddress *addr);
 
     friend class InputStreamInterface;
@@ -44,12 +61,57 @@ class InputStream: virtual public Stream {
     size_t getReadBufferSize(void);
     void setReadBufferSize(size_t bs);
 
+    //! \brief Gives the maximum length of the lines read by readString
+    size_t getMaxLineLength(void) const;
+
+    //! \brief Sets the maximum length of the lines read by readString
+    //! \param[in] length the maximum length, CRLF excluded, 0 for no limit
+    //!
+    //! A longer line makes readString throw an InputStreamException with the
+    //! code EX_ISTREAM_LINE_TOO_LONG, leaving the data in the stream, instead
+    //! of buffering it whole. No limit by default.
+    void setMaxLineLength(size_t length);
+
+    //! \brief Gives the biggest message accepted by readObject
+    size_t getMaxMessageSize(void) const;
+
+    //! \brief Sets the biggest message accepted by readObject
+    //! \param[in] size the maximum size, headers excluded, 0 for no limit
+    //!
+    //! The size announced by the peer is checked before anything is
+    //! allocated: a bigger message makes readObject throw an
+    //! InputStreamException with the code EX_MALFORMED_MESSAGE, after which
+    //! the stream is not usable. 64MB by default.
+    void setMaxMessageSize(size_t size);
+
+    //! \brief Enables or disables zero-copy parsing
+    //! \param[in] enable true to enable it
+    //!
+    //! When enabled, readObject reads each message at once into a single
+    //! SharedBlock and the data blocks of the parsed NetMessages are views into
+    //! it. Buffer objects then reference that memory instead of owning a copy,
+    //! which keeps the whole message alive as long as one of them exists.
+    //! Disabled by default.
+    void setZeroCopyParsing(bool enable);
+    bool getZeroCopyParsing(void) const;
+
     Buffer<char> *readBytes(Buffer<char> *buff, int flags = 0);
     Buffer<char> *readBytes(Buffer<char> *buff, uint64_t nanosec, int flags = 0);
     Buffer<char> *readBytes(Buffer<char> *buff, time_t sec, long nanosec, int flags = 0);
     String *readString(void);
     String *readString(uint64_t nanosec);
     String *readString(time_t sec, long nanosec);
+
+    //! \brief Reads up to the first of a set of delimiters
+    //! \param[in] delimiters the delimiting bytes
+    //! \return the bytes read, ending with the delimiter found
+    //!
+    //! The delimiter is kept at the end of the string, so that the callers
+    //! waiting for several ones can tell which one was met. The maximum line
+    //! length applies, the delimiter excluded.
+    String *readUntil(const std::string &delimiters);
+    String *readUntil(const std::string &delimiters, uint64_t nanosec);
+    String *readUntil(const std::string &delimiters, time_t sec, long nanosec);
     Serializable *readObject(void);
     Serializable *readObject(uint64_t nanosec);
     Serializable *readObject(time_t sec, long nanosec);
@@ -80,11 +142,20 @@ class InputStreamInterface {
     virtual Serializable *readObject(time_t sec, long nanosec);
 };*/
 
+//! \class BufferedInputStream libcomm/input_stream.h
+//! \brief Input stream reading ahead into a ring buffer
+//!
+//! The data read ahead is kept in a ring buffer, allocated at the first read
+//! and then reused: the raw reads fill its free space at once, both sides of
+//! the wrap-around included. A read needing more than the capacity grows the
+//! buffer, which comes back to the capacity once drained.
 class BufferedInputStream: public InputStream{
   private:
     char *buf;
-    size_t bufferSize;
-    size_t offset;
+    size_t capacity;
+    size_t bufferCapacity;
+    size_t head;
+    size_t count;
     NetAddress lastNetAddress;
 
     ssize_t readData(   char *buffer, size_t size, int flags,
@@ -93,14 +164,44 @@ class BufferedInputStream: public InputStream{
                         NetAddress *addr);
 
     void fillBuffer(size_t size, int flags, bool netAddress);
+    void growBuffer(size_t size);
+    void copyBuffer(char *buffer, size_t size);
     void clearBuffer(void);
+    bool findDelimiterInBuffer(const char *delimiters, size_t nbDelimiters,
+                               size_t *scanned);
+    bool findLineEnd(size_t *scanned);
+    String *extractString(size_t size, size_t consumed, NetAddress *addr);
 
   protected:
+    // If true, big reads bypass the buffer when it is empty. Must be false
+    // for datagram sockets, which would lose the end of the packets.
+    bool directRead;
+
     BufferedInputStream(void);
     virtual ~BufferedInputStream(void);
 
+    bool hasBufferedBytes(void);
+    bool hasBufferedLine(void);
+    bool hasBufferedDelimiter(const std::string &delimiters);
+    bool hasBufferedObject(void);
+    String *readString2(NetAddress *addr);
+    String *readUntil2(const std::string &delimiters, NetAddress *addr);
+
     virtual ssize_t readRawData(   char *buffer, size_t size, int flags,
                                    NetAddress *addr) = 0;
+    virtual ssize_t readRawData(   const struct iovec *iov, int iovcnt,
+                                   int flags, NetAddress *addr) = 0;
+
+  public:
+    //! \brief Gives the capacity of the read buffer
+    size_t getReadBufferCapacity(void) const;
+
+    //! \brief Sets the capacity of the read buffer
+    //! \param[in] capacity the capacity, in bytes
+    //!
+    //! Bytes kept by the buffer between two reads, 16KB by default. It is
+    //! exceeded only by the reads, or peeks, needing more at once.
+    void setReadBufferCapacity(size_t capacity);
 };
 
 #endif
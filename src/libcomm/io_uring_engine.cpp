@@ -0,0 +1,622 @@
+#include "io_uring_engine.h"
+
+#include <stddef.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+static const int maxIov = sysconf(_SC_IOV_MAX);
+
+// User data of the multishot receive and of its cancellation
+#define RECV_USER_DATA 1
+#define CANCEL_USER_DATA 2
+
+#ifdef HAVE_IO_URING
+
+static int ioUringSetup(unsigned entries, struct io_uring_params *params) {
+  return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ioUringEnter(int ringFd, unsigned toSubmit, unsigned minComplete,
+  unsigned flags) {
+  return (int) syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete,
+    flags, NULL, 0);
+}
+
+static int ioUringRegister(int ringFd, unsigned opcode, const void *arg,
+  unsigned nrArgs) {
+  return (int) syscall(__NR_io_uring_register, ringFd, opcode, arg, nrArgs);
+}
+
+IoUringEngine::IoUringEngine(int fd, unsigned entries): ringFd(-1), fd(fd),
+  fileIndex(-1), socket(false), multishot(false), recvArmed(false),
+  endOfStream(false), pendingError(0),
+  sqRing(NULL), sqRingSize(0), cqRing(NULL), cqRingSize(0), sqes(NULL),
+  sqesSize(0), toSubmit(0), bufRing(NULL), bufRingSize(0), recvBuffers(NULL),
+  bufRingTail(0), currentBuffer(-1), currentOffset(0), currentSize(0) {
+  struct stat stats;
+
+  if (fstat(fd, &stats) == -1) {
+    throw IoUringException(errno);
+  }
+  socket = S_ISSOCK(stats.st_mode);
+
+  // Multishot receives post one completion per filled buffer
+  setupRing(entries, 2 * entries + (socket ? 2 * IO_URING_ENGINE_RECV_BUFFERS : 0));
+
+  // Registered files save the lookup of fd on each operation
+  if (ioUringRegister(ringFd, IORING_REGISTER_FILES, &fd, 1) == 0) {
+    fileIndex = 0;
+  }
+  if (socket) {
+    setupRecvBuffers();
+  }
+}
+
+IoUringEngine::~IoUringEngine(void) {
+  freeRing();
+}
+
+void IoUringEngine::setupRing(unsigned entries, unsigned cqEntries) {
+  struct io_uring_params params;
+  int error;
+
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CLAMP | IORING_SETUP_CQSIZE;
+  params.cq_entries = cqEntries;
+
+  ringFd = ioUringSetup(entries, &params);
+  if (ringFd == -1) {
+    throw IoUringException(errno);
+  }
+
+  sqEntries = params.sq_entries;
+  sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+    if (cqRingSize > sqRingSize) sqRingSize = cqRingSize;
+    cqRingSize = sqRingSize;
+  }
+
+  sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+  if (sqRing == MAP_FAILED) {
+    error = errno;
+    sqRing = NULL;
+    freeRing();
+    throw IoUringException(error);
+  }
+
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+    cqRing = sqRing;
+  } else {
+    cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    if (cqRing == MAP_FAILED) {
+      error = errno;
+      cqRing = NULL;
+      freeRing();
+      throw IoUringException(error);
+    }
+  }
+
+  sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes = (struct io_uring_sqe*) mmap(NULL, sqesSize, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    error = errno;
+    sqes = NULL;
+    freeRing();
+    throw IoUringException(error);
+  }
+
+  sqHead = (unsigned*) ((char*) sqRing + params.sq_off.head);
+  sqTail = (unsigned*) ((char*) sqRing + params.sq_off.tail);
+  sqMask = *(unsigned*) ((char*) sqRing + params.sq_off.ring_mask);
+  sqArray = (unsigned*) ((char*) sqRing + params.sq_off.array);
+  cqHead = (unsigned*) ((char*) cqRing + params.cq_off.head);
+  cqTail = (unsigned*) ((char*) cqRing + params.cq_off.tail);
+  cqMask = *(unsigned*) ((char*) cqRing + params.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe*) ((char*) cqRing + params.cq_off.cqes);
+}
+
+void IoUringEngine::setupRecvBuffers(void) {
+#ifdef IORING_RECV_MULTISHOT
+  struct io_uring_buf_reg reg;
+  void *ring;
+
+  bufRingSize = IO_URING_ENGINE_RECV_BUFFERS * sizeof(struct io_uring_buf);
+  ring = mmap(NULL, bufRingSize, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED) return;
+  memset(ring, 0, bufRingSize);
+  bufRing = (struct io_uring_buf_ring*) ring;
+
+  recvBuffers = (char*) malloc(IO_URING_ENGINE_RECV_BUFFERS * IO_URING_ENGINE_RECV_BUFFER_SIZE);
+  if (recvBuffers == NULL) return;
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t) (uintptr_t) bufRing;
+  reg.ring_entries = IO_URING_ENGINE_RECV_BUFFERS;
+  reg.bgid = 0;
+  if (ioUringRegister(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) return;
+
+  for (int i = 0; i < IO_URING_ENGINE_RECV_BUFFERS; ++i) {
+    recycleBuffer(i);
+  }
+  multishot = true;
+#endif
+}
+
+void IoUringEngine::freeRing(void) {
+  if (sqes != NULL) munmap(sqes, sqesSize);
+  if ((cqRing != NULL) && (cqRing != sqRing)) munmap(cqRing, cqRingSize);
+  if (sqRing != NULL) munmap(sqRing, sqRingSize);
+  if (ringFd != -1) close(ringFd);
+  if (bufRing != NULL) munmap(bufRing, bufRingSize);
+  free(recvBuffers);
+  sqes = NULL;
+  sqRing = cqRing = NULL;
+  bufRing = NULL;
+  recvBuffers = NULL;
+  ringFd = -1;
+}
+
+// The kernel only looks at the queue in io_uring_enter, so the entry can be
+// published before it is filled.
+struct io_uring_sqe *IoUringEngine::getSqe(void) {
+  unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+  unsigned tail = *sqTail;
+  unsigned index;
+  struct io_uring_sqe *sqe;
+
+  if (tail - head >= sqEntries) {
+    if (enter(0) == -1) {
+      throw IoUringException(errno);
+    }
+    head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (tail - head >= sqEntries) {
+      throw IoUringException(EBUSY, "Submission queue full.");
+    }
+  }
+
+  index = tail & sqMask;
+  sqe = &(sqes[index]);
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  if (fileIndex != -1) {
+    sqe->fd = fileIndex;
+    sqe->flags = IOSQE_FIXED_FILE;
+  } else {
+    sqe->fd = fd;
+  }
+  sqArray[index] = index;
+  __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+  ++toSubmit;
+
+  return sqe;
+}
+
+struct io_uring_cqe *IoUringEngine::peekCqe(void) {
+  unsigned head = *cqHead;
+  unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+
+  if (head == tail) return NULL;
+  return &(cqes[head & cqMask]);
+}
+
+struct io_uring_cqe *IoUringEngine::waitCqe(void) {
+  struct io_uring_cqe *cqe;
+
+  while ((cqe = peekCqe()) == NULL) {
+    if (enter(1) == -1) return NULL;
+  }
+
+  return cqe;
+}
+
+void IoUringEngine::seenCqe(void) {
+  __atomic_store_n(cqHead, *cqHead + 1, __ATOMIC_RELEASE);
+}
+
+int IoUringEngine::enter(unsigned minComplete) {
+  int result;
+
+  do {
+    result = ioUringEnter(ringFd, toSubmit, minComplete,
+      (minComplete > 0) ? IORING_ENTER_GETEVENTS : 0);
+  } while ((result == -1) && (errno == EINTR));
+
+  if (result == -1) return -1;
+  toSubmit -= ((unsigned) result < toSubmit) ? result : toSubmit;
+
+  return 0;
+}
+
+// The user data of the operations is their index in results
+int IoUringEngine::submitAndWait(unsigned nbOperations, int *results) {
+  for (unsigned i = 0; i < nbOperations; ++i) {
+    struct io_uring_cqe *cqe = waitCqe();
+
+    if (cqe == NULL) return -1;
+    results[cqe->user_data] = cqe->res;
+    seenCqe();
+  }
+
+  return 0;
+}
+
+void IoUringEngine::armRecv(void) {
+#ifdef IORING_RECV_MULTISHOT
+  struct io_uring_sqe *sqe = getSqe();
+
+  sqe->opcode = IORING_OP_RECV;
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = 0;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->user_data = RECV_USER_DATA;
+  recvArmed = true;
+#endif
+}
+
+// Stops the multishot receive once everything it received has been read, so
+// that the data arriving between two reads is left in the socket, where poll
+// and epoll see it. What is received before the cancellation is kept.
+void IoUringEngine::disarmRecv(void) {
+#ifdef IORING_RECV_MULTISHOT
+  struct io_uring_sqe *sqe = getSqe();
+  bool canceled = false;
+
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->flags = 0;
+  sqe->fd = -1;
+  sqe->addr = RECV_USER_DATA;
+  sqe->user_data = CANCEL_USER_DATA;
+
+  while (recvArmed || !canceled) {
+    struct io_uring_cqe *cqe = waitCqe();
+
+    if (cqe == NULL) return;
+    if (cqe->user_data == CANCEL_USER_DATA) {
+      canceled = true;
+    } else if ((cqe->res == -ECANCELED) && ((cqe->flags & IORING_CQE_F_MORE) == 0)) {
+      recvArmed = false;
+    } else {
+      // Left to nextBuffer, which skips the completion of the cancellation
+      return;
+    }
+    seenCqe();
+  }
+#endif
+}
+
+// Drops the completions at the head of the queue which carry no data
+void IoUringEngine::skipEmptyCqes(void) {
+#ifdef IORING_RECV_MULTISHOT
+  struct io_uring_cqe *cqe;
+
+  while ((cqe = peekCqe()) != NULL) {
+    if (cqe->user_data == CANCEL_USER_DATA) {
+      seenCqe();
+    } else if ((cqe->res == -ECANCELED) || (cqe->res == -ENOBUFS)) {
+      if ((cqe->flags & IORING_CQE_F_MORE) == 0) recvArmed = false;
+      seenCqe();
+    } else {
+      break;
+    }
+  }
+#endif
+}
+
+void IoUringEngine::recycleBuffer(int bufferId) {
+  struct io_uring_buf *buf;
+  uint16_t *tail;
+
+  // The flexible array of io_uring_buf_ring is not laid out as in C when
+  // compiled as C++, so the entries and the tail (overlaid with the resv
+  // field of the first entry) are addressed explicitly
+  buf = &(((struct io_uring_buf*) bufRing)[bufRingTail & (IO_URING_ENGINE_RECV_BUFFERS - 1)]);
+  buf->addr = (uint64_t) (uintptr_t) &(recvBuffers[bufferId * IO_URING_ENGINE_RECV_BUFFER_SIZE]);
+  buf->len = IO_URING_ENGINE_RECV_BUFFER_SIZE;
+  buf->bid = bufferId;
+  ++bufRingTail;
+  tail = (uint16_t*) ((char*) bufRing + offsetof(struct io_uring_buf, resv));
+  __atomic_store_n(tail, bufRingTail, __ATOMIC_RELEASE);
+}
+
+ssize_t IoUringEngine::writev(const struct iovec *iov, int iovcnt, size_t *written) {
+  struct iovec *remaining;
+  int *results;
+  int first = 0;
+
+  *written = 0;
+  remaining = (struct iovec*) malloc(iovcnt * sizeof(struct iovec) + sqEntries * sizeof(int));
+  if (remaining == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+  memcpy(remaining, iov, iovcnt * sizeof(struct iovec));
+  results = (int*) &(remaining[iovcnt]);
+
+  while (first < iovcnt) {
+    struct io_uring_sqe *sqe = NULL;
+    unsigned nbOperations = 0;
+    size_t chainWritten = 0;
+    int error = 0;
+
+    // One system call for as many linked writev as the ring holds
+    for (int index = first; (index < iovcnt) && (nbOperations < sqEntries);) {
+      int count = ((iovcnt - index) > maxIov) ? maxIov : iovcnt - index;
+
+      sqe = getSqe();
+      sqe->opcode = IORING_OP_WRITEV;
+      sqe->flags |= IOSQE_IO_LINK;
+      sqe->addr = (uint64_t) (uintptr_t) &(remaining[index]);
+      sqe->len = count;
+      sqe->off = (uint64_t) -1;
+      sqe->user_data = nbOperations;
+      index += count;
+      ++nbOperations;
+    }
+    sqe->flags &= ~IOSQE_IO_LINK;
+
+    if (submitAndWait(nbOperations, results) == -1) {
+      free(remaining);
+      return -1;
+    }
+
+    // A short write cancels the rest of the chain, which is submitted again
+    for (unsigned i = 0; i < nbOperations; ++i) {
+      if (results[i] >= 0) {
+        chainWritten += results[i];
+      } else if ((results[i] != -ECANCELED) && (error == 0)) {
+        error = -results[i];
+      }
+    }
+    *written += chainWritten;
+    if (error != 0) {
+      free(remaining);
+      errno = error;
+      return -1;
+    }
+
+    while ((first < iovcnt) && (remaining[first].iov_len <= chainWritten)) {
+      chainWritten -= remaining[first].iov_len;
+      ++first;
+    }
+    if (chainWritten > 0) {
+      remaining[first].iov_base = (char*) remaining[first].iov_base + chainWritten;
+      remaining[first].iov_len -= chainWritten;
+    }
+  }
+
+  free(remaining);
+  return *written;
+}
+
+ssize_t IoUringEngine::send(const char *data, size_t size, int flags) {
+  struct io_uring_sqe *sqe = getSqe();
+  int result;
+
+  sqe->opcode = IORING_OP_SEND;
+  sqe->addr = (uint64_t) (uintptr_t) data;
+  sqe->len = size;
+  sqe->msg_flags = flags;
+  sqe->user_data = 0;
+
+  if (submitAndWait(1, &result) == -1) return -1;
+  if (result < 0) {
+    errno = -result;
+    return -1;
+  }
+  return result;
+}
+
+ssize_t IoUringEngine::readOnce(char *buffer, size_t size, int flags) {
+  struct io_uring_sqe *sqe = getSqe();
+  int result;
+
+  if (socket) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->msg_flags = flags;
+  } else {
+    sqe->opcode = IORING_OP_READ;
+    sqe->off = (uint64_t) -1;
+  }
+  sqe->addr = (uint64_t) (uintptr_t) buffer;
+  sqe->len = size;
+  sqe->user_data = 0;
+
+  if (submitAndWait(1, &result) == -1) return -1;
+  if (result < 0) {
+    errno = -result;
+    return -1;
+  }
+  return result;
+}
+
+// Takes the next filled buffer. Returns 1 when currentBuffer is set, 0 at the
+// end of the stream, -1 with errno set otherwise (EAGAIN if it should not
+// wait and nothing has been received).
+int IoUringEngine::nextBuffer(bool wait) {
+#ifdef IORING_RECV_MULTISHOT
+  while (currentBuffer == -1) {
+    struct io_uring_cqe *cqe;
+    unsigned cqeFlags;
+    int result;
+
+    if (endOfStream) return 0;
+    if (pendingError != 0) {
+      errno = pendingError;
+      pendingError = 0;
+      return -1;
+    }
+    if (!recvArmed) armRecv();
+
+    if (wait) {
+      cqe = waitCqe();
+      if (cqe == NULL) return -1;
+    } else {
+      if ((cqe = peekCqe()) == NULL) {
+        if ((toSubmit > 0) && (enter(0) == -1)) return -1;
+        if ((cqe = peekCqe()) == NULL) {
+          errno = EAGAIN;
+          return -1;
+        }
+      }
+    }
+    result = cqe->res;
+    cqeFlags = cqe->flags;
+    if (cqe->user_data == CANCEL_USER_DATA) {
+      seenCqe();
+      continue;
+    }
+    seenCqe();
+
+    if ((cqeFlags & IORING_CQE_F_MORE) == 0) recvArmed = false;
+    if (result > 0) {
+      currentBuffer = cqeFlags >> IORING_CQE_BUFFER_SHIFT;
+      currentOffset = 0;
+      currentSize = result;
+    } else if (result == 0) {
+      endOfStream = true;
+    } else if ((result != -ENOBUFS) && (result != -ECANCELED)) {
+      // On ENOBUFS all the buffers were full: the receive is armed again
+      pendingError = -result;
+    }
+  }
+  return 1;
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+ssize_t IoUringEngine::recvMultishot(char *buffer, size_t size, int flags) {
+  size_t copied = 0;
+  ssize_t result = 0;
+
+  // Completed buffers are taken while they fill the request, waiting only
+  // for the first one
+  while (copied < size) {
+    size_t toCopy;
+    int next = nextBuffer((copied == 0) && ((flags & MSG_DONTWAIT) == 0));
+
+    if (next <= 0) {
+      if (copied == 0) result = next;
+      break;
+    }
+
+    toCopy = currentSize - currentOffset;
+    if (toCopy > size - copied) toCopy = size - copied;
+    memcpy(&(buffer[copied]), &(recvBuffers[currentBuffer * IO_URING_ENGINE_RECV_BUFFER_SIZE
+      + currentOffset]), toCopy);
+    copied += toCopy;
+
+    if ((flags & MSG_PEEK) != 0) break;
+    currentOffset += toCopy;
+    if (currentOffset == currentSize) {
+      recycleBuffer(currentBuffer);
+      currentBuffer = -1;
+    }
+  }
+
+  if (recvArmed && !hasReadData()) {
+    int error = errno;
+
+    disarmRecv();
+    errno = error;
+  }
+  return (copied > 0) ? (ssize_t) copied : result;
+}
+
+ssize_t IoUringEngine::read(char *buffer, size_t size, int flags) {
+  if (size == 0) return 0;
+  if (multishot) {
+    ssize_t result = recvMultishot(buffer, size, flags);
+
+    // Kernels without multishot receives refuse it when it is armed
+    if ((result == -1) && (errno == EINVAL) && (bufRingTail == IO_URING_ENGINE_RECV_BUFFERS)) {
+      multishot = false;
+    } else {
+      return result;
+    }
+  }
+  return readOnce(buffer, size, flags);
+}
+
+bool IoUringEngine::hasReadData(void) {
+  skipEmptyCqes();
+  return (currentBuffer != -1) || endOfStream || (pendingError != 0)
+    || (peekCqe() != NULL);
+}
+
+bool IoUringEngine::isSupported(void) {
+  static int supported = -1;
+
+  if (supported == -1) {
+    struct io_uring_params params;
+    int ringFd;
+
+    memset(&params, 0, sizeof(params));
+    ringFd = ioUringSetup(2, &params);
+    if (ringFd != -1) close(ringFd);
+    supported = (ringFd != -1) ? 1 : 0;
+  }
+
+  return (supported == 1);
+}
+
+#else
+
+IoUringEngine::IoUringEngine(int fd, unsigned entries) {
+  throw IoUringException(ENOSYS, "io_uring is not available.");
+}
+
+IoUringEngine::~IoUringEngine(void) {
+}
+
+ssize_t IoUringEngine::writev(const struct iovec *iov, int iovcnt, size_t *written) {
+  errno = ENOSYS;
+  return -1;
+}
+
+ssize_t IoUringEngine::send(const char *data, size_t size, int flags) {
+  errno = ENOSYS;
+  return -1;
+}
+
+ssize_t IoUringEngine::read(char *buffer, size_t size, int flags) {
+  errno = ENOSYS;
+  return -1;
+}
+
+bool IoUringEngine::hasReadData(void) {
+  return false;
+}
+
+bool IoUringEngine::isSupported(void) {
+  return false;
+}
+
+#endif
+
+IoUringEngine::IoUringException::IoUringException(int code)
+  : Exception(code) {}
+
+IoUringEngine::IoUringException::IoUringException(int code, std::string message)
+  : Exception(code, message) {}
@@ -0,0 +1,156 @@
+//! \file io_uring_engine.h
+//! \brief I/O through io_uring
+//!
+//! File containing the declarations of the class IoUringEngine.
+
+#ifndef IO_URING_ENGINE_H
+#define IO_URING_ENGINE_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdint.h>
+
+#include "exception.h"
+
+#define IO_URING_ENGINE_DEFAULT_ENTRIES 64
+#define IO_URING_ENGINE_RECV_BUFFERS 8
+#define IO_URING_ENGINE_RECV_BUFFER_SIZE 16384
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+//! \class IoUringEngine libcomm/io_uring_engine.h
+//! \brief Performs the reads or the writes of one file descriptor
+//!
+//! An IoUringEngine owns an io_uring instance dedicated to one file
+//! descriptor, which is registered into it:
+//! - writev splits big iovec arrays into IOV_MAX chunks which are submitted
+//!   as one chain of linked operations, with a single system call;
+//! - read on a socket arms a multishot receive: the kernel then fills a ring
+//!   of provided buffers as data arrives and posts completions that are
+//!   taken without system call while some are pending. The receive is
+//!   canceled once all it received has been read, so that the data arriving
+//!   between two reads stays in the socket and makes it readable;
+//! - read on other files is a single read operation.
+//!
+//! An engine is not thread safe: streams use one for reading and another one
+//! for writing (see Stream::setIoUringEnabled). Reads and writes must not be
+//! mixed on a single engine of a socket, since data is received ahead.
+class IoUringEngine {
+  private:
+    int ringFd;
+    int fd;
+    int fileIndex;
+    bool socket;
+    bool multishot;
+    bool recvArmed;
+    bool endOfStream;
+    int pendingError;
+
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned toSubmit;
+
+    // Provided buffers of the multishot receive
+    struct io_uring_buf_ring *bufRing;
+    size_t bufRingSize;
+    char *recvBuffers;
+    uint16_t bufRingTail;
+    int currentBuffer;
+    size_t currentOffset;
+    size_t currentSize;
+
+    IoUringEngine(const IoUringEngine &engine);
+    IoUringEngine &operator=(const IoUringEngine &engine);
+
+    void setupRing(unsigned entries, unsigned cqEntries);
+    void setupRecvBuffers(void);
+    void freeRing(void);
+
+    struct io_uring_sqe *getSqe(void);
+    struct io_uring_cqe *peekCqe(void);
+    struct io_uring_cqe *waitCqe(void);
+    void seenCqe(void);
+    int enter(unsigned minComplete);
+    int submitAndWait(unsigned nbOperations, int *results);
+
+    void armRecv(void);
+    void disarmRecv(void);
+    void skipEmptyCqes(void);
+    void recycleBuffer(int bufferId);
+    int nextBuffer(bool wait);
+    ssize_t readOnce(char *buffer, size_t size, int flags);
+    ssize_t recvMultishot(char *buffer, size_t size, int flags);
+
+  public:
+    //! \brief IoUringEngine constructor
+    //! \param[in] fd the file descriptor, which stays owned by the caller
+    //! \param[in] entries the size of the submission queue
+    //!
+    //! Throws an IoUringException if the ring can not be created.
+    IoUringEngine(int fd, unsigned entries = IO_URING_ENGINE_DEFAULT_ENTRIES);
+
+    //! \brief IoUringEngine destructor
+    //!
+    //! Must be called before the file descriptor is closed, since the ring
+    //! holds a reference on it.
+    ~IoUringEngine(void);
+
+    //! \brief Writes a whole iovec array
+    //! \param[in] iov the data
+    //! \param[in] iovcnt the number of elements of iov
+    //! \param[out] written the number of bytes written, even on errors
+    //! \return the number of bytes written, or -1 with errno set
+    ssize_t writev(const struct iovec *iov, int iovcnt, size_t *written);
+
+    //! \brief Sends data on a socket
+    //! \param[in] data the data
+    //! \param[in] size the size of data
+    //! \param[in] flags the flags, as with send
+    //! \return the number of bytes sent, or -1 with errno set
+    ssize_t send(const char *data, size_t size, int flags);
+
+    //! \brief Reads data
+    //! \param[out] buffer where to put the data
+    //! \param[in] size the size of buffer
+    //! \param[in] flags MSG_PEEK and MSG_DONTWAIT are supported on sockets
+    //! \return the number of bytes read, 0 at the end of the stream, or -1
+    //!         with errno set
+    ssize_t read(char *buffer, size_t size, int flags = 0);
+
+    //! \brief Checks if data has been received ahead
+    //! \return true if the next read gives data, the end of the stream or an
+    //!         error without waiting
+    //!
+    //! Data received ahead is no longer in the file descriptor, which poll
+    //! does not report readable for it.
+    bool hasReadData(void);
+
+    //! \brief Checks if io_uring can be used
+    //! \return true if the kernel supports it
+    //!
+    //! The check is done once, by creating a small ring.
+    static bool isSupported(void);
+
+    class IoUringException : public Exception {
+      public :
+        IoUringException(int code);
+        IoUringException(int code, std::string message);
+    };
+};
+
+#endif
@@ -3,6 +3,7 @@
 #include "config_loader.h"
 #include "logger.h"
 #include "thread.h"
+#include "tcp_socket.h"
 
 #include "libcomm_structs.h"
 
@@ -315,6 +316,7 @@ void libcomm::clean() {
   //Cleanup stuff
   delete SerializationManager::getSerializationManager();
   delete ConfigLoader::getConfigLoader();
+  TcpSocket::stopBatchFlusher();
   Thread::cleanup();
   Logger::cleanup();
 }
@@ -26,7 +26,6 @@ class libcomm {
     static void addSupportForAutoSerializable(MyType<T> type) {
       SerializationManager *serManager = SerializationManager::getSerializationManager(); 
       T::type = serManager->addDeserializationFunc(&T::deserialize);
-      T::init();
     }
     static void setSigPipeHandler(SigAction handler);
 };
@@ -99,7 +99,7 @@ class LoggerEndMessage {
   public :
     void flush();
   private :
-    LoggerEndMessage<T>() {}
+    LoggerEndMessage() {}
     
     std::string getClassName() {
       std::string str(typeid(T).name());
@@ -1,11 +1,22 @@
 #include <time.h>
 #include <sstream>
 
+#include <new>
+
 #include "net_message.h"
 #include "types_utils.h"
 #include "exception.h"
+#include "arena.h"
 
 #define FAST_VECT_BLOCK_SIZE 16
+// Room kept in front of each NetMessage for the arena it comes from
+#define ARENA_PREFIX_SIZE 16
+
+// Release of the data blocks: by their owner, by the NetMessage with free,
+// or with the arena of the NetMessage
+#define IOV_KEEP 0
+#define IOV_FREE 1
+#define IOV_ARENA 2
 
 const size_t flagsHeader = sizeof(uint8_t);
 const size_t typeHeader = sizeof(uint16_t);
@@ -14,36 +25,77 @@ const size_t typeHeader = sizeof(uint16_t);
 
 #include <iostream>
 
+SharedBlock::SharedBlock(size_t size): size(size), refCount(1) {
+  data = (char*) malloc((size != 0) ? size : 1);
+  if (data == NULL) throw std::bad_alloc();
+}
+
+SharedBlock::~SharedBlock(void) {
+  free(data);
+}
+
+void SharedBlock::ref(void) {
+  __sync_add_and_fetch(&refCount, 1);
+}
+
+void SharedBlock::unref(void) {
+  if (__sync_sub_and_fetch(&refCount, 1) == 0) {
+    delete this;
+  }
+}
+
+char *SharedBlock::getData(void) const {
+  return data;
+}
+
+size_t SharedBlock::getSize(void) const {
+  return size;
+}
+
+bool SharedBlock::contains(const void *ptr) const {
+  const char *cptr = (const char*) ptr;
+  return ((cptr >= data) && (cptr < &(data[size])));
+}
+
 NetMessage::NetMessage(void) {
   initVars();
   addIovec(1);
-  freeIov[0] = true;
+  freeIov[0] = ownedBlock();
 }
 
 NetMessage::NetMessage(uint16_t type): type(type)  {
   initVars();
   addIovec(1);
-  freeIov[0] = true;
+  freeIov[0] = ownedBlock();
 }
 
 NetMessage::NetMessage(uint16_t type, char *value, size_t primitiveSize): type(type) {
   initVars();
   addIovec(1);
-  freeIov[0] = true;
+  freeIov[0] = ownedBlock();
   this->primitiveValue = value;
   this->primitiveSize = primitiveSize;
 }
 
+NetMessage::NetMessage(uint16_t type, size_t primitiveSize): type(type) {
+  initVars();
+  addIovec(1);
+  freeIov[0] = ownedBlock();
+  this->primitiveValue = primitiveStorage;
+  this->primitiveSize = primitiveSize;
+}
+
 NetMessage::NetMessage(const NetMessage &net_message) {
   std::vector<NetMessage*>::const_iterator iter;
 
   initVars();
   type = net_message.type;
   dataSize = net_message.dataSize;
+  varint = net_message.varint;
 
   if (net_message.primitiveSize != 0) {
     primitiveSize = net_message.primitiveSize;
-    primitiveValue = (char*) malloc(primitiveSize);
+    primitiveValue = primitiveStorage;
     memcpy(primitiveValue, net_message.primitiveValue, primitiveSize);
   } else {
     addIovec(net_message.iovCount);
@@ -51,10 +103,16 @@ NetMessage::NetMessage(const NetMessage &net_message) {
     for (int i = 0; i<iovCount; ++i) {
       size_t size = net_message.data[i].iov_len;
       data[i].iov_len = size;
-      data[i].iov_base = (char*) malloc(size);
+      // The blocks not freed by the message are given away to the
+      // deserializers, which free or adopt them: they must come from malloc
+      if (net_message.freeIov[i] == IOV_KEEP) {
+        data[i].iov_base = (char*) malloc(size);
+        freeIov[i] = IOV_KEEP;
+      } else {
+        data[i].iov_base = (char*) allocate(size);
+        freeIov[i] = ownedBlock();
+      }
       memcpy(data[i].iov_base, net_message.data[i].iov_base, size);
-      freeIov[i] = net_message.freeIov[i];
-      //std::cout << freeIov[i] << std::endl;
     }
 
     nestedNetMessages.reserve(net_message.nestedNetMessages.size());  
@@ -69,14 +127,15 @@ NetMessage::NetMessage(const NetMessage &net_message) {
 NetMessage::~NetMessage() {
   std::vector<NetMessage*>::iterator iter;
   
-  if (primitiveValue != NULL) free(primitiveValue);
+  if (primitiveValue != primitiveStorage) free(primitiveValue);
   for (int i = 0; i<iovCount; ++i) {
-    if (freeIov[i]) {
+    if (freeIov[i] == IOV_FREE) {
       free(data[i].iov_base);
     }
   }
-  free(data);
-  free(freeIov);
+  release(data);
+  release(freeIov);
+  if (sharedBlock != NULL) sharedBlock->unref();
 
   for (iter = nestedNetMessages.begin(); iter < nestedNetMessages.end(); ++iter) {
     delete *iter;
@@ -84,10 +143,73 @@ NetMessage::~NetMessage() {
   nestedNetMessages.clear();
 }
 
+void *NetMessage::operator new(size_t size) {
+  Arena *arena = Arena::getCurrentArena();
+  char *ptr;
+
+  if (arena != NULL) {
+    ptr = (char*) arena->allocate(size + ARENA_PREFIX_SIZE);
+  } else {
+    ptr = (char*) malloc(size + ARENA_PREFIX_SIZE);
+    if (ptr == NULL) throw std::bad_alloc();
+  }
+  *((Arena**) ptr) = arena;
+
+  return &(ptr[ARENA_PREFIX_SIZE]);
+}
+
+void NetMessage::operator delete(void *ptr) {
+  char *realPtr;
+
+  if (ptr == NULL) return;
+  realPtr = &(((char*) ptr)[-ARENA_PREFIX_SIZE]);
+  // Memory from an arena is released when the arena is reset
+  if (*((Arena**) realPtr) == NULL) {
+    free(realPtr);
+  }
+}
+
+void *NetMessage::allocate(size_t size) {
+  if (arena != NULL) {
+    return arena->allocate(size);
+  } else {
+    return malloc(size);
+  }
+}
+
+void *NetMessage::reallocate(void *ptr, size_t oldSize, size_t newSize) {
+  if (arena != NULL) {
+    return arena->reallocate(ptr, oldSize, newSize);
+  } else {
+    return realloc(ptr, newSize);
+  }
+}
+
+void NetMessage::release(void *ptr) {
+  if (arena == NULL) free(ptr);
+}
+
+char NetMessage::ownedBlock(void) const {
+  return (arena == NULL) ? IOV_FREE : IOV_ARENA;
+}
+
+// The blocks of allocateDataBlock are known without looking into the arena
+char NetMessage::givenBlock(const char *block, bool toFree) const {
+  if (!toFree) return IOV_KEEP;
+  if ((arena != NULL) && ((block == lastDataBlock) || arena->owns(block))) {
+    return IOV_ARENA;
+  }
+  return IOV_FREE;
+}
+
 void NetMessage::initVars(void) {
+  arena = Arena::getCurrentArena();
+  sharedBlock = NULL;
   primitiveValue = NULL;
+  varint = false;
   data = NULL;
   freeIov = NULL;
+  lastDataBlock = NULL;
   iovCount = iovAllocated = primitiveSize = dataSize = 0;
   headersGenerated = false;
 }
@@ -102,21 +224,33 @@ void NetMessage::addIovec(size_t iovcnt) {
 
   if (iovToAllocate > 0) {
     int nbBlockToAllocate = (iovToAllocate / FAST_VECT_BLOCK_SIZE) 
-      + (iovToAllocate % FAST_VECT_BLOCK_SIZE != 0) ? 1 : 0;
+      + ((iovToAllocate % FAST_VECT_BLOCK_SIZE != 0) ? 1 : 0);
 
     oldIovAllocated = iovAllocated;
     newIovAllocated = nbBlockToAllocate * FAST_VECT_BLOCK_SIZE;
     iovAllocated += newIovAllocated;
-    data = (chariovec*) realloc(data, iovAllocated * sizeof(chariovec));
-    freeIov = (bool*) realloc(freeIov, iovAllocated * sizeof(bool));
+    data = (chariovec*) reallocate(data, oldIovAllocated * sizeof(chariovec),
+      iovAllocated * sizeof(chariovec));
+    freeIov = (char*) reallocate(freeIov, oldIovAllocated * sizeof(char),
+      iovAllocated * sizeof(char));
     //ptrIov = (size_t*) realloc(ptrIov, iovAllocated * sizeof(size_t));
     memset(&(data[oldIovAllocated]), 0, newIovAllocated*sizeof(chariovec));
-    memset(&(freeIov[oldIovAllocated]), 0, newIovAllocated*sizeof(bool));
+    memset(&(freeIov[oldIovAllocated]), IOV_KEEP, newIovAllocated*sizeof(char));
     //memset(&(ptrIov[oldIovAllocated]), 0, newIovAllocated*sizeof(size_t));
   }
 }
 
 size_t NetMessage::generateBlockHeader(int type, size_t size, bool toFree, chariovec &iov) {
+  size_t sizeHeaders;
+
+  sizeHeaders = ((type < 0) ? flagsHeader : flagsTypeHeaders) + findRealSize(size);
+  iov.iov_base = (char*) reallocate(iov.iov_base, iov.iov_len, sizeHeaders);
+  iov.iov_len = sizeHeaders;
+
+  return writeBlockHeader(type, size, toFree, iov.iov_base);
+}
+
+size_t NetMessage::writeBlockHeader(int type, size_t size, bool toFree, char *dest) {
   size_t realSize;
   size_t sizeHeaders;
   int index = 0;
@@ -124,67 +258,129 @@ size_t NetMessage::generateBlockHeader(int type, size_t size, bool toFree, chari
 
   realSize = findRealSize(size);
   sizeHeaders = ((type < 0) ? flagsHeader : flagsTypeHeaders) + realSize;
-  iov.iov_len = sizeHeaders;
-  iov.iov_base = (char*) realloc(iov.iov_base, sizeHeaders);
 
   // Flags
-  iov.iov_base[index] = 0;
-  iov.iov_base[index] |= (realSize & 0xF);
-  iov.iov_base[index] |= ((toFree << 6) & 0x40);
-  iov.iov_base[index] |= ((((type < 0) ? 0 : 1) << 5) & 0x20);
-  //std::cout << (void*) (iov.iov_base[index] & (0xFF)) << std::endl;
+  dest[index] = 0;
+  dest[index] |= (realSize & 0xF);
+  dest[index] |= ((toFree << 6) & 0x40);
+  dest[index] |= ((((type < 0) ? 0 : 1) << 5) & 0x20);
   index += flagsHeader;
 
   //Type
   if (type > -1) {
     uint16_t typeCast = type;
-    convertToChars(typeCast, &(iov.iov_base[index]));
+    convertToChars(typeCast, &(dest[index]));
     index += typeHeader;
   }
   
   // Size
-
-  //std::cout << "GenerateblockSize:" << size << std::endl;
-  //std::cout << "RealSize:" << realSize << std::endl;
-
   swap64.uint = size;
-  /*for (int i = 0; i<8; ++i) {
-    std::cout << (void*) swap64.chars[i] << " ";
-  }
-  std::cout << std::endl;*/
   if (isLittleEndian()) {
     for (size_t i = realSize; i > 0; --i) {
-      iov.iov_base[index+i-1] = swap64.chars[realSize-i];
+      dest[index+i-1] = swap64.chars[realSize-i];
     }
   } else {
-    memcpy(&(iov.iov_base[index]), &(swap64.chars[8-realSize]), realSize);
+    memcpy(&(dest[index]), &(swap64.chars[8-realSize]), realSize);
   }
-  /*std::cout << (void*) iov.iov_base[index+1] << std::endl;
-  std::cout << (void*) iov.iov_base[index+2] << std::endl;
-  std::cout << (void*) iov.iov_base[index+3] << std::endl;*/
 
   return sizeHeaders;
 }
     
 size_t NetMessage::generatePrimitiveBlockHeader(chariovec &iov) {
-  int index = 0;
-  int sizeHeaders;
+  size_t sizeHeaders;
   
-  sizeHeaders = flagsHeader + primitiveSize;
+  sizeHeaders = getHeaderSize();
+  iov.iov_base = (char*) reallocate(iov.iov_base, iov.iov_len, sizeHeaders);
   iov.iov_len = sizeHeaders;
-  iov.iov_base = (char*) realloc(iov.iov_base, sizeHeaders);
+
+  return writePrimitiveBlockHeader(iov.iov_base);
+}
+
+size_t NetMessage::writePrimitiveBlockHeader(char *dest) {
+  int index = 0;
 
   // Flags
-  iov.iov_base[index] = 0;
-  iov.iov_base[index] |= (type  & 0xF);
-  iov.iov_base[index] |= ((true << 6) & 0x40);
-  iov.iov_base[index] |= ((true << 5) & 0x22);
+  dest[index] = 0;
+  dest[index] |= (type  & 0xF);
+  dest[index] |= ((true << 6) & 0x40);
+  dest[index] |= ((true << 5) & 0x22);
   index += flagsHeader;
 
   //Primitive value
-  memcpy(&(iov.iov_base[index]), primitiveValue, primitiveSize);
+  if (isVarintPrimitive()) {
+    dest[0] |= 0x80;
+    return flagsHeader + convertToVarint(getVarintValue(), &(dest[index]));
+  }
+  memcpy(&(dest[index]), primitiveValue, primitiveSize);
 
-  return sizeHeaders;
+  return flagsHeader + primitiveSize;
+}
+
+bool NetMessage::isVarintPrimitive(void) const {
+  if (!varint || (primitiveValue == NULL)) return false;
+
+  switch (type) {
+    case INT16_T :
+    case INT32_T :
+    case INT64_T :
+    case UINT16_T :
+    case UINT32_T :
+    case UINT64_T :
+      return true;
+    default :
+      return false;
+  }
+}
+
+uint64_t NetMessage::getVarintValue(void) const {
+  uint64_t value = 0;
+  int shift = 64 - 8 * primitiveSize;
+
+  for (size_t i = 0; i < primitiveSize; ++i) {
+    value = (value << 8) | (uint8_t) primitiveValue[i];
+  }
+  if ((type == INT16_T) || (type == INT32_T) || (type == INT64_T)) {
+    // Sign extension
+    return zigzagEncode(((int64_t) (value << shift)) >> shift);
+  }
+
+  return value;
+}
+
+void NetMessage::setVarintValue(uint64_t value) {
+  int shift = 64 - 8 * primitiveSize;
+
+  if ((type == INT16_T) || (type == INT32_T) || (type == INT64_T)) {
+    int64_t signedValue = zigzagDecode(value);
+    value = (uint64_t) signedValue;
+    if ((((int64_t) (value << shift)) >> shift) != signedValue) {
+      throw Exception(EX_MALFORMED_MESSAGE, "Varint out of range");
+    }
+  } else if ((shift != 0) && ((value >> (64 - shift)) != 0)) {
+    throw Exception(EX_MALFORMED_MESSAGE, "Varint out of range");
+  }
+
+  for (size_t i = primitiveSize; i > 0; --i) {
+    primitiveValue[i - 1] = (char) (value & 0xFF);
+    value >>= 8;
+  }
+}
+
+void NetMessage::setVarintEncoding(bool varint) {
+  std::vector<NetMessage*>::iterator iter;
+
+  this->varint = varint;
+  headersGenerated = false;
+  // Nested sizes are part of dataSize
+  for (iter = nestedNetMessages.begin(); iter != nestedNetMessages.end(); ++iter) {
+    dataSize -= (*iter)->getFlattenedSize();
+    (*iter)->setVarintEncoding(varint);
+    dataSize += (*iter)->getFlattenedSize();
+  }
+}
+
+bool NetMessage::getVarintEncoding(void) const {
+  return varint;
 }
 
 void NetMessage::generateNetMessageHeader(void) {
@@ -196,11 +392,26 @@ void NetMessage::generateNetMessageHeader(void) {
   headersGenerated = true;
 }
 
+size_t NetMessage::getHeaderSize(void) {
+  if (isVarintPrimitive()) {
+    return flagsHeader + getVarintSize(getVarintValue());
+  } else if (primitiveValue != NULL) {
+    return flagsHeader + primitiveSize;
+  } else {
+    return flagsTypeHeaders + findRealSize(dataSize);
+  }
+}
+
 void NetMessage::collectIov(chariovec **iov, int *size) {
   int newSize = *size + iovCount;
   *iov = (chariovec*) realloc(*iov, newSize * sizeof(chariovec));
   std::vector<NetMessage*>::iterator iter;
   
+  // Nested headers are only generated when the message is collected
+  if (!headersGenerated) {
+    generateNetMessageHeader();
+  }
+
   for (int i = 0; i<iovCount; ++i) {
     (*iov)[*size+i] = data[i];
   }
@@ -230,10 +441,7 @@ uint16_t NetMessage::getType(void) const {
 
 uint32_t NetMessage::getDataSize(bool withHeaders){
   if (withHeaders) {
-    if (!headersGenerated) {
-      generateNetMessageHeader();
-    }
-    return dataSize + data[0].iov_len;
+    return dataSize + getHeaderSize();
   } else {
     return dataSize;
   }
@@ -242,14 +450,75 @@ uint32_t NetMessage::getDataSize(bool withHeaders){
 chariovec *NetMessage::getData(int *iovcnt){
   chariovec *iov = NULL;
    
-  if (!headersGenerated) {
-    generateNetMessageHeader();
-  }
   *iovcnt = 0;
   collectIov(&iov, iovcnt);
   return iov;
 }
 
+size_t NetMessage::getFlattenedSize(void) {
+  return dataSize + getHeaderSize();
+}
+
+size_t NetMessage::flatten(char *buffer) {
+  std::vector<NetMessage*>::iterator iter;
+  size_t offset;
+
+  if (primitiveValue != NULL) {
+    offset = writePrimitiveBlockHeader(buffer);
+  } else {
+    offset = writeBlockHeader((int) type, dataSize, false, buffer);
+  }
+
+  // data[0] is the NetMessage header, already written above
+  for (int i = 1; i<iovCount; ++i) {
+    memcpy(&(buffer[offset]), data[i].iov_base, data[i].iov_len);
+    offset += data[i].iov_len;
+  }
+
+  for (iter = nestedNetMessages.begin(); iter != nestedNetMessages.end(); ++iter) {
+    offset += (*iter)->flatten(&(buffer[offset]));
+  }
+
+  return offset;
+}
+
+void NetMessage::flatten(NetMessageSink &sink) {
+  std::vector<NetMessage*>::iterator iter;
+  char header[NET_MESSAGE_MAX_HEADER_SIZE];
+  size_t headerSize;
+
+  if (primitiveValue != NULL) {
+    headerSize = writePrimitiveBlockHeader(header);
+  } else {
+    headerSize = writeBlockHeader((int) type, dataSize, false, header);
+  }
+  sink.write(header, headerSize);
+
+  for (int i = 1; i<iovCount; ++i) {
+    sink.write(data[i].iov_base, data[i].iov_len);
+  }
+
+  for (iter = nestedNetMessages.begin(); iter != nestedNetMessages.end(); ++iter) {
+    (*iter)->flatten(sink);
+  }
+}
+
+size_t NetMessage::writeMessageHeader(uint16_t type, size_t dataSize, char *dest) {
+  return writeBlockHeader((int) type, dataSize, false, dest);
+}
+
+size_t NetMessage::writeDataBlockHeader(size_t size, bool toFree, char *dest) {
+  return writeBlockHeader(-1, size, toFree, dest);
+}
+
+size_t NetMessage::getMessageHeaderSize(size_t dataSize) {
+  return flagsTypeHeaders + findRealSize(dataSize);
+}
+
+size_t NetMessage::getDataBlockHeaderSize(size_t size) {
+  return flagsHeader + findRealSize(size);
+}
+
 chariovec *NetMessage::getDataBlocks(int *iovcnt) const {
   //std::cout << "IovCount:" << iovCount << std::endl;
   int iovcntVar = (iovCount-1) / 2;
@@ -276,8 +545,30 @@ const char *NetMessage::getPrimitiveValue(void) const {
   return primitiveValue;
 }
 
+char *NetMessage::getPrimitiveBuffer(void) {
+  return primitiveValue;
+}
+
+SharedBlock *NetMessage::getSharedBlock(void) const {
+  return sharedBlock;
+}
+
+void NetMessage::setSharedBlock(SharedBlock *block) {
+  if (block != NULL) block->ref();
+  if (sharedBlock != NULL) sharedBlock->unref();
+  sharedBlock = block;
+}
+
+char *NetMessage::allocateDataBlock(size_t size) {
+  char *block = (char*) allocate(size);
+
+  if (block == NULL) throw std::bad_alloc();
+  lastDataBlock = block;
+  return block;
+}
+
 void NetMessage::addMessage(NetMessage *message) {
-  dataSize += message->getDataSize(true);
+  dataSize += message->getFlattenedSize();
   
   if (nestedNetMessages.capacity() == nestedNetMessages.size()) {
     nestedNetMessages.reserve(nestedNetMessages.size() + FAST_VECT_BLOCK_SIZE);
@@ -299,7 +590,7 @@ int NetMessage::addDataBlock(char *newData, size_t size, bool toFree,
     addIovec(2);
     sizeHeaders = generateBlockHeader(-1, size, toFree, data[oldIovCount]);
     dataSize += (size + sizeHeaders);
-    freeIov[oldIovCount] = true;
+    freeIov[oldIovCount] = ownedBlock();
     ++oldIovCount;
   } else {
     addIovec(1);
@@ -308,7 +599,7 @@ int NetMessage::addDataBlock(char *newData, size_t size, bool toFree,
 
   data[oldIovCount].iov_base = newData;
   data[oldIovCount].iov_len  = size;
-  freeIov[oldIovCount] = toFree;
+  freeIov[oldIovCount] = givenBlock(newData, toFree);
   
   headersGenerated = false;
 
@@ -372,11 +663,24 @@ NetMessage *NetMessage::parseFlags(const char *buff, size_t *nextSize,
   if (isNetMessage) {
     if (specialFlag) {
       //Primitive type
+      if ((*nextSize == NONE) || (*nextSize >= NB_PRIMITVE_TYPES)) {
+        throw Exception(EX_MALFORMED_MESSAGE, "Unknown primitive type");
+      }
       netMessage = new NetMessage();
       netMessage->primitiveSize = primitiveSizeArray[*nextSize];
       netMessage->type = *nextSize;
-      *nextSize = netMessage->primitiveSize;
-      netMessage->primitiveValue = (char*) malloc(netMessage->primitiveSize);
+      netMessage->primitiveValue = netMessage->primitiveStorage;
+      netMessage->varint = ((0x80 & buff[0]) != 0);
+      if (netMessage->varint) {
+        if (!netMessage->isVarintPrimitive()) {
+          delete netMessage;
+          throw Exception(EX_MALFORMED_MESSAGE, "Varint flag on a non integer value");
+        }
+        // At least one byte. The following ones are found by the caller.
+        *nextSize = 1;
+      } else {
+        *nextSize = netMessage->primitiveSize;
+      }
     } else {
       // Normal NetMessage
       *nextSize += typeHeader;
@@ -405,9 +709,9 @@ NetMessage *NetMessage::parseFlags(const char *buff, size_t *nextSize,
 
   len = flagsHeader + *nextSize;
   netMessage->data[iovIndex].iov_len = len;
-  netMessage->data[iovIndex].iov_base = (char*) malloc(len);
+  netMessage->data[iovIndex].iov_base = (char*) netMessage->allocate(len);
   memcpy(netMessage->data[iovIndex].iov_base, buff, flagsHeader);
-  netMessage->freeIov[iovIndex] = true;
+  netMessage->freeIov[iovIndex] = netMessage->ownedBlock();
 
   return returnNetMessage;
 }
@@ -416,12 +720,27 @@ void NetMessage::parseTypeSize(const char *buff, bool withType, size_t size,
   size_t *blockSize) {
   int index = 0;
   swap_64 swap64;
+  chariovec &header = data[iovCount-1];
   
-  memcpy(&(data[iovCount-1].iov_base[flagsHeader]), buff, size);
+  // Varints are longer than announced by parseFlags
+  if (header.iov_len < flagsHeader + size) {
+    header.iov_base = (char*) reallocate(header.iov_base, header.iov_len,
+      flagsHeader + size);
+    header.iov_len = flagsHeader + size;
+  }
+  memcpy(&(header.iov_base[flagsHeader]), buff, size);
   
   
   if (primitiveSize != 0) {
-    memcpy(primitiveValue, buff, size);
+    if (varint) {
+      uint64_t value;
+      if (convertFromVarint(buff, size, &value) != size) {
+        throw Exception(EX_MALFORMED_MESSAGE, "Malformed varint");
+      }
+      setVarintValue(value);
+    } else {
+      memcpy(primitiveValue, buff, size);
+    }
     *blockSize = 0;
   } else {
     // Type
@@ -449,11 +768,68 @@ void NetMessage::parseTypeSize(const char *buff, bool withType, size_t size,
   }
 }
 
+void NetMessage::parseContent(const char *buff, size_t size) {
+  size_t index = 0;
+
+  while (index < size) {
+    NetMessage *child;
+    size_t nextSize;
+    size_t blockSize;
+    bool toFree;
+
+    child = parseFlags(&(buff[index]), &nextSize, &toFree);
+    index += flagsHeader;
+    if ((child != NULL) && child->varint) {
+      while ((nextSize < size - index) && (nextSize < VARINT_MAX_SIZE)
+        && (buff[index + nextSize - 1] & 0x80)) {
+        ++nextSize;
+      }
+    }
+    if (nextSize > size - index) {
+      if (child != NULL) delete child;
+      throw Exception(EX_MALFORMED_MESSAGE, "Truncated NetMessage header");
+    }
+
+    if (child == NULL) {
+      // The sender ownership flag does not matter: the block is a view
+      parseTypeSize(&(buff[index]), false, nextSize, &blockSize);
+    } else {
+      try {
+        child->parseTypeSize(&(buff[index]), true, nextSize, &blockSize);
+      } catch (Exception &e) {
+        delete child;
+        throw e;
+      }
+    }
+    index += nextSize;
+    if (blockSize > size - index) {
+      if (child != NULL) delete child;
+      throw Exception(EX_MALFORMED_MESSAGE, "Truncated NetMessage content");
+    }
+
+    if (child != NULL) {
+      addMessage(child);
+      child->setSharedBlock(sharedBlock);
+      if (blockSize != 0) {
+        child->parseContent(&(buff[index]), blockSize);
+      }
+    } else {
+      addDataBlock((char*) &(buff[index]), blockSize, false, false);
+    }
+    index += blockSize;
+  }
+}
+
 void NetMessage::deleteAllData(void) {
   std::vector<NetMessage*>::iterator iter;
 
+  // The blocks kept by their owner are freed too, but those of the shared
+  // block
   for (int i = 0; i<iovCount; ++i) {
-    free(data[i].iov_base);
+    if ((freeIov[i] == IOV_FREE) || ((freeIov[i] == IOV_KEEP)
+      && ((sharedBlock == NULL) || !sharedBlock->contains(data[i].iov_base)))) {
+      free(data[i].iov_base);
+    }
   }
   iovCount = 0;
 
@@ -15,14 +15,73 @@
 #include <string.h>
 #include <vector>
 
+class Arena;
+
 #define UDP_PACKET_MAX_SIZE 65535
 #define ETHER_IP_HEADERS 42 //ahem!
+// Flags, type and size, or flags and a varint primitive value
+#define NET_MESSAGE_MAX_HEADER_SIZE 11
 
 typedef  struct {
   char  *iov_base;    /* Starting address */
   size_t iov_len;     /* Number of bytes to transfer */
 } chariovec;
 
+//! \class SharedBlock libcomm/net_message.h
+//! \brief Reference counted block of memory
+//!
+//! A SharedBlock holds a received message when it is parsed without copy
+//! (see InputStream::setZeroCopyParsing). The NetMessages parsed from it, and
+//! the objects deserialized from them, reference its memory instead of owning
+//! copies. The block is freed when the last reference is released.
+class SharedBlock {
+  private:
+    char *data;
+    size_t size;
+    int refCount;
+
+    SharedBlock(const SharedBlock &block);
+    SharedBlock &operator=(const SharedBlock &block);
+    ~SharedBlock(void);
+
+  public:
+    //! \brief SharedBlock constructor
+    //! \param[in] size the size of the block
+    //!
+    //! Allocates a new block of size bytes, with a reference count of one.
+    SharedBlock(size_t size);
+
+    //! \brief Takes a reference on the block
+    void ref(void);
+
+    //! \brief Releases a reference on the block
+    //!
+    //! Deletes the block when no reference is left.
+    void unref(void);
+
+    char *getData(void) const;
+    size_t getSize(void) const;
+
+    //! \brief Checks if memory is inside the block
+    //! \param[in] ptr the memory
+    //! \return true if ptr points inside the block
+    bool contains(const void *ptr) const;
+};
+
+//! \class NetMessageSink libcomm/net_message.h
+//! \brief Destination of a NetMessage written by pieces
+//!
+//! See NetMessage::flatten(NetMessageSink&).
+class NetMessageSink {
+  public:
+    virtual ~NetMessageSink(void) {}
+
+    //! \brief Writes the next piece of the NetMessage
+    //! \param[in] data the bytes
+    //! \param[in] size the number of bytes
+    virtual void write(const char *data, size_t size) = 0;
+};
+
 //! \class NetMessage libcomm/net_message.h
 //! \brief Network message container
 //!
@@ -51,23 +110,35 @@ typedef  struct {
 //!   6: Same as 5                                 _|
 //!
 //! Flags has the three weak bits used to determine the size of the 
-//! size header
+//! size header. For primitive values, the high bit tells that the value is
+//! a varint (see setVarintEncoding).
 class NetMessage {
   
   private :
     uint16_t type;
     size_t dataSize;
     
+    // Arena the internal memory comes from, or NULL for the heap
+    Arena *arena;
+    // Block the data blocks are views into, or NULL if they are owned
+    SharedBlock *sharedBlock;
+
     // Content for primitive type
     char *primitiveValue;
     size_t primitiveSize;
+    // Storage for primitiveValue, when owned by the NetMessage
+    char primitiveStorage[8];
+    // Send integer primitive values as varints
+    bool varint;
 
     // Data blocks
     chariovec *data;
     int iovCount;
     int iovAllocated;
-    // Should data block bee freed?
-    bool *freeIov;
+    // Who releases each data block: its owner, the NetMessage or the arena
+    char *freeIov;
+    // Last block given by allocateDataBlock, to be added with toFree
+    char *lastDataBlock;
     //size_t *ptrIov;
     
     // Nested NetMessages
@@ -78,13 +149,30 @@ class NetMessage {
     // Init NetMessages variables to NULL,0,false
     void initVars(); 
     // Find the size needed to represent the value of var
-    size_t findRealSize(size_t var);
+    static size_t findRealSize(size_t var);
     // Prepare data and freeIov to add iovcnt elements.
     void addIovec(size_t iovcnt);
+    // Internal memory management: from the arena if any, from the heap
+    // otherwise. release frees heap memory only.
+    void *allocate(size_t size);
+    void *reallocate(void *ptr, size_t oldSize, size_t newSize);
+    void release(void *ptr);
+    char ownedBlock(void) const;
+    char givenBlock(const char *block, bool toFree) const;
       
     // If type < 0, dataBlock, otherwise, NetMessage
     size_t generateBlockHeader(int type, size_t size, bool toFree, chariovec &iov);
     size_t generatePrimitiveBlockHeader(chariovec &iov);
+    // Same as above, but write the headers to dest, which must be large enough
+    static size_t writeBlockHeader(int type, size_t size, bool toFree, char *dest);
+    size_t writePrimitiveBlockHeader(char *dest);
+    // Size of the NetMessage headers, computed without generating them
+    size_t getHeaderSize(void);
+    // True if the primitive value is sent as a varint
+    bool isVarintPrimitive(void) const;
+    // Primitive value as the integer sent in the varint, and back
+    uint64_t getVarintValue(void) const;
+    void setVarintValue(uint64_t value);
     // Call generateBlockHeader and set headersGenerated to true
     void generateNetMessageHeader(void);
     
@@ -114,6 +202,14 @@ class NetMessage {
     //! Creates a new NetMessage for a primitive type .
     NetMessage(uint16_t type, char *value, size_t primitiveSize);
 
+    //! \brief NetMessage constructor for primitive type
+    //! \param[in] type the type of the primitive type
+    //! \param[in] primitiveSize the size of the primitive value, in bytes
+    //!
+    //! Creates a new NetMessage for a primitive type. The value is stored in
+    //! the NetMessage itself and has to be written with getPrimitiveBuffer.
+    NetMessage(uint16_t type, size_t primitiveSize);
+
     //! \brief NetMessage copy constructor
     //! \param[in] the constructor 
     //!
@@ -126,6 +222,10 @@ class NetMessage {
     //! NetMessages 
     ~NetMessage(void);
 
+    // NetMessages created while an arena is current are allocated from it
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr);
+
     //! \brief Gets the type
     //! \return the type
     //!
@@ -150,6 +250,62 @@ class NetMessage {
     //! get the raw data to transfer on a stream. Note that the list must be
     //! freed with free.
     chariovec *getData(int *iovcnt);
+
+    //! \brief Gets the size of the flattened NetMessage
+    //! \return the size, in bytes
+    //!
+    //! Returns the total number of bytes, headers included, of this NetMessage
+    //! and its nested NetMessages. It is the size of the buffer needed by
+    //! flatten. The size is computed without generating any header.
+    size_t getFlattenedSize(void);
+
+    //! \brief Writes the NetMessage into a contiguous buffer
+    //! \param[out] buffer the destination, at least getFlattenedSize() bytes
+    //! \return the number of bytes written
+    //!
+    //! Writes the headers and the data of this NetMessage and of its nested
+    //! NetMessages into buffer, in the same order as getData. The result can be
+    //! sent with a single write call.
+    size_t flatten(char *buffer);
+
+    //! \brief Writes the NetMessage by pieces
+    //! \param[in] sink the destination
+    //!
+    //! Same as flatten(char*), but the headers and the data blocks are given
+    //! to sink one after the other instead of being gathered in a buffer.
+    void flatten(NetMessageSink &sink);
+
+    //! \brief Writes the headers of a NetMessage
+    //! \param[in] type the type of the NetMessage
+    //! \param[in] dataSize the size of its content
+    //! \param[out] dest the destination, at least NET_MESSAGE_MAX_HEADER_SIZE
+    //! bytes
+    //! \return the number of bytes written
+    //!
+    //! Writes the headers flatten would write for a NetMessage of the given
+    //! type and content size. With writeDataBlockHeader, it lets an object
+    //! be flattened without building its NetMessage (see
+    //! Serializable::serializeTo): its content must follow, data blocks first.
+    static size_t writeMessageHeader(uint16_t type, size_t dataSize, char *dest);
+
+    //! \brief Writes the header of a data block
+    //! \param[in] size the size of the block
+    //! \param[in] toFree the toFree flag the block would be added with (see
+    //! addDataBlock)
+    //! \param[out] dest the destination, at least NET_MESSAGE_MAX_HEADER_SIZE
+    //! bytes
+    //! \return the number of bytes written
+    static size_t writeDataBlockHeader(size_t size, bool toFree, char *dest);
+
+    //! \brief Gets the size of the headers of a NetMessage
+    //! \param[in] dataSize the size of its content
+    //! \return the size written by writeMessageHeader
+    static size_t getMessageHeaderSize(size_t dataSize);
+
+    //! \brief Gets the size of the header of a data block
+    //! \param[in] size the size of the block
+    //! \return the size written by writeDataBlockHeader
+    static size_t getDataBlockHeaderSize(size_t size);
     
     //! \brief Gets data block of the NetMessage
     //! \param[out] iovcnt The number of buffers
@@ -173,6 +329,54 @@ class NetMessage {
     //! Returns a pointer to the primitive value of this NetMessage.
     const char *getPrimitiveValue(void) const;
 
+    //! \brief Gets the buffer holding the primitive value
+    //! \return the buffer
+    //!
+    //! Returns the buffer where the primitive value of a NetMessage created
+    //! with NetMessage(uint16_t type, size_t primitiveSize) has to be written.
+    char *getPrimitiveBuffer(void);
+
+    //! \brief Allocates memory for a data block
+    //! \param[in] size the size of the block
+    //! \return the memory
+    //!
+    //! Returns memory with the same lifetime as the NetMessage. It must be
+    //! given to addDataBlock with toFree set to true, and must not be freed.
+    //! When the NetMessage is built inside an arena (see ArenaScope), the
+    //! memory comes from that arena.
+    char *allocateDataBlock(size_t size);
+
+    //! \brief Gets the shared block
+    //! \return the block, or NULL
+    //!
+    //! Returns the SharedBlock the data blocks of this NetMessage point into
+    //! when it has been parsed without copy, NULL otherwise. When not NULL, the
+    //! data blocks are not owned by the NetMessage and must not be freed nor
+    //! adopted: take a reference on the block to keep using them.
+    SharedBlock *getSharedBlock(void) const;
+
+    // Set the block the data blocks will point into. Takes a reference.
+    void setSharedBlock(SharedBlock *block);
+
+    //! \brief Sets the encoding of integer primitive values
+    //! \param[in] varint true to send them as varints
+    //!
+    //! When set, the 16, 32 and 64 bits integer primitive values of this
+    //! NetMessage and of its nested NetMessages are sent as LEB128 varints
+    //! (zigzag encoded for signed types) instead of fixed size big endian
+    //! values. Small values then take one or two bytes. The flags byte of each
+    //! such value has its high bit set, so receivers decode both encodings
+    //! without any setting. Primitive fields packed by AutoSerializable are
+    //! not concerned (see AUTO_SER_VARINT_FIELD).
+    void setVarintEncoding(bool varint);
+
+    //! \brief Gets the encoding of integer primitive values
+    //! \return true if they are sent as varints
+    //!
+    //! For a received primitive NetMessage, tells if it has been received as
+    //! a varint.
+    bool getVarintEncoding(void) const;
+
     
     // Delete all the data containing in this NetMessage, even those which 
     // correspoing freeIov bool is false.
@@ -219,6 +423,9 @@ class NetMessage {
     // Parse the the remaining headers. If NetMessage, withType is true. blockSize
     // is filled with the size of the block.
     void parseTypeSize(const char *buff, bool withType, size_t sizeSize, size_t *blockSize);
+    // Parse the content of the NetMessage from buff, which must be inside the
+    // shared block. Data blocks and nested NetMessages reference buff.
+    void parseContent(const char *buff, size_t size);
 
 };
 
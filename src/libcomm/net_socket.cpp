@@ -15,6 +15,7 @@
 #include "udp_socket.h"
 #include "serialization_manager.h"
 #include "types_utils.h"
+#include "async_event_loop.h"
 
 
 NetSocket::NetSocket(void) {}
@@ -160,7 +161,8 @@ int NetSocket::IntegerOption::getIntegerValue() {
 }
 
 const int NetSocket::BooleanOption::names[] = 
-  {SO_DEBUG, SO_BROADCAST, SO_REUSEADDR, SO_KEEPALIVE, SO_OOBINLINE, SO_DONTROUTE};
+  {SO_DEBUG, SO_BROADCAST, SO_REUSEADDR, SO_KEEPALIVE, SO_OOBINLINE, SO_DONTROUTE,
+   SO_REUSEPORT};
 
 NetSocket::BooleanOption::BooleanOption(BooleanOption::Name name, bool value) 
   : NetSocket::IntOption(names[name], (value) ? 1 : 0) {
@@ -276,6 +278,33 @@ void IONetSocket::connectSocket(const NetAddress &address, time_t sec, long nano
   }
 }
 
+void IONetSocket::asyncConnect(AsyncEventLoop &loop, const NetAddress &address,
+  AsyncCallback *callback) {
+  loop.connect(this, address, callback);
+}
+
+void IONetSocket::asyncReadObject(AsyncEventLoop &loop, AsyncCallback *callback) {
+  loop.read(this, AsyncResult::READ_OBJECT, 0, callback);
+}
+
+void IONetSocket::asyncReadString(AsyncEventLoop &loop, AsyncCallback *callback) {
+  loop.read(this, AsyncResult::READ_STRING, 0, callback);
+}
+
+void IONetSocket::asyncReadBytes(AsyncEventLoop &loop, size_t size,
+  AsyncCallback *callback) {
+  loop.read(this, AsyncResult::READ_BYTES, size, callback);
+}
+
+void IONetSocket::asyncWriteObject(AsyncEventLoop &loop, const Serializable &object,
+  AsyncCallback *callback) {
+  size_t size;
+  char *data;
+
+  data = flattenObject(object, &size);
+  loop.writeObject(this, data, size, NULL, callback);
+}
+
 NetAddress IONetSocket::getDistantAddress() const {
   struct sockaddr_in distAddr;
   socklen_t size;
@@ -10,6 +10,9 @@
 #include "input_stream.h"
 #include "output_stream.h"
 
+class AsyncEventLoop;
+class AsyncCallback;
+
 class NetSocket {
   protected :
     
@@ -22,6 +25,7 @@ class NetSocket {
     virtual int getSocketId(void) const = 0;
 
     friend class NetAddress;
+    friend class AsyncEventLoop;
   public :
     
     NetAddress getLocalAddress() const;
@@ -78,7 +82,8 @@ class NetSocket {
           reuseAddrOpt,
           keepAliveOpt,
           oobInlineOpt,
-          dontRouteOpt
+          dontRouteOpt,
+          reusePortOpt
         };
         bool getBooleanValue();
         BooleanOption(BooleanOption::Name name, bool value);
@@ -111,6 +116,39 @@ class IONetSocket: public NetSocket, public BufferedInputStream, public OutputSt
     void connectSocket(const NetAddress &address, uint64_t nanosec);
     void connectSocket(const NetAddress &address, time_t sec, long nanosec);
 
+    //! \brief Connects the socket without blocking
+    //! \param[in] loop the loop driving the operation
+    //! \param[in] address the address to connect to
+    //! \param[in] callback called when connected or on error
+    void asyncConnect(AsyncEventLoop &loop, const NetAddress &address,
+      AsyncCallback *callback);
+
+    //! \brief Reads an object without blocking
+    //! \param[in] loop the loop driving the operation
+    //! \param[in] callback called with the object, and its sender for
+    //!            datagram sockets
+    void asyncReadObject(AsyncEventLoop &loop, AsyncCallback *callback);
+
+    //! \brief Reads a string ended by CRLF without blocking
+    //! \param[in] loop the loop driving the operation
+    //! \param[in] callback called with the String, without its CRLF
+    void asyncReadString(AsyncEventLoop &loop, AsyncCallback *callback);
+
+    //! \brief Reads bytes without blocking
+    //! \param[in] loop the loop driving the operation
+    //! \param[in] size the maximum number of bytes
+    //! \param[in] callback called with a Buffer<char> of the bytes available,
+    //!            as soon as there is one
+    void asyncReadBytes(AsyncEventLoop &loop, size_t size, AsyncCallback *callback);
+
+    //! \brief Writes an object without blocking
+    //! \param[in] loop the loop driving the operation
+    //! \param[in] object the object, which is serialized at once and can be
+    //!            deleted on return
+    //! \param[in] callback called when the object has been written
+    void asyncWriteObject(AsyncEventLoop &loop, const Serializable &object,
+      AsyncCallback *callback);
+
     NetAddress getDistantAddress() const;
 };
 
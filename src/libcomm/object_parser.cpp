@@ -0,0 +1,230 @@
+#include "object_parser.h"
+#include "input_stream.h"
+#include "serialization_manager.h"
+#include "arena.h"
+
+#include <new>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Flags, then a 2 bytes type and up to 8 bytes of size
+#define TYPE_HEADER_SIZE 2
+#define MAX_SIZE_HEADER_SIZE 8
+
+ObjectParser::ObjectParser(size_t maxMessageSize): state(STATE_FLAGS),
+  headerSize(NetMessage::getFlagsHeaderSize()), headerReceived(0),
+  block(NULL), contentSize(0), contentReceived(0),
+  maxMessageSize(maxMessageSize), readBuffer(NULL) {
+}
+
+ObjectParser::~ObjectParser(void) {
+  reset();
+  free(readBuffer);
+}
+
+void ObjectParser::parseFlags(void) {
+  size_t sizeSize = header[0] & 0xF;
+
+  // Only objects are sent at the top level, never data blocks or primitives
+  if (((header[0] & 0xE0) != 0x20) || (sizeSize > MAX_SIZE_HEADER_SIZE)) {
+    throw Exception(EX_MALFORMED_MESSAGE, "Malformed object header");
+  }
+  headerSize = NetMessage::getFlagsHeaderSize() + TYPE_HEADER_SIZE + sizeSize;
+  state = STATE_TYPE_SIZE;
+}
+
+void ObjectParser::parseTypeSize(void) {
+  size_t index = NetMessage::getFlagsHeaderSize() + TYPE_HEADER_SIZE;
+
+  contentSize = 0;
+  for (; index < headerSize; ++index) {
+    contentSize = (contentSize << 8) | (uint8_t) header[index];
+  }
+  if (contentSize > maxMessageSize) {
+    throw Exception(EX_MALFORMED_MESSAGE, "Message too big");
+  }
+
+  block = new SharedBlock(contentSize);
+  contentReceived = 0;
+  state = STATE_CONTENT;
+}
+
+void ObjectParser::parseMessage(void) {
+  NetMessage *netMessage;
+  SharedBlock *messageBlock = block;
+  SerializationManager *serManager;
+  void *object;
+  size_t nextSize;
+  size_t blockSize;
+  ArenaScope arenaScope(Arena::getThreadArena());
+
+  block = NULL;
+  state = STATE_FLAGS;
+  headerSize = NetMessage::getFlagsHeaderSize();
+  headerReceived = 0;
+
+  netMessage = new NetMessage();
+  netMessage->setSharedBlock(messageBlock);
+  messageBlock->unref();
+  try {
+    netMessage->parseFlags(header, &nextSize, NULL);
+    netMessage->parseTypeSize(&(header[NetMessage::getFlagsHeaderSize()]),
+      true, nextSize, &blockSize);
+    netMessage->parseContent(messageBlock->getData(), blockSize);
+  } catch (Exception &e) {
+    netMessage->deleteAllData();
+    delete netMessage;
+    throw e;
+  }
+
+  serManager = SerializationManager::getSerializationManager();
+  object = serManager->deserialize(*netMessage, false);
+
+  if (object == NULL) netMessage->deleteAllData();
+  delete netMessage;
+
+  // Objects of unknown types are dropped, as readObject would return NULL
+  if (object != NULL) {
+    objects.push_back((Serializable*) object);
+  }
+}
+
+size_t ObjectParser::feed2(const char *data, size_t size, bool untilObject) {
+  size_t consumed = 0;
+
+  while (consumed < size) {
+    size_t toCopy;
+    bool parsed = false;
+
+    if (state == STATE_CONTENT) {
+      toCopy = contentSize - contentReceived;
+      if (toCopy > size - consumed) toCopy = size - consumed;
+      memcpy(&(block->getData()[contentReceived]), &(data[consumed]), toCopy);
+      contentReceived += toCopy;
+    } else {
+      toCopy = headerSize - headerReceived;
+      if (toCopy > size - consumed) toCopy = size - consumed;
+      memcpy(&(header[headerReceived]), &(data[consumed]), toCopy);
+      headerReceived += toCopy;
+
+      if (headerReceived == headerSize) {
+        if (state == STATE_FLAGS) {
+          parseFlags();
+        } else {
+          parseTypeSize();
+        }
+      }
+    }
+
+    if ((state == STATE_CONTENT) && (contentReceived == contentSize)) {
+      parseMessage();
+      parsed = true;
+    }
+    consumed += toCopy;
+    if (parsed && untilObject) break;
+  }
+
+  return consumed;
+}
+
+size_t ObjectParser::feed(const char *data, size_t size) {
+  feed2(data, size, false);
+
+  return objects.size();
+}
+
+size_t ObjectParser::feedUntilObject(const char *data, size_t size) {
+  return feed2(data, size, true);
+}
+
+size_t ObjectParser::readFrom(int fd) {
+  size_t totalRead = 0;
+
+  for (;;) {
+    char *dest;
+    size_t size;
+    ssize_t sizeRead;
+
+    // Big contents go straight into their block, the rest is read by chunks
+    if ((state == STATE_CONTENT)
+      && (contentSize - contentReceived >= OBJECT_PARSER_READ_SIZE)) {
+      dest = &(block->getData()[contentReceived]);
+      size = contentSize - contentReceived;
+    } else {
+      if (readBuffer == NULL) {
+        readBuffer = (char*) malloc(OBJECT_PARSER_READ_SIZE);
+        if (readBuffer == NULL) throw std::bad_alloc();
+      }
+      dest = readBuffer;
+      size = OBJECT_PARSER_READ_SIZE;
+    }
+
+    sizeRead = read(fd, dest, size);
+    if (sizeRead == -1) {
+      if (errno == EINTR) continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+      throw InputStream::InputStreamException(errno);
+    }
+    if (sizeRead == 0) {
+      if (totalRead == 0) {
+        throw InputStream::InputStreamException(EX_STREAM_CLOSED, "Stream has been closed.");
+      }
+      break;
+    }
+    totalRead += sizeRead;
+
+    if (dest == readBuffer) {
+      feed(readBuffer, sizeRead);
+    } else {
+      contentReceived += sizeRead;
+      if (contentReceived == contentSize) parseMessage();
+    }
+    if ((size_t) sizeRead < size) break;
+  }
+
+  return totalRead;
+}
+
+bool ObjectParser::hasObject(void) const {
+  return !objects.empty();
+}
+
+Serializable *ObjectParser::nextObject(void) {
+  Serializable *object;
+
+  if (objects.empty()) return NULL;
+  object = objects.front();
+  objects.pop_front();
+
+  return object;
+}
+
+bool ObjectParser::isParsing(void) const {
+  return (state != STATE_FLAGS) || (headerReceived != 0);
+}
+
+void ObjectParser::reset(void) {
+  while (!objects.empty()) {
+    delete objects.front();
+    objects.pop_front();
+  }
+  if (block != NULL) {
+    block->unref();
+    block = NULL;
+  }
+  state = STATE_FLAGS;
+  headerSize = NetMessage::getFlagsHeaderSize();
+  headerReceived = 0;
+  contentSize = 0;
+  contentReceived = 0;
+}
+
+size_t ObjectParser::getMaxMessageSize(void) const {
+  return maxMessageSize;
+}
+
+void ObjectParser::setMaxMessageSize(size_t size) {
+  maxMessageSize = size;
+}
@@ -0,0 +1,122 @@
+//! \file object_parser.h
+//! \brief Resumable object parser
+//!
+//! File containing the declarations of the class ObjectParser.
+
+#ifndef OBJECT_PARSER_H
+#define OBJECT_PARSER_H
+
+#include <deque>
+#include <sys/types.h>
+
+#include "net_message.h"
+#include "serializable.h"
+
+#define OBJECT_PARSER_DEFAULT_MAX_MESSAGE_SIZE (64 * 1024 * 1024)
+#define OBJECT_PARSER_READ_SIZE 65536
+
+//! \class ObjectParser libcomm/object_parser.h
+//! \brief Builds objects from a byte stream received by pieces
+//!
+//! InputStream::readObject blocks until a whole object has been received. An
+//! ObjectParser instead keeps its state between calls: bytes are given as
+//! they arrive, in pieces of any size, and complete objects are queued as
+//! soon as their last byte is fed. It suits non blocking file descriptors
+//! (O_NONBLOCK), where a read may return any part of a message.
+//!
+//! Messages are parsed without copy (see InputStream::setZeroCopyParsing):
+//! each message is gathered into a SharedBlock which the deserialized objects
+//! may reference.
+//! After an exception, the stream is out of sync and the parser must be
+//! reset before being used again.
+class ObjectParser {
+  private:
+    enum State {
+      STATE_FLAGS,
+      STATE_TYPE_SIZE,
+      STATE_CONTENT
+    };
+
+    State state;
+    char header[NET_MESSAGE_MAX_HEADER_SIZE];
+    size_t headerSize;
+    size_t headerReceived;
+    SharedBlock *block;
+    size_t contentSize;
+    size_t contentReceived;
+    size_t maxMessageSize;
+    char *readBuffer;
+    std::deque<Serializable*> objects;
+
+    ObjectParser(const ObjectParser &parser);
+    ObjectParser &operator=(const ObjectParser &parser);
+
+    void parseFlags(void);
+    void parseTypeSize(void);
+    void parseMessage(void);
+    size_t feed2(const char *data, size_t size, bool untilObject);
+
+  public:
+    //! \brief ObjectParser constructor
+    //! \param[in] maxMessageSize the biggest message accepted, in bytes
+    //!
+    //! The size of each message is checked against maxMessageSize before any
+    //! memory is allocated for it, so that a peer can not make the parser
+    //! allocate arbitrary amounts of memory.
+    ObjectParser(size_t maxMessageSize = OBJECT_PARSER_DEFAULT_MAX_MESSAGE_SIZE);
+
+    //! \brief ObjectParser destructor
+    //!
+    //! Deletes the objects which have not been taken.
+    ~ObjectParser(void);
+
+    //! \brief Gives received bytes to the parser
+    //! \param[in] data the bytes
+    //! \param[in] size the number of bytes
+    //! \return the number of objects now available
+    //!
+    //! Throws an Exception with the code EX_MALFORMED_MESSAGE if the bytes do
+    //! not form valid messages.
+    size_t feed(const char *data, size_t size);
+
+    //! \brief Gives received bytes to the parser, up to the end of a message
+    //! \param[in] data the bytes
+    //! \param[in] size the number of bytes
+    //! \return the number of bytes taken
+    //!
+    //! Stops right after a message has been parsed, so that the bytes which
+    //! follow it can be handled otherwise (as strings for instance).
+    size_t feedUntilObject(const char *data, size_t size);
+
+    //! \brief Reads the available bytes of a file descriptor
+    //! \param[in] fd the file descriptor
+    //! \return the number of bytes read, 0 if none was available
+    //!
+    //! Reads until the descriptor has no more data (EAGAIN) or a read is
+    //! short, and feeds the bytes to the parser. Big message contents are
+    //! read directly in place. Throws an InputStream::InputStreamException
+    //! with the code EX_STREAM_CLOSED when the end of the stream is reached
+    //! with no byte read, or with errno on errors.
+    size_t readFrom(int fd);
+
+    //! \brief Checks if an object is available
+    //! \return true if nextObject will return an object
+    bool hasObject(void) const;
+
+    //! \brief Gets the next complete object
+    //! \return the object, to be deleted by the caller, or NULL if none is
+    //!         available
+    Serializable *nextObject(void);
+
+    //! \brief Checks if a message is partly received
+    //! \return true if bytes of an incomplete message are pending
+    bool isParsing(void) const;
+
+    //! \brief Drops the incomplete message and the queued objects
+    void reset(void);
+
+    size_t getMaxMessageSize(void) const;
+    void setMaxMessageSize(size_t size);
+};
+
+#endif
@@ -2,12 +2,92 @@
 
 #include "net_message.h"
 #include "serialization_manager.h"
+#include "arena.h"
+
+#include <new>
+#include <stdlib.h>
+#include <vector>
 
 #define DEFAULT_WRITE_BUFFER_SIZE 4096
+#define DEFAULT_FLATTEN_MAX_SIZE 1048576
+#define DEFAULT_WRITE_WINDOW_SIZE 65536
+
+// Window a serialized object is flattened into by pieces. Blocks at least as
+// big as the window are written directly, without copy.
+class OutputStream::Window : public NetMessageSink {
+  private:
+    OutputStream *stream;
+    const NetAddress *addr;
+    char *buffer;
+    size_t size;
+    size_t used;
+    ssize_t written;
+
+  public:
+    Window(OutputStream *stream, const NetAddress *addr, char *buffer,
+      size_t size): stream(stream), addr(addr), buffer(buffer), size(size),
+      used(0), written(0) {
+    }
+
+    void write(const char *data, size_t dataSize) {
+      if (dataSize >= size) {
+        flush();
+        written += stream->writeData(data, dataSize, 0, addr);
+        return;
+      }
+      while (dataSize > 0) {
+        size_t toCopy = (size - used < dataSize) ? size - used : dataSize;
+        memcpy(&(buffer[used]), data, toCopy);
+        used += toCopy;
+        data += toCopy;
+        dataSize -= toCopy;
+        if (used == size) flush();
+      }
+    }
+
+    void flush(void) {
+      if (used > 0) {
+        written += stream->writeData(buffer, used, 0, addr);
+        used = 0;
+      }
+    }
+
+    ssize_t getWritten(void) const {
+      return written;
+    }
+};
+
+OutputStream::OutputStream(void): flattenMaxSize(DEFAULT_FLATTEN_MAX_SIZE),
+  writeWindowSize(DEFAULT_WRITE_WINDOW_SIZE), varintEncoding(false) {
+}
 
 OutputStream::~OutputStream(void) {
 }
 
+size_t OutputStream::getFlattenMaxSize(void) const {
+  return flattenMaxSize;
+}
+
+void OutputStream::setFlattenMaxSize(size_t size) {
+  flattenMaxSize = size;
+}
+
+size_t OutputStream::getWriteWindowSize(void) const {
+  return writeWindowSize;
+}
+
+void OutputStream::setWriteWindowSize(size_t size) {
+  writeWindowSize = size;
+}
+
+bool OutputStream::getVarintEncoding(void) const {
+  return varintEncoding;
+}
+
+void OutputStream::setVarintEncoding(bool varint) {
+  varintEncoding = varint;
+}
+
 ssize_t OutputStream::writeRemainingData( const struct iovec *iov, int iovcnt,
                             ssize_t written, const NetAddress *addr) {
   size_t totalSizeToWrite = 0;
@@ -65,23 +145,94 @@ char *OutputStream::generateRemainingData(  const struct iovec *iov, int iovcnt,
   return data;
 }
 
+char *OutputStream::flattenObject(const Serializable &object, size_t *size) {
+  NetMessage *message;
+  SerializationManager *serManager;
+  char *buffer;
+  ArenaScope arenaScope(Arena::getThreadArena());
+
+  serManager = SerializationManager::getSerializationManager();
+  message = serManager->serialize(object, NULL);
+  if (varintEncoding) {
+    message->setVarintEncoding(true);
+  }
+  *size = message->getFlattenedSize();
+
+  buffer = (char*) malloc(*size);
+  if (buffer == NULL) {
+    delete message;
+    throw std::bad_alloc();
+  }
+  message->flatten(buffer);
+  delete message;
+
+  return buffer;
+}
+
 ssize_t OutputStream::writeObject2(const Serializable &object, const NetAddress *addr) {
   NetMessage *message;
   SerializationManager *serManager;
-  struct iovec *iov;
+  struct iovec *iov = NULL;
   int iovcnt;
+  size_t size;
   ssize_t sizeWritten;
+  // The message and the flatten buffer are released at once on return
+  Arena *arena = Arena::getThreadArena();
+  ArenaScope arenaScope(arena);
   
   serManager = SerializationManager::getSerializationManager();
+
+  // Objects which know their size are encoded by pieces into the write
+  // window when too big to be flattened at once, without building their
+  // NetMessage. The NetMessages of their elements which have to be built are
+  // taken from the heap: the arena would keep them until the end.
+  if (writeWindowSize != 0) {
+    size = serManager->getSerializedSize(object, varintEncoding);
+    if (size > flattenMaxSize) {
+      Window window(this, addr, (char*) arena->allocate(writeWindowSize),
+        writeWindowSize);
+
+      Arena::setCurrentArena(NULL);
+      try {
+        serManager->serializeTo(object, window, varintEncoding);
+        window.flush();
+      } catch (...) {
+        Arena::setCurrentArena(arena);
+        throw;
+      }
+      Arena::setCurrentArena(arena);
+      return window.getWritten();
+    }
+  }
+
   message = serManager->serialize(object, NULL);
-  iov = (struct iovec*) message->getData(&iovcnt);
+  if (varintEncoding) {
+    message->setVarintEncoding(true);
+  }
+  size = message->getFlattenedSize();
   
   try {
-    sizeWritten = writeData(iov, iovcnt, addr);
-    free(iov);
+    // Small enough messages are copied once into a contiguous buffer and
+    // sent with a single write. Bigger ones are flattened through the write
+    // window, or go through writev.
+    if (size <= flattenMaxSize) {
+      char *buffer = (char*) arena->allocate(size);
+      message->flatten(buffer);
+      sizeWritten = writeData(buffer, size, 0, addr);
+    } else if (writeWindowSize != 0) {
+      Window window(this, addr, (char*) arena->allocate(writeWindowSize),
+        writeWindowSize);
+      message->flatten(window);
+      window.flush();
+      sizeWritten = window.getWritten();
+    } else {
+      iov = (struct iovec*) message->getData(&iovcnt);
+      sizeWritten = writeData(iov, iovcnt, addr);
+      free(iov);
+    }
     delete message;
   } catch (Exception &e) {
-    free(iov);
+    if (iov != NULL) free(iov);
     delete message;
     throw e;
   }
@@ -147,93 +298,83 @@ const char *OutputStream::OutputStreamException::getNonWrittenData(void) {
   return data;
 }
 
-BufferedOutputStream::BufferedOutputStream(void): buffers(NULL), buffersCount(0),
-  dataSize(0), lastNetAddress(NULL), writeBufferSize(DEFAULT_WRITE_BUFFER_SIZE) {
+BufferedOutputStream::BufferedOutputStream(void): buffer(NULL), bufferCapacity(0),
+  dataSize(0), hasNetAddress(false), writeBufferSize(DEFAULT_WRITE_BUFFER_SIZE) {
 }
 
 BufferedOutputStream::~BufferedOutputStream(void) {
-  clearBuffers();
+  free(buffer);
 }
 
 void BufferedOutputStream::closeStream(void) {
   flushBuffers();
 }
 
-void BufferedOutputStream::clearBuffers(void) {
-  if (buffers != NULL) {
-    for (int i = 0; i<buffersCount; ++i) {
-      free(buffers[i].iov_base);
-    }
-    free(buffers);
-
-    buffers = NULL;
-    dataSize = 0;
-    buffersCount = 0;
-  }
-
-  if (lastNetAddress != NULL) {
-    delete lastNetAddress;
-    lastNetAddress = NULL;
-  }
-}
-
 ssize_t BufferedOutputStream::writeData(  const char *data, size_t size, int flags,
                                           const NetAddress *addr) {
-  ++buffersCount;
-  dataSize += size;
-  buffers = (struct iovec*) realloc(buffers, buffersCount*sizeof(struct iovec));
-  buffers[buffersCount-1].iov_base = malloc(size);
-  memcpy(buffers[buffersCount-1].iov_base, data, size);
-  buffers[buffersCount-1].iov_len = size;
+  struct iovec iov;
 
-  if (addr != NULL) {
-    if (lastNetAddress != NULL) delete lastNetAddress;
-    lastNetAddress = new NetAddress(*addr);
-  }
-
-  if (dataSize > writeBufferSize) {
-    flushBuffers();
-  }
-
-  return size;
+  iov.iov_base = (void*) data;
+  iov.iov_len = size;
+  return writeData(&iov, 1, addr);
 }
 
 ssize_t BufferedOutputStream::writeData(  const struct iovec *iov, int iovCount,
                     const NetAddress *addr) {
-  int oldBuffersCount = buffersCount;
   size_t totalSize = 0;
 
-  buffersCount += iovCount;
-  buffers = (struct iovec*) realloc(buffers, iovCount*sizeof(struct iovec));
-  
-  for(int i = 0; i<iovCount; ++i) {
-    struct iovec &ciov = buffers[oldBuffersCount+i];
-    ciov.iov_base = malloc(iov[i].iov_len);
-    memcpy(ciov.iov_base, iov[i].iov_base, iov[i].iov_len);
-    ciov.iov_len = iov[i].iov_len;
-    dataSize += ciov.iov_len;
-    totalSize += ciov.iov_len;
+  for (int i = 0; i<iovCount; ++i) {
+    totalSize += iov[i].iov_len;
   }
 
   if (addr != NULL) {
-    if (lastNetAddress != NULL) delete lastNetAddress;
-    lastNetAddress = new NetAddress(*addr);
+    lastNetAddress = *addr;
+    hasNetAddress = true;
+  }
+
+  if ((dataSize + totalSize) > writeBufferSize) {
+    writeThrough(iov, iovCount);
+    return totalSize;
   }
 
-  if (dataSize > writeBufferSize) {
-    flushBuffers();
+  if (bufferCapacity < writeBufferSize) {
+    buffer = (char*) realloc(buffer, writeBufferSize);
+    bufferCapacity = writeBufferSize;
+  }
+  for (int i = 0; i<iovCount; ++i) {
+    memcpy(&(buffer[dataSize]), iov[i].iov_base, iov[i].iov_len);
+    dataSize += iov[i].iov_len;
   }
 
   return totalSize;
 }
 
-ssize_t BufferedOutputStream::flushBuffers(void) {
-  ssize_t dataWritten = writeRawData(buffers, buffersCount,
-    lastNetAddress);
-  clearBuffers();
+ssize_t BufferedOutputStream::writeThrough(const struct iovec *iov, int iovcnt) {
+  std::vector<struct iovec> all;
+  ssize_t dataWritten;
+
+  all.reserve(iovcnt + 1);
+  if (dataSize > 0) {
+    struct iovec buffered;
+
+    buffered.iov_base = buffer;
+    buffered.iov_len = dataSize;
+    all.push_back(buffered);
+  }
+  all.insert(all.end(), iov, iov + iovcnt);
+
+  dataWritten = writeRawData(&(all[0]), all.size(),
+    (hasNetAddress) ? &lastNetAddress : NULL);
+  dataSize = 0;
+  hasNetAddress = false;
   return dataWritten;
 }
 
+ssize_t BufferedOutputStream::flushBuffers(void) {
+  if (dataSize == 0) return 0;
+  return writeThrough(NULL, 0);
+}
+
 size_t BufferedOutputStream::getWriteBufferSize(void) const {
   return writeBufferSize;
 }
@@ -9,7 +9,16 @@
 
 
 class OutputStream: virtual public Stream {
+  private:
+    size_t flattenMaxSize;
+    size_t writeWindowSize;
+    bool varintEncoding;
+
+    class Window;
+
   protected:
+    OutputStream(void);
+
     virtual ssize_t writeData(  const char *data, size_t size, int flags,
                                 const NetAddress *addr) = 0;
     virtual ssize_t writeData(  const struct iovec *iov, int iovcnt,
@@ -20,6 +29,9 @@ class OutputStream: virtual public Stream {
     char *generateRemainingData(  const struct iovec *iov, int iovcnt,
                                   size_t totalWritten, size_t *toWrite);
     
+    // Serializes an object into a buffer to be freed by the caller
+    char *flattenObject(const Serializable &object, size_t *size);
+
     ssize_t writeObject2(const Serializable &object, const NetAddress *addr);
     ssize_t writeString2(const std::string &string, const NetAddress *addr);
     ssize_t writeBytes2(const Buffer<char> &data, int flags, const NetAddress *addr);
@@ -28,6 +40,26 @@ class OutputStream: virtual public Stream {
     
     virtual ~OutputStream();
 
+    size_t getFlattenMaxSize(void) const;
+    void setFlattenMaxSize(size_t size);
+
+    // Objects bigger than the flatten maximum size are written by pieces
+    // through a window of this size, written each time it is full, instead of
+    // a buffer of their whole size. Those which know their serialized size
+    // (see Serializable::getSerializedSize), such as the containers, String,
+    // Buffer and AutoSerializable objects made of them, are encoded into the
+    // window as it goes: the memory used does not depend on their size. The
+    // others have their NetMessage built first, then flattened into the
+    // window. 0 means that they are written at once with writev, which
+    // datagram sockets need.
+    size_t getWriteWindowSize(void) const;
+    void setWriteWindowSize(size_t size);
+
+    // Send the integer primitive values of the objects written as varints
+    // (see NetMessage::setVarintEncoding)
+    bool getVarintEncoding(void) const;
+    void setVarintEncoding(bool varint);
+
     ssize_t writeObject(const Serializable &object);
     ssize_t writeString(const std::string &string);
     ssize_t writeBytes(const Buffer<char> &data, int flags = 0);
@@ -52,15 +84,23 @@ class OutputStream: virtual public Stream {
 
 };
 
+//! \class BufferedOutputStream libcomm/output_stream.h
+//! \brief Output stream gathering the small writes
+//!
+//! The writes are appended to a buffer of the write buffer size, allocated
+//! at the first one and then reused. A write which would overflow it is not
+//! copied: it is written at once, after the buffered data, with a single
+//! vectored raw write.
 class BufferedOutputStream: public OutputStream {
   private:
-    struct iovec *buffers;
-    int buffersCount;
+    char *buffer;
+    size_t bufferCapacity;
     size_t dataSize;
-    NetAddress *lastNetAddress;
+    NetAddress lastNetAddress;
+    bool hasNetAddress;
     size_t writeBufferSize;
 
-    void clearBuffers(void);
+    ssize_t writeThrough(const struct iovec *iov, int iovcnt);
     
     ssize_t writeData(  const char *data, size_t size, int flags,
                         const NetAddress *addr);
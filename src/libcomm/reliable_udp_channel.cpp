@@ -0,0 +1,581 @@
+#include "reliable_udp_channel.h"
+#include "object_parser.h"
+#include "thread.h"
+#include "types_utils.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PACKET_DATA 1
+#define PACKET_ACK 2
+// Type, sequence number, stream, message number, fragment index and count
+#define DATA_HEADER_SIZE 15
+// Type, next sequence number expected and number of ranges
+#define ACK_HEADER_SIZE 6
+#define ACK_MAX_RANGES 16
+#define FRAGMENT_SIZE (RELIABLE_UDP_PACKET_SIZE - DATA_HEADER_SIZE)
+
+#define INITIAL_WINDOW 4.0
+#define INITIAL_RTO ((uint64_t) 100000000)
+#define MIN_RTO ((uint64_t) 20000000)
+#define MAX_RTO ((uint64_t) 2000000000)
+// Later packets acknowledged before an unacknowledged one is resent
+#define REORDERING_THRESHOLD 3
+#define MAX_BACKOFF 6
+// Packets resent at once when the timeout expires, the acks of which
+// trigger the others
+#define MAX_TIMEOUT_RETRANSMISSIONS 4
+
+static uint64_t now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool before(uint32_t a, uint32_t b) {
+  return ((int32_t) (a - b) < 0);
+}
+
+bool ReliableUdpChannel::SequenceLess::operator()(uint32_t a, uint32_t b) const {
+  return before(a, b);
+}
+
+class ReliableUdpChannel::Receiver: public Thread {
+  private:
+    ReliableUdpChannel *channel;
+
+  public:
+    Receiver(ReliableUdpChannel *channel): channel(channel) {
+    }
+
+  protected:
+    void *run(void) {
+      channel->receiveLoop();
+      return NULL;
+    }
+};
+
+ReliableUdpChannel::ReliableUdpChannel(int localPort, const NetAddress &peer)
+  : socket(localPort), peerAddress(peer), receiver(NULL), stopped(false), nextSeq(0),
+  congestionWindow(INITIAL_WINDOW), slowStartThreshold(1e9), recoverySeq(0),
+  smoothedRtt(0), rttVariation(0), retransmitTimeout(INITIAL_RTO),
+  backoff(0), latestAckedSentTime(0), nbRetransmissions(0), nextExpectedSeq(0), lossRate(0), lossSeed(1) {
+  peer.getSockAddr(&this->peer);
+  socket.setMaximumSize(RELIABLE_UDP_PACKET_SIZE);
+  receivedCondition = mutex.getNewCondition();
+  ackedCondition = mutex.getNewCondition();
+
+  receiver = new Receiver(this);
+  receiver->start();
+}
+
+ReliableUdpChannel::~ReliableUdpChannel(void) {
+  close();
+  delete receiver;
+  delete receivedCondition;
+  delete ackedCondition;
+  for (size_t i = 0; i < received.size(); ++i) {
+    delete received[i].first;
+  }
+}
+
+void ReliableUdpChannel::receiveLoop(void) {
+  char *buffer = (char*) malloc(RELIABLE_UDP_PACKET_SIZE);
+  uint64_t nextTick = now() + RELIABLE_UDP_TICK;
+  bool running = true;
+
+  // The retransmissions are checked here too, so that none runs once the
+  // thread is joined
+  while (running) {
+    uint64_t time = now();
+
+    if (time >= nextTick) {
+      tick();
+      nextTick = time + RELIABLE_UDP_TICK;
+    }
+    try {
+      StreamWFRResult waitResult = socket.waitForReady(
+        (StreamWFRSet) (STREAM_WFR_READ | STREAM_WFR_ERROR), nextTick - time);
+
+      if (waitResult.setIsRead()) {
+        NetAddress from;
+        sockaddr_in fromAddr;
+        ssize_t size;
+
+        size = socket.readRawData(buffer, RELIABLE_UDP_PACKET_SIZE, 0, &from);
+        from.getSockAddr(&fromAddr);
+        if ((fromAddr.sin_addr.s_addr == peer.sin_addr.s_addr)
+          && (fromAddr.sin_port == peer.sin_port)) {
+          handlePacket(buffer, size);
+        }
+      }
+    } catch (Exception &e) {
+      // A bad datagram, or the socket being closed: checked below
+    }
+
+    mutex.lock();
+    running = !stopped;
+    mutex.unlock();
+  }
+
+  free(buffer);
+}
+
+void ReliableUdpChannel::sendPacket(const std::string &data) {
+  if ((lossRate > 0) && (rand_r(&lossSeed) < lossRate * RAND_MAX)) return;
+
+  try {
+    socket.writeData(data.data(), data.size(), 0, &peerAddress);
+  } catch (Exception &e) {
+    // Handled as a lost datagram
+  }
+}
+
+void ReliableUdpChannel::sendWaiting(void) {
+  while (!waiting.empty() && (inFlight.size() < (size_t) congestionWindow)) {
+    uint32_t seq = convertToUInt32(&(waiting.front()[1]));
+    Packet &packet = inFlight[seq];
+
+    packet.data.swap(waiting.front());
+    packet.sentTime = now();
+    packet.nbTransmissions = 1;
+    waiting.pop_front();
+    sendPacket(packet.data);
+  }
+}
+
+void ReliableUdpChannel::sendAck(void) {
+  char ack[ACK_HEADER_SIZE + ACK_MAX_RANGES * 8];
+  std::set<uint32_t>::iterator it = receivedAbove.begin();
+  uint8_t nbRanges = 0;
+
+  ack[0] = PACKET_ACK;
+  convertToChars(nextExpectedSeq, &ack[1]);
+  while ((it != receivedAbove.end()) && (nbRanges < ACK_MAX_RANGES)) {
+    uint32_t start = *it;
+    uint32_t end = start + 1;
+
+    for (++it; (it != receivedAbove.end()) && (*it == end); ++it) ++end;
+    convertToChars(start, &ack[ACK_HEADER_SIZE + nbRanges * 8]);
+    convertToChars(end, &ack[ACK_HEADER_SIZE + nbRanges * 8 + 4]);
+    ++nbRanges;
+  }
+  ack[5] = nbRanges;
+
+  sendPacket(std::string(ack, ACK_HEADER_SIZE + nbRanges * 8));
+}
+
+void ReliableUdpChannel::retransmit(uint32_t seq, Packet &packet, uint64_t now) {
+  packet.sentTime = now;
+  ++packet.nbTransmissions;
+  ++nbRetransmissions;
+  sendPacket(packet.data);
+}
+
+void ReliableUdpChannel::updateRtt(uint64_t sample) {
+  if (smoothedRtt == 0) {
+    smoothedRtt = sample;
+    rttVariation = sample / 2;
+  } else {
+    uint64_t delta = (smoothedRtt > sample) ? smoothedRtt - sample : sample - smoothedRtt;
+
+    rttVariation = (3 * rttVariation + delta) / 4;
+    smoothedRtt = (7 * smoothedRtt + sample) / 8;
+  }
+
+  // Expirations are only seen at each tick
+  retransmitTimeout = smoothedRtt + std::max(4 * rttVariation, RELIABLE_UDP_TICK);
+  retransmitTimeout = std::max(retransmitTimeout, MIN_RTO);
+  retransmitTimeout = std::min(retransmitTimeout, MAX_RTO);
+}
+
+void ReliableUdpChannel::handlePacket(const char *data, size_t size) {
+  mutex.lock();
+  if (!stopped && (error.getCode() == 0) && (size > 0)) {
+    if (data[0] == PACKET_DATA) {
+      handleData(data, size);
+    } else if (data[0] == PACKET_ACK) {
+      handleAck(data, size);
+    }
+  }
+  mutex.unlock();
+}
+
+void ReliableUdpChannel::handleData(const char *data, size_t size) {
+  uint32_t seq;
+  uint16_t stream;
+  uint32_t messageSeq;
+  uint16_t index;
+  uint16_t nbFragments;
+  bool isNew = false;
+
+  if (size <= DATA_HEADER_SIZE) return;
+  seq = convertToUInt32(&data[1]);
+  stream = convertToUInt16(&data[5]);
+  messageSeq = convertToUInt32(&data[7]);
+  index = convertToUInt16(&data[11]);
+  nbFragments = convertToUInt16(&data[13]);
+  if (index >= nbFragments) return;
+
+  if (seq == nextExpectedSeq) {
+    isNew = true;
+    ++nextExpectedSeq;
+    while (!receivedAbove.empty() && (*receivedAbove.begin() == nextExpectedSeq)) {
+      receivedAbove.erase(receivedAbove.begin());
+      ++nextExpectedSeq;
+    }
+  } else if (before(nextExpectedSeq, seq)) {
+    isNew = receivedAbove.insert(seq).second;
+  }
+
+  // Retransmitted fragments keep their sequence number: each one is taken once
+  if (isNew) {
+    StreamState &state = streams[stream];
+
+    if (!before(messageSeq, state.nextMessage)) {
+      Message &message = state.messages[messageSeq];
+
+      if (message.fragments.empty()) {
+        message.nbFragments = nbFragments;
+        message.nbReceived = 0;
+        message.fragments.resize(nbFragments);
+      }
+      if ((nbFragments == message.nbFragments) && message.fragments[index].empty()) {
+        message.fragments[index].assign(&data[DATA_HEADER_SIZE], size - DATA_HEADER_SIZE);
+        ++message.nbReceived;
+        if (messageSeq == state.nextMessage) deliver(stream, state);
+      }
+    }
+  }
+
+  // Duplicates are acknowledged too, their ack may have been lost
+  sendAck();
+}
+
+void ReliableUdpChannel::handleAck(const char *data, size_t size) {
+  uint64_t time = now();
+  uint32_t cumulativeAck;
+  uint32_t highestAcked;
+  size_t nbRanges;
+  std::map<uint32_t, Packet>::iterator it;
+
+  if (size < ACK_HEADER_SIZE) return;
+  cumulativeAck = convertToUInt32(&data[1]);
+  nbRanges = (uint8_t) data[5];
+  if (size < ACK_HEADER_SIZE + nbRanges * 8) return;
+
+  while (!inFlight.empty() && before(inFlight.begin()->first, cumulativeAck)) {
+    acknowledge(inFlight.begin()->first, time);
+  }
+  highestAcked = cumulativeAck;
+  for (size_t i = 0; i < nbRanges; ++i) {
+    uint32_t start = convertToUInt32(&data[ACK_HEADER_SIZE + i * 8]);
+    uint32_t end = convertToUInt32(&data[ACK_HEADER_SIZE + i * 8 + 4]);
+
+    it = inFlight.lower_bound(start);
+    while ((it != inFlight.end()) && before(it->first, end)) {
+      uint32_t seq = it->first;
+
+      ++it;
+      acknowledge(seq, time);
+    }
+    if (before(highestAcked, end)) highestAcked = end;
+  }
+
+  // Packets followed by enough acknowledged ones are lost, and so are the
+  // ones sent some time before an acknowledged one, which catches the lost
+  // retransmissions
+  for (it = inFlight.begin(); it != inFlight.end(); ++it) {
+    Packet &packet = it->second;
+
+    if (((packet.nbTransmissions > 1) || !before(it->first + REORDERING_THRESHOLD, highestAcked))
+      && (packet.sentTime + smoothedRtt / 4 >= latestAckedSentTime)) continue;
+    // The window is reduced once per window of data: the packets in flight,
+    // not the ones still waiting
+    if (!before(it->first, recoverySeq)) {
+      slowStartThreshold = std::max(congestionWindow / 2, 2.0);
+      congestionWindow = slowStartThreshold;
+      recoverySeq = inFlight.rbegin()->first + 1;
+    }
+    retransmit(it->first, packet, time);
+  }
+
+  sendWaiting();
+  if (inFlight.empty() && waiting.empty()) ackedCondition->notifyAll();
+}
+
+void ReliableUdpChannel::acknowledge(uint32_t seq, uint64_t now) {
+  Packet &packet = inFlight[seq];
+
+  // Karn: the acks of retransmitted packets are ambiguous
+  if (packet.nbTransmissions == 1) updateRtt(now - packet.sentTime);
+  latestAckedSentTime = std::max(latestAckedSentTime, packet.sentTime);
+  backoff = 0;
+  inFlight.erase(seq);
+
+  if (congestionWindow < slowStartThreshold) {
+    congestionWindow += 1;
+  } else {
+    congestionWindow += 1 / congestionWindow;
+  }
+}
+
+void ReliableUdpChannel::deliver(uint16_t stream, StreamState &state) {
+  std::map<uint32_t, Message>::iterator it = state.messages.begin();
+
+  while ((it != state.messages.end()) && (it->first == state.nextMessage)
+    && (it->second.nbReceived == it->second.nbFragments)) {
+    ObjectParser parser(OBJECT_PARSER_DEFAULT_MAX_MESSAGE_SIZE);
+    Serializable *object = NULL;
+
+    try {
+      for (size_t i = 0; i < it->second.fragments.size(); ++i) {
+        parser.feed(it->second.fragments[i].data(), it->second.fragments[i].size());
+      }
+      object = parser.nextObject();
+    } catch (Exception &e) {
+      // Malformed or unknown objects are skipped, the stream goes on
+    }
+    if (object != NULL) {
+      received.push_back(std::make_pair(object, stream));
+      receivedCondition->notifyAll();
+    }
+
+    state.messages.erase(it++);
+    ++state.nextMessage;
+  }
+}
+
+void ReliableUdpChannel::tick(void) {
+  uint64_t time;
+  uint64_t timeout;
+  size_t nbRetransmitted = 0;
+  bool timedOut = false;
+  std::map<uint32_t, Packet>::iterator it;
+
+  mutex.lock();
+  if (stopped || (error.getCode() != 0)) {
+    mutex.unlock();
+    return;
+  }
+  time = now();
+  timeout = std::min(retransmitTimeout << backoff, MAX_RTO);
+  for (it = inFlight.begin(); it != inFlight.end(); ++it) {
+    if (time - it->second.sentTime < timeout) continue;
+    if (it->second.nbTransmissions > RELIABLE_UDP_MAX_RETRANSMISSIONS) {
+      fail(ETIMEDOUT);
+      break;
+    }
+
+    if (!timedOut) {
+      // Nothing comes back: restart from a single packet, and back off
+      timedOut = true;
+      slowStartThreshold = std::max(congestionWindow / 2, 2.0);
+      congestionWindow = 1;
+      recoverySeq = inFlight.rbegin()->first + 1;
+      if (backoff < MAX_BACKOFF) ++backoff;
+    }
+    retransmit(it->first, it->second, time);
+    if (++nbRetransmitted >= MAX_TIMEOUT_RETRANSMISSIONS) break;
+  }
+
+  mutex.unlock();
+}
+
+void ReliableUdpChannel::fail(int code) {
+  error = ChannelException(code, "The peer does not acknowledge.");
+  inFlight.clear();
+  waiting.clear();
+  receivedCondition->notifyAll();
+  ackedCondition->notifyAll();
+}
+
+void ReliableUdpChannel::send(const Serializable &object, uint16_t stream) {
+  char *data;
+  size_t size;
+  size_t nbFragments;
+  uint32_t messageSeq;
+
+  data = socket.flattenObject(object, &size);
+  nbFragments = (size + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE;
+  if (nbFragments > 0xFFFF) {
+    free(data);
+    throw ChannelException(EX_OSTREAM_TOO_MUCH_DATA, "Object too big.");
+  }
+
+  mutex.lock();
+  if (stopped || (error.getCode() != 0)) {
+    Exception e = stopped ? ChannelException(EX_STREAM_CLOSED,
+      "The channel has been closed.") : error;
+
+    mutex.unlock();
+    free(data);
+    throw e;
+  }
+
+  messageSeq = nextMessages[stream]++;
+  for (size_t i = 0; i < nbFragments; ++i) {
+    size_t offset = i * FRAGMENT_SIZE;
+    size_t fragmentSize = std::min(size - offset, (size_t) FRAGMENT_SIZE);
+    char header[DATA_HEADER_SIZE];
+    std::string packet;
+
+    header[0] = PACKET_DATA;
+    convertToChars(nextSeq++, &header[1]);
+    convertToChars(stream, &header[5]);
+    convertToChars(messageSeq, &header[7]);
+    convertToChars((uint16_t) i, &header[11]);
+    convertToChars((uint16_t) nbFragments, &header[13]);
+    packet.reserve(DATA_HEADER_SIZE + fragmentSize);
+    packet.append(header, DATA_HEADER_SIZE);
+    packet.append(&data[offset], fragmentSize);
+    waiting.push_back(packet);
+  }
+  sendWaiting();
+  mutex.unlock();
+
+  free(data);
+}
+
+Serializable *ReliableUdpChannel::receive(uint16_t *stream) {
+  return receive2(0, false, stream);
+}
+
+Serializable *ReliableUdpChannel::receive(uint64_t nanosec, uint16_t *stream) {
+  return receive2(nanosec, true, stream);
+}
+
+Serializable *ReliableUdpChannel::receive2(uint64_t nanosec, bool timed,
+  uint16_t *stream) {
+  uint64_t deadline = now() + nanosec;
+  Serializable *object;
+
+  mutex.lock();
+  while (received.empty() && !stopped && (error.getCode() == 0)) {
+    uint64_t time = now();
+
+    if (!timed) {
+      receivedCondition->wait();
+      continue;
+    }
+    if (time >= deadline) break;
+    try {
+      receivedCondition->timedWait(deadline - time);
+    } catch (Condition::ConditionException &e) {
+      // Checked with the deadline
+    }
+  }
+
+  if (received.empty()) {
+    Exception e = (error.getCode() != 0) ? error : (stopped
+      ? ChannelException(EX_STREAM_CLOSED, "The channel has been closed.")
+      : ChannelException(EX_STREAM_TIMEOUT, "Timeout."));
+
+    mutex.unlock();
+    throw e;
+  }
+
+  object = received.front().first;
+  if (stream != NULL) *stream = received.front().second;
+  received.pop_front();
+  mutex.unlock();
+
+  return object;
+}
+
+bool ReliableUdpChannel::flush(uint64_t nanosec) {
+  uint64_t deadline = now() + nanosec;
+  bool flushed;
+
+  mutex.lock();
+  while ((!inFlight.empty() || !waiting.empty()) && !stopped
+    && (error.getCode() == 0)) {
+    uint64_t time = now();
+
+    if (time >= deadline) break;
+    try {
+      ackedCondition->timedWait(deadline - time);
+    } catch (Condition::ConditionException &e) {
+      // Checked with the deadline
+    }
+  }
+
+  if (error.getCode() != 0) {
+    Exception e = error;
+
+    mutex.unlock();
+    throw e;
+  }
+  flushed = inFlight.empty() && waiting.empty();
+  mutex.unlock();
+
+  return flushed;
+}
+
+void ReliableUdpChannel::close(void) {
+  mutex.lock();
+  if (stopped) {
+    mutex.unlock();
+    return;
+  }
+  stopped = true;
+  receivedCondition->notifyAll();
+  ackedCondition->notifyAll();
+  mutex.unlock();
+
+  // No tick runs once the receiving thread is done
+  receiver->join();
+  try {
+    socket.closeStream();
+  } catch (Exception &e) {
+  }
+}
+
+double ReliableUdpChannel::getCongestionWindow(void) {
+  double window;
+
+  mutex.lock();
+  window = congestionWindow;
+  mutex.unlock();
+
+  return window;
+}
+
+uint64_t ReliableUdpChannel::getRoundTripTime(void) {
+  uint64_t rtt;
+
+  mutex.lock();
+  rtt = smoothedRtt;
+  mutex.unlock();
+
+  return rtt;
+}
+
+uint64_t ReliableUdpChannel::getNbRetransmissions(void) {
+  uint64_t nb;
+
+  mutex.lock();
+  nb = nbRetransmissions;
+  mutex.unlock();
+
+  return nb;
+}
+
+void ReliableUdpChannel::setLossRate(double rate, unsigned int seed) {
+  mutex.lock();
+  lossRate = rate;
+  lossSeed = seed;
+  mutex.unlock();
+}
+
+ReliableUdpChannel::ChannelException::ChannelException(int code)
+  : Exception(code) {
+}
+
+ReliableUdpChannel::ChannelException::ChannelException(int code,
+  std::string message): Exception(code, message) {
+}
@@ -0,0 +1,192 @@
+//! \file reliable_udp_channel.h
+//! \brief Reliable and ordered messages over UDP
+//!
+//! File containing the declarations of the class ReliableUdpChannel.
+
+#ifndef RELIABLE_UDP_CHANNEL_H
+#define RELIABLE_UDP_CHANNEL_H
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "condition.h"
+#include "mutex.h"
+#include "udp_socket.h"
+
+// Biggest datagram sent, headers included
+#define RELIABLE_UDP_PACKET_SIZE 1400
+// Period of the retransmission checks
+#define RELIABLE_UDP_TICK ((uint64_t) 5000000)
+// Retransmissions of a packet before the peer is considered unreachable
+#define RELIABLE_UDP_MAX_RETRANSMISSIONS 20
+
+//! \class ReliableUdpChannel libcomm/reliable_udp_channel.h
+//! \brief Reliable, ordered objects between two UDP endpoints
+//!
+//! Each side creates a channel on its own port, giving the address of the
+//! other one. Objects are cut into fragments fitting in a datagram, and
+//! every fragment is numbered and kept until the peer acknowledges it. The
+//! acknowledgements carry the ranges received beyond the first hole
+//! (selective acks), so that only the missing fragments are sent again:
+//! either when three later ones have been acknowledged, or when their
+//! retransmission timeout expires. The timeout follows the measured round
+//! trip time, and is checked periodically by the receiving thread.
+//!
+//! The fragments in flight are limited by a congestion window, which grows
+//! with the acknowledgements (slow start, then one fragment per round trip)
+//! and is halved on losses. Fragments beyond the window wait in a queue.
+//!
+//! Objects are sent on numbered streams. Each stream is delivered in order,
+//! but independently of the others: a loss only delays the objects of its
+//! own stream.
+class ReliableUdpChannel {
+  private:
+    class Receiver;
+
+    // Sequence numbers wrap around: a is before b if it is less than 2^31
+    // numbers behind
+    struct SequenceLess {
+      bool operator()(uint32_t a, uint32_t b) const;
+    };
+
+    struct Packet {
+      std::string data;
+      uint64_t sentTime;
+      int nbTransmissions;
+    };
+
+    struct Message {
+      uint16_t nbFragments;
+      uint16_t nbReceived;
+      std::vector<std::string> fragments;
+    };
+
+    struct StreamState {
+      uint32_t nextMessage;
+      std::map<uint32_t, Message, SequenceLess> messages;
+    };
+
+    UdpSocket socket;
+    sockaddr_in peer;
+    NetAddress peerAddress;
+    Mutex mutex;
+    Condition *receivedCondition;
+    Condition *ackedCondition;
+    Receiver *receiver;
+    bool stopped;
+    Exception error;
+
+    // Sender
+    uint32_t nextSeq;
+    std::map<uint32_t, Packet, SequenceLess> inFlight;
+    std::deque<std::string> waiting;
+    std::map<uint16_t, uint32_t> nextMessages;
+    double congestionWindow;
+    double slowStartThreshold;
+    uint32_t recoverySeq;
+    uint64_t smoothedRtt;
+    uint64_t rttVariation;
+    uint64_t retransmitTimeout;
+    int backoff;
+    uint64_t latestAckedSentTime;
+    uint64_t nbRetransmissions;
+
+    // Receiver
+    uint32_t nextExpectedSeq;
+    std::set<uint32_t, SequenceLess> receivedAbove;
+    std::map<uint16_t, StreamState> streams;
+    std::deque<std::pair<Serializable*, uint16_t> > received;
+
+    double lossRate;
+    unsigned int lossSeed;
+
+    ReliableUdpChannel(const ReliableUdpChannel &channel);
+    ReliableUdpChannel &operator=(const ReliableUdpChannel &channel);
+
+    void receiveLoop(void);
+    void sendPacket(const std::string &data);
+    void sendWaiting(void);
+    void sendAck(void);
+    void retransmit(uint32_t seq, Packet &packet, uint64_t now);
+    void updateRtt(uint64_t sample);
+    void handlePacket(const char *data, size_t size);
+    void handleData(const char *data, size_t size);
+    void handleAck(const char *data, size_t size);
+    void acknowledge(uint32_t seq, uint64_t now);
+    void deliver(uint16_t stream, StreamState &state);
+    void tick(void);
+    void fail(int code);
+    Serializable *receive2(uint64_t nanosec, bool timed, uint16_t *stream);
+
+  public:
+    //! \brief ReliableUdpChannel constructor
+    //! \param[in] localPort the port to bind
+    //! \param[in] peer the address of the other side, the datagrams from
+    //!            other addresses being ignored
+    //!
+    //! Starts the receiving thread, which also resends the fragments.
+    ReliableUdpChannel(int localPort, const NetAddress &peer);
+
+    //! \brief ReliableUdpChannel destructor
+    //!
+    //! Closes the channel: the fragments not acknowledged yet are dropped.
+    ~ReliableUdpChannel(void);
+
+    //! \brief Sends an object
+    //! \param[in] object the object, serialized at once
+    //! \param[in] stream the stream of the object
+    //!
+    //! Returns as soon as the fragments are queued. Throws a
+    //! ChannelException with the code ETIMEDOUT once the peer has been
+    //! declared unreachable, or EX_STREAM_CLOSED after close.
+    void send(const Serializable &object, uint16_t stream = 0);
+
+    //! \brief Receives the next object of any stream
+    //! \param[out] stream the stream of the object, if not NULL
+    //! \return the object, to be deleted by the caller
+    Serializable *receive(uint16_t *stream = NULL);
+
+    //! \brief Receives the next object of any stream, with a timeout
+    //! \param[in] nanosec the timeout
+    //! \param[out] stream the stream of the object, if not NULL
+    //! \return the object, to be deleted by the caller
+    //!
+    //! Throws a ChannelException with the code EX_STREAM_TIMEOUT when no
+    //! object is received in time.
+    Serializable *receive(uint64_t nanosec, uint16_t *stream = NULL);
+
+    //! \brief Waits until the peer has acknowledged every object sent
+    //! \param[in] nanosec the timeout
+    //! \return false on timeout
+    //!
+    //! Throws a ChannelException with the code ETIMEDOUT if the peer has been
+    //! declared unreachable.
+    bool flush(uint64_t nanosec);
+
+    //! \brief Stops the thread and closes the socket
+    //!
+    //! Wakes up the calls waiting for objects or acknowledgements.
+    void close(void);
+
+    double getCongestionWindow(void);
+    // Smoothed round trip time, in nanoseconds
+    uint64_t getRoundTripTime(void);
+    uint64_t getNbRetransmissions(void);
+
+    //! \brief Drops outgoing datagrams at random, for tests
+    //! \param[in] rate the probability of dropping a datagram, from 0 to 1
+    //! \param[in] seed the seed of the drawing
+    void setLossRate(double rate, unsigned int seed = 1);
+
+    class ChannelException : public Exception {
+      public :
+        ChannelException(int code);
+        ChannelException(int code, std::string message);
+    };
+};
+
+#endif
@@ -2,3 +2,22 @@
 
 Serializable::~Serializable(void) {
 }
+
+size_t Serializable::getSerializedSize(bool varint) const {
+  return 0;
+}
+
+void Serializable::serializeTo(NetMessageSink &sink, bool varint) const {
+  NetMessage *message = serialize();
+
+  if (varint) {
+    message->setVarintEncoding(true);
+  }
+  try {
+    message->flatten(sink);
+  } catch (...) {
+    delete message;
+    throw;
+  }
+  delete message;
+}
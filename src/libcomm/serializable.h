@@ -36,6 +36,27 @@ class Serializable {
     //! containing the object state.
     virtual NetMessage *serialize(void) const = 0;
 
+    //! \brief Gets the size of the serialized object
+    //! \param[in] varint true if the integer primitive values are sent as
+    //! varints (see NetMessage::setVarintEncoding)
+    //! \return the size of the flattened NetMessage, or 0 if it is not known
+    //! without serializing the object
+    //!
+    //! Returns 0 by default. Classes which override it must override
+    //! serializeTo too.
+    virtual size_t getSerializedSize(bool varint) const;
+
+    //! \brief Serializes the object by pieces
+    //! \param[in] sink the destination
+    //! \param[in] varint true if the integer primitive values are sent as
+    //! varints (see NetMessage::setVarintEncoding)
+    //!
+    //! Gives sink the same bytes as flattening the NetMessage returned by
+    //! serialize. By default, the NetMessage is built and flattened. Classes
+    //! knowing their serialized size encode themselves into sink instead, so
+    //! that big objects are written without building their whole NetMessage.
+    virtual void serializeTo(NetMessageSink &sink, bool varint) const;
+
     //! \brief Deserializes a NetMessage
     //! \param[in] data the NetMessage to deserialize
     //! \param[in] ptr if true, the returned Serializable object pointer must be in
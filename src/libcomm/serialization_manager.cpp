@@ -1,5 +1,6 @@
 #include "serialization_manager.h"
 #include "types_utils.h"
+#include "arena.h"
 
 #include <iostream>
 
@@ -7,6 +8,9 @@ SerializationManager* SerializationManager::self = (SerializationManager*) NULL;
 
 SerializationManager::SerializationManager(void){
   currentId = NB_PRIMITVE_TYPES;
+  dispatchTable = new DispatchTable();
+  dispatchTable->size = 0;
+  dispatchTable->funcs = NULL;
 }
 
 SerializationManager *SerializationManager::getSerializationManager(void) {
@@ -17,19 +21,79 @@ SerializationManager *SerializationManager::getSerializationManager(void) {
 
 void SerializationManager::addDeserializationFunc(const uint16_t type, 
   DeserializeFunc f) {
+  DispatchTable *oldTable;
+  DispatchTable *newTable;
+
+  registrationMutex.lock();
+  oldTable = dispatchTable;
+  // A slot of the current array is set in place, readers seeing either the
+  // former function or the new one. Only growing the array, by doubling, or
+  // changing the map makes a new copy: registering n types of the array
+  // copies O(n) entries, while each sparse type copies the whole map.
+  if (type < oldTable->size) {
+    __atomic_store_n(&(oldTable->funcs[type]), f, __ATOMIC_RELEASE);
+    registrationMutex.unlock();
+    return;
+  }
+
+  newTable = new DispatchTable();
+  newTable->sparseFuncs = oldTable->sparseFuncs;
+  newTable->size = oldTable->size;
+  if ((type < DISPATCH_TABLE_MAX_SIZE) && (type >= newTable->size)) {
+    newTable->size = (newTable->size == 0) ? 64 : newTable->size;
+    while (newTable->size <= type) {
+      newTable->size *= 2;
+    }
+  }
+  newTable->funcs = new DeserializeFunc[newTable->size];
+  for (size_t i = 0; i < newTable->size; i++) {
+    newTable->funcs[i] = (i < oldTable->size) ? oldTable->funcs[i] : NULL;
+  }
 
-  deserializeFuncs[type] = f;
+  if (type < DISPATCH_TABLE_MAX_SIZE) {
+    newTable->funcs[type] = f;
+  } else {
+    newTable->sparseFuncs[type] = f;
+  }
+
+  // Readers may still be using the old table: keep it
+  retiredTables.push_back(oldTable);
+  __atomic_store_n(&dispatchTable, newTable, __ATOMIC_RELEASE);
+  registrationMutex.unlock();
 }
 
 uint16_t SerializationManager::addDeserializationFunc(DeserializeFunc f) {
-  deserializeFuncs[currentId] = f;
-  return currentId++;
+  uint16_t type;
+
+  registrationMutex.lock();
+  type = currentId++;
+  registrationMutex.unlock();
+  addDeserializationFunc(type, f);
+
+  return type;
+}
+
+DeserializeFunc SerializationManager::findDeserializationFunc(uint16_t type) const {
+  const DispatchTable *table = __atomic_load_n(&dispatchTable, __ATOMIC_ACQUIRE);
+
+  if (type < table->size) {
+    return __atomic_load_n(&(table->funcs[type]), __ATOMIC_ACQUIRE);
+  } else if (!table->sparseFuncs.empty()) {
+    std::map<uint16_t, DeserializeFunc>::const_iterator iter =
+      table->sparseFuncs.find(type);
+    if (iter != table->sparseFuncs.end()) {
+      return iter->second;
+    }
+  }
+
+  return NULL;
 }
   
 Serializable *SerializationManager::clone(const Serializable &object) {
   NetMessage *message;
   NetMessage *cloneMessage;
   void *copy;
+  ArenaScope arenaScope(Arena::getThreadArena());
 
   message = object.serialize();
   cloneMessage = new NetMessage(*message);
@@ -56,10 +120,8 @@ void *SerializationManager::deserialize(const NetMessage &message, bool ptr) {
   if ((type >= min) && (type < max)) {
     return deserializePrimitive(message);
   } else {
-    std::map<uint16_t, DeserializeFunc>::iterator iter = 
-      deserializeFuncs.find(type);
-    if (iter != deserializeFuncs.end()) {
-      DeserializeFunc f = iter->second;
+    DeserializeFunc f = findDeserializationFunc(type);
+    if (f != NULL) {
       return (void*) f(message, ptr);
     } else {
       return (void*) NULL;
@@ -106,6 +168,17 @@ NetMessage *SerializationManager::mergeMessage(NetMessage *message, NetMessage *
 }
 
 
+void SerializationManager::flattenPrimitive(NetMessage *message,
+  NetMessageSink &sink, bool varint) const {
+  char buffer[NET_MESSAGE_MAX_HEADER_SIZE];
+  size_t size;
+
+  message->setVarintEncoding(varint);
+  size = message->flatten(buffer);
+  delete message;
+  sink.write(buffer, size);
+}
+
 NetMessage *SerializationManager::serialize(const Serializable &object,
   NetMessage *message) const {
   NetMessage *newMessage = object.serialize();
@@ -119,84 +192,77 @@ NetMessage *SerializationManager::serialize(const Serializable *object,
 }
 
 NetMessage *SerializationManager::serialize(char c, NetMessage *message) const {
-  size_t size = 0;
-  char *cptr = convertToChars((uint8_t)c,size);
-  NetMessage *newMessage = new NetMessage(CHAR,cptr,size);
+  NetMessage *newMessage = new NetMessage(CHAR, sizeof(char));
+  convertToChars((uint8_t)c, newMessage->getPrimitiveBuffer());
   return mergeMessage(message, newMessage);
 }
 
 NetMessage *SerializationManager::serialize(float f, NetMessage *message) const {
-  size_t size = 0;
-  char *cptr = convertToChars(f,size);
-  NetMessage *newMessage = new NetMessage(FLOAT,cptr,size);
+  NetMessage *newMessage = new NetMessage(FLOAT, sizeof(float));
+  convertToChars(f, newMessage->getPrimitiveBuffer());
   return mergeMessage(message, newMessage);
 }
 
 NetMessage *SerializationManager::serialize(double d, NetMessage *message) const {
-  size_t size = 0;
-  char *cptr = convertToChars(d,size);
-  NetMessage *newMessage = new NetMessage(DOUBLE,cptr,size);
+  NetMessage *newMessage = new NetMessage(DOUBLE, sizeof(double));
+  convertToChars(d, newMessage->getPrimitiveBuffer());
   return mergeMessage(message, newMessage);
 }
 
 NetMessage *SerializationManager::serialize(int8_t i, NetMessage *message) const {
-  size_t size = 0;
-  char *cptr = convertToChars((uint8_t)i,size);
-  NetMessage *newMessage = new NetMessage(INT8_T, cptr, size);
+  NetMessage *newMessage = new NetMessage(INT8_T, sizeof(int8_t));
+  convertToChars((uint8_t)i, newMessage->getPrimitiveBuffer());
   return mergeMessage(message, newMessage);
 }
 
 NetMessage *SerializationManager::serialize(int16_t i, NetMessage *message) const {
-  size_t size = 0;
-  char *cptr = convertToChars((uint16_t)i,size);
-  NetMessage *newMessage = new NetMessage(INT16_T,cptr,size);
+  NetMessage *newMessage = new NetMessage(INT16_T, sizeof(int16_t));
+  convertToChars((uint16_t)i, newMessage->getPrimitiveBuffer());
   return mergeMessage(message, newMessage);
 }
 
 NetMessage *SerializationManager::serialize(int32_t i, NetMessage *message) const {
-  size_t size = 0;
-  char *cptr = convertToChars((uint32_t)i,size);
-  NetMessage *newMessage = new NetMessage(INT32_T,cptr,size);
+  NetMessage *newMessage = new NetMessage(INT32_T, sizeof(int32_t));
+  convertToChars((uint32_t)i, newMessage->getPrimitiveBuffer());
   return mergeMessage(message, newMessage);
 }
 
 NetMessage *SerializationManager::serialize(int64_t i, NetMessage *message) const {
-  size_t size = 0;
-  char *cptr = convertToChars((uint64_t)i,size);
-  NetMessage *newMessage = new NetMessage(INT64_T,cptr,size); 
+  NetMessage *newMessage = new NetMessage(INT64_T, sizeof(int64_t));
+  convertToChars((uint64_t)i, newMessage->getPrimitiveBuffer());
   return mergeMessage(message, newMessage);
 }
 
 NetMessage *SerializationManager::serialize(uint8_t i, NetMessage *message) const {
-  size_t size = 0;
-  char *cptr = convertToChars(i,size);
-  NetMessage *newMessage = new NetMessage(UINT8_T, cptr,size);
+  NetMessage *newMessage = new NetMessage(UINT8_T, sizeof(uint8_t));
+  convertToChars(i, newMessage->getPrimitiveBuffer());
   return mergeMessage(message, newMessage);
 }
 
 NetMessage *SerializationManager::serialize(uint16_t i, NetMessage *message) const {
-  size_t size = 0;
-  char *cptr = convertToChars(i,size);
-  NetMessage *newMessage = new NetMessage(UINT16_T, cptr,size);
+  NetMessage *newMessage = new NetMessage(UINT16_T, sizeof(uint16_t));
+  convertToChars(i, newMessage->getPrimitiveBuffer());
   return mergeMessage(message, newMessage);
 }
 
 NetMessage *SerializationManager::serialize(uint32_t i, NetMessage *message) const {
-  size_t size = 0;
-  char *cptr = convertToChars(i,size);
-  NetMessage *newMessage = new NetMessage(UINT32_T, cptr,size);
+  NetMessage *newMessage = new NetMessage(UINT32_T, sizeof(uint32_t));
+  convertToChars(i, newMessage->getPrimitiveBuffer());
   return mergeMessage(message, newMessage);
 }
 
 NetMessage *SerializationManager::serialize(uint64_t i, NetMessage *message) const {
-  size_t size = 0;
-  char *cptr = convertToChars(i,size);
-  NetMessage *newMessage = new NetMessage(UINT64_T, cptr,size);
+  NetMessage *newMessage = new NetMessage(UINT64_T, sizeof(uint64_t));
+  convertToChars(i, newMessage->getPrimitiveBuffer());
   return mergeMessage(message, newMessage);
 }
 
 SerializationManager::~SerializationManager(void) {
-  deserializeFuncs.clear();
+  retiredTables.push_back(dispatchTable);
+  for (size_t i = 0; i < retiredTables.size(); i++) {
+    delete[] retiredTables[i]->funcs;
+    delete retiredTables[i];
+  }
 }
 
 void SerializationManager::deleteT(Serializable &object) const {}
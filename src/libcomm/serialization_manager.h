@@ -9,8 +9,19 @@
 #define SERIALIZATION_MANAGER_H
 
 #include <map>
+#include <vector>
+#include <iterator>
+#include <type_traits>
 
 #include "serializable.h"
+#include "types_utils.h"
+#include "mutex.h"
+
+// Types below this bound are dispatched through a flat array, the others
+// through a map
+#define DISPATCH_TABLE_MAX_SIZE 4096
+// Packed blocks are encoded by pieces of this size by serializePackedTo
+#define PACKED_CHUNK_SIZE 4096
 
 //! \class SerializationManager libcomm/serialization_manager.h
 //! \brief Serialization manager
@@ -23,15 +34,79 @@
 //! SimpleSerializable class, you will need to implement yourself the different
 //! serialization methods. This class provides several methods that you should
 //! use to make it.
+//!
+//! Deserialization functions are looked up in a flat array indexed by type,
+//! the map being only used for sparse types (at least
+//! DISPATCH_TABLE_MAX_SIZE). Lookups take no lock: registering a function
+//! sets its slot of the array in place, or publishes a new copy of the tables
+//! when the array grows or the map changes. The old copies are freed with
+//! the manager.
 class SerializationManager {
 
   private :
-    std::map<uint16_t, DeserializeFunc> deserializeFuncs;
+    struct DispatchTable {
+      size_t size;
+      DeserializeFunc *funcs;
+      std::map<uint16_t, DeserializeFunc> sparseFuncs;
+    };
+
+    // Current tables, replaced as a whole on registration
+    DispatchTable *dispatchTable;
+    // Previous tables, which concurrent readers may still use
+    std::vector<DispatchTable*> retiredTables;
+    // Serializes registrations
+    Mutex registrationMutex;
     uint16_t currentId;
 
+    DeserializeFunc findDeserializationFunc(uint16_t type) const;
+
     SerializationManager(void);
     static SerializationManager *self;
     NetMessage *mergeMessage(NetMessage *message, NetMessage *newMessage) const;
+
+    // True for the Serializable objects and the pointers to them, false for
+    // the primitive values
+    template <typename T>
+    struct IsSerializable : std::is_base_of<Serializable,
+      typename std::remove_pointer<T>::type> {};
+
+    static const Serializable &toSerializable(const Serializable &object) {
+      return object;
+    }
+    static const Serializable &toSerializable(const Serializable *object) {
+      return *object;
+    }
+
+    template <typename T>
+    size_t getSerializedSize(const T &t, bool varint, std::true_type) const {
+      return toSerializable(t).getSerializedSize(varint);
+    }
+    // Computed without building the NetMessage: the value follows the flags,
+    // as a varint for the integers of more than one byte when asked
+    template <typename T>
+    size_t getSerializedSize(const T &t, bool varint, std::false_type) const {
+      if (!varint || !std::is_integral<T>::value || (sizeof(T) == 1)) {
+        return NetMessage::getFlagsHeaderSize() + sizeof(T);
+      } else if (std::is_signed<T>::value) {
+        return NetMessage::getFlagsHeaderSize()
+          + getVarintSize(zigzagEncode((int64_t) t));
+      } else {
+        return NetMessage::getFlagsHeaderSize() + getVarintSize((uint64_t) t);
+      }
+    }
+    template <typename T>
+    void serializeTo(const T &t, NetMessageSink &sink, bool varint,
+      std::true_type) const {
+      toSerializable(t).serializeTo(sink, varint);
+    }
+    template <typename T>
+    void serializeTo(const T &t, NetMessageSink &sink, bool varint,
+      std::false_type) const {
+      flattenPrimitive(serialize(t, (NetMessage*) NULL), sink, varint);
+    }
+    // Flatten the NetMessage of a primitive value, and delete it
+    void flattenPrimitive(NetMessage *message, NetMessageSink &sink,
+      bool varint) const;
   
   public :
 
@@ -117,7 +192,88 @@ class SerializationManager {
     //! Similar to SerializationManager::serialize, but with a pointer to an 
     //! object instead of a reference.
     NetMessage *serialize(const Serializable *object, NetMessage *message) const;
+
+    //! \brief Serializes a value with its integers as varints
+    //! \param[in] t the value to serialize
+    //! \param[in] message messate to add, or NULL for none
+    //! \return a new NetMessage
+    //!
+    //! Similar to SerializationManager::serialize, but the integer primitive
+    //! values of the generated NetMessage are sent as varints (see
+    //! NetMessage::setVarintEncoding).
+    template <typename T>
+    NetMessage *serializeVarint(const T &t, NetMessage *message) const {
+      NetMessage *newMessage = serialize(t, (NetMessage*) NULL);
+      newMessage->setVarintEncoding(true);
+      return mergeMessage(message, newMessage);
+    }
     
+    //! \brief Gets the serialized size of a value
+    //! \param[in] t the value: a primitive value, a Serializable object or a
+    //! pointer to one
+    //! \param[in] varint true if the integer primitive values are sent as
+    //! varints (see NetMessage::setVarintEncoding)
+    //! \return the size of the flattened NetMessage of t, or 0 for an object
+    //! which does not know it (see Serializable::getSerializedSize)
+    //!
+    //! Used by the containers to implement Serializable::getSerializedSize.
+    template <typename T>
+    size_t getSerializedSize(const T &t, bool varint) const {
+      return getSerializedSize(t, varint, IsSerializable<T>());
+    }
+
+    //! \brief Serializes a value by pieces
+    //! \param[in] t the value: a primitive value, a Serializable object or a
+    //! pointer to one
+    //! \param[in] sink the destination
+    //! \param[in] varint true if the integer primitive values are sent as
+    //! varints (see NetMessage::setVarintEncoding)
+    //!
+    //! Gives sink the bytes of the flattened NetMessage of t (see
+    //! Serializable::serializeTo). Used by the containers to implement
+    //! Serializable::serializeTo.
+    template <typename T>
+    void serializeTo(const T &t, NetMessageSink &sink, bool varint) const {
+      serializeTo(t, sink, varint, IsSerializable<T>());
+    }
+
+    // Write to sink the data block of count primitive values (see
+    // PackedArray), as a container adding it with toFree would. Used by
+    // libcomm class only.
+    template <typename Iterator>
+    void serializePackedTo(Iterator iter, size_t count, NetMessageSink &sink) const {
+      typedef typename std::iterator_traits<Iterator>::value_type T;
+      char buffer[PACKED_CHUNK_SIZE];
+      size_t used;
+
+      used = NetMessage::writeDataBlockHeader(count * sizeof(T), true, buffer);
+      for (size_t i = 0; i < count; ++i, ++iter) {
+        if (used + sizeof(T) > PACKED_CHUNK_SIZE) {
+          sink.write(buffer, used);
+          used = 0;
+        }
+        PackedArray<T>::encode(&(*iter), 1, &(buffer[used]));
+        used += sizeof(T);
+      }
+      sink.write(buffer, used);
+    }
+
+    // Same as above for values contiguous in memory, encoded by chunks
+    template <typename T>
+    void serializePackedTo(const T *array, size_t count, NetMessageSink &sink) const {
+      char buffer[PACKED_CHUNK_SIZE];
+      size_t chunk = PACKED_CHUNK_SIZE / sizeof(T);
+      size_t used;
+
+      used = NetMessage::writeDataBlockHeader(count * sizeof(T), true, buffer);
+      sink.write(buffer, used);
+      for (size_t i = 0; i < count; i += chunk) {
+        size_t toEncode = (count - i < chunk) ? count - i : chunk;
+        PackedArray<T>::encode(&(array[i]), toEncode, buffer);
+        sink.write(buffer, toEncode * sizeof(T));
+      }
+    }
+
     //! \brief Serializes an char
     //! \param[in] c the char to serialize
     //! \param[in] message messate to add, or NULL for none
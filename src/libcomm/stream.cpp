@@ -1,13 +1,31 @@
 #include "stream.h"
 #include "types_utils.h"
+#include "io_uring_engine.h"
 
 #include <errno.h>
+#include <poll.h>
+#include <set>
 
-#define computeStreamWFRSets(fd, fdsReadPtr, fdsWritePtr, fdsErrorPtr)\
-   (StreamWFRSet)\
-   (((fdsReadPtr != NULL) ? (FD_ISSET(fd, fdsReadPtr) & 0x1) : 0)\
-  | ((fdsWritePtr != NULL) ? (FD_ISSET(fd, fdsWritePtr) << 1 & 0x2) : 0)\
-  | ((fdsErrorPtr != NULL) ? (FD_ISSET(fd, fdsErrorPtr) << 2 & 0x3) : 0))
+static short setsToPollEvents(StreamWFRSet sets) {
+  short events = 0;
+
+  if ((sets & STREAM_WFR_READ) != 0) events |= POLLIN;
+  if ((sets & STREAM_WFR_WRITE) != 0) events |= POLLOUT;
+  if ((sets & STREAM_WFR_ERROR) != 0) events |= POLLPRI;
+
+  return events;
+}
+
+// Errors and hang ups make a stream readable or writable, as with select
+static StreamWFRSet pollEventsToSets(short events, StreamWFRSet sets) {
+  int resultSets = STREAM_WFR_NONE;
+
+  if ((events & (POLLIN | POLLHUP | POLLERR)) != 0) resultSets |= STREAM_WFR_READ;
+  if ((events & (POLLOUT | POLLERR)) != 0) resultSets |= STREAM_WFR_WRITE;
+  if ((events & POLLPRI) != 0) resultSets |= STREAM_WFR_ERROR;
+
+  return (StreamWFRSet) (resultSets & sets);
+}
 
 bool StreamWFRResult::setIsNone(void) {
   return (sets == STREAM_WFR_NONE);
@@ -44,121 +62,88 @@ StreamWFRResult::StreamWFRResult(int index, StreamWFRSet sets, int code, std::st
 StreamWFRResult::~StreamWFRResult(void) {
 }
 
-StreamWFRResult Stream::waitForReady2(StreamWFRSet sets, timespec *timeout) {
-  fd_set fdsRead, fdsWrite, fdsError;
-  fd_set *fdsReadPtr, *fdsWritePtr, *fdsErrorPtr;
-  fdsReadPtr = fdsWritePtr = fdsErrorPtr = NULL;
+// Data received ahead by io_uring is no longer in fd
+bool Stream::hasReadAhead(StreamWFRSet sets) {
+  return ((sets & STREAM_WFR_READ) != 0) && (readEngine != NULL)
+    && readEngine->hasReadData();
+}
 
-  int resultSelect;
+StreamWFRResult Stream::waitForReady2(StreamWFRSet sets, timespec *timeout) {
+  struct pollfd pfd;
+  timespec noWait = {0, 0};
+  bool readAhead = hasReadAhead(sets);
+  int resultPoll;
   int index = 0;
-  StreamWFRSet resultSets = STREAM_WFR_NONE;
 
-  FD_ZERO(&fdsRead);
-  FD_ZERO(&fdsWrite);
-  FD_ZERO(&fdsError);
+  // poll has no limit on the value of fd, unlike select
+  pfd.fd = fd;
+  pfd.events = setsToPollEvents(sets);
+  pfd.revents = 0;
 
-  if ((sets & STREAM_WFR_READ) != 0) {
-    FD_SET(fd, &fdsRead);
-    fdsReadPtr = &fdsRead;
-  }
-  if ((sets & STREAM_WFR_WRITE) != 0) {
-    FD_SET(fd, &fdsWrite);
-    fdsWritePtr = &fdsWrite;
+  resultPoll = ppoll(&pfd, 1, readAhead ? &noWait : timeout, NULL);
+  if (readAhead && (resultPoll != -1)) {
+    pfd.revents |= POLLIN;
+    resultPoll = 1;
   }
-  if ((sets & STREAM_WFR_ERROR) != 0)  {
-    FD_SET(fd, &fdsError);
-    fdsErrorPtr = &fdsError;
-  }
-
-  resultSelect = pselect(fd+1, fdsReadPtr, fdsWritePtr, fdsErrorPtr, timeout, NULL);
   
-  switch (resultSelect) {
+  switch (resultPoll) {
     case -1:
-      resultSets = computeStreamWFRSets(fd, fdsReadPtr, fdsWritePtr, fdsErrorPtr);
-      return StreamWFRResult(index, resultSets, errno);
+      return StreamWFRResult(index, STREAM_WFR_NONE, errno);
     case 0:
       index = -1;
-      return StreamWFRResult(index, resultSets, EX_STREAM_TIMEOUT, "Timeout on waitForReady.");
+      return StreamWFRResult(index, STREAM_WFR_NONE, EX_STREAM_TIMEOUT, "Timeout on waitForReady.");
     default:
-      resultSets = computeStreamWFRSets(fd, fdsReadPtr, fdsWritePtr, fdsErrorPtr);
-      return StreamWFRResult(index, resultSets);
+      return StreamWFRResult(index, pollEventsToSets(pfd.revents, sets));
   }
 }
 
-#include <iostream>
+// Streams appearing twice in the vector are reported with their first index
+// only: the other entries are given a negative fd, which poll ignores.
 void Stream::waitForReady2(const std::vector<Stream*> *streams, StreamWFRSet sets,
   timespec *timeout, std::vector<StreamWFRResult> *result) {
-  
-  std::vector<Stream*>::const_iterator iter;
-  fd_set fdsRead, fdsWrite, fdsError;
-  fd_set *fdsReadPtr, *fdsWritePtr, *fdsErrorPtr;
-  fdsReadPtr = fdsWritePtr = fdsErrorPtr = NULL;
-  fd_set* nullPtr = NULL;
-
-  int highestFd = 0;
-  int resultSelect;
-
-  FD_ZERO(&fdsRead);
-  FD_ZERO(&fdsWrite);
-  FD_ZERO(&fdsError);
-
-  bool read = (sets & STREAM_WFR_READ) != 0;
-  bool write = (sets & STREAM_WFR_WRITE) != 0;
-  bool error = (sets & STREAM_WFR_ERROR) != 0;
-
-  if (read | write | error) {
-    for (iter = streams->begin(); iter != streams->end(); ++iter) {
-      Stream *stream = *iter;
-      if (stream != NULL) {
-        if (read) {
-          FD_SET(stream->fd, &fdsRead);
-          fdsReadPtr = &fdsRead;
-        }
-        if (write) {
-          FD_SET(stream->fd, &fdsWrite);
-          fdsWritePtr = &fdsWrite;
-        }
-        if (error)  {
-          FD_SET(stream->fd, &fdsError);
-          fdsErrorPtr = &fdsError;
-        }
-        if (highestFd < stream->fd) highestFd = stream->fd;
-      }
+  std::vector<struct pollfd> pfds(streams->empty() ? 1 : streams->size());
+  std::set<int> fds;
+  std::vector<bool> readAhead(streams->size(), false);
+  short events = setsToPollEvents(sets);
+  timespec noWait = {0, 0};
+  int nbReadAhead = 0;
+  int resultPoll;
+
+  for (size_t i = 0; i<streams->size(); ++i) {
+    Stream *stream = (*streams)[i];
+
+    pfds[i].fd = -1;
+    pfds[i].events = events;
+    pfds[i].revents = 0;
+    if ((stream != NULL) && (events != 0) && fds.insert(stream->fd).second) {
+      pfds[i].fd = stream->fd;
+      readAhead[i] = stream->hasReadAhead(sets);
+      if (readAhead[i]) ++nbReadAhead;
     }
   }
- 
-  resultSelect = pselect(highestFd+1, fdsReadPtr, fdsWritePtr, fdsErrorPtr, timeout, NULL);
-  
-  if (result != NULL) {
-    Stream *stream;
-    StreamWFRSet resultSets;
 
-    switch (resultSelect) {
+  resultPoll = ppoll(&pfds[0], streams->size(), (nbReadAhead > 0) ? &noWait : timeout, NULL);
+  if ((nbReadAhead > 0) && (resultPoll != -1)) {
+    for (size_t i = 0; i<streams->size(); ++i) {
+      if (readAhead[i]) pfds[i].revents |= POLLIN;
+    }
+    resultPoll += nbReadAhead;
+  }
+
+  if (result != NULL) {
+    switch (resultPoll) {
       case -1:
-        for (size_t i = 0; i<streams->size(); ++i) {
-          std::cout << "HERE:" << i << std::endl;
-          stream = (*streams)[i];
-          if (stream != NULL) {
-            resultSets = computeStreamWFRSets(stream->fd, nullPtr, nullPtr, fdsErrorPtr);
-            if (resultSets != STREAM_WFR_NONE) {
-              result->push_back(StreamWFRResult(i, resultSets, errno));
-            } 
-          }
-        }
+        result->push_back(StreamWFRResult(-1, STREAM_WFR_NONE, errno));
         break;
       case 0:
-        resultSets = STREAM_WFR_NONE;
-        result->push_back(StreamWFRResult(-1, resultSets, EX_STREAM_TIMEOUT,
+        result->push_back(StreamWFRResult(-1, STREAM_WFR_NONE, EX_STREAM_TIMEOUT,
           "Timeout on waitForReady."));
         break;
       default:
         for (size_t i = 0; i<streams->size(); ++i) {
-          stream = (*streams)[i];
-          if (stream != NULL) {
-            resultSets = computeStreamWFRSets(stream->fd, fdsReadPtr, fdsWritePtr, fdsErrorPtr);
-            if (resultSets != STREAM_WFR_NONE) {
-              result->push_back(StreamWFRResult(i, resultSets));
-            } 
+          StreamWFRSet resultSets = pollEventsToSets(pfds[i].revents, sets);
+          if ((pfds[i].fd >= 0) && (resultSets != STREAM_WFR_NONE)) {
+            result->push_back(StreamWFRResult(i, resultSets));
           }
         }
         break;
@@ -166,12 +151,58 @@ void Stream::waitForReady2(const std::vector<Stream*> *streams, StreamWFRSet set
   }
 }
 
+Stream::Stream(void): ioUringEnabled(false), readEngine(NULL),
+  writeEngine(NULL) {
+}
+
 Stream::~Stream(void) {
+  deleteEngines();
+}
+
+IoUringEngine *Stream::getReadEngine(void) {
+  if (ioUringEnabled && (readEngine == NULL)) {
+    try {
+      readEngine = new IoUringEngine(fd);
+    } catch (Exception &e) {
+      ioUringEnabled = false;
+    }
+  }
+  return readEngine;
+}
+
+IoUringEngine *Stream::getWriteEngine(void) {
+  if (ioUringEnabled && (writeEngine == NULL)) {
+    try {
+      writeEngine = new IoUringEngine(fd);
+    } catch (Exception &e) {
+      ioUringEnabled = false;
+    }
+  }
+  return writeEngine;
+}
+
+void Stream::deleteEngines(void) {
+  delete readEngine;
+  delete writeEngine;
+  readEngine = writeEngine = NULL;
+}
+
+void Stream::setIoUringEnabled(bool enable) {
+  ioUringEnabled = enable && IoUringEngine::isSupported();
+  if (!ioUringEnabled) {
+    deleteEngines();
+  }
+}
+
+bool Stream::getIoUringEnabled(void) const {
+  return ioUringEnabled;
 }
 
 void Stream::closeStream(void) {
   int result;
   
+  // The rings hold a reference on fd
+  deleteEngines();
   result = close(fd);
   if (result == -1) {
     throw Stream::StreamException(errno); 
@@ -17,21 +17,53 @@ enum StreamWFRSet {
 };
 
 class StreamWFRResult;
+class IoUringEngine;
 
 class Stream {
+  private:
+    bool ioUringEnabled;
+    IoUringEngine *readEngine;
+    IoUringEngine *writeEngine;
+
   protected:
     int fd;
 
+    Stream(void);
+
+    // Engines of the stream when io_uring is enabled, NULL otherwise. They are
+    // created on first use, and io_uring is disabled if that fails.
+    IoUringEngine *getReadEngine(void);
+    IoUringEngine *getWriteEngine(void);
+    void deleteEngines(void);
+    bool hasReadAhead(StreamWFRSet sets);
+
     StreamWFRResult waitForReady2(StreamWFRSet sets, timespec *timeout);
     
     static void waitForReady2(const std::vector<Stream*> *streams, StreamWFRSet sets,
       timespec *timeout, std::vector<StreamWFRResult> *result);
 
     friend class StreamWFRResult;
+    friend class EventLoop;
+    friend class TcpSocket;
   public:
     
     virtual ~Stream(void);
     virtual void closeStream(void);
+
+    //! \brief Enables or disables io_uring
+    //! \param[in] enable true to enable it
+    //!
+    //! When enabled, TcpSocket and BufferedFile make their reads and writes
+    //! through io_uring (see IoUringEngine): big writes are submitted with a
+    //! single system call, and a socket receives into a ring of buffers from
+    //! which data arriving in bursts is read without a system call per read.
+    //! The data received ahead is accounted for by waitForReady. Other streams
+    //! are not concerned.
+    //! Nothing changes if the kernel lacks io_uring, which getIoUringEnabled
+    //! tells. It must be set before any read, since disabling it drops the
+    //! data received ahead. Disabled by default.
+    void setIoUringEnabled(bool enable);
+    bool getIoUringEnabled(void) const;
     
     StreamWFRResult waitForReady(StreamWFRSet sets);
     StreamWFRResult waitForReady(StreamWFRSet sets, uint64_t nanosec);
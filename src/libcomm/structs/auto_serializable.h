@@ -12,8 +12,6 @@
 
 #include "../libcomm.h"
 #include "../types_utils.h"
-#include <stdarg.h>
-#include <vector>
 #include <iostream>
 
 #define _QUOTEME(x) #x
@@ -43,7 +41,9 @@
 //! \li AUTO_SER_FIELD(type,name): primitive or object member;
 //! \li AUTO_SER_FIELD_PTR: pointer to a primitive or an object value;
 //! \li AUTO_SER_PRIMITIVE_FIELD: primitive only member;
-//! \li AUTO_SER_PRIMITIVE_FIELD_PTR: pointer to a primitive only value.
+//! \li AUTO_SER_PRIMITIVE_FIELD_PTR: pointer to a primitive only value;
+//! \li AUTO_SER_VARINT_FIELD: 16, 32 or 64 bits integer member, sent as a
+//!     varint (see NetMessage::setVarintEncoding).
 //!
 //! Note that macros declaring pointer fields take the value type as first
 //! argument, and not the pointer one. In the example, we declare a field
@@ -79,6 +79,13 @@
 //! Note that multiple inheritance is not supported; AutoSerializable must be
 //! the base class of only one superclass.
 //!
+//! The list of serialized fields is resolved at compile time: serialize and
+//! deserialize are expanded field by field, without any table to fill at
+//! runtime. When all the fields know their serialized size (primitive values,
+//! containers, String, Buffer, AutoSerializable objects), the object also
+//! encodes itself by pieces without building its NetMessage (see
+//! Serializable::serializeTo).
+//!
 //! Each user defined Serializable class must be register at program
 //! initialization. AutoSerializable classes need to be registered with the
 //! addSupportForAutoSerializable function.
@@ -97,26 +104,26 @@ class AutoSerializable : public Serializable {
     friend class libcomm;
   protected :
     //helpers
-    char *cvrtochars(uint8_t uint, size_t &size);
-    void cvrtochars(uint8_t uint, char *data, size_t &size);
-    char *cvrtochars(uint16_t uint, size_t &size);
-    void cvrtochars(uint16_t uint, char *data, size_t &size);
-    char *cvrtochars(uint32_t uint, size_t &size);
-    void cvrtochars(uint32_t uint, char *data, size_t &size);
-    char *cvrtochars(uint64_t uint, size_t &size);
-    void cvrtochars(uint64_t uint, char *data, size_t &size);
-    char *cvrtochars(int8_t i, size_t &size);
-    void cvrtochars(int8_t i, char *data, size_t &size);
-    char *cvrtochars(int16_t i, size_t &size);
-    void cvrtochars(int16_t i, char *data, size_t &size);
-    char *cvrtochars(int32_t i, size_t &size);
-    void cvrtochars(int32_t i, char *data, size_t &size);
-    char *cvrtochars(int64_t i, size_t &size);
-    void cvrtochars(int64_t i, char *data, size_t &size);
-    char *cvrtochars(float f, size_t &size);
-    void cvrtochars(float f, char *data, size_t &size);
-    char *cvrtochars(double d, size_t &size);
-    void cvrtochars(double d, char *data, size_t &size);
+    static char *cvrtochars(uint8_t uint, size_t &size);
+    static void cvrtochars(uint8_t uint, char *data, size_t &size);
+    static char *cvrtochars(uint16_t uint, size_t &size);
+    static void cvrtochars(uint16_t uint, char *data, size_t &size);
+    static char *cvrtochars(uint32_t uint, size_t &size);
+    static void cvrtochars(uint32_t uint, char *data, size_t &size);
+    static char *cvrtochars(uint64_t uint, size_t &size);
+    static void cvrtochars(uint64_t uint, char *data, size_t &size);
+    static char *cvrtochars(int8_t i, size_t &size);
+    static void cvrtochars(int8_t i, char *data, size_t &size);
+    static char *cvrtochars(int16_t i, size_t &size);
+    static void cvrtochars(int16_t i, char *data, size_t &size);
+    static char *cvrtochars(int32_t i, size_t &size);
+    static void cvrtochars(int32_t i, char *data, size_t &size);
+    static char *cvrtochars(int64_t i, size_t &size);
+    static void cvrtochars(int64_t i, char *data, size_t &size);
+    static char *cvrtochars(float f, size_t &size);
+    static void cvrtochars(float f, char *data, size_t &size);
+    static char *cvrtochars(double d, size_t &size);
+    static void cvrtochars(double d, char *data, size_t &size);
 
   protected :
     AutoSerializable();
@@ -217,10 +224,11 @@ class AutoSerializable : public Serializable {
 #define AUTO_SER_FIELD(type,name) \
   private:\
   type name; \
-  AUTO_SER_ENTRY_POINTS(name) \
-  AUTO_SER_RETURN_SIZE_PRIMITIVE(name,type) \
-  AUTO_SER_FIELD_SERIALIZE(name) \
-  AUTO_SER_FIELD_DESERIALIZE(type,name) \
+  struct autoSerField##name { \
+    static const size_t primitiveSize = 0; \
+    AUTO_SER_FIELD_SERIALIZE(name) \
+    AUTO_SER_FIELD_DESERIALIZE(type,name) \
+  };
 
 //! \def AUTO_SER_FIELD_2(type,name)
 //! \brief Add a serialisable field
@@ -232,10 +240,11 @@ class AutoSerializable : public Serializable {
 #define AUTO_SER_FIELD_2(type1,type2,name) \
   private:\
   type1,type2 name; \
-  AUTO_SER_ENTRY_POINTS(name) \
-  AUTO_SER_RETURN_SIZE_PRIMITIVE_2(name,type1,type2) \
-  AUTO_SER_FIELD_SERIALIZE(name) \
-  AUTO_SER_FIELD_DESERIALIZE_2(type1,type2,name) \
+  struct autoSerField##name { \
+    static const size_t primitiveSize = 0; \
+    AUTO_SER_FIELD_SERIALIZE(name) \
+    AUTO_SER_FIELD_DESERIALIZE_2(type1,type2,name) \
+  };
 
 
 #define AUTO_SER_FIELD_PTR_WITH_GET(type,name) \
@@ -246,7 +255,7 @@ class AutoSerializable : public Serializable {
   }
 
 #define AUTO_SER_FIELD_PTR_WITH_GET_2(type1,type2,name) \
-  AUTO_SER_FIELD_PTR(type1,type2,name)\
+  AUTO_SER_FIELD_PTR_2(type1,type2,name)\
   public:\
   const type1,type2 *get##name() const { \
     return name;\
@@ -289,18 +298,20 @@ class AutoSerializable : public Serializable {
 #define AUTO_SER_FIELD_PTR(type,name) \
   private:\
   type *name; \
-  AUTO_SER_ENTRY_POINTS(name) \
-  AUTO_SER_RETURN_SIZE_PRIMITIVE(name,type) \
-  AUTO_SER_FIELD_SERIALIZE(name) \
-  AUTO_SER_FIELD_DESERIALIZE_PTR(type,name) \
+  struct autoSerField##name { \
+    static const size_t primitiveSize = 0; \
+    AUTO_SER_FIELD_SERIALIZE(name) \
+    AUTO_SER_FIELD_DESERIALIZE_PTR(type,name) \
+  };
 
 #define AUTO_SER_FIELD_PTR_2(type1,type2,name) \
   private:\
   type1,type2 *name; \
-  AUTO_SER_ENTRY_POINTS(name) \
-  AUTO_SER_RETURN_SIZE_PRIMITIVE_2(name,type1,type2) \
-  AUTO_SER_FIELD_SERIALIZE(name) \
-  AUTO_SER_FIELD_DESERIALIZE_PTR_2(type1,type2,name) \
+  struct autoSerField##name { \
+    static const size_t primitiveSize = 0; \
+    AUTO_SER_FIELD_SERIALIZE(name) \
+    AUTO_SER_FIELD_DESERIALIZE_PTR_2(type1,type2,name) \
+  };
 
 
 #define AUTO_SER_PRIMITIVE_FIELD_WITH_GET(type,name) \
@@ -330,10 +341,11 @@ class AutoSerializable : public Serializable {
 #define AUTO_SER_PRIMITIVE_FIELD(type,name) \
   private:\
   type name; \
-  AUTO_SER_ENTRY_POINTS(name) \
-  AUTO_SER_RETURN_SIZE_PRIMITIVE(name,type) \
-  AUTO_SER_PRIMITIVE_FIELD_SERIALIZE(name) \
-  AUTO_SER_PRIMITIVE_FIELD_DESERIALIZE(type,name) \
+  struct autoSerField##name { \
+    static const size_t primitiveSize = sizeof(type); \
+    AUTO_SER_PRIMITIVE_FIELD_SERIALIZE(name) \
+    AUTO_SER_PRIMITIVE_FIELD_DESERIALIZE(type,name) \
+  };
 
 #define AUTO_SER_PRIMITIVE_FIELD_PTR_WITH_GET(type,name) \
   AUTO_SER_PRIMITIVE_FIELD_PTR(type,name)\
@@ -362,42 +374,89 @@ class AutoSerializable : public Serializable {
 #define AUTO_SER_PRIMITIVE_FIELD_PTR(type,name) \
   private:\
   type *name; \
-  AUTO_SER_ENTRY_POINTS(name) \
-  AUTO_SER_RETURN_SIZE_PRIMITIVE(name,type) \
-  AUTO_SER_PRIMITIVE_FIELD_SERIALIZE_PTR(name) \
-  AUTO_SER_PRIMITIVE_FIELD_DESERIALIZE_PTR(type,name) \
+  struct autoSerField##name { \
+    static const size_t primitiveSize = sizeof(type); \
+    AUTO_SER_PRIMITIVE_FIELD_SERIALIZE_PTR(name) \
+    AUTO_SER_PRIMITIVE_FIELD_DESERIALIZE_PTR(type,name) \
+  };
+
+#define AUTO_SER_VARINT_FIELD_WITH_GET(type,name) \
+  AUTO_SER_VARINT_FIELD(type,name) \
+  public:\
+  const type &get##name() const { \
+    return name;\
+  }
 
+#define AUTO_SER_VARINT_FIELD_WITH_SET(type,name) \
+  AUTO_SER_VARINT_FIELD(type,name) \
+  public:\
+  void set##name(type name) { \
+    this->name = name;\
+  }
 
-#define AUTO_SER_ENTRY_POINTS(name) \
-  private:\
-  template <typename T>\
-  static NetMessage *serializeEntryPointMember##name(void* pthis,MyType<T> t,NetMessage *m, char *data, size_t &size) {\
-    T* p = (T*) pthis;\
-    return p->serializeMember##name(m, data, size);\
+#define AUTO_SER_VARINT_FIELD_WITH_GET_AND_SET(type,name) \
+  AUTO_SER_VARINT_FIELD(type,name) \
+  public:\
+  const type &get##name() const { \
+    return name;\
   }\
-
-#define AUTO_SER_RETURN_SIZE_PRIMITIVE(name,type) \
-  static size_t returnSizePrimitive##name(void) {\
-    return sizeof(type);\
+  void set##name(type name) { \
+    this->name = name;\
   }
 
-#define AUTO_SER_RETURN_SIZE_PRIMITIVE_2(name,type1,type2) \
-  static size_t returnSizePrimitive##name(void) {\
-    return sizeof(type1,type2);\
-  }
+// Sent as a primitive NetMessage with its own header, which is worth it for
+// values which are usually small
+#define AUTO_SER_VARINT_FIELD(type,name) \
+  private:\
+  type name; \
+  struct autoSerField##name { \
+    static const size_t primitiveSize = 0; \
+    AUTO_SER_VARINT_FIELD_SERIALIZE(name) \
+    AUTO_SER_FIELD_DESERIALIZE(type,name) \
+  };
+
+
+// Each field is described by a nested struct autoSerField##name with a
+// primitiveSize constant and static serialize and deserialize functions.
 
 #define AUTO_SER_FIELD_SERIALIZE(name) \
-   NetMessage *serializeMember##name(NetMessage *m, char *data, size_t &currentPos) { \
+  static NetMessage *serialize(const className *c, NetMessage *m, char *data, size_t &currentPos) { \
     if (m != NULL) { \
       return SerializationManager::getSerializationManager()->\
-        serialize(name,m);\
+        serialize(c->name,m);\
     }\
     return m;\
+  }\
+  AUTO_SER_FIELD_SERIALIZE_TO(name,varint)
+
+#define AUTO_SER_VARINT_FIELD_SERIALIZE(name) \
+  static NetMessage *serialize(const className *c, NetMessage *m, char *data, size_t &currentPos) { \
+    if (m != NULL) { \
+      return SerializationManager::getSerializationManager()->\
+        serializeVarint(c->name,m);\
+    }\
+    return m;\
+  }\
+  AUTO_SER_FIELD_SERIALIZE_TO(name,true)
+
+// Streamed serialization of a field sent as a nested NetMessage (see
+// Serializable::serializeTo), with varints if fieldVarint is true.
+// getSerializedSize adds the size of the field to size, and returns false if
+// the field does not know it.
+#define AUTO_SER_FIELD_SERIALIZE_TO(name,fieldVarint) \
+  static bool getSerializedSize(const className *c, bool varint, size_t &size) { \
+    size_t fieldSize = SerializationManager::getSerializationManager()->\
+      getSerializedSize(c->name,fieldVarint);\
+    size += fieldSize;\
+    return (fieldSize != 0);\
+  }\
+  static void serializeTo(const className *c, NetMessageSink &sink, bool varint) { \
+    SerializationManager::getSerializationManager()->\
+      serializeTo(c->name,sink,fieldVarint);\
   }
 
 #define AUTO_SER_FIELD_DESERIALIZE(type,name) \
-  template <typename T> \
-  static void deserializeMember##name(T *c,\
+  static void deserialize(className *c,\
     const NetMessage &data, size_t blockIndex, size_t &offset, size_t &netMessageIndex) { \
     const std::vector<NetMessage*> &messages = data.getMessages();\
     type* ser = (type*) SerializationManager::getSerializationManager()->deserialize(*(messages[netMessageIndex]),false);\
@@ -409,8 +468,7 @@ class AutoSerializable : public Serializable {
   }\
 
 #define AUTO_SER_FIELD_DESERIALIZE_2(type1,type2,name) \
-  template <typename T> \
-  static void deserializeMember##name(T *c,\
+  static void deserialize(className *c,\
     const NetMessage &data, size_t blockIndex, size_t &offset, size_t &netMessageIndex) { \
     const std::vector<NetMessage*> &messages = data.getMessages();\
     type1,type2* ser = (type1,type2*) SerializationManager::getSerializationManager()->deserialize(*(messages[netMessageIndex]),false);\
@@ -422,8 +480,7 @@ class AutoSerializable : public Serializable {
   }\
 
 #define AUTO_SER_FIELD_DESERIALIZE_PTR(type,name) \
-  template <typename T> \
-  static void deserializeMember##name(T *c,\
+  static void deserialize(className *c,\
     const NetMessage &data, size_t blockIndex, size_t &offset, size_t &netMessageIndex) { \
     const std::vector<NetMessage*> &messages = data.getMessages();\
     type* ser = (type*) SerializationManager::getSerializationManager()->deserialize(*(messages[netMessageIndex]),false);\
@@ -434,8 +491,7 @@ class AutoSerializable : public Serializable {
   }\
 
 #define AUTO_SER_FIELD_DESERIALIZE_PTR_2(type1,type2,name) \
-  template <typename T> \
-  static void deserializeMember##name(T *c,\
+  static void deserialize(className *c,\
     const NetMessage &data, size_t blockIndex, size_t &offset, size_t &netMessageIndex) { \
     const std::vector<NetMessage*> &messages = data.getMessages();\
     type1,type2* ser = (type1,type2*) SerializationManager::getSerializationManager()->deserialize(*(messages[netMessageIndex]),false);\
@@ -447,16 +503,26 @@ class AutoSerializable : public Serializable {
 
     
 #define AUTO_SER_PRIMITIVE_FIELD_SERIALIZE(name) \
-  NetMessage *serializeMember##name(NetMessage *m, char *data, size_t &currentPos) { \
-    cvrtochars(name, &(data[currentPos]), currentPos);\
+  static NetMessage *serialize(const className *c, NetMessage *m, char *data, size_t &currentPos) { \
+    className::cvrtochars(c->name, &(data[currentPos]), currentPos);\
     return m;\
-   }
+   }\
+  AUTO_SER_PRIMITIVE_FIELD_SERIALIZE_TO
 
 #define AUTO_SER_PRIMITIVE_FIELD_SERIALIZE_PTR(name) \
-  NetMessage *serializeMember##name(NetMessage *m, char *data, size_t &currentPos) { \
-    cvrtochars(*name, &(data[currentPos]), currentPos);\
+  static NetMessage *serialize(const className *c, NetMessage *m, char *data, size_t &currentPos) { \
+    className::cvrtochars(*(c->name), &(data[currentPos]), currentPos);\
     return m;\
-   }
+   }\
+  AUTO_SER_PRIMITIVE_FIELD_SERIALIZE_TO
+
+// Primitive fields are streamed with the data block of their class
+#define AUTO_SER_PRIMITIVE_FIELD_SERIALIZE_TO \
+  static bool getSerializedSize(const className *c, bool varint, size_t &size) { \
+    return true;\
+  }\
+  static void serializeTo(const className *c, NetMessageSink &sink, bool varint) { \
+  }
 
 
 #define AUTO_SER_CONVERT_uint8_t(x) convertToUInt8(x)
@@ -472,15 +538,13 @@ class AutoSerializable : public Serializable {
 #define AUTO_SER_CONVERT_char(x) (char) convertToUInt8(x)
 
 #define AUTO_SER_PRIMITIVE_FIELD_DESERIALIZE(type,name) \
-  template <typename T> \
-  static void deserializeMember##name(T *c,\
+  static void deserialize(className *c,\
     const NetMessage &data, size_t blockIndex, size_t &offset, size_t &netMessageIndex) { \
     c->name = (type) AUTO_SER_CONVERT_##type(data.getDataFromBlock(blockIndex,offset,sizeof(type)));\
   }\
 
 #define AUTO_SER_PRIMITIVE_FIELD_DESERIALIZE_PTR(type,name) \
-  template <typename T> \
-  static void deserializeMember##name(T *c,\
+  static void deserialize(className *c,\
     const NetMessage &data, size_t blockIndex, size_t &offset, size_t &netMessageIndex) { \
     type converted = (type) AUTO_SER_CONVERT_##type(data.getDataFromBlock(blockIndex,offset,sizeof(type)));\
     type *convertedPtr = new type;\
@@ -491,10 +555,69 @@ class AutoSerializable : public Serializable {
 //! \def ITEM(name)
 //! \brief Macro to use when passing args to AUTO_SER_STUFF().
 //! \param name name of the field
-#define ITEM(name) \
-  (className::autoSerSerializeFunc) className::serializeEntryPointMember##name,\
-  (className::autoSerDeserialiseFunc) className::deserializeMember##name,\
-  (className::autoSerReturnSizePrimitive) className::returnSizePrimitive##name
+#define ITEM(name) autoSerField##name
+
+// Compile time list of the serialized fields of a class. Each Field is one
+// of the autoSerField##name structs generated by the AUTO_SER field macros.
+template <typename... Fields>
+struct AutoSerFieldList;
+
+template <>
+struct AutoSerFieldList<> {
+  static const size_t count = 0;
+  static const size_t primitiveSize = 0;
+
+  template <typename C>
+  static NetMessage *serialize(const C *c, NetMessage *m, char *data, size_t &currentPos) {
+    return m;
+  }
+
+  template <typename C>
+  static bool getSerializedSize(const C *c, bool varint, size_t &size) {
+    return true;
+  }
+
+  template <typename C>
+  static void serializeTo(const C *c, NetMessageSink &sink, bool varint) {
+  }
+
+  template <typename C>
+  static void deserialize(C *c, const NetMessage &data, size_t blockIndex,
+    size_t &offset, size_t &netMessageIndex) {
+  }
+};
+
+template <typename Field, typename... Fields>
+struct AutoSerFieldList<Field, Fields...> {
+  static const size_t count = 1 + AutoSerFieldList<Fields...>::count;
+  static const size_t primitiveSize = Field::primitiveSize
+    + AutoSerFieldList<Fields...>::primitiveSize;
+
+  template <typename C>
+  static NetMessage *serialize(const C *c, NetMessage *m, char *data, size_t &currentPos) {
+    m = Field::serialize(c, m, data, currentPos);
+    return AutoSerFieldList<Fields...>::serialize(c, m, data, currentPos);
+  }
+
+  template <typename C>
+  static bool getSerializedSize(const C *c, bool varint, size_t &size) {
+    if (!Field::getSerializedSize(c, varint, size)) return false;
+    return AutoSerFieldList<Fields...>::getSerializedSize(c, varint, size);
+  }
+
+  template <typename C>
+  static void serializeTo(const C *c, NetMessageSink &sink, bool varint) {
+    Field::serializeTo(c, sink, varint);
+    AutoSerFieldList<Fields...>::serializeTo(c, sink, varint);
+  }
+
+  template <typename C>
+  static void deserialize(C *c, const NetMessage &data, size_t blockIndex,
+    size_t &offset, size_t &netMessageIndex) {
+    Field::deserialize(c, data, blockIndex, offset, netMessageIndex);
+    AutoSerFieldList<Fields...>::deserialize(c, data, blockIndex, offset, netMessageIndex);
+  }
+};
 
 
 //! \def AUTO_SER_STUFF(...)
@@ -503,15 +626,15 @@ class AutoSerializable : public Serializable {
 //! \param ... list of fields (each one as arg of the ITEM(name) macro).
 #define AUTO_SER_STUFF(...) \
   AUTO_SER_CLASS_OTHER_FUNCS \
-  AUTO_SER_CLASS_INIT_MEMBERS(__VA_ARGS__)\
+  AUTO_SER_CLASS_FIELDS(__VA_ARGS__)\
   AUTO_SER_CLASS_SER_FUNCS
 
 //! \def AUTO_SER_STUFF_WITHOUT_MEMBERS
 //! \brief Add main serialization functions
-//! \param 
+//! \param
 #define AUTO_SER_STUFF_WITHOUT_MEMBERS \
   AUTO_SER_CLASS_OTHER_FUNCS \
-  AUTO_SER_CLASS_INIT_MEMBERS_EMPTY\
+  AUTO_SER_CLASS_FIELDS()\
   AUTO_SER_CLASS_SER_FUNCS
 
 //! \def AUTO_SER_STUFF_WITH_SUPERCLASS(superclass,...)
@@ -521,7 +644,7 @@ class AutoSerializable : public Serializable {
 //! \param ... list of fields (each one as arg of the ITEM(name) macro).
 #define AUTO_SER_STUFF_WITH_SUPERCLASS(superclass,...) \
   AUTO_SER_CLASS_OTHER_FUNCS \
-  AUTO_SER_CLASS_INIT_MEMBERS(__VA_ARGS__)\
+  AUTO_SER_CLASS_FIELDS(__VA_ARGS__)\
   AUTO_SER_CLASS_SUPERCLASS_SER_FUNCS(superclass)
 
 //! \def AUTO_SER_STUFF_WITH_SUPERCLASS_WITHOUT_MEMBERS(superclass)
@@ -529,69 +652,31 @@ class AutoSerializable : public Serializable {
 //! \param superclass the name of the superclass
 #define AUTO_SER_STUFF_WITH_SUPERCLASS_WITHOUT_MEMBERS(superclass) \
   AUTO_SER_CLASS_OTHER_FUNCS \
-  AUTO_SER_CLASS_INIT_MEMBERS_EMPTY\
+  AUTO_SER_CLASS_FIELDS()\
   AUTO_SER_CLASS_SUPERCLASS_SER_FUNCS(superclass)
 
 #define AUTO_SER_CLASS_OTHER_FUNCS \
-  public:\
-  typedef NetMessage* (*autoSerSerializeFunc) (void*,MyType<className>,NetMessage*, char *data, size_t &currentPos);\
-  typedef void (*autoSerDeserialiseFunc) (className*,const NetMessage&, size_t blockIndex, size_t &offset, size_t &netMessageIndex);\
-  typedef size_t (*autoSerReturnSizePrimitive) (void);\
   private:\
-  MyType<className> classType;\
-  static std::vector<autoSerSerializeFunc> serFuncs;\
-  static std::vector<autoSerDeserialiseFunc> deserFuncs;\
-  static size_t sizePrimitiveFields;\
-  static void initMembers(int ph,...) {\
-    va_list ap;\
-    va_start(ap,ph);\
-    void* v = va_arg(ap,void*);\
-    int i = 0;\
-    while (v != NULL) {\
-      switch (i%3) {\
-        case 0:\
-          serFuncs.push_back((className::autoSerSerializeFunc) v);\
-          break;\
-        case 1:\
-          deserFuncs.push_back((className::autoSerDeserialiseFunc) v);\
-          break;\
-        case 2:\
-          sizePrimitiveFields += ((className::autoSerReturnSizePrimitive) v)();\
-          break;\
-      }\
-      ++i;\
-      v = va_arg(ap,void*);\
-    }\
-  }\
   static uint16_t type; \
   virtual uint16_t getType() const { \
     return type; \
   } \
   friend class libcomm;
 
-#define AUTO_SER_CLASS_INIT_MEMBERS(...) \
-  static void init() {\
-    initMembers(0,__VA_ARGS__,NULL);\
-  }
-
-#define AUTO_SER_CLASS_INIT_MEMBERS_EMPTY \
-  static void init() {\
-  }
+#define AUTO_SER_CLASS_FIELDS(...) \
+  typedef AutoSerFieldList<__VA_ARGS__> autoSerFields;
 
+// Primitive fields of a class are packed in one data block, which is sent
+// as soon as the class has fields, even when none of them is primitive.
 #define AUTO_SER_CLASS_SER_FUNCS \
   protected:\
   static Serializable *deserialize(const NetMessage &data, bool ptr) {\
     size_t blockIndex = 2;\
-    size_t offset = 0;\
     size_t netMessageIndex = 0;\
     className *c = new className();\
-    className **cptr = NULL; \
-    if (ptr) cptr = new className*();\
-    std::vector<autoSerDeserialiseFunc>::iterator it;\
-    for(it = deserFuncs.begin();it != deserFuncs.end();++it){\
-      (*it)(c,data,blockIndex,offset,netMessageIndex);\
-    }\
+    c->deserialize(data, blockIndex, netMessageIndex);\
     if (ptr) { \
+      className **cptr = new className*();\
       *cptr = c; \
       return (Serializable*) cptr; \
     } else { \
@@ -600,40 +685,45 @@ class AutoSerializable : public Serializable {
   }\
   void deserialize(const NetMessage &data, size_t &blockIndex, size_t &netMessageIndex) {\
     size_t offset = 0;\
-    std::vector<autoSerDeserialiseFunc>::iterator it;\
-    for(it=deserFuncs.begin();it != deserFuncs.end();++it){\
-      (*it)(this,data,blockIndex,offset,netMessageIndex);\
-    }\
-    blockIndex += 2;\
+    autoSerFields::deserialize(this, data, blockIndex, offset, netMessageIndex);\
+    if (autoSerFields::count != 0) blockIndex += 2;\
   }\
   virtual NetMessage *serialize() const {\
+    NetMessage *message = new NetMessage(getType());\
+    return serializeFields(message);\
+  }\
+  NetMessage *serializeFields(NetMessage *message) const {\
     char *data = NULL;\
     size_t currentPos = 0;\
-    if (sizePrimitiveFields != 0) data = (char*) malloc(sizePrimitiveFields);\
-    NetMessage *message = new NetMessage(getType());\
-    std::vector<autoSerSerializeFunc>::iterator it = serFuncs.begin();\
-    for(;it != serFuncs.end(); ++it){\
-      message = (*it)((void*)this,classType,message,data,currentPos);\
-    }\
-    if (sizePrimitiveFields != 0) message->addDataBlock(data, currentPos, true);\
+    if (autoSerFields::count == 0) return message;\
+    if (autoSerFields::primitiveSize != 0) data = message->allocateDataBlock(autoSerFields::primitiveSize);\
+    message = autoSerFields::serialize(this, message, data, currentPos);\
+    message->addDataBlock(data, currentPos, true);\
     return message;\
-  }
+  }\
+  bool getFieldsSize(bool varint, size_t &size) const {\
+    if (autoSerFields::count == 0) return true;\
+    size += autoSerFields::primitiveSize\
+      + NetMessage::getDataBlockHeaderSize(autoSerFields::primitiveSize);\
+    return autoSerFields::getSerializedSize(this, varint, size);\
+  }\
+  void serializeBlocksTo(NetMessageSink &sink) const {\
+    AUTO_SER_CLASS_BLOCK_TO\
+  }\
+  void serializeFieldsTo(NetMessageSink &sink, bool varint) const {\
+    autoSerFields::serializeTo(this, sink, varint);\
+  }\
+  AUTO_SER_CLASS_SERIALIZE_TO
 
 #define AUTO_SER_CLASS_SUPERCLASS_SER_FUNCS(superclass) \
   protected:\
   static Serializable *deserialize(const NetMessage &data, bool ptr) {\
     size_t blockIndex = 2;\
     size_t netMessageIndex = 0;\
-    size_t offset = 0;\
     className *c = new className();\
-    c->superclass::deserialize(data, blockIndex, netMessageIndex);\
-    className **cptr = NULL; \
-    if (ptr) cptr = new className*();\
-    std::vector<autoSerDeserialiseFunc>::iterator it;\
-    for(it = deserFuncs.begin();it != deserFuncs.end();++it){\
-      (*it)(c,data,blockIndex, offset,netMessageIndex);\
-    }\
+    c->deserialize(data, blockIndex, netMessageIndex);\
     if (ptr) { \
+      className **cptr = new className*();\
       *cptr = c; \
       return (Serializable*) cptr; \
     } else { \
@@ -643,30 +733,72 @@ class AutoSerializable : public Serializable {
   void deserialize(const NetMessage &data, size_t &blockIndex, size_t &netMessageIndex) {\
     size_t offset = 0;\
     superclass::deserialize(data, blockIndex, netMessageIndex);\
-    std::vector<autoSerDeserialiseFunc>::iterator it;\
-    for(it=deserFuncs.begin();it != deserFuncs.end();++it){\
-      (*it)(this,data,blockIndex,offset,netMessageIndex);\
-    }\
-    blockIndex += 2;\
+    autoSerFields::deserialize(this, data, blockIndex, offset, netMessageIndex);\
+    if (autoSerFields::count != 0) blockIndex += 2;\
   }\
   virtual NetMessage *serialize() const {\
+    NetMessage *message = superclass::serialize();\
+    return serializeFields(message);\
+  }\
+  NetMessage *serializeFields(NetMessage *message) const {\
     char *data = NULL;\
     size_t currentPos = 0;\
-    if (sizePrimitiveFields != 0) data = (char*) malloc(sizePrimitiveFields);\
-    NetMessage *message = superclass::serialize();\
-    std::vector<autoSerSerializeFunc>::iterator it = serFuncs.begin();\
-    for(;it != serFuncs.end(); ++it){\
-      message = (*it)((void*)this,classType,message,data,currentPos);\
-    }\
-    if (sizePrimitiveFields != 0) message->addDataBlock(data, currentPos, true);\
+    if (autoSerFields::count == 0) return message;\
+    if (autoSerFields::primitiveSize != 0) data = message->allocateDataBlock(autoSerFields::primitiveSize);\
+    message = autoSerFields::serialize(this, message, data, currentPos);\
+    message->addDataBlock(data, currentPos, true);\
     return message;\
+  }\
+  bool getFieldsSize(bool varint, size_t &size) const {\
+    if (!superclass::getFieldsSize(varint, size)) return false;\
+    if (autoSerFields::count == 0) return true;\
+    size += autoSerFields::primitiveSize\
+      + NetMessage::getDataBlockHeaderSize(autoSerFields::primitiveSize);\
+    return autoSerFields::getSerializedSize(this, varint, size);\
+  }\
+  void serializeBlocksTo(NetMessageSink &sink) const {\
+    superclass::serializeBlocksTo(sink);\
+    AUTO_SER_CLASS_BLOCK_TO\
+  }\
+  void serializeFieldsTo(NetMessageSink &sink, bool varint) const {\
+    superclass::serializeFieldsTo(sink, varint);\
+    autoSerFields::serializeTo(this, sink, varint);\
+  }\
+  AUTO_SER_CLASS_SERIALIZE_TO
+
+
+// Streamed serialization (see Serializable::serializeTo). As with serialize,
+// the data blocks of the classes of the hierarchy come first, from the base
+// class down, then their nested fields.
+#define AUTO_SER_CLASS_SERIALIZE_TO \
+  virtual size_t getSerializedSize(bool varint) const {\
+    size_t size = 0;\
+    if (!getFieldsSize(varint, size)) return 0;\
+    return size + NetMessage::getMessageHeaderSize(size);\
+  }\
+  virtual void serializeTo(NetMessageSink &sink, bool varint) const {\
+    char header[NET_MESSAGE_MAX_HEADER_SIZE];\
+    size_t size = 0;\
+    if (!getFieldsSize(varint, size)) {\
+      Serializable::serializeTo(sink, varint);\
+      return;\
+    }\
+    sink.write(header, NetMessage::writeMessageHeader(getType(), size, header));\
+    serializeBlocksTo(sink);\
+    serializeFieldsTo(sink, varint);\
   }
 
+// Data block of the primitive fields of a class, as serializeFields adds it
+#define AUTO_SER_CLASS_BLOCK_TO \
+    char header[NET_MESSAGE_MAX_HEADER_SIZE];\
+    char data[autoSerFields::primitiveSize + 1];\
+    size_t currentPos = 0;\
+    if (autoSerFields::count == 0) return;\
+    autoSerFields::serialize(this, (NetMessage*) NULL, data, currentPos);\
+    sink.write(header, NetMessage::writeDataBlockHeader(currentPos, true, header));\
+    sink.write(data, currentPos);
 
 #define AUTO_SER_STATIC_STUFF \
-  uint16_t className::type = 0;\
-  std::vector<className::autoSerSerializeFunc> className::serFuncs;\
-  std::vector<className::autoSerDeserialiseFunc> className::deserFuncs;\
-  size_t className::sizePrimitiveFields = 0;
+  uint16_t className::type = 0;
 
 #endif
@@ -14,6 +14,7 @@
 #include "../types_utils.h"
 #include "../exception.h"
 #include <errno.h>
+#include <stdint.h>
 #include <iostream>
 
 class InputStream;
@@ -29,19 +30,31 @@ class InputStream;
 //! greater index than the current buffer size. The buffer array is allocated
 //! by blocks; the real allocated size of the buffer array is therefore greater
 //! than or equal to the size used by its elements.
+//! A Buffer received with zero-copy parsing (see
+//! InputStream::setZeroCopyParsing) references the received message instead
+//! of owning its array. It gets its own copy the first time it is modified,
+//! including through the non-const operator[].
 template <typename T>
 class Buffer : public Serializable {
   private:
     size_t realSize;
     size_t allocatedSize;
     T *array;
+    // Block array points into, or NULL if the array is owned
+    SharedBlock *sharedBlock;
 
     size_t computeNbBlocks(size_t size);
+    // Reference data inside block instead of owning the array
+    void set_shared_data(T *data, size_t size, SharedBlock *block);
+    // Make the array owned, copying it out of the shared block if needed
+    void detach(void);
 
   protected:
     static uint16_t type;
     
     NetMessage *serialize() const;
+    virtual size_t getSerializedSize(bool varint) const;
+    virtual void serializeTo(NetMessageSink &sink, bool varint) const;
     virtual uint16_t getType() const;
     static Serializable *deserialize(const NetMessage &data, bool ptr);
 
@@ -140,10 +153,11 @@ size_t Buffer<T>::computeNbBlocks(size_t size) {
 }
 
 template <typename T>
-Buffer<T>::Buffer(): realSize(0), allocatedSize(0), array(NULL) {}
+Buffer<T>::Buffer(): realSize(0), allocatedSize(0), array(NULL),
+  sharedBlock(NULL) {}
 
 template <typename T>
-Buffer<T>::Buffer(size_t size): realSize(size) {
+Buffer<T>::Buffer(size_t size): realSize(size), sharedBlock(NULL) {
   if (size > 0) {
     allocatedSize = computeNbBlocks(size) * BLOCK_SIZE;
     array = (T*) malloc(allocatedSize*sizeof(T));
@@ -155,7 +169,11 @@ Buffer<T>::Buffer(size_t size): realSize(size) {
 
 template <typename T>
 Buffer<T>::~Buffer() {
-  if (allocatedSize != 0) free(array);
+  if (sharedBlock != NULL) {
+    sharedBlock->unref();
+  } else if (allocatedSize != 0) {
+    free(array);
+  }
 }
 
 template <typename T>
@@ -170,14 +188,47 @@ const T *Buffer<T>::data() const {
 
 template <typename T>
 void Buffer<T>::set_data(T *data, size_t size) {
-  if (allocatedSize != 0) free(array);
+  if (sharedBlock != NULL) {
+    sharedBlock->unref();
+    sharedBlock = NULL;
+  } else if (allocatedSize != 0) {
+    free(array);
+  }
   allocatedSize = realSize = size;
   array = data;
 }
 
+template <typename T>
+void Buffer<T>::set_shared_data(T *data, size_t size, SharedBlock *block) {
+  set_data(NULL, 0);
+  block->ref();
+  sharedBlock = block;
+  realSize = size;
+  array = data;
+}
+
+template <typename T>
+void Buffer<T>::detach(void) {
+  T *shared = array;
+
+  if (sharedBlock == NULL) return;
+
+  if (realSize > 0) {
+    allocatedSize = computeNbBlocks(realSize) * BLOCK_SIZE;
+    array = (T*) malloc(allocatedSize*sizeof(T));
+    memcpy(array, shared, realSize*sizeof(T));
+  } else {
+    allocatedSize = 0;
+    array = NULL;
+  }
+  sharedBlock->unref();
+  sharedBlock = NULL;
+}
+
 template <typename T>
 void Buffer<T>::resize(size_t size) {
   size_t newAllocatedSize;
+  detach();
   if (size < realSize) realSize = size;
   if (size > 0) {
     newAllocatedSize = computeNbBlocks(size) * BLOCK_SIZE;
@@ -193,6 +244,7 @@ void Buffer<T>::resize(size_t size) {
 
 template <typename T>
 void Buffer<T>::copyIn(size_t start, const T *src, size_t len) {
+  detach();
   if (start == Buffer<T>::end) {
     start = realSize;
     realSize = realSize+len;
@@ -221,6 +273,7 @@ inline const T& Buffer<T>::operator[] (size_t index) const {
 
 template <typename T>
 inline T& Buffer<T>::operator[] (size_t index) {
+  detach();
   if (index < realSize) {
     return array[index];
   } else if (index < allocatedSize) {
@@ -247,6 +300,27 @@ NetMessage *Buffer<T>::serialize(void) const {
   return message;
 }
 
+template <typename T>
+size_t Buffer<T>::getSerializedSize(bool varint) const {
+  size_t dataSize = realSize * sizeof(T);
+  size_t size = dataSize + NetMessage::getDataBlockHeaderSize(dataSize);
+
+  return size + NetMessage::getMessageHeaderSize(size);
+}
+
+template <typename T>
+void Buffer<T>::serializeTo(NetMessageSink &sink, bool varint) const {
+  char header[NET_MESSAGE_MAX_HEADER_SIZE];
+  size_t dataSize = realSize * sizeof(T);
+  size_t size = dataSize + NetMessage::getDataBlockHeaderSize(dataSize);
+
+  sink.write(header, NetMessage::writeMessageHeader(getType(), size, header));
+  sink.write(header, NetMessage::writeDataBlockHeader(dataSize, false, header));
+  if (dataSize > 0) {
+    sink.write((const char*) array, dataSize);
+  }
+}
+
 template <typename T>
 Serializable *Buffer<T>::deserialize(const NetMessage &data, bool ptr) {
   Buffer<T> *buffer;
@@ -256,7 +330,17 @@ Serializable *Buffer<T>::deserialize(const NetMessage &data, bool ptr) {
   iov = data.getDataBlocks(&iovcnt);
   buffer = new Buffer<T>();
   if (iovcnt == 1) {
-    buffer->set_data((T*) iov[0].iov_base, iov[0].iov_len / sizeof(T));
+    size_t size = iov[0].iov_len / sizeof(T);
+    SharedBlock *block = data.getSharedBlock();
+
+    if (block == NULL) {
+      buffer->set_data((T*) iov[0].iov_base, size);
+    } else if (((uintptr_t) iov[0].iov_base) % __alignof__(T) == 0) {
+      buffer->set_shared_data((T*) iov[0].iov_base, size, block);
+    } else {
+      // Misaligned for T: take a copy
+      buffer->copyIn(0, (T*) iov[0].iov_base, size);
+    }
   }
   free(iov);
 
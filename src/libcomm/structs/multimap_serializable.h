@@ -28,8 +28,12 @@ class Multimap : public std::multimap<K,V,C,A>, public Serializable {
     static bool pointerContentValue;
 
     NetMessage *serialize() const;
+    virtual size_t getSerializedSize(bool varint) const;
+    virtual void serializeTo(NetMessageSink &sink, bool varint) const;
     static Serializable *deserialize(const NetMessage &data, bool ptr);
     virtual uint16_t getType() const;
+    // Size of the serialized pairs, false if one of them does not know it
+    bool getContentSize(bool varint, size_t &size) const;
 
     friend class libcomm_structs;
     friend class libcomm;
@@ -76,6 +80,48 @@ NetMessage *Multimap<K,V,C,A>::serialize() const {
   return message;
 }
 
+template <typename K, typename V, typename C, typename A>
+bool Multimap<K,V,C,A>::getContentSize(bool varint, size_t &size) const {
+  SerializationManager *sM = SerializationManager::getSerializationManager();  
+
+  size = 0;
+  typename std::multimap<K,V,C,A>::const_iterator iter = this->begin();
+  for (; iter != this->end(); ++iter) {
+    size_t keySize = sM->getSerializedSize(iter->first, varint);
+    size_t valueSize = sM->getSerializedSize(iter->second, varint);
+    if ((keySize == 0) || (valueSize == 0)) return false;
+    size += keySize + valueSize;
+  }
+  return true;
+}
+
+template <typename K, typename V, typename C, typename A>
+size_t Multimap<K,V,C,A>::getSerializedSize(bool varint) const {
+  size_t size;
+
+  if (!getContentSize(varint, size)) return 0;
+  return size + NetMessage::getMessageHeaderSize(size);
+}
+
+template <typename K, typename V, typename C, typename A>
+void Multimap<K,V,C,A>::serializeTo(NetMessageSink &sink, bool varint) const {
+  SerializationManager *sM = SerializationManager::getSerializationManager();  
+  char header[NET_MESSAGE_MAX_HEADER_SIZE];
+  size_t size;
+
+  if (!getContentSize(varint, size)) {
+    Serializable::serializeTo(sink, varint);
+    return;
+  }
+  sink.write(header, NetMessage::writeMessageHeader(getType(), size, header));
+
+  typename std::multimap<K,V,C,A>::const_iterator iter = this->begin();
+  for (; iter != this->end(); ++iter) {
+    sM->serializeTo(iter->first, sink, varint);
+    sM->serializeTo(iter->second, sink, varint);
+  }
+}
+
 template <typename K, typename V, typename C, typename A>
 Serializable *Multimap<K,V,C,A>::deserialize(const NetMessage &data, bool ptr) {
   SerializationManager *sm = SerializationManager::getSerializationManager();
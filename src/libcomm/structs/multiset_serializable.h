@@ -13,6 +13,7 @@
 
 #include "../serializable.h"
 #include "../serialization_manager.h"
+#include "../types_utils.h"
 
 //! \class Multiset libcomm/structs/vector_serializable.h
 //! \brief Serializable multiset
@@ -20,6 +21,8 @@
 //! This class is a subclass of the multiset class from the STL. Therefore, all
 //! standard multiset functions are inherited. The class implements
 //! the methods needed for the serialization.
+//! Elements of primitive types (see PackedArray) are sent as a single block
+//! of big endian values.
 template <typename K, typename C = std::less<K>, typename A = std::allocator<K> >
 class Multiset : public std::multiset<K,C,A>, public Serializable {
   protected:
@@ -27,8 +30,12 @@ class Multiset : public std::multiset<K,C,A>, public Serializable {
     static uint16_t type;
     
     NetMessage *serialize() const;
+    virtual size_t getSerializedSize(bool varint) const;
+    virtual void serializeTo(NetMessageSink &sink, bool varint) const;
     virtual uint16_t getType() const;
     static Serializable *deserialize(const NetMessage &data, bool ptr);
+    // Size of the serialized elements, false if one of them does not know it
+    bool getContentSize(bool varint, size_t &size) const;
 
     friend class libcomm_structs;
     friend class libcomm;
@@ -58,12 +65,80 @@ NetMessage *Multiset<K,C,A>::serialize() const{
   SerializationManager *sM = SerializationManager::getSerializationManager();  
   NetMessage *message = new NetMessage(this->getType());
   typename std::multiset<K,C,A>::const_iterator iter = this->begin();
+
+  if (PackedArray<K>::packed) {
+    if (!this->empty()) {
+      size_t size = this->size() * sizeof(K);
+      char *data = message->allocateDataBlock(size);
+      for (size_t i = 0; iter != this->end(); ++iter, ++i) {
+        PackedArray<K>::encode(&(*iter), 1, &(data[i*sizeof(K)]));
+      }
+      message->addDataBlock(data, size, true);
+    }
+    return message;
+  }
+
   for (;  iter != this->end(); ++iter) {
     message = sM->serialize(*iter, message);
   }
   return message;
 }
 
+template <typename K, typename C, typename A>
+bool Multiset<K,C,A>::getContentSize(bool varint, size_t &size) const {
+  SerializationManager *sM = SerializationManager::getSerializationManager();  
+
+  size = 0;
+  if (PackedArray<K>::packed) {
+    if (!this->empty()) {
+      size = this->size() * sizeof(K);
+      size += NetMessage::getDataBlockHeaderSize(size);
+    }
+    return true;
+  }
+
+  typename std::multiset<K,C,A>::const_iterator iter = this->begin();
+  for (;  iter != this->end(); ++iter) {
+    size_t elementSize = sM->getSerializedSize(*iter, varint);
+    if (elementSize == 0) return false;
+    size += elementSize;
+  }
+  return true;
+}
+
+template <typename K, typename C, typename A>
+size_t Multiset<K,C,A>::getSerializedSize(bool varint) const {
+  size_t size;
+
+  if (!getContentSize(varint, size)) return 0;
+  return size + NetMessage::getMessageHeaderSize(size);
+}
+
+template <typename K, typename C, typename A>
+void Multiset<K,C,A>::serializeTo(NetMessageSink &sink, bool varint) const {
+  SerializationManager *sM = SerializationManager::getSerializationManager();  
+  char header[NET_MESSAGE_MAX_HEADER_SIZE];
+  size_t size;
+
+  if (!getContentSize(varint, size)) {
+    Serializable::serializeTo(sink, varint);
+    return;
+  }
+  sink.write(header, NetMessage::writeMessageHeader(getType(), size, header));
+
+  typename std::multiset<K,C,A>::const_iterator iter = this->begin();
+  if (PackedArray<K>::packed) {
+    if (!this->empty()) {
+      sM->serializePackedTo(iter, this->size(), sink);
+    }
+    return;
+  }
+
+  for (;  iter != this->end(); ++iter) {
+    sM->serializeTo(*iter, sink, varint);
+  }
+}
+
 #include <iostream>
 template <typename K, typename C, typename A>
 Serializable *Multiset<K,C,A>::deserialize(const NetMessage &data, bool ptr) {
@@ -72,10 +147,27 @@ Serializable *Multiset<K,C,A>::deserialize(const NetMessage &data, bool ptr) {
   size_t multisetSize = messages.size();
   Multiset<K,C,A> *s = new Multiset<K,C,A>();
 
-  for (size_t i = 0; i<multisetSize; ++i) {
-    K *k = (K*) sM->deserialize(*(messages[i]), pointerContent);
-    s->insert(*k);
-    delete k;
+  if (PackedArray<K>::packed && messages.empty()) {
+    int iovcnt;
+    chariovec *iov = data.getDataBlocks(&iovcnt);
+
+    multisetSize = (iovcnt == 1) ? iov[0].iov_len / sizeof(K) : 0;
+    if (multisetSize > 0) {
+      K *keys = (K*) malloc(multisetSize * sizeof(K));
+      PackedArray<K>::decode(iov[0].iov_base, multisetSize, keys);
+      // Keys come sorted: inserting at the end is constant time
+      for (size_t i = 0; i<multisetSize; ++i) {
+        s->insert(s->end(), keys[i]);
+      }
+      free(keys);
+    }
+    free(iov);
+  } else {
+    for (size_t i = 0; i<multisetSize; ++i) {
+      K *k = (K*) sM->deserialize(*(messages[i]), pointerContent);
+      s->insert(*k);
+      delete k;
+    }
   }
   if (ptr) {
     Multiset<K,C,A> **sPtr = new Multiset<K,C,A>*();
@@ -8,18 +8,31 @@ SimpleSerializable::~SimpleSerializable() {}
 
 NetMessage *SimpleSerializable::serialize() const {
   int size = returnClassSize();
-  char *buff = (char*) malloc(size);
-  memcpy((void*) buff, (void*)&(((char*) this)[sizeof(int)]), size);
-
   NetMessage *message = new NetMessage(getType());
+  char *buff = message->allocateDataBlock(size);
+  memcpy((void*) buff, (void*)&(((char*) this)[SIMPLE_SER_OFFSET]), size);
+
   message->addDataBlock(buff, size, true);
   return message;
 }
 
 Serializable *SimpleSerializable::deserialize(SimpleSerializable *ss,          
   const NetMessage &data, bool ptr) {
-  chariovec *iov = data.getDataBlocks();
-  memcpy((void*)&(((char*) ss)[sizeof(int)]), (void*) iov[0].iov_base, iov[0].iov_len);
+  int iovcnt;
+  size_t size;
+  size_t skip = 0;
+  chariovec *iov = data.getDataBlocks(&iovcnt);
+
+  // Copied straight from the received block, which may be a shared view
+  if (iovcnt == 1) {
+    size = (size_t) ss->returnClassSize();
+    // Former senders start with the end of their vptr: skipped
+    if (iov[0].iov_len == size + SIMPLE_SER_OFFSET - sizeof(int)) {
+      skip = SIMPLE_SER_OFFSET - sizeof(int);
+    }
+    if (iov[0].iov_len - skip < size) size = iov[0].iov_len - skip;
+    memcpy((void*)&(((char*) ss)[SIMPLE_SER_OFFSET]), (void*) &(iov[0].iov_base[skip]), size);
+  }
   free(iov);
   
   if (ptr) {
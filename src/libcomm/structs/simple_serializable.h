@@ -12,10 +12,16 @@
 
 #include "../serializable.h"
 
+// Offset of the first field of a SimpleSerializable subclass, after the vptr.
+// Wire change: the fields were sent from sizeof(int), which on 64 bits
+// builds also sent, and overwrote, the upper half of the vptr. deserialize
+// still accepts that layout.
+#define SIMPLE_SER_OFFSET sizeof(SimpleSerializable)
+
 #define SIMPLE_SER_STUFF \
   int returnClassSize() const { \
     const className &ref = *this; \
-    return sizeof(ref)-sizeof(int); \
+    return sizeof(ref)-SIMPLE_SER_OFFSET; \
   } \
   static uint16_t type; \
   virtual uint16_t getType() const { \
@@ -28,7 +34,7 @@
   friend class libcomm;
 
 #define SIMPLE_SER_INIT \
-  memset((void*)&(((char*)this)[sizeof(int)]),0,(size_t)returnClassSize());
+  memset((void*)&(((char*)this)[SIMPLE_SER_OFFSET]),0,(size_t)returnClassSize());
 
 #define SIMPLE_SER_STATIC_STUFF \
   uint16_t className::type = 0;
@@ -18,10 +18,26 @@ NetMessage *String::serialize() const {
   return message;
 }
 
+size_t String::getSerializedSize(bool varint) const {
+  size_t size = length() + NetMessage::getDataBlockHeaderSize(length());
+
+  return size + NetMessage::getMessageHeaderSize(size);
+}
+
+void String::serializeTo(NetMessageSink &sink, bool varint) const {
+  char header[NET_MESSAGE_MAX_HEADER_SIZE];
+  size_t size = length() + NetMessage::getDataBlockHeaderSize(length());
+
+  sink.write(header, NetMessage::writeMessageHeader(getType(), size, header));
+  sink.write(header, NetMessage::writeDataBlockHeader(length(), false, header));
+  sink.write(data(), length());
+}
+
 Serializable *String::deserialize(const NetMessage &data, bool ptr) {
   chariovec *iov = data.getDataBlocks();
   String *str = new String(iov[0].iov_base,iov[0].iov_len);
-  free(iov[0].iov_base);
+  // Views into a shared block are not ours to free
+  if (data.getSharedBlock() == NULL) free(iov[0].iov_base);
   free(iov);
   if (ptr) {
     String **strPtr = new String*();
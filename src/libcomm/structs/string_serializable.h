@@ -26,6 +26,8 @@ class String : public Serializable, public std::string {
 
     int returnDataSize() const;
     NetMessage *serialize() const;
+    virtual size_t getSerializedSize(bool varint) const;
+    virtual void serializeTo(NetMessageSink &sink, bool varint) const;
     static Serializable *deserialize(const NetMessage &data, bool ptr);
     virtual uint16_t getType() const;
 
@@ -21,6 +21,8 @@
 //! This class is a subclass of the vector class from the STL. Therefore, all
 //! standard vector functions are inherited. The class implements
 //! the methods needed for the serialization.
+//! Vectors of primitive types (see PackedArray) are sent as a single block
+//! of big endian values.
 template <typename T, typename A = std::allocator<T> >
 class Vector : public std::vector<T,A>, public Serializable {
   
@@ -29,8 +31,12 @@ class Vector : public std::vector<T,A>, public Serializable {
     static uint16_t type;
     
     NetMessage *serialize() const;
+    virtual size_t getSerializedSize(bool varint) const;
+    virtual void serializeTo(NetMessageSink &sink, bool varint) const;
     virtual uint16_t getType() const;
     static Serializable *deserialize(const NetMessage &data, bool ptr);
+    // Size of the serialized elements, false if one of them does not know it
+    bool getContentSize(bool varint, size_t &size) const;
 
     friend class libcomm_structs;
     friend class libcomm;
@@ -62,6 +68,17 @@ NetMessage *Vector<T,A>::serialize() const{
 
   SerializationManager *sM = SerializationManager::getSerializationManager();  
   NetMessage *message = new NetMessage(this->getType());
+
+  if (PackedArray<T>::packed) {
+    if (!this->empty()) {
+      size_t size = this->size() * sizeof(T);
+      char *data = message->allocateDataBlock(size);
+      PackedArray<T>::encode(&(this->front()), this->size(), data);
+      message->addDataBlock(data, size, true);
+    }
+    return message;
+  }
+
   typename std::vector<T,A>::const_iterator iter = this->begin();
   for (;  iter != this->end(); ++iter) {
     message = sM->serialize(*iter, message);
@@ -69,18 +86,86 @@ NetMessage *Vector<T,A>::serialize() const{
   return message;
 }
 
+template <typename T, typename A>
+bool Vector<T,A>::getContentSize(bool varint, size_t &size) const {
+  SerializationManager *sM = SerializationManager::getSerializationManager();  
+
+  size = 0;
+  if (PackedArray<T>::packed) {
+    if (!this->empty()) {
+      size = this->size() * sizeof(T);
+      size += NetMessage::getDataBlockHeaderSize(size);
+    }
+    return true;
+  }
+
+  typename std::vector<T,A>::const_iterator iter = this->begin();
+  for (;  iter != this->end(); ++iter) {
+    size_t elementSize = sM->getSerializedSize(*iter, varint);
+    if (elementSize == 0) return false;
+    size += elementSize;
+  }
+  return true;
+}
+
+template <typename T, typename A>
+size_t Vector<T,A>::getSerializedSize(bool varint) const {
+  size_t size;
+
+  if (!getContentSize(varint, size)) return 0;
+  return size + NetMessage::getMessageHeaderSize(size);
+}
+
+template <typename T, typename A>
+void Vector<T,A>::serializeTo(NetMessageSink &sink, bool varint) const {
+  SerializationManager *sM = SerializationManager::getSerializationManager();  
+  char header[NET_MESSAGE_MAX_HEADER_SIZE];
+  size_t size;
+
+  if (!getContentSize(varint, size)) {
+    Serializable::serializeTo(sink, varint);
+    return;
+  }
+  sink.write(header, NetMessage::writeMessageHeader(getType(), size, header));
+
+  if (PackedArray<T>::packed) {
+    if (!this->empty()) {
+      sM->serializePackedTo(&(this->front()), this->size(), sink);
+    }
+    return;
+  }
+
+  typename std::vector<T,A>::const_iterator iter = this->begin();
+  for (;  iter != this->end(); ++iter) {
+    sM->serializeTo(*iter, sink, varint);
+  }
+}
+
 #include <iostream>
 template <typename T, typename A>
 Serializable *Vector<T,A>::deserialize(const NetMessage &data, bool ptr) {
   SerializationManager *sM = SerializationManager::getSerializationManager();  
   const std::vector<NetMessage*> &messages = data.getMessages();
   size_t vectorSize = messages.size();
-  Vector<T,A> *v = new Vector<T,A>(vectorSize);
-
-  for (size_t i = 0; i<vectorSize; ++i) {
-    T *t = (T*) sM->deserialize(*(messages[i]), pointerContent);
-    (*v)[i] = *t;
-    delete t;
+  Vector<T,A> *v;
+
+  if (PackedArray<T>::packed && messages.empty()) {
+    int iovcnt;
+    chariovec *iov = data.getDataBlocks(&iovcnt);
+
+    vectorSize = (iovcnt == 1) ? iov[0].iov_len / sizeof(T) : 0;
+    v = new Vector<T,A>(vectorSize);
+    if (vectorSize > 0) {
+      PackedArray<T>::decode(iov[0].iov_base, vectorSize, &(v->front()));
+    }
+    free(iov);
+  } else {
+    v = new Vector<T,A>(vectorSize);
+    for (size_t i = 0; i<vectorSize; ++i) {
+      T *t = (T*) sM->deserialize(*(messages[i]), pointerContent);
+      (*v)[i] = *t;
+      delete t;
+    }
   }
   if (ptr) {
     Vector<T,A> **vPtr = new Vector<T,A>*();
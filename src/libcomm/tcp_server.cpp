@@ -0,0 +1,289 @@
+#include "tcp_server.h"
+#include "thread.h"
+
+#include <set>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+// Pause of a worker out of descriptors, when it has no reserve one either
+#define ACCEPT_BACKOFF 10000
+
+class TcpServer::Worker: public Thread, private AsyncCallback {
+  private:
+    TcpServer *server;
+    TcpServerSocket *listener;
+    std::set<TcpServerConnection*> connections;
+    int reserveFd;
+
+    void pin(void);
+    void rejectConnection(void);
+    void completed(AsyncResult &result);
+
+  protected:
+    void *run(void);
+
+  public:
+    int index;
+    AsyncEventLoop loop;
+
+    Worker(TcpServer *server, int index, TcpServerSocket *listener);
+    ~Worker(void);
+
+    void release(TcpServerConnection *connection);
+};
+
+TcpServerHandler::~TcpServerHandler(void) {
+}
+
+void TcpServerHandler::connected(TcpServerConnection &connection) {
+}
+
+void TcpServerHandler::disconnected(TcpServerConnection &connection, Exception &e) {
+}
+
+TcpServer::Worker::Worker(TcpServer *server, int index, TcpServerSocket *listener)
+  : server(server), listener(listener), index(index) {
+  reserveFd = open("/dev/null", O_RDONLY);
+}
+
+TcpServer::Worker::~Worker(void) {
+  if (reserveFd != -1) close(reserveFd);
+  listener->closeServer();
+  delete listener;
+}
+
+void TcpServer::Worker::pin(void) {
+  cpu_set_t allowed;
+  cpu_set_t set;
+  int nbCpus;
+  int wanted;
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+  nbCpus = CPU_COUNT(&allowed);
+  if (nbCpus == 0) return;
+  wanted = index % nbCpus;
+
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (!CPU_ISSET(cpu, &allowed)) continue;
+    if (wanted-- == 0) {
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+      // Not being pinned is not an error
+      pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      break;
+    }
+  }
+}
+
+void *TcpServer::Worker::run(void) {
+  if (server->cpuPinning) pin();
+
+  listener->asyncAccept(loop, this);
+  loop.run();
+
+  // The loop has stopped: the connections end with it
+  while (!connections.empty()) {
+    TcpServerConnection *connection = *(connections.begin());
+
+    connection->error = Exception(ECANCELED);
+    release(connection);
+  }
+
+  return NULL;
+}
+
+void TcpServer::Worker::completed(AsyncResult &result) {
+  if (!result.failed()) {
+    TcpServerConnection *connection;
+
+    connection = new TcpServerConnection(result.acceptedSocket,
+      server->handler, loop, this);
+    connections.insert(connection);
+    server->handler->connected(*connection);
+    if (!connection->closing) {
+      connection->read();
+    } else if (connection->pendingOperations == 0) {
+      release(connection);
+    }
+  } else if ((result.e.getCode() == EMFILE) || (result.e.getCode() == ENFILE)) {
+    rejectConnection();
+  }
+
+  // Errors such as EMFILE do not stop the worker
+  listener->asyncAccept(loop, this);
+}
+
+// Out of descriptors, the pending connection would make the next accept
+// fail at once, and the worker spin: the reserve descriptor is given up to
+// accept it and close it.
+void TcpServer::Worker::rejectConnection(void) {
+  if (reserveFd != -1) {
+    close(reserveFd);
+    try {
+      TcpSocket *socket = listener->acceptConnection(0, 0);
+
+      socket->closeStream();
+      delete socket;
+    } catch (Exception &e) {
+      // Gone already
+    }
+  }
+
+  reserveFd = open("/dev/null", O_RDONLY);
+  if (reserveFd == -1) usleep(ACCEPT_BACKOFF);
+}
+
+void TcpServer::Worker::release(TcpServerConnection *connection) {
+  server->handler->disconnected(*connection, connection->error);
+  connections.erase(connection);
+  delete connection;
+}
+
+TcpServerConnection::TcpServerConnection(TcpSocket *socket,
+  TcpServerHandler *handler, AsyncEventLoop &loop, TcpServer::Worker *worker)
+  : socket(socket), handler(handler), loop(loop), worker(worker), data(NULL),
+  pendingOperations(0), closing(false) {
+}
+
+TcpServerConnection::~TcpServerConnection(void) {
+  try {
+    socket->closeStream();
+  } catch (Exception &e) {
+  }
+  delete socket;
+}
+
+void TcpServerConnection::read(void) {
+  ++pendingOperations;
+  socket->asyncReadObject(loop, this);
+}
+
+void TcpServerConnection::closeWith(Exception &e) {
+  if (closing) return;
+  closing = true;
+  error = e;
+
+  // Released once the canceled operations and the cancellation are done
+  ++pendingOperations;
+  loop.cancel(socket, this);
+}
+
+void TcpServerConnection::completed(AsyncResult &result) {
+  --pendingOperations;
+
+  if (result.type == AsyncResult::CANCEL) {
+    // Nothing more to do
+  } else if (result.failed()) {
+    closeWith(result.e);
+  } else if (result.type == AsyncResult::READ_OBJECT) {
+    // Keeps the connection during the handler, which may close it
+    ++pendingOperations;
+    handler->objectReceived(*this, result.object);
+    --pendingOperations;
+    if (!closing) read();
+  }
+
+  if (closing && (pendingOperations == 0)) {
+    worker->release(this);
+  }
+}
+
+TcpSocket &TcpServerConnection::getSocket(void) {
+  return *socket;
+}
+
+NetAddress TcpServerConnection::getDistantAddress(void) const {
+  return socket->getDistantAddress();
+}
+
+int TcpServerConnection::getWorkerIndex(void) const {
+  return worker->index;
+}
+
+void TcpServerConnection::send(const Serializable &object) {
+  if (closing) return;
+  ++pendingOperations;
+  try {
+    socket->asyncWriteObject(loop, object, this);
+  } catch (Exception &e) {
+    --pendingOperations;
+    throw;
+  }
+}
+
+void TcpServerConnection::close(void) {
+  Exception e;
+
+  closeWith(e);
+}
+
+void *TcpServerConnection::getData(void) const {
+  return data;
+}
+
+void TcpServerConnection::setData(void *data) {
+  this->data = data;
+}
+
+TcpServer::TcpServer(int port, TcpServerHandler *handler, int nbWorkers,
+  int backlog): port(port), handler(handler), nbWorkers(nbWorkers),
+  backlog(backlog), cpuPinning(false) {
+  if (this->nbWorkers <= 0) {
+    this->nbWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (this->nbWorkers <= 0) this->nbWorkers = 1;
+  }
+}
+
+TcpServer::~TcpServer(void) {
+  stop();
+}
+
+void TcpServer::start(void) {
+  if (!workers.empty()) return;
+
+  // All the listening sockets are bound before any worker runs, so that a
+  // failure leaves nothing behind
+  try {
+    for (int i = 0; i < nbWorkers; ++i) {
+      TcpServerSocket *listener = new TcpServerSocket(port, backlog, true);
+
+      workers.push_back(new Worker(this, i, listener));
+    }
+  } catch (Exception &e) {
+    for (size_t i = 0; i < workers.size(); ++i) {
+      delete workers[i];
+    }
+    workers.clear();
+    throw e;
+  }
+
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i]->start();
+  }
+}
+
+void TcpServer::stop(void) {
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i]->loop.stop();
+  }
+  for (size_t i = 0; i < workers.size(); ++i) {
+    workers[i]->join();
+    delete workers[i];
+  }
+  workers.clear();
+}
+
+int TcpServer::getNbWorkers(void) const {
+  return nbWorkers;
+}
+
+bool TcpServer::getCpuPinning(void) const {
+  return cpuPinning;
+}
+
+void TcpServer::setCpuPinning(bool pin) {
+  cpuPinning = pin;
+}
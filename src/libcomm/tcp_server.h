@@ -0,0 +1,162 @@
+//! \file tcp_server.h
+//! \brief Multi-threaded TCP server
+//!
+//! File containing the declarations of the classes TcpServer,
+//! TcpServerConnection and TcpServerHandler.
+
+#ifndef TCP_SERVER_H
+#define TCP_SERVER_H
+
+#include <vector>
+#include <sys/socket.h>
+
+#include "tcp_socket.h"
+#include "async_event_loop.h"
+
+class TcpServerConnection;
+
+//! \class TcpServerHandler libcomm/tcp_server.h
+//! \brief Handles the clients of a TcpServer
+//!
+//! The methods are called by the workers of the server: calls for different
+//! connections may run concurrently, but the calls for one connection are
+//! made by a single worker, one at a time.
+class TcpServerHandler {
+  public:
+    virtual ~TcpServerHandler(void);
+
+    //! \brief Called when a client has connected
+    //! \param[in] connection the new connection
+    virtual void connected(TcpServerConnection &connection);
+
+    //! \brief Called for each object received
+    //! \param[in] connection the connection
+    //! \param[in] object the object, to be deleted by the handler
+    virtual void objectReceived(TcpServerConnection &connection,
+      Serializable *object) = 0;
+
+    //! \brief Called once when a connection ends
+    //! \param[in] connection the connection, deleted on return
+    //! \param[in] e the cause: the code EX_STREAM_CLOSED when the client has
+    //!            closed it, ECANCELED when the server stops, 0 when the
+    //!            handler has closed it
+    virtual void disconnected(TcpServerConnection &connection, Exception &e);
+};
+
+//! \class TcpServer libcomm/tcp_server.h
+//! \brief Serves TCP clients on a fixed number of threads
+//!
+//! Each worker thread has its own listening socket, bound to the same port
+//! with SO_REUSEPORT so that the kernel spreads the connections between
+//! them, and its own AsyncEventLoop. A worker accepts connections, reads
+//! their objects without blocking and gives them to the handler, so that
+//! any number of clients are served without a thread each.
+//!
+//! Workers can be pinned to CPUs, worker i being bound to the i-th CPU the
+//! process may run on (modulo their number).
+class TcpServer {
+  private:
+    class Worker;
+
+    int port;
+    TcpServerHandler *handler;
+    int nbWorkers;
+    int backlog;
+    bool cpuPinning;
+    std::vector<Worker*> workers;
+
+    TcpServer(const TcpServer &server);
+    TcpServer &operator=(const TcpServer &server);
+
+    friend class TcpServerConnection;
+
+  public:
+    //! \brief TcpServer constructor
+    //! \param[in] port the port to listen to
+    //! \param[in] handler the handler of the clients, which stays owned by
+    //!            the caller
+    //! \param[in] nbWorkers the number of threads, 0 for one per online CPU
+    //! \param[in] backlog the maximum number of pending connections of each
+    //!            listening socket
+    TcpServer(int port, TcpServerHandler *handler, int nbWorkers = 0,
+      int backlog = SOMAXCONN);
+
+    //! \brief TcpServer destructor
+    //!
+    //! Stops the server if running.
+    ~TcpServer(void);
+
+    //! \brief Starts the workers
+    //!
+    //! Throws a NetSocket::NetException if a listening socket can not be
+    //! created.
+    void start(void);
+
+    //! \brief Stops the workers
+    //!
+    //! Waits for them, after the open connections have been closed. Must not
+    //! be called from the handler.
+    void stop(void);
+
+    int getNbWorkers(void) const;
+
+    // Must be set before start. Disabled by default.
+    bool getCpuPinning(void) const;
+    void setCpuPinning(bool pin);
+};
+
+//! \class TcpServerConnection libcomm/tcp_server.h
+//! \brief A client of a TcpServer
+//!
+//! Its methods must be called from the handler, by the worker of the
+//! connection.
+class TcpServerConnection: private AsyncCallback {
+  private:
+    TcpSocket *socket;
+    TcpServerHandler *handler;
+    AsyncEventLoop &loop;
+    TcpServer::Worker *worker;
+    void *data;
+    int pendingOperations;
+    bool closing;
+    Exception error;
+
+    TcpServerConnection(TcpSocket *socket, TcpServerHandler *handler,
+      AsyncEventLoop &loop, TcpServer::Worker *worker);
+    ~TcpServerConnection(void);
+    TcpServerConnection(const TcpServerConnection &connection);
+    TcpServerConnection &operator=(const TcpServerConnection &connection);
+
+    void read(void);
+    void closeWith(Exception &e);
+    void completed(AsyncResult &result);
+
+    friend class TcpServer::Worker;
+
+  public:
+    TcpSocket &getSocket(void);
+    NetAddress getDistantAddress(void) const;
+
+    //! \brief Gets the index of the worker serving the connection
+    //! \return the index, from 0 to the number of workers - 1
+    int getWorkerIndex(void) const;
+
+    //! \brief Sends an object
+    //! \param[in] object the object, serialized at once
+    //!
+    //! The object is written without blocking the worker. An error closes
+    //! the connection.
+    void send(const Serializable &object);
+
+    //! \brief Closes the connection
+    //!
+    //! Pending writes are canceled, and disconnected is called once the
+    //! handler has returned.
+    void close(void);
+
+    // Any data of the handler
+    void *getData(void) const;
+    void setData(void *data);
+};
+
+#endif
@@ -4,23 +4,181 @@
 #include <errno.h>
 #include <stdlib.h> //free
 #include <string.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
 
 #include "tcp_socket.h"
+#include "file.h"
 #include "serialization_manager.h"
 #include "timer.h"
+#include "io_uring_engine.h"
+#include "async_event_loop.h"
+#include "thread.h"
+#include "condition.h"
 
-#define DEFAULT_BACKLOG 15
+#include <map>
+
+// The kernel caps it to net.core.somaxconn
+#define DEFAULT_BACKLOG SOMAXCONN
 
 const int MAX_IOV = sysconf(_SC_IOV_MAX);
 
+static uint64_t now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Ends the batches of all the sockets at their deadline
+class TcpSocket::BatchFlusher: public Thread {
+  private:
+    Mutex mutex;
+    Condition *condition;
+    // Batch generations, by deadline
+    std::multimap<uint64_t, std::pair<TcpSocket*, uint64_t> > deadlines;
+    TcpSocket *current;
+    bool stopped;
+
+  protected:
+    void *run(void);
+
+  public:
+    BatchFlusher(void);
+    ~BatchFlusher(void);
+
+    void schedule(TcpSocket *socket, uint64_t generation, uint64_t deadline);
+    void cancel(TcpSocket *socket);
+    void stop(void);
+};
+
+Mutex TcpSocket::batchFlusherMutex;
+TcpSocket::BatchFlusher *TcpSocket::batchFlusher = NULL;
+
+TcpSocket::BatchFlusher::BatchFlusher(void): current(NULL), stopped(false) {
+  condition = mutex.getNewCondition();
+}
+
+TcpSocket::BatchFlusher::~BatchFlusher(void) {
+  delete condition;
+}
+
+void *TcpSocket::BatchFlusher::run(void) {
+  mutex.lock();
+  while (!stopped) {
+    uint64_t time = now();
+    std::pair<TcpSocket*, uint64_t> batch;
+
+    if (deadlines.empty()) {
+      condition->wait();
+      continue;
+    }
+    if (deadlines.begin()->first > time) {
+      try {
+        condition->timedWait(deadlines.begin()->first - time);
+      } catch (Condition::ConditionException &e) {
+        // Checked with the deadline
+      }
+      continue;
+    }
+
+    // The socket is not released while its batch ends
+    batch = deadlines.begin()->second;
+    deadlines.erase(deadlines.begin());
+    current = batch.first;
+    mutex.unlock();
+    current->endBatch(batch.second);
+    mutex.lock();
+    current = NULL;
+    condition->notifyAll();
+  }
+  mutex.unlock();
+
+  return NULL;
+}
+
+void TcpSocket::BatchFlusher::schedule(TcpSocket *socket, uint64_t generation,
+  uint64_t deadline) {
+  mutex.lock();
+  deadlines.insert(std::make_pair(deadline, std::make_pair(socket, generation)));
+  if (deadlines.begin()->first == deadline) condition->notifyAll();
+  mutex.unlock();
+}
+
+void TcpSocket::BatchFlusher::cancel(TcpSocket *socket) {
+  std::multimap<uint64_t, std::pair<TcpSocket*, uint64_t> >::iterator it;
+
+  mutex.lock();
+  it = deadlines.begin();
+  while (it != deadlines.end()) {
+    if (it->second.first == socket) {
+      deadlines.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+  while (current == socket) condition->wait();
+  mutex.unlock();
+}
+
+void TcpSocket::BatchFlusher::stop(void) {
+  mutex.lock();
+  stopped = true;
+  condition->notifyAll();
+  mutex.unlock();
+}
+
 TcpSocket::TcpSocket(int socketId): IONetSocket() {
   fd = socketId;
+  init();
+}
+
+void TcpSocket::init(void) {
+  zeroCopy = false;
+  zeroCopyThreshold = DEFAULT_ZERO_COPY_THRESHOLD;
+  zeroCopySent = 0;
+  zeroCopyCompleted = 0;
+  nbZeroCopyCopied = 0;
+
+  batchThreshold = 0;
+  batchDelay = 0;
+  batchScheduled = false;
+  batching = false;
+  batchGeneration = 0;
+  batchBytes = 0;
+  batchWrites = 0;
+  nbBatches = 0;
+  nbBatchedWrites = 0;
+  nbBatchedBytes = 0;
+  maxBatchBytes = 0;
 }
 
 ssize_t TcpSocket::readRawData(   char *buffer, size_t size, int flags,
                                   NetAddress *addr) {
+  struct iovec iov;
+
+  iov.iov_base = buffer;
+  iov.iov_len = size;
+  return readRawData(&iov, 1, flags, addr);
+}
+
+ssize_t TcpSocket::readRawData(   const struct iovec *iov, int iovcnt,
+                                  int flags, NetAddress *addr) {
+  IoUringEngine *engine = getReadEngine();
   ssize_t bytesRead;
-  bytesRead = recv(fd, buffer, size, flags);
+
+  if (engine != NULL) {
+    // The engine reads into a single buffer
+    bytesRead = engine->read((char*) iov[0].iov_base, iov[0].iov_len, flags);
+  } else {
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec*) iov;
+    msg.msg_iovlen = iovcnt;
+    bytesRead = recvmsg(fd, &msg, flags);
+  }
  
   switch (bytesRead) {
     case -1:
@@ -49,11 +207,49 @@ ssize_t TcpSocket::readRawData(   char *buffer, size_t size, int flags,
 
 ssize_t TcpSocket::writeData( const char *data, size_t size, int flags,
                               const NetAddress *addr) {
+  uint64_t generation;
+  bool first;
+  ssize_t written;
+
+  if (batchThreshold == 0) return sendData(data, size, flags);
+
+  generation = beginBatchedWrite(&first);
+  written = sendData(data, size, flags);
+  endBatchedWrite(generation, first, written);
+  return written;
+}
+
+ssize_t TcpSocket::writeData( const struct iovec *iov, int iovcnt,
+                              const NetAddress *addr) {
+  uint64_t generation;
+  bool first;
+  ssize_t written;
+
+  if (batchThreshold == 0) return sendData(iov, iovcnt);
+
+  generation = beginBatchedWrite(&first);
+  written = sendData(iov, iovcnt);
+  endBatchedWrite(generation, first, written);
+  return written;
+}
+
+ssize_t TcpSocket::sendData(const char *data, size_t size, int flags) {
+  IoUringEngine *engine = getWriteEngine();
   ssize_t bytesWritten;
   size_t totalWritten = 0;
+
+  if (zeroCopy && (size >= zeroCopyThreshold)) {
+    struct iovec iov;
+
+    iov.iov_base = (void*) data;
+    iov.iov_len = size;
+    return writeZeroCopy(&iov, 1);
+  }
   
   do {
-    bytesWritten = send(fd, &(data[totalWritten]), size-totalWritten, flags);
+    bytesWritten = (engine != NULL)
+      ? engine->send(&(data[totalWritten]), size-totalWritten, flags)
+      : send(fd, &(data[totalWritten]), size-totalWritten, flags);
 
     if (bytesWritten == -1) {
       throw OutputStream::OutputStreamException(errno, size);
@@ -64,19 +260,38 @@ ssize_t TcpSocket::writeData( const char *data, size_t size, int flags,
   return totalWritten;
 }
 
-ssize_t TcpSocket::writeData( const struct iovec *iov, int iovcnt,
-                              const NetAddress *addr) {
+ssize_t TcpSocket::sendData(const struct iovec *iov, int iovcnt) {
+  IoUringEngine *engine = getWriteEngine();
   int iovcntBlocks;
   size_t totalQuantityWritten = 0;
   ssize_t quantityWritten = 0;
 
-  iovcntBlocks = (iovcnt / MAX_IOV) + (iovcnt % MAX_IOV == 0) ? 0 : 1;
+  if (zeroCopy) {
+    size_t size = 0;
+
+    for (int i = 0; i < iovcnt; ++i) size += iov[i].iov_len;
+    if (size >= zeroCopyThreshold) return writeZeroCopy(iov, iovcnt);
+  }
+
+  // The engine writes everything, whatever the number of blocks
+  if (engine != NULL) {
+    if (engine->writev(iov, iovcnt, &totalQuantityWritten) == -1) {
+      size_t toWrite;
+      char *dataLeft;
+
+      dataLeft = generateRemainingData(iov, iovcnt, totalQuantityWritten, &toWrite);
+      throw OutputStream::OutputStreamException(errno, toWrite, dataLeft, totalQuantityWritten);
+    }
+    return totalQuantityWritten;
+  }
+
+  iovcntBlocks = (iovcnt / MAX_IOV) + ((iovcnt % MAX_IOV == 0) ? 0 : 1);
   
   if (iovcntBlocks > 1) {
     for (int i = 0; i<iovcntBlocks; ++i) {
-      int iovcntToWrite = ((i+1*MAX_IOV) > iovcnt) ? iovcnt - i * MAX_IOV : MAX_IOV; 
+      int iovcntToWrite = (((i+1)*MAX_IOV) > iovcnt) ? iovcnt - i * MAX_IOV : MAX_IOV; 
 
-      totalQuantityWritten += writeData(&(iov[i*MAX_IOV]), iovcntToWrite, addr); 
+      totalQuantityWritten += sendData(&(iov[i*MAX_IOV]), iovcntToWrite); 
     }
   } else {
     quantityWritten = writev(fd, iov, iovcnt);
@@ -88,19 +303,240 @@ ssize_t TcpSocket::writeData( const struct iovec *iov, int iovcnt,
       throw OutputStream::OutputStreamException(errno, toWrite,  dataLeft, quantityWritten);
     }
     totalQuantityWritten += quantityWritten;
-    totalQuantityWritten += writeRemainingData(iov, iovcnt, quantityWritten, addr);
+    totalQuantityWritten += writeRemainingData(iov, iovcnt, quantityWritten, NULL);
   }
   
   return totalQuantityWritten;
 }
 
+ssize_t TcpSocket::writeZeroCopy(const struct iovec *iov, int iovcnt) {
+  std::vector<struct iovec> left(iov, iov + iovcnt);
+  size_t first = 0;
+  size_t totalWritten = 0;
+
+  while (first < left.size()) {
+    struct msghdr msg;
+    ssize_t written;
+    bool copied;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &left[first];
+    msg.msg_iovlen = std::min(left.size() - first, (size_t) MAX_IOV);
+    written = sendmsg(fd, &msg, MSG_ZEROCOPY | MSG_NOSIGNAL);
+    copied = false;
+    if ((written == -1) && (errno == ENOBUFS)) {
+      // No memory left for the notifications: this part is copied
+      written = sendmsg(fd, &msg, MSG_NOSIGNAL);
+      copied = true;
+    }
+    if (written == -1) {
+      size_t toWrite;
+      char *dataLeft;
+
+      if (errno == EINTR) continue;
+      // The pages of the writes already made are still in use
+      try {
+        waitZeroCopyCompletions();
+      } catch (Exception &e) {
+      }
+      dataLeft = generateRemainingData(iov, iovcnt, totalWritten, &toWrite);
+      throw OutputStream::OutputStreamException(errno, toWrite, dataLeft, totalWritten);
+    }
+    // Each successful zero copy call is counted, and notified, by the kernel
+    if (!copied) ++zeroCopySent;
+    totalWritten += written;
+
+    while ((first < left.size()) && ((size_t) written >= left[first].iov_len)) {
+      written -= left[first].iov_len;
+      ++first;
+    }
+    if (written > 0) {
+      left[first].iov_base = (char*) left[first].iov_base + written;
+      left[first].iov_len -= written;
+    }
+  }
+
+  waitZeroCopyCompletions();
+  return totalWritten;
+}
+
+void TcpSocket::waitZeroCopyCompletions(void) {
+  while (zeroCopyCompleted != zeroCopySent) {
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE) == -1) {
+      if (errno == EAGAIN) {
+        // The error queue is always polled (POLLERR)
+        struct pollfd pfd;
+
+        pfd.fd = fd;
+        pfd.events = 0;
+        poll(&pfd, 1, -1);
+        continue;
+      }
+      if (errno == EINTR) continue;
+      throw OutputStream::OutputStreamException(errno, 0);
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      struct sock_extended_err *error;
+
+      if (!(((cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == IP_RECVERR))
+        || ((cmsg->cmsg_level == SOL_IPV6) && (cmsg->cmsg_type == IPV6_RECVERR)))) {
+        continue;
+      }
+      error = (struct sock_extended_err*) CMSG_DATA(cmsg);
+      if ((error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) || (error->ee_errno != 0)) {
+        continue;
+      }
+      // The calls from ee_info to ee_data are done
+      zeroCopyCompleted = error->ee_data + 1;
+      if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) ++nbZeroCopyCopied;
+    }
+  }
+}
+
 TcpSocket::TcpSocket(): IONetSocket(SOCK_STREAM) {
+  init();
 }
 
 TcpSocket::TcpSocket(const NetAddress &address): IONetSocket(SOCK_STREAM, address) {
+  init();
 }
 
 TcpSocket::~TcpSocket() {
+  if (batchScheduled) {
+    batchFlusherMutex.lock();
+    if (batchFlusher != NULL) batchFlusher->cancel(this);
+    batchFlusherMutex.unlock();
+  }
+}
+
+void TcpSocket::closeStream(void) {
+  // Corked data is sent before the socket is closed
+  if (batchScheduled) {
+    flushBatch();
+    batchFlusherMutex.lock();
+    if (batchFlusher != NULL) batchFlusher->cancel(this);
+    batchFlusherMutex.unlock();
+    batchScheduled = false;
+  }
+  IONetSocket::closeStream();
+}
+
+uint64_t TcpSocket::beginBatchedWrite(bool *first) {
+  uint64_t generation;
+
+  batchMutex.lock();
+  *first = !batching;
+  if (!batching) {
+    batching = true;
+    ++batchGeneration;
+    batchBytes = 0;
+    batchWrites = 0;
+
+    // Scheduled before the write, so that the batch ends even if it fails
+    batchFlusherMutex.lock();
+    if (batchFlusher == NULL) {
+      batchFlusher = new BatchFlusher();
+      batchFlusher->start();
+    }
+    batchFlusher->schedule(this, batchGeneration, now() + batchDelay * 1000);
+    batchFlusherMutex.unlock();
+    batchScheduled = true;
+  }
+  generation = batchGeneration;
+  batchMutex.unlock();
+
+  return generation;
+}
+
+void TcpSocket::endBatchedWrite(uint64_t generation, bool first, size_t size) {
+  batchMutex.lock();
+  if (batching && (generation == batchGeneration)) {
+    // The first write has left: the next ones wait for the end of the batch
+    if (first) setCork(true);
+    batchBytes += size;
+    ++batchWrites;
+    if (batchBytes >= batchThreshold) endBatch();
+  }
+  batchMutex.unlock();
+}
+
+void TcpSocket::endBatch(void) {
+  setCork(false);
+  batching = false;
+  ++nbBatches;
+  nbBatchedWrites += batchWrites;
+  nbBatchedBytes += batchBytes;
+  if (batchBytes > maxBatchBytes) maxBatchBytes = batchBytes;
+}
+
+void TcpSocket::endBatch(uint64_t generation) {
+  batchMutex.lock();
+  if (batching && (generation == batchGeneration)) endBatch();
+  batchMutex.unlock();
+}
+
+void TcpSocket::setCork(bool cork) {
+  int value = cork;
+
+  // A failure only costs the batching, the data is sent anyway
+  setsockopt(fd, SOL_TCP, TCP_CORK, &value, sizeof(value));
+}
+
+void TcpSocket::stopBatchFlusher(void) {
+  batchFlusherMutex.lock();
+  if (batchFlusher != NULL) {
+    batchFlusher->stop();
+    batchFlusher->join();
+    delete batchFlusher;
+    batchFlusher = NULL;
+  }
+  batchFlusherMutex.unlock();
+}
+
+void TcpSocket::setBatching(size_t threshold, uint64_t delay) {
+  batchMutex.lock();
+  if (batching && (threshold == 0)) endBatch();
+  batchThreshold = threshold;
+  batchDelay = delay;
+  batchMutex.unlock();
+}
+
+size_t TcpSocket::getBatchThreshold(void) const {
+  return batchThreshold;
+}
+
+uint64_t TcpSocket::getBatchDelay(void) const {
+  return batchDelay;
+}
+
+void TcpSocket::flushBatch(void) {
+  batchMutex.lock();
+  if (batching) endBatch();
+  batchMutex.unlock();
+}
+
+uint64_t TcpSocket::getNbBatches(void) const {
+  return nbBatches;
+}
+
+uint64_t TcpSocket::getNbBatchedWrites(void) const {
+  return nbBatchedWrites;
+}
+
+uint64_t TcpSocket::getNbBatchedBytes(void) const {
+  return nbBatchedBytes;
+}
+
+size_t TcpSocket::getMaxBatchBytes(void) const {
+  return maxBatchBytes;
 }
 
 void TcpSocket::shutdownSocket(bool read, bool write) {
@@ -113,6 +549,99 @@ void TcpSocket::shutdownSocket(bool read, bool write) {
   }
 }
 
+ssize_t TcpSocket::sendFile(File &file, off_t offset, size_t length) {
+  size_t totalSent = 0;
+
+  while (totalSent < length) {
+    ssize_t sent = sendfile(fd, file.fd, &offset, length - totalSent);
+
+    if (sent == -1) {
+      if (errno == EINTR) continue;
+      // Files without page cache, such as pipes, need splice
+      if (((errno == EINVAL) || (errno == ENOSYS) || (errno == ESPIPE))
+        && (totalSent == 0)) {
+        return spliceFile(file.fd, offset, length);
+      }
+      throw OutputStream::OutputStreamException(errno, length - totalSent);
+    }
+    if (sent == 0) break;
+    totalSent += sent;
+  }
+
+  return totalSent;
+}
+
+ssize_t TcpSocket::spliceFile(int fileFd, off_t offset, size_t length) {
+  int pipeFds[2];
+  size_t totalSent = 0;
+  int error = 0;
+  // Pipes and sockets have no offset, and refuse one
+  off_t *offsetPtr = (lseek(fileFd, 0, SEEK_CUR) == -1) ? NULL : &offset;
+
+  if (pipe(pipeFds) == -1) {
+    throw OutputStream::OutputStreamException(errno, length);
+  }
+
+  while ((totalSent < length) && (error == 0)) {
+    ssize_t inPipe = splice(fileFd, offsetPtr, pipeFds[1], NULL,
+      length - totalSent, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+    if (inPipe == -1) {
+      if (errno != EINTR) error = errno;
+      continue;
+    }
+    if (inPipe == 0) break;
+
+    while ((inPipe > 0) && (error == 0)) {
+      ssize_t sent = splice(pipeFds[0], NULL, fd, NULL, inPipe,
+        SPLICE_F_MOVE | SPLICE_F_MORE);
+
+      if (sent == -1) {
+        if (errno != EINTR) error = errno;
+        continue;
+      }
+      inPipe -= sent;
+      totalSent += sent;
+    }
+  }
+
+  close(pipeFds[0]);
+  close(pipeFds[1]);
+  if (error != 0) {
+    throw OutputStream::OutputStreamException(error, length - totalSent);
+  }
+
+  return totalSent;
+}
+
+bool TcpSocket::setZeroCopyEnabled(bool enable) {
+  int value = enable ? 1 : 0;
+
+  if (enable && (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &value, sizeof(value)) == -1)) {
+    zeroCopy = false;
+  } else {
+    zeroCopy = enable;
+  }
+
+  return zeroCopy;
+}
+
+bool TcpSocket::getZeroCopyEnabled(void) const {
+  return zeroCopy;
+}
+
+size_t TcpSocket::getZeroCopyThreshold(void) const {
+  return zeroCopyThreshold;
+}
+
+void TcpSocket::setZeroCopyThreshold(size_t threshold) {
+  zeroCopyThreshold = threshold;
+}
+
+uint64_t TcpSocket::getNbZeroCopyCopied(void) const {
+  return nbZeroCopyCopied;
+}
+
 TcpServerSocket::TcpServerSocket() {
   socketId = createSocket(SOCK_STREAM);
   listenTo(DEFAULT_BACKLOG); 
@@ -127,13 +656,25 @@ TcpServerSocket::TcpServerSocket(int localPort) {
 }
 
 TcpServerSocket::TcpServerSocket(int localPort, int backlog) {
-  createSocket(SOCK_STREAM);
+  socketId = createSocket(SOCK_STREAM);
   BooleanOption opt(BooleanOption::reuseAddrOpt, true);
   setSocketOption(opt);
   bindSocket(localPort);
   listenTo(backlog);
 }
 
+TcpServerSocket::TcpServerSocket(int localPort, int backlog, bool reusePort) {
+  socketId = createSocket(SOCK_STREAM);
+  BooleanOption opt(BooleanOption::reuseAddrOpt, true);
+  setSocketOption(opt);
+  if (reusePort) {
+    BooleanOption portOpt(BooleanOption::reusePortOpt, true);
+    setSocketOption(portOpt);
+  }
+  bindSocket(localPort);
+  listenTo(backlog);
+}
+
 void TcpServerSocket::listenTo(int backlog) {
   int result;
 
@@ -187,6 +728,10 @@ TcpSocket *TcpServerSocket::acceptConnection(time_t sec, long nanosec) {
   return NULL;
 }
 
+void TcpServerSocket::asyncAccept(AsyncEventLoop &loop, AsyncCallback *callback) {
+  loop.accept(this, callback);
+}
+
 void TcpServerSocket::closeServer(void) {
   int result;
   
@@ -2,23 +2,69 @@
 #define TCP_SOCKET_H
 
 #include "net_socket.h"
+#include "mutex.h"
 #include <vector>
 #include <netinet/tcp.h>
 
+class File;
+
+// Writes from which MSG_ZEROCOPY is used by default: below, pinning the
+// pages costs more than the copy
+#define DEFAULT_ZERO_COPY_THRESHOLD (64 * 1024)
+
 
 class TcpSocket : public IONetSocket {
   private :
+    class BatchFlusher;
+
+    static Mutex batchFlusherMutex;
+    static BatchFlusher *batchFlusher;
+
+    bool zeroCopy;
+    size_t zeroCopyThreshold;
+    uint32_t zeroCopySent;
+    uint32_t zeroCopyCompleted;
+    uint64_t nbZeroCopyCopied;
+
+    Mutex batchMutex;
+    size_t batchThreshold;
+    uint64_t batchDelay;
+    bool batchScheduled;
+    bool batching;
+    uint64_t batchGeneration;
+    size_t batchBytes;
+    size_t batchWrites;
+    uint64_t nbBatches;
+    uint64_t nbBatchedWrites;
+    uint64_t nbBatchedBytes;
+    size_t maxBatchBytes;
 
     TcpSocket(int sockedId);
+    void init(void);
+
+    ssize_t sendData(const char *data, size_t size, int flags);
+    ssize_t sendData(const struct iovec *iov, int iovcnt);
+    uint64_t beginBatchedWrite(bool *first);
+    void endBatchedWrite(uint64_t generation, bool first, size_t size);
+    void endBatch(void);
+    void endBatch(uint64_t generation);
+    void setCork(bool cork);
+    static void stopBatchFlusher(void);
 
     ssize_t readRawData(char *buffer, size_t size, int flags,
                         NetAddress *addr);
+    ssize_t readRawData(const struct iovec *iov, int iovcnt, int flags,
+                        NetAddress *addr);
     ssize_t writeData(  const char *data, size_t size, int flags,
                         const NetAddress *addr);
     ssize_t writeData(  const struct iovec *iov, int iovcnt,
                         const NetAddress *addr);
+    ssize_t writeZeroCopy(const struct iovec *iov, int iovcnt);
+    void waitZeroCopyCompletions(void);
+    ssize_t spliceFile(int fileFd, off_t offset, size_t length);
 
     friend class TcpServerSocket;
+    friend class libcomm;
   public :
     TcpSocket(void);
     TcpSocket(const NetAddress &address);
@@ -26,6 +72,69 @@ class TcpSocket : public IONetSocket {
 
     void shutdownSocket(bool read, bool write);
 
+    //! \brief Sends a part of a file
+    //! \param[in] file the file, which is read from its descriptor: data
+    //!            buffered by a BufferedFile is not seen
+    //! \param[in] offset the offset of the first byte, the offset of the file
+    //!            being left unchanged. Ignored for pipes, which are read
+    //!            from their current position.
+    //! \param[in] length the number of bytes
+    //! \return the number of bytes sent, less than length if the end of the
+    //!         file is reached
+    //!
+    //! The kernel moves the bytes from the page cache to the socket
+    //! (sendfile), without copying them to user space. Files sendfile does
+    //! not support go through a pipe with splice. Throws an
+    //! OutputStreamException on errors.
+    ssize_t sendFile(File &file, off_t offset, size_t length);
+
+    //! \brief Enables the zero copy writes (MSG_ZEROCOPY)
+    //! \param[in] enable true to enable them
+    //! \return true if enabled, false if the kernel does not support them
+    //!
+    //! Writes of at least the zero copy threshold are then sent from the
+    //! pages of the caller instead of being copied into the kernel. Since
+    //! the pages must stay untouched until the kernel has sent them, each
+    //! such write waits for its completion notification, read from the
+    //! error queue of the socket: it returns once the peer has acknowledged
+    //! the data. They bypass io_uring. Disabled by default.
+    bool setZeroCopyEnabled(bool enable);
+    bool getZeroCopyEnabled(void) const;
+
+    size_t getZeroCopyThreshold(void) const;
+    void setZeroCopyThreshold(size_t threshold);
+
+    // Zero copy writes for which the kernel still had to copy the data, as
+    // on loopback
+    uint64_t getNbZeroCopyCopied(void) const;
+
+    void closeStream(void);
+
+    //! \brief Batches the writes
+    //! \param[in] threshold the bytes after which a batch is sent, 0 to
+    //!            disable the batching
+    //! \param[in] delay the microseconds a batch waits at most
+    //!
+    //! A write on an idle socket leaves at once, then the socket is corked
+    //! (TCP_CORK): the kernel holds the writes following it and sends them
+    //! in full segments when the batch ends, after the delay, once threshold
+    //! bytes have been written, or on flushBatch. A burst of small objects
+    //! goes out in a few segments while a lone request is not delayed. The
+    //! delays are handled by a thread shared by all the sockets. Disabled
+    //! by default.
+    void setBatching(size_t threshold, uint64_t delay);
+    size_t getBatchThreshold(void) const;
+    uint64_t getBatchDelay(void) const;
+
+    //! \brief Ends the current batch, sending what the kernel holds
+    void flushBatch(void);
+
+    // Batches ended, and the writes and bytes they held
+    uint64_t getNbBatches(void) const;
+    uint64_t getNbBatchedWrites(void) const;
+    uint64_t getNbBatchedBytes(void) const;
+    size_t getMaxBatchBytes(void) const;
+
     void disable_nable(void) {
       int one = 1;
       setsockopt(fd, SOL_TCP, TCP_NODELAY, &one, sizeof(one));
@@ -44,10 +153,26 @@ class TcpServerSocket : public NetSocket {
     TcpServerSocket();
     TcpServerSocket(int localPort);
     TcpServerSocket(int localPort, int backlog);
+
+    //! \brief TcpServerSocket constructor
+    //! \param[in] localPort the port to listen to
+    //! \param[in] backlog the maximum number of pending connections
+    //! \param[in] reusePort true to share the port with other sockets
+    //!            (SO_REUSEPORT), between which the kernel spreads the
+    //!            incoming connections
+    TcpServerSocket(int localPort, int backlog, bool reusePort);
     TcpSocket *acceptConnection();
     TcpSocket *acceptConnection(uint64_t nanosec);
     TcpSocket *acceptConnection(time_t sec, long nanosec);
 
+    //! \brief Accepts a connection without blocking
+    //! \param[in] loop the loop driving the operation
+    //! \param[in] callback called with the new connection
+    //!
+    //! The server socket is switched to non blocking mode, so that
+    //! acceptConnection without timeout no longer waits afterwards.
+    void asyncAccept(AsyncEventLoop &loop, AsyncCallback *callback);
+
     void closeServer(void);
 };
 
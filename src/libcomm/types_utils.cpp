@@ -33,17 +33,8 @@ char *convertToChars(uint8_t uint, size_t &size) {
 }
 
 void convertToChars(uint16_t uint, char *c){
-  size_t size_uint16_t = sizeof(uint16_t);
-  union swap_16 swp16;
-  swp16.uint = uint;
-
-  if (littleEndian) {
-    for (size_t i = 0; i<size_uint16_t; ++i) {
-      c[size_uint16_t-i-1] = swp16.chars[i];
-    }
-  } else {
-    memcpy(c,swp16.chars,size_uint16_t);
-  }
+  uint = hostToBigEndian16(uint);
+  memcpy(c, &uint, sizeof(uint16_t));
 }
 
 char *convertToChars(uint16_t uint, size_t &size) {
@@ -54,17 +45,8 @@ char *convertToChars(uint16_t uint, size_t &size) {
 }
 
 void convertToChars(uint32_t uint, char *c) {
-  size_t size_uint32_t = sizeof(uint32_t);
-  union swap_32 swp32;
-  swp32.uint = uint;
-
-  if (littleEndian) {
-    for (size_t i = 0; i<size_uint32_t; ++i) {
-      c[size_uint32_t-i-1] = swp32.chars[i];
-    }
-  } else {
-    memcpy(c,swp32.chars,size_uint32_t);
-  }
+  uint = hostToBigEndian32(uint);
+  memcpy(c, &uint, sizeof(uint32_t));
 }
 
 char *convertToChars(uint32_t uint, size_t &size) {
@@ -75,18 +57,8 @@ char *convertToChars(uint32_t uint, size_t &size) {
 }
 
 void convertToChars(uint64_t uint, char *c) { 
-  size_t size_uint64_t = sizeof(uint64_t);
-  union swap_64 swp64;
-  swp64.uint = uint;
-
-  std::string str = "";
-  if (littleEndian) {
-    for (size_t i = 0; i<size_uint64_t; ++i) {
-      c[size_uint64_t-i-1] = swp64.chars[i];
-    }
-  } else {
-    memcpy(c,swp64.chars,size_uint64_t);
-  }
+  uint = hostToBigEndian64(uint);
+  memcpy(c, &uint, sizeof(uint64_t));
 }
 
 char *convertToChars(uint64_t uint, size_t &size) {
@@ -97,18 +69,9 @@ char *convertToChars(uint64_t uint, size_t &size) {
 }
 
 void convertToChars(float f, char *c) { 
-  size_t size_float = sizeof(float);
   union swap_float swpf;
   swpf.f = f;
-
-  std::string str = "";
-  if (littleEndian) {
-    for (size_t i = 0; i<size_float; ++i) {
-      c[size_float-i-1] = swpf.chars[i];
-    }
-  } else {
-    memcpy(c,swpf.chars,size_float);
-  }
+  convertToChars(swpf.uint, c);
 }
 
 char *convertToChars(float f, size_t &size) {
@@ -119,18 +82,9 @@ char *convertToChars(float f, size_t &size) {
 }
 
 void convertToChars(double d, char *c) { 
-  size_t size_double = sizeof(double);
   union swap_double swpd;
   swpd.d = d;
-
-  std::string str = "";
-  if (littleEndian) {
-    for (size_t i = 0; i<size_double; ++i) {
-      c[size_double-i-1] = swpd.chars[i];
-    }
-  } else {
-    memcpy(c,swpd.chars,size_double);
-  }
+  convertToChars(swpd.uint, c);
 }
 
 char *convertToChars(double d, size_t &size) {
@@ -145,78 +99,520 @@ uint8_t convertToUInt8(const char* buf) {
 }
 
 uint16_t convertToUInt16(const char* buf) {
-  size_t size_uint16_t = sizeof(uint16_t);
-  union swap_16 swp16;
+  uint16_t uint;
+  memcpy(&uint, buf, sizeof(uint16_t));
+  return bigEndianToHost16(uint);
+}
+
+uint32_t convertToUInt32(const char* buf) {
+  uint32_t uint;
+  memcpy(&uint, buf, sizeof(uint32_t));
+  return bigEndianToHost32(uint);
+}
+
+uint64_t convertToUInt64(const char* buf) {
+  uint64_t uint;
+  memcpy(&uint, buf, sizeof(uint64_t));
+  return bigEndianToHost64(uint);
+}
+
+float convertToFloat(const char* buf) {
+  union swap_float swpf;
+  swpf.uint = convertToUInt32(buf);
+  return swpf.f;
+}
+
+double convertToDouble(const char* buf) {
+  union swap_double swpd;
+  swpd.uint = convertToUInt64(buf);
+  return swpd.d;
+}
+
+// Byte swap kernels. Each one swaps whole vectors and leaves the remaining
+// values (less than a vector) to the scalar loop.
+
+static size_t swapBytesScalar16(const char *src, size_t count, char *dest) {
+  for (size_t i = 0; i < count; ++i) {
+    uint16_t v;
+    memcpy(&v, &(src[i*sizeof(uint16_t)]), sizeof(uint16_t));
+    v = swapBytes16(v);
+    memcpy(&(dest[i*sizeof(uint16_t)]), &v, sizeof(uint16_t));
+  }
+  return count;
+}
+
+static size_t swapBytesScalar32(const char *src, size_t count, char *dest) {
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t v;
+    memcpy(&v, &(src[i*sizeof(uint32_t)]), sizeof(uint32_t));
+    v = swapBytes32(v);
+    memcpy(&(dest[i*sizeof(uint32_t)]), &v, sizeof(uint32_t));
+  }
+  return count;
+}
 
-  if (littleEndian) {
-    for (size_t i = 0; i<size_uint16_t; ++i) {
-      swp16.chars[i] = buf[size_uint16_t-i-1];
+static size_t swapBytesScalar64(const char *src, size_t count, char *dest) {
+  for (size_t i = 0; i < count; ++i) {
+    uint64_t v;
+    memcpy(&v, &(src[i*sizeof(uint64_t)]), sizeof(uint64_t));
+    v = swapBytes64(v);
+    memcpy(&(dest[i*sizeof(uint64_t)]), &v, sizeof(uint64_t));
+  }
+  return count;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define TYPES_UTILS_SSE2_TARGET __attribute__((target("sse2")))
+#define TYPES_UTILS_AVX2_TARGET __attribute__((target("avx2")))
+
+// SSE2 has no byte shuffle: swap the bytes of each 16 bits word with
+// shifts, after reordering the words for the larger types
+TYPES_UTILS_SSE2_TARGET
+static inline __m128i swapBytesInWordsSse2(__m128i v) {
+  return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+TYPES_UTILS_SSE2_TARGET
+static size_t swapBytesSse2_16(const char *src, size_t count, char *dest) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i*) &(src[i*2]));
+    _mm_storeu_si128((__m128i*) &(dest[i*2]), swapBytesInWordsSse2(v));
+  }
+  return i;
+}
+
+TYPES_UTILS_SSE2_TARGET
+static size_t swapBytesSse2_32(const char *src, size_t count, char *dest) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i*) &(src[i*4]));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    _mm_storeu_si128((__m128i*) &(dest[i*4]), swapBytesInWordsSse2(v));
+  }
+  return i;
+}
+
+TYPES_UTILS_SSE2_TARGET
+static size_t swapBytesSse2_64(const char *src, size_t count, char *dest) {
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    __m128i v = _mm_loadu_si128((const __m128i*) &(src[i*8]));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    _mm_storeu_si128((__m128i*) &(dest[i*8]), swapBytesInWordsSse2(v));
+  }
+  return i;
+}
+
+TYPES_UTILS_AVX2_TARGET
+static inline size_t swapBytesAvx2(const char *src, size_t size, char *dest,
+  __m256i mask) {
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) &(src[i]));
+    _mm256_storeu_si256((__m256i*) &(dest[i]), _mm256_shuffle_epi8(v, mask));
+  }
+  return i;
+}
+
+TYPES_UTILS_AVX2_TARGET
+static size_t swapBytesAvx2_16(const char *src, size_t count, char *dest) {
+  const __m256i mask = _mm256_setr_epi8(
+    1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+    1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  return swapBytesAvx2(src, count*2, dest, mask) / 2;
+}
+
+TYPES_UTILS_AVX2_TARGET
+static size_t swapBytesAvx2_32(const char *src, size_t count, char *dest) {
+  const __m256i mask = _mm256_setr_epi8(
+    3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+    3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  return swapBytesAvx2(src, count*4, dest, mask) / 4;
+}
+
+TYPES_UTILS_AVX2_TARGET
+static size_t swapBytesAvx2_64(const char *src, size_t count, char *dest) {
+  const __m256i mask = _mm256_setr_epi8(
+    7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+    7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+  return swapBytesAvx2(src, count*8, dest, mask) / 8;
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+static size_t swapBytesNeon16(const char *src, size_t count, char *dest) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    uint8x16_t v = vld1q_u8((const uint8_t*) &(src[i*2]));
+    vst1q_u8((uint8_t*) &(dest[i*2]), vrev16q_u8(v));
+  }
+  return i;
+}
+
+static size_t swapBytesNeon32(const char *src, size_t count, char *dest) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    uint8x16_t v = vld1q_u8((const uint8_t*) &(src[i*4]));
+    vst1q_u8((uint8_t*) &(dest[i*4]), vrev32q_u8(v));
+  }
+  return i;
+}
+
+static size_t swapBytesNeon64(const char *src, size_t count, char *dest) {
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    uint8x16_t v = vld1q_u8((const uint8_t*) &(src[i*8]));
+    vst1q_u8((uint8_t*) &(dest[i*8]), vrev64q_u8(v));
+  }
+  return i;
+}
+#endif
+
+typedef size_t (*SwapBytesFunc)(const char *src, size_t count, char *dest);
+
+struct SwapBytesKernel {
+  const char *name;
+  SwapBytesFunc swap16;
+  SwapBytesFunc swap32;
+  SwapBytesFunc swap64;
+};
+
+// Ordered from the fastest to the slowest
+static const SwapBytesKernel swapBytesKernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+  {"avx2", &swapBytesAvx2_16, &swapBytesAvx2_32, &swapBytesAvx2_64},
+  {"sse2", &swapBytesSse2_16, &swapBytesSse2_32, &swapBytesSse2_64},
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  {"neon", &swapBytesNeon16, &swapBytesNeon32, &swapBytesNeon64},
+#endif
+  {"scalar", &swapBytesScalar16, &swapBytesScalar32, &swapBytesScalar64}
+};
+
+#define NB_SWAP_BYTES_KERNELS (sizeof(swapBytesKernels) / sizeof(SwapBytesKernel))
+
+static bool isKernelSupported(const char *name) {
+#if defined(__x86_64__) || defined(__i386__)
+  if (strcmp(name, "avx2") == 0) {
+    return __builtin_cpu_supports("avx2");
+  } else if (strcmp(name, "sse2") == 0) {
+    return __builtin_cpu_supports("sse2");
+  }
+#endif
+  return true;
+}
+
+static bool isSwapBytesKernelSupported(const SwapBytesKernel *kernel) {
+  return isKernelSupported(kernel->name);
+}
+
+static const SwapBytesKernel *selectBestSwapBytesKernel(void) {
+  for (size_t i = 0; i < NB_SWAP_BYTES_KERNELS; ++i) {
+    if (isSwapBytesKernelSupported(&(swapBytesKernels[i]))) {
+      return &(swapBytesKernels[i]);
     }
-  } else {
-    memcpy (swp16.chars, buf, size_uint16_t);
   }
-  
-  return swp16.uint;
+  return &(swapBytesKernels[NB_SWAP_BYTES_KERNELS - 1]);
 }
 
-uint32_t convertToUInt32(const char* buf) {
-  size_t size_uint32_t = sizeof(uint32_t);
-  union swap_32 swp32;
+static const SwapBytesKernel *currentSwapBytesKernel = NULL;
+
+static const SwapBytesKernel *getSwapBytesKernel(void) {
+  const SwapBytesKernel *kernel = 
+    __atomic_load_n(&currentSwapBytesKernel, __ATOMIC_ACQUIRE);
 
-  if (littleEndian) {
-    for (size_t i = 0; i<size_uint32_t; ++i) {
-      swp32.chars[i] = buf[size_uint32_t-i-1];
+  if (kernel == NULL) {
+    kernel = selectBestSwapBytesKernel();
+    __atomic_store_n(&currentSwapBytesKernel, kernel, __ATOMIC_RELEASE);
+  }
+  return kernel;
+}
+
+const char *getSwapBytesKernelName(void) {
+  return getSwapBytesKernel()->name;
+}
+
+bool setSwapBytesKernel(const char *name) {
+  for (size_t i = 0; i < NB_SWAP_BYTES_KERNELS; ++i) {
+    if ((strcmp(swapBytesKernels[i].name, name) == 0)
+      && isSwapBytesKernelSupported(&(swapBytesKernels[i]))) {
+      __atomic_store_n(&currentSwapBytesKernel, &(swapBytesKernels[i]),
+        __ATOMIC_RELEASE);
+      return true;
     }
-  } else {
-    memcpy (swp32.chars, buf, size_uint32_t);
   }
-  
-  return swp32.uint;
+  return false;
 }
 
-uint64_t convertToUInt64(const char* buf) {
-  size_t size_uint64_t = sizeof(uint64_t);
-  union swap_64 swp64;
+void swapBytesArray16(const void *src, size_t count, void *dest) {
+  size_t done = getSwapBytesKernel()->swap16((const char*) src, count, (char*) dest);
+  swapBytesScalar16(&(((const char*) src)[done*2]), count - done, &(((char*) dest)[done*2]));
+}
+
+void swapBytesArray32(const void *src, size_t count, void *dest) {
+  size_t done = getSwapBytesKernel()->swap32((const char*) src, count, (char*) dest);
+  swapBytesScalar32(&(((const char*) src)[done*4]), count - done, &(((char*) dest)[done*4]));
+}
+
+void swapBytesArray64(const void *src, size_t count, void *dest) {
+  size_t done = getSwapBytesKernel()->swap64((const char*) src, count, (char*) dest);
+  swapBytesScalar64(&(((const char*) src)[done*8]), count - done, &(((char*) dest)[done*8]));
+}
 
-  if (littleEndian) {
-    for (size_t i = 0; i<size_uint64_t; ++i) {
-      swp64.chars[i] = buf[size_uint64_t-i-1];
+// Delimiter search. The kernels return the offset of the first delimiter
+// in their whole blocks, or the end of these blocks: the scalar loop goes on
+// from there.
+static size_t findDelimiterScalar(const char *data, size_t size,
+  const char *delimiters, size_t nbDelimiters) {
+  for (size_t i = 0; i < size; ++i) {
+    for (size_t j = 0; j < nbDelimiters; ++j) {
+      if (data[i] == delimiters[j]) return i;
     }
-  } else {
-    memcpy (swp64.chars, buf, size_uint64_t);
   }
-  
-  return swp64.uint;
+  return size;
 }
 
-float convertToFloat(const char* buf) {
-  size_t size_float = sizeof(float);
-  union swap_float swpf;
+#if defined(__x86_64__) || defined(__i386__)
+TYPES_UTILS_SSE2_TARGET
+static size_t findDelimiterSse2(const char *data, size_t size,
+  const char *delimiters, size_t nbDelimiters) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*) &(data[i]));
+    __m128i matches = _mm_setzero_si128();
+    int mask;
+
+    for (size_t j = 0; j < nbDelimiters; ++j) {
+      matches = _mm_or_si128(matches, _mm_cmpeq_epi8(v, _mm_set1_epi8(delimiters[j])));
+    }
+    mask = _mm_movemask_epi8(matches);
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+  return i;
+}
 
-  if (littleEndian) {
-    for (size_t i = 0; i<size_float; ++i) {
-      swpf.chars[i] = buf[size_float-i-1];
+TYPES_UTILS_AVX2_TARGET
+static size_t findDelimiterAvx2(const char *data, size_t size,
+  const char *delimiters, size_t nbDelimiters) {
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*) &(data[i]));
+    __m256i matches = _mm256_setzero_si256();
+    unsigned int mask;
+
+    for (size_t j = 0; j < nbDelimiters; ++j) {
+      matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(delimiters[j])));
     }
-  } else {
-    memcpy (swpf.chars, buf, size_float);
+    mask = (unsigned int) _mm256_movemask_epi8(matches);
+    if (mask != 0) return i + __builtin_ctz(mask);
   }
-  
-  return swpf.f;
+  return i;
+}
+#endif
+
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && defined(__aarch64__)
+// No movemask: a block holding a delimiter is left to the scalar loop
+static size_t findDelimiterNeon(const char *data, size_t size,
+  const char *delimiters, size_t nbDelimiters) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    uint8x16_t v = vld1q_u8((const uint8_t*) &(data[i]));
+    uint8x16_t matches = vdupq_n_u8(0);
+
+    for (size_t j = 0; j < nbDelimiters; ++j) {
+      matches = vorrq_u8(matches, vceqq_u8(v, vdupq_n_u8((uint8_t) delimiters[j])));
+    }
+    if (vmaxvq_u8(matches) != 0) return i;
+  }
+  return i;
+}
+#endif
+
+typedef size_t (*FindDelimiterFunc)(const char *data, size_t size,
+  const char *delimiters, size_t nbDelimiters);
+
+struct FindDelimiterKernel {
+  const char *name;
+  FindDelimiterFunc find;
+};
+
+// Ordered from the fastest to the slowest
+static const FindDelimiterKernel findDelimiterKernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+  {"avx2", &findDelimiterAvx2},
+  {"sse2", &findDelimiterSse2},
+#endif
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && defined(__aarch64__)
+  {"neon", &findDelimiterNeon},
+#endif
+  {"scalar", &findDelimiterScalar}
+};
+
+#define NB_FIND_DELIMITER_KERNELS (sizeof(findDelimiterKernels) / sizeof(FindDelimiterKernel))
+
+static const FindDelimiterKernel *currentFindDelimiterKernel = NULL;
+
+static const FindDelimiterKernel *getFindDelimiterKernel(void) {
+  const FindDelimiterKernel *kernel =
+    __atomic_load_n(&currentFindDelimiterKernel, __ATOMIC_ACQUIRE);
+
+  if (kernel == NULL) {
+    kernel = &(findDelimiterKernels[NB_FIND_DELIMITER_KERNELS - 1]);
+    for (size_t i = 0; i < NB_FIND_DELIMITER_KERNELS; ++i) {
+      if (isKernelSupported(findDelimiterKernels[i].name)) {
+        kernel = &(findDelimiterKernels[i]);
+        break;
+      }
+    }
+    __atomic_store_n(&currentFindDelimiterKernel, kernel, __ATOMIC_RELEASE);
+  }
+  return kernel;
 }
 
-double convertToDouble(const char* buf) {
-  size_t size_double = sizeof(double);
-  union swap_double swpd;
+const char *getFindDelimiterKernelName(void) {
+  return getFindDelimiterKernel()->name;
+}
 
-  if (littleEndian) {
-    for (size_t i = 0; i<size_double; ++i) {
-      swpd.chars[i] = buf[size_double-i-1];
+bool setFindDelimiterKernel(const char *name) {
+  for (size_t i = 0; i < NB_FIND_DELIMITER_KERNELS; ++i) {
+    if ((strcmp(findDelimiterKernels[i].name, name) == 0)
+      && isKernelSupported(name)) {
+      __atomic_store_n(&currentFindDelimiterKernel, &(findDelimiterKernels[i]),
+        __ATOMIC_RELEASE);
+      return true;
     }
+  }
+  return false;
+}
+
+const char *findDelimiter(const char *data, size_t size,
+  const char *delimiters, size_t nbDelimiters) {
+  size_t index;
+
+  if (nbDelimiters == 1) return (const char*) memchr(data, delimiters[0], size);
+
+  index = getFindDelimiterKernel()->find(data, size, delimiters, nbDelimiters);
+  index += findDelimiterScalar(&(data[index]), size - index, delimiters, nbDelimiters);
+  return (index < size) ? &(data[index]) : NULL;
+}
+
+// Array conversions
+void convertArrayToChars(const uint8_t *src, size_t count, char *dest) {
+  memcpy(dest, src, count);
+}
+
+void convertArrayToChars(const uint16_t *src, size_t count, char *dest) {
+  if (HOST_IS_LITTLE_ENDIAN) {
+    swapBytesArray16(src, count, dest);
   } else {
-    memcpy (swpd.chars, buf, size_double);
+    memcpy(dest, src, count*sizeof(uint16_t));
   }
-  
-  return swpd.d;
+}
+
+void convertArrayToChars(const uint32_t *src, size_t count, char *dest) {
+  if (HOST_IS_LITTLE_ENDIAN) {
+    swapBytesArray32(src, count, dest);
+  } else {
+    memcpy(dest, src, count*sizeof(uint32_t));
+  }
+}
+
+void convertArrayToChars(const uint64_t *src, size_t count, char *dest) {
+  if (HOST_IS_LITTLE_ENDIAN) {
+    swapBytesArray64(src, count, dest);
+  } else {
+    memcpy(dest, src, count*sizeof(uint64_t));
+  }
+}
+
+void convertArrayToChars(const float *src, size_t count, char *dest) {
+  convertArrayToChars((const uint32_t*) src, count, dest);
+}
+
+void convertArrayToChars(const double *src, size_t count, char *dest) {
+  convertArrayToChars((const uint64_t*) src, count, dest);
+}
+
+void convertArrayFromChars(const char *src, size_t count, uint8_t *dest) {
+  memcpy(dest, src, count);
+}
+
+void convertArrayFromChars(const char *src, size_t count, uint16_t *dest) {
+  if (HOST_IS_LITTLE_ENDIAN) {
+    swapBytesArray16(src, count, dest);
+  } else {
+    memcpy(dest, src, count*sizeof(uint16_t));
+  }
+}
+
+void convertArrayFromChars(const char *src, size_t count, uint32_t *dest) {
+  if (HOST_IS_LITTLE_ENDIAN) {
+    swapBytesArray32(src, count, dest);
+  } else {
+    memcpy(dest, src, count*sizeof(uint32_t));
+  }
+}
+
+void convertArrayFromChars(const char *src, size_t count, uint64_t *dest) {
+  if (HOST_IS_LITTLE_ENDIAN) {
+    swapBytesArray64(src, count, dest);
+  } else {
+    memcpy(dest, src, count*sizeof(uint64_t));
+  }
+}
+
+void convertArrayFromChars(const char *src, size_t count, float *dest) {
+  convertArrayFromChars(src, count, (uint32_t*) dest);
+}
+
+void convertArrayFromChars(const char *src, size_t count, double *dest) {
+  convertArrayFromChars(src, count, (uint64_t*) dest);
+}
+
+size_t convertToVarint(uint64_t uint, char *c) {
+  size_t i = 0;
+
+  while (uint >= 0x80) {
+    c[i++] = (char) ((uint & 0x7F) | 0x80);
+    uint >>= 7;
+  }
+  c[i++] = (char) uint;
+
+  return i;
+}
+
+size_t convertFromVarint(const char *buf, size_t size, uint64_t *uint) {
+  uint64_t result = 0;
+
+  for (size_t i = 0; (i < size) && (i < VARINT_MAX_SIZE); ++i) {
+    // The 10th byte holds the 64th bit only
+    if ((i == VARINT_MAX_SIZE - 1) && (buf[i] & 0x7E)) return 0;
+    result |= ((uint64_t) (buf[i] & 0x7F)) << (7 * i);
+    if ((buf[i] & 0x80) == 0) {
+      *uint = result;
+      return i + 1;
+    }
+  }
+
+  return 0;
+}
+
+size_t getVarintSize(uint64_t uint) {
+  size_t size = 1;
+
+  while (uint >= 0x80) {
+    uint >>= 7;
+    ++size;
+  }
+
+  return size;
 }
 
 void nanosecToSecNsec(uint64_t nanosec, time_t *sec, long *nsec) {
@@ -2,6 +2,8 @@
 #define TYPES_UTILS_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <time.h>
 
 enum {  NONE,
         CHAR,
@@ -22,11 +24,13 @@ const size_t primitiveSizeArray[] = {0, 1, 4, 8, 1, 2, 4, 8, 1, 2, 4, 8};
 
 union swap_float {
   float f;
+  uint32_t uint;
   char chars[4];
 };
 
 union swap_double {
   double d;
+  uint64_t uint;
   char chars[8];
 };
 
@@ -47,6 +51,61 @@ union swap_64 {
 
 int isLittleEndian();
 
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define HOST_IS_LITTLE_ENDIAN 0
+#else
+#define HOST_IS_LITTLE_ENDIAN 1
+#endif
+
+// Single value byte swaps, compiled to a bswap instruction
+static inline uint16_t swapBytes16(uint16_t v) {
+  return __builtin_bswap16(v);
+}
+
+static inline uint32_t swapBytes32(uint32_t v) {
+  return __builtin_bswap32(v);
+}
+
+static inline uint64_t swapBytes64(uint64_t v) {
+  return __builtin_bswap64(v);
+}
+
+static inline uint16_t hostToBigEndian16(uint16_t v) {
+  return HOST_IS_LITTLE_ENDIAN ? swapBytes16(v) : v;
+}
+
+static inline uint32_t hostToBigEndian32(uint32_t v) {
+  return HOST_IS_LITTLE_ENDIAN ? swapBytes32(v) : v;
+}
+
+static inline uint64_t hostToBigEndian64(uint64_t v) {
+  return HOST_IS_LITTLE_ENDIAN ? swapBytes64(v) : v;
+}
+
+#define bigEndianToHost16(v) hostToBigEndian16(v)
+#define bigEndianToHost32(v) hostToBigEndian32(v)
+#define bigEndianToHost64(v) hostToBigEndian64(v)
+
+// Byte swap count values of 2, 4 or 8 bytes from src to dest, which may be
+// the same buffer. Neither needs to be aligned. The vectorized kernel (avx2,
+// sse2, neon or scalar) is selected at the first call from what the CPU
+// supports.
+void swapBytesArray16(const void *src, size_t count, void *dest);
+void swapBytesArray32(const void *src, size_t count, void *dest);
+void swapBytesArray64(const void *src, size_t count, void *dest);
+// Name of the selected kernel
+const char *getSwapBytesKernelName(void);
+// Force a kernel, by name. Returns false if the CPU does not support it.
+bool setSwapBytesKernel(const char *name);
+
+// First byte of data which is one of the nbDelimiters delimiters, or NULL.
+// A single delimiter is searched with memchr, already vectorized by the C
+// library. For several, the kernel is selected as for the byte swaps.
+const char *findDelimiter(const char *data, size_t size,
+  const char *delimiters, size_t nbDelimiters);
+const char *getFindDelimiterKernelName(void);
+bool setFindDelimiterKernel(const char *name);
+
 void convertToChars(uint8_t uint, char *c);
 char *convertToChars(uint8_t uint, size_t &size);
 void convertToChars(uint16_t uint, char *c);
@@ -66,6 +125,77 @@ uint64_t convertToUInt64(const char* buf);
 float convertToFloat(const char* buf);
 double convertToDouble(const char* buf);
 
+// Convert count values at once, to or from their big endian representation
+void convertArrayToChars(const uint8_t *src, size_t count, char *dest);
+void convertArrayToChars(const uint16_t *src, size_t count, char *dest);
+void convertArrayToChars(const uint32_t *src, size_t count, char *dest);
+void convertArrayToChars(const uint64_t *src, size_t count, char *dest);
+void convertArrayToChars(const float *src, size_t count, char *dest);
+void convertArrayToChars(const double *src, size_t count, char *dest);
+void convertArrayFromChars(const char *src, size_t count, uint8_t *dest);
+void convertArrayFromChars(const char *src, size_t count, uint16_t *dest);
+void convertArrayFromChars(const char *src, size_t count, uint32_t *dest);
+void convertArrayFromChars(const char *src, size_t count, uint64_t *dest);
+void convertArrayFromChars(const char *src, size_t count, float *dest);
+void convertArrayFromChars(const char *src, size_t count, double *dest);
+
+// PackedArray<T>::packed is true for the primitive types, which containers
+// send as one block of big endian values instead of one NetMessage per
+// element. encode and decode do nothing for other types.
+template <typename T>
+struct PackedArray {
+  enum { packed = 0 };
+  static void encode(const T *src, size_t count, char *dest) {}
+  static void decode(const char *src, size_t count, T *dest) {}
+};
+
+#define PACKED_ARRAY(type,wireType) \
+  template <> \
+  struct PackedArray<type> { \
+    enum { packed = 1 }; \
+    static void encode(const type *src, size_t count, char *dest) { \
+      convertArrayToChars((const wireType*) src, count, dest); \
+    } \
+    static void decode(const char *src, size_t count, type *dest) { \
+      convertArrayFromChars(src, count, (wireType*) dest); \
+    } \
+  };
+
+PACKED_ARRAY(char, uint8_t)
+PACKED_ARRAY(int8_t, uint8_t)
+PACKED_ARRAY(uint8_t, uint8_t)
+PACKED_ARRAY(int16_t, uint16_t)
+PACKED_ARRAY(uint16_t, uint16_t)
+PACKED_ARRAY(int32_t, uint32_t)
+PACKED_ARRAY(uint32_t, uint32_t)
+PACKED_ARRAY(int64_t, uint64_t)
+PACKED_ARRAY(uint64_t, uint64_t)
+PACKED_ARRAY(float, float)
+PACKED_ARRAY(double, double)
+
+// Maximum size of a 64 bits varint
+#define VARINT_MAX_SIZE 10
+
+// LEB128 varints: 7 bits per byte, least significant group first, high bit
+// set on every byte but the last. Returns the number of bytes written.
+size_t convertToVarint(uint64_t uint, char *c);
+// Returns the number of bytes of the varint at the beginning of buf, or 0
+// if it is not complete within size bytes, longer than VARINT_MAX_SIZE or
+// beyond 64 bits.
+size_t convertFromVarint(const char *buf, size_t size, uint64_t *uint);
+// Size of the varint representing uint
+size_t getVarintSize(uint64_t uint);
+
+// Zigzag mapping of signed values, so that small negative values give
+// small varints
+static inline uint64_t zigzagEncode(int64_t v) {
+  return (((uint64_t) v) << 1) ^ ((uint64_t) (v >> 63));
+}
+
+static inline int64_t zigzagDecode(uint64_t v) {
+  return (int64_t) ((v >> 1) ^ (~(v & 1) + 1));
+}
+
 void nanosecToSecNsec(uint64_t nanosec, time_t *sec, long *nsec);
 uint64_t secNsecToNanosec(time_t sec, long nanosec);
 
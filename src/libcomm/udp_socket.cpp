@@ -6,25 +6,49 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <netinet/udp.h>
+
+#include <algorithm>
 
 #include <iostream>
 
 #include "udp_socket.h"
 #include "serialization_manager.h"
+#include "async_event_loop.h"
+#include "object_parser.h"
 
 #define MAX_UDP_PACKET_SIZE 1500
 #define NB_USEC_PER_SEC 1000000000
 
+// Biggest payload of an IPv4 datagram, and of a GSO buffer
+#define MAX_UDP_PAYLOAD_SIZE 65507
+// Segments per GSO buffer accepted by every kernel having UDP_SEGMENT
+#define MAX_GSO_SEGMENTS 64
+// Messages per sendmmsg/recvmmsg call accepted by the kernel
+#define MAX_MMSG 1024
+
 const int MAX_IOV = sysconf(_SC_IOV_MAX);
 
-UdpSocket::UdpSocket(): IONetSocket(SOCK_DGRAM), maxSize(MAX_UDP_PACKET_SIZE) {}
+UdpSocket::UdpSocket(): IONetSocket(SOCK_DGRAM), maxSize(MAX_UDP_PACKET_SIZE),
+  genericOffload(false), batchBuffer(NULL), batchBufferSize(0) {
+  directRead = false;
+  // An object must stay in a single datagram
+  setWriteWindowSize(0);
+}
 
-UdpSocket::UdpSocket(int localPort): IONetSocket(SOCK_DGRAM), maxSize(MAX_UDP_PACKET_SIZE) {
+UdpSocket::UdpSocket(int localPort): IONetSocket(SOCK_DGRAM), maxSize(MAX_UDP_PACKET_SIZE),
+  genericOffload(false), batchBuffer(NULL), batchBufferSize(0) {
+  directRead = false;
+  setWriteWindowSize(0);
   BooleanOption opt(BooleanOption::reuseAddrOpt, true);
   setSocketOption(opt);
   bindSocket(localPort);
 }
 
+UdpSocket::~UdpSocket(void) {
+  free(batchBuffer);
+}
+
 void UdpSocket::setMaximumSize(size_t maxSize) {
   this->maxSize = maxSize;
 }
@@ -33,17 +57,43 @@ size_t UdpSocket::getMaximumSize(void) {
   return maxSize;
 }
 
+void UdpSocket::setGenericOffload(bool enable) {
+  genericOffload = enable;
+#ifdef UDP_GRO
+  int value = enable;
+
+  // Without GRO, the kernel still splits what it receives: not an error
+  setsockopt(fd, SOL_UDP, UDP_GRO, &value, sizeof(value));
+#endif
+}
+
+bool UdpSocket::getGenericOffload(void) const {
+  return genericOffload;
+}
+
 ssize_t UdpSocket::readRawData(   char *buffer, size_t size, int flags,
                                   NetAddress *addr) {
+  struct iovec iov;
+
+  iov.iov_base = buffer;
+  iov.iov_len = size;
+  return readRawData(&iov, 1, flags, addr);
+}
+
+ssize_t UdpSocket::readRawData(   const struct iovec *iov, int iovcnt,
+                                  int flags, NetAddress *addr) {
   struct sockaddr_in clientAddr;
-  socklen_t sizeAddr = sizeof(clientAddr);
+  struct msghdr msg;
   ssize_t bytesRead;
 
-  if (addr == NULL) {
-    bytesRead = recv(fd, buffer, size, flags);
-  } else {
-    bytesRead = recvfrom(fd, buffer, size, flags, (sockaddr*) &clientAddr, &sizeAddr);
+  memset(&msg, 0, sizeof(msg));
+  if (addr != NULL) {
+    msg.msg_name = &clientAddr;
+    msg.msg_namelen = sizeof(clientAddr);
   }
+  msg.msg_iov = (struct iovec*) iov;
+  msg.msg_iovlen = iovcnt;
+  bytesRead = recvmsg(fd, &msg, flags);
  
   switch (bytesRead) {
     case -1:
@@ -108,6 +158,9 @@ ssize_t UdpSocket::writeData( const char *data, size_t size, int flags,
 ssize_t UdpSocket::writeData( const struct iovec *iov, int iovcnt,
                               const NetAddress *addr) {
   int currentIovCnt;
+  int totalIovCnt = 0;
+  struct msghdr msg;
+  struct sockaddr_in clientAddr;
   size_t totalBytesToWrite = 0;
   ssize_t quantityWritten = 0;
   size_t totalQuantityWritten = 0;
@@ -121,55 +174,367 @@ ssize_t UdpSocket::writeData( const struct iovec *iov, int iovcnt,
       "Too much data to send into a single UDP packet.");
   }
 
-  if (addr == NULL) {
-    int totalIovCnt = 0;
-
-    while (totalIovCnt < iovcnt) {
-      currentIovCnt = iovcnt - totalIovCnt;
-      if (currentIovCnt > MAX_IOV) currentIovCnt = MAX_IOV;
-
-      quantityWritten = writev(fd, &(iov[totalIovCnt]), currentIovCnt);
-      if (quantityWritten == -1) {
-        size_t toWrite;
-        char *dataLeft;
-        
-        dataLeft = generateRemainingData(iov,iovcnt, totalQuantityWritten, &toWrite);
-        throw OutputStream::OutputStreamException(errno, toWrite,  dataLeft,
-          quantityWritten);
+  memset(&msg, 0, sizeof(msg));
+  if (addr != NULL) {
+    addr->getSockAddr(&clientAddr);
+    msg.msg_name = &clientAddr;
+    msg.msg_namelen = sizeof(clientAddr);
+  }
+
+  // One sendmsg per datagram. Beyond IOV_MAX fragments, the datagram is
+  // corked with MSG_MORE until its last chunk.
+  while (totalIovCnt < iovcnt) {
+    currentIovCnt = iovcnt - totalIovCnt;
+    if (currentIovCnt > MAX_IOV) currentIovCnt = MAX_IOV;
+
+    msg.msg_iov = (struct iovec*) &(iov[totalIovCnt]);
+    msg.msg_iovlen = currentIovCnt;
+    quantityWritten = sendmsg(fd, &msg,
+      (totalIovCnt + currentIovCnt < iovcnt) ? MSG_MORE : 0);
+    if (quantityWritten == -1) {
+      size_t toWrite;
+      char *dataLeft;
+
+      dataLeft = generateRemainingData(iov,iovcnt, totalQuantityWritten, &toWrite);
+      throw OutputStream::OutputStreamException(errno, toWrite,  dataLeft,
+        quantityWritten);
+    }
+    totalQuantityWritten += quantityWritten;
+    totalIovCnt += currentIovCnt;
+  }
+
+  return totalQuantityWritten;
+}
+
+ssize_t UdpSocket::writeObject(const Serializable &object, const NetAddress &addr) {
+  return writeObject2(object, &addr);
+}
+
+void UdpSocket::asyncWriteObject(AsyncEventLoop &loop, const Serializable &object,
+  const NetAddress &addr, AsyncCallback *callback) {
+  size_t size;
+  char *data;
+
+  data = flattenObject(object, &size);
+  if ((maxSize != 0) && (size > maxSize)) {
+    free(data);
+    throw OutputStreamException(EX_OSTREAM_TOO_MUCH_DATA, size,
+      "Too much data to send into a single UDP packet.");
+  }
+  loop.writeObject(this, data, size, &addr, callback);
+}
+
+ssize_t UdpSocket::sendBatch(std::vector<struct mmsghdr> &messages,
+  const std::vector<size_t> &nbObjects, size_t *nbSent) {
+  size_t messagesSent = 0;
+
+  *nbSent = 0;
+  while (messagesSent < messages.size()) {
+    unsigned int count = std::min(messages.size() - messagesSent, (size_t) MAX_MMSG);
+    int result = sendmmsg(fd, &messages[messagesSent], count, 0);
+
+    if (result == -1) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    for (int i = 0; i < result; ++i) {
+      *nbSent += nbObjects[messagesSent + i];
+    }
+    messagesSent += result;
+  }
+
+  return 0;
+}
+
+size_t UdpSocket::writeObjects(const std::vector<const Serializable*> &objects,
+  const std::vector<NetAddress> &addresses) {
+  size_t nbObjects = objects.size();
+  std::vector<char*> data(nbObjects, (char*) NULL);
+  std::vector<struct iovec> iov(nbObjects);
+  std::vector<struct sockaddr_in> sockAddrs(addresses.size());
+  size_t nbSent = 0;
+  int error = 0;
+
+  if ((addresses.size() != nbObjects) && (addresses.size() != 1)) {
+    throw OutputStreamException(EINVAL, 0,
+      "One address per object, or a single one, is expected.");
+  }
+  if (nbObjects == 0) return 0;
+
+  try {
+    for (size_t i = 0; i < nbObjects; ++i) {
+      data[i] = flattenObject(*objects[i], &iov[i].iov_len);
+      iov[i].iov_base = data[i];
+      if ((maxSize != 0) && (iov[i].iov_len > maxSize)) {
+        throw OutputStreamException(EX_OSTREAM_TOO_MUCH_DATA, iov[i].iov_len,
+          "Too much data to send into a single UDP packet.");
       }
-      totalQuantityWritten += quantityWritten;
-      totalIovCnt += currentIovCnt;
     }
-  } else {
-    struct sockaddr_in clientAddr;
-    socklen_t sizeAddr;
+  } catch (Exception &e) {
+    for (size_t i = 0; i < nbObjects; ++i) free(data[i]);
+    throw e;
+  }
+  for (size_t i = 0; i < addresses.size(); ++i) {
+    addresses[i].getSockAddr(&sockAddrs[i]);
+  }
 
-    addr->getSockAddr(&clientAddr);
-    sizeAddr = sizeof(clientAddr);
+  for (;;) {
+    std::vector<struct mmsghdr> messages;
+    std::vector<size_t> nbObjectsPerMessage;
+#ifdef UDP_SEGMENT
+    std::vector<char> control;
+    const size_t controlSize = CMSG_SPACE(sizeof(uint16_t));
+
+    // One control block per message at most
+    if (genericOffload) control.resize(nbObjects * controlSize, 0);
+#endif
+
+    for (size_t first = 0; first < nbObjects;) {
+      struct sockaddr_in *sockAddr = &sockAddrs[(addresses.size() == 1) ? 0 : first];
+      struct mmsghdr message;
+      size_t last = first + 1;
+
+#ifdef UDP_SEGMENT
+      if (genericOffload) {
+        size_t segmentSize = iov[first].iov_len;
+        size_t totalSize = segmentSize;
+
+        // The kernel cuts a GSO buffer in segments of the size of the first
+        // one: only the last datagram may be shorter
+        while ((last < nbObjects) && (last - first < MAX_GSO_SEGMENTS)
+          && (iov[last - 1].iov_len == segmentSize)
+          && (iov[last].iov_len <= segmentSize) && (iov[last].iov_len > 0)
+          && (totalSize + iov[last].iov_len <= MAX_UDP_PAYLOAD_SIZE)
+          && ((addresses.size() == 1)
+            || (memcmp(&sockAddrs[last], sockAddr, sizeof(*sockAddr)) == 0))) {
+          totalSize += iov[last].iov_len;
+          ++last;
+        }
+      }
+#endif
+
+      memset(&message, 0, sizeof(message));
+      message.msg_hdr.msg_name = sockAddr;
+      message.msg_hdr.msg_namelen = sizeof(*sockAddr);
+      message.msg_hdr.msg_iov = &iov[first];
+      message.msg_hdr.msg_iovlen = last - first;
+
+#ifdef UDP_SEGMENT
+      if (last - first > 1) {
+        char *buffer = &control[messages.size() * controlSize];
+        struct cmsghdr *cmsg = (struct cmsghdr*) buffer;
+        uint16_t segmentSize = iov[first].iov_len;
+
+        message.msg_hdr.msg_control = buffer;
+        message.msg_hdr.msg_controllen = controlSize;
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(segmentSize));
+        memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+      }
+#endif
+
+      messages.push_back(message);
+      nbObjectsPerMessage.push_back(last - first);
+      first = last;
+    }
+
+    if (sendBatch(messages, nbObjectsPerMessage, &nbSent) == 0) break;
+    error = errno;
+    // A kernel or a device without GSO: sent again without it
+    if (genericOffload && (nbSent == 0) && (messages.size() < nbObjects)
+      && ((error == EIO) || (error == EINVAL) || (error == ENOPROTOOPT)
+        || (error == EOPNOTSUPP))) {
+      genericOffload = false;
+      error = 0;
+      continue;
+    }
+    break;
+  }
+
+  for (size_t i = 0; i < nbObjects; ++i) free(data[i]);
+  if ((error != 0) && (nbSent == 0)) {
+    throw OutputStreamException(error, nbObjects);
+  }
+
+  return nbSent;
+}
 
-    for (int i = 0; i<iovcnt; ++i) {
-      quantityWritten = sendto(fd, iov[i].iov_base, iov[i].iov_len, MSG_MORE,
-        (const sockaddr*) &clientAddr, sizeAddr);
+size_t UdpSocket::readObjects(std::vector<Serializable*> *objects,
+  std::vector<NetAddress> *addresses, size_t maxDatagrams) {
+  struct mmsghdr messages[UDP_BATCH_SIZE];
+  struct iovec iov[UDP_BATCH_SIZE];
+  struct sockaddr_in sockAddrs[UDP_BATCH_SIZE];
+  size_t slotSize;
+  size_t nbDatagrams = 0;
+  size_t nbObjects = 0;
+  int flags = MSG_WAITFORONE;
+#ifdef UDP_GRO
+  const size_t controlSize = CMSG_SPACE(sizeof(int));
+  char control[UDP_BATCH_SIZE][CMSG_SPACE(sizeof(int))];
+#endif
+
+  // Coalesced datagrams may fill a whole IP packet
+  slotSize = ((maxSize == 0) || genericOffload) ? MAX_UDP_PAYLOAD_SIZE : maxSize;
+  if (batchBufferSize < slotSize * UDP_BATCH_SIZE) {
+    char *buffer = (char*) realloc(batchBuffer, slotSize * UDP_BATCH_SIZE);
+
+    if (buffer == NULL) throw InputStreamException(ENOMEM);
+    batchBuffer = buffer;
+    batchBufferSize = slotSize * UDP_BATCH_SIZE;
+  }
 
-      if (quantityWritten == -1) {
-        char *dataLeft;
-        size_t toWrite;
+  ObjectParser parser(slotSize);
+
+  while (nbDatagrams < maxDatagrams) {
+    unsigned int count = std::min(maxDatagrams - nbDatagrams, (size_t) UDP_BATCH_SIZE);
+    int result;
+
+    for (unsigned int i = 0; i < count; ++i) {
+      memset(&messages[i], 0, sizeof(messages[i]));
+      iov[i].iov_base = batchBuffer + i * slotSize;
+      iov[i].iov_len = slotSize;
+      messages[i].msg_hdr.msg_name = &sockAddrs[i];
+      messages[i].msg_hdr.msg_namelen = sizeof(sockAddrs[i]);
+      messages[i].msg_hdr.msg_iov = &iov[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+#ifdef UDP_GRO
+      messages[i].msg_hdr.msg_control = control[i];
+      messages[i].msg_hdr.msg_controllen = controlSize;
+#endif
+    }
+
+    result = recvmmsg(fd, messages, count, flags, NULL);
+    if (result == -1) {
+      if (errno == EINTR) continue;
+      // Nothing more pending
+      if ((nbDatagrams > 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) break;
+      throw InputStreamException(errno);
+    }
 
-        dataLeft = generateRemainingData(iov,iovcnt, totalQuantityWritten, &toWrite);
-        throw OutputStream::OutputStreamException(errno, toWrite,  dataLeft, quantityWritten);
+    for (int i = 0; i < result; ++i) {
+      size_t length = messages[i].msg_len;
+      size_t segmentSize = length;
+
+      if (messages[i].msg_hdr.msg_flags & MSG_TRUNC) continue;
+#ifdef UDP_GRO
+      for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&messages[i].msg_hdr);
+        cmsg != NULL; cmsg = CMSG_NXTHDR(&messages[i].msg_hdr, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO)) {
+          int size;
+
+          memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+          if (size > 0) segmentSize = size;
+        }
+      }
+#endif
+
+      // Each segment of a coalesced datagram is a datagram of its own
+      for (size_t offset = 0; offset < length; offset += segmentSize) {
+        size_t size = std::min(segmentSize, length - offset);
+
+        try {
+          parser.feed((char*) iov[i].iov_base + offset, size);
+        } catch (Exception &e) {
+          parser.reset();
+          continue;
+        }
+        // A datagram holds a whole object
+        if (parser.isParsing()) {
+          parser.reset();
+          continue;
+        }
+        while (parser.hasObject()) {
+          Serializable *object = parser.nextObject();
+
+          if (object == NULL) continue;
+          objects->push_back(object);
+          addresses->push_back(NetAddress(sockAddrs[i]));
+          ++nbObjects;
+        }
       }
-      totalQuantityWritten += quantityWritten;
     }
 
-    quantityWritten = sendto(fd, NULL, 0, 0,
-      (const sockaddr*) &clientAddr, sizeAddr);
+    nbDatagrams += result;
+    if ((unsigned int) result < count) break;
+    flags = MSG_DONTWAIT;
   }
 
-  return totalQuantityWritten;
+  return nbObjects;
 }
 
-ssize_t UdpSocket::writeObject(const Serializable &object, const NetAddress &addr) {
-  return writeObject2(object, &addr);
+void UdpSocket::changeMembership(int option, const NetAddress &group,
+  const NetAddress *interface) {
+  struct sockaddr_in groupAddr;
+  struct ip_mreq request;
+
+  group.getSockAddr(&groupAddr);
+  request.imr_multiaddr = groupAddr.sin_addr;
+  if (interface == NULL) {
+    request.imr_interface.s_addr = htonl(INADDR_ANY);
+  } else {
+    struct sockaddr_in interfaceAddr;
+
+    interface->getSockAddr(&interfaceAddr);
+    request.imr_interface = interfaceAddr.sin_addr;
+  }
+
+  if (setsockopt(fd, IPPROTO_IP, option, &request, sizeof(request)) == -1) {
+    throw NetException(errno);
+  }
+}
+
+void UdpSocket::joinGroup(const NetAddress &group) {
+  changeMembership(IP_ADD_MEMBERSHIP, group, NULL);
+}
+
+void UdpSocket::joinGroup(const NetAddress &group, const NetAddress &interface) {
+  changeMembership(IP_ADD_MEMBERSHIP, group, &interface);
+}
+
+void UdpSocket::leaveGroup(const NetAddress &group) {
+  changeMembership(IP_DROP_MEMBERSHIP, group, NULL);
+}
+
+void UdpSocket::leaveGroup(const NetAddress &group, const NetAddress &interface) {
+  changeMembership(IP_DROP_MEMBERSHIP, group, &interface);
+}
+
+void UdpSocket::setMulticastTtl(int ttl) {
+  unsigned char value = ttl;
+
+  if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &value, sizeof(value)) == -1) {
+    throw NetException(errno);
+  }
+}
+
+void UdpSocket::setMulticastLoop(bool loop) {
+  unsigned char value = loop ? 1 : 0;
+
+  if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &value, sizeof(value)) == -1) {
+    throw NetException(errno);
+  }
+}
+
+void UdpSocket::setMulticastInterface(const NetAddress &interface) {
+  struct sockaddr_in interfaceAddr;
+
+  interface.getSockAddr(&interfaceAddr);
+  if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &interfaceAddr.sin_addr,
+    sizeof(interfaceAddr.sin_addr)) == -1) {
+    throw NetException(errno);
+  }
+}
+
+ssize_t UdpSocket::writeObjectToGroup(const Serializable &object,
+  const NetAddress &group) {
+  struct sockaddr_in groupAddr;
+
+  group.getSockAddr(&groupAddr);
+  if (!IN_MULTICAST(ntohl(groupAddr.sin_addr.s_addr))) {
+    throw NetException(EINVAL, "Not a multicast address.");
+  }
+  return writeObject2(object, &group);
 }
 
 ssize_t UdpSocket::writeString(const std::string &string, const NetAddress &addr) {
@@ -193,6 +558,8 @@ Buffer<char> *UdpSocket::readBytes(Buffer<char> *buff, NetAddress *addr, uint64_
 }
 
 Buffer<char> *UdpSocket::readBytes(Buffer<char> *buff, NetAddress *addr, time_t sec, long nanosec, int flags) {
+  if (hasBufferedBytes()) return readBytes(buff, addr, flags);
+
   StreamWFRResult waitResult =
     waitForReady((StreamWFRSet) (STREAM_WFR_READ | STREAM_WFR_ERROR), sec, nanosec);
   // timeout || error
@@ -216,6 +583,8 @@ String *UdpSocket::readString(NetAddress *addr, uint64_t nanosec) {
 }
 
 String *UdpSocket::readString(NetAddress *addr, time_t sec, long nanosec) {
+  if (hasBufferedLine()) return readString(addr);
+
   StreamWFRResult waitResult =
     waitForReady((StreamWFRSet) (STREAM_WFR_READ | STREAM_WFR_ERROR), sec, nanosec);
   // timeout || error
@@ -239,6 +608,8 @@ Serializable *UdpSocket::readObject(NetAddress *addr, uint64_t nanosec) {
 }
 
 Serializable *UdpSocket::readObject(NetAddress *addr, time_t sec, long nanosec) {
+  if (hasBufferedObject()) return readObject(addr);
+
   StreamWFRResult waitResult =
     waitForReady((StreamWFRSet) (STREAM_WFR_READ | STREAM_WFR_ERROR), sec, nanosec);
   // timeout || error
@@ -3,15 +3,33 @@
 
 #include "net_socket.h"
 #include <vector>
+#include <sys/socket.h>
+
+// Datagrams given to the kernel in one system call by the batch methods
+#define UDP_BATCH_SIZE 64
 
 class UdpSocket: public IONetSocket {
   private :
     size_t maxSize;
+    bool genericOffload;
+    char *batchBuffer;
+    size_t batchBufferSize;
 
     friend class UdpAddress;
+    friend class ReliableUdpChannel;
+
+    UdpSocket(const UdpSocket &socket);
+    UdpSocket &operator=(const UdpSocket &socket);
+
+    ssize_t sendBatch(std::vector<struct mmsghdr> &messages,
+                      const std::vector<size_t> &nbObjects, size_t *nbSent);
+    void changeMembership(int option, const NetAddress &group,
+                          const NetAddress *interface);
 
     ssize_t readRawData(char *buffer, size_t size, int flags,
                         NetAddress *addr);
+    ssize_t readRawData(const struct iovec *iov, int iovcnt, int flags,
+                        NetAddress *addr);
     ssize_t writeData(  const char *data, size_t size, int flags,
                         const NetAddress *addr);
     ssize_t writeData(  const struct iovec *iov, int iovcnt,
@@ -19,11 +37,107 @@ class UdpSocket: public IONetSocket {
   public :
     UdpSocket();
     UdpSocket(int localPort);
+    ~UdpSocket(void);
 
     void setMaximumSize(size_t maxSize);
     size_t getMaximumSize(void);
 
+    //! \brief Enables the UDP segmentation offloads (GSO and GRO)
+    //! \param[in] enable true to enable them
+    //!
+    //! With the offloads, writeObjects gives the kernel runs of datagrams of
+    //! the same size to the same address as a single buffer (UDP_SEGMENT),
+    //! and readObjects accepts datagrams coalesced by the kernel (UDP_GRO).
+    //! They are only available on Linux: elsewhere, or when the kernel
+    //! refuses them, the batch methods silently fall back to one datagram per
+    //! message. Disabled by default.
+    void setGenericOffload(bool enable);
+    bool getGenericOffload(void) const;
+
+    //! \brief Sends objects to addresses, with few system calls
+    //! \param[in] objects the objects, each sent in its own datagram
+    //! \param[in] addresses the destination of each object, or a single
+    //!            address for all of them
+    //! \return the number of objects sent
+    //!
+    //! The datagrams are given to the kernel by batches (sendmmsg). All the
+    //! objects are serialized and checked against the maximum size before
+    //! anything is sent: an OutputStreamException with the code
+    //! EX_OSTREAM_TOO_MUCH_DATA is thrown if one does not fit. An
+    //! OutputStreamException with errno is thrown if the first batch can
+    //! not be sent; later errors end the call, and the return value tells how
+    //! many objects went out.
+    size_t writeObjects(const std::vector<const Serializable*> &objects,
+                        const std::vector<NetAddress> &addresses);
+
+    //! \brief Receives the pending objects, with few system calls
+    //! \param[out] objects the objects received are appended, to be deleted
+    //!             by the caller
+    //! \param[out] addresses the sender of each object is appended
+    //! \param[in] maxDatagrams the maximum number of datagrams read
+    //! \return the number of objects appended
+    //!
+    //! Blocks until a datagram is available, then takes the ones already
+    //! received (recvmmsg), up to maxDatagrams. Datagrams which can not be
+    //! parsed, or of an unknown type, are dropped, so that one bad datagram
+    //! does not lose the others. Must not be mixed with the buffered
+    //! readObject. Throws an InputStreamException with errno on errors.
+    size_t readObjects(std::vector<Serializable*> *objects,
+                       std::vector<NetAddress> *addresses,
+                       size_t maxDatagrams = UDP_BATCH_SIZE);
+
     ssize_t writeObject(const Serializable &object, const NetAddress &addr);
+
+    using IONetSocket::asyncWriteObject;
+    //! \brief Sends an object to an address without blocking
+    //! \param[in] loop the loop driving the operation
+    //! \param[in] object the object, which is serialized at once
+    //! \param[in] addr the destination
+    //! \param[in] callback called when the datagram has been sent
+    //!
+    //! Throws an OutputStreamException if the object does not fit in a
+    //! datagram of the maximum size.
+    void asyncWriteObject(AsyncEventLoop &loop, const Serializable &object,
+      const NetAddress &addr, AsyncCallback *callback);
+    //! \brief Joins an IPv4 multicast group
+    //! \param[in] group the address of the group, its port being ignored
+    //!
+    //! The datagrams sent to the group and to the port of the socket are then
+    //! received. The socket must be bound to the port, the group being
+    //! joined on the interface chosen by the kernel. Throws a
+    //! NetSocket::NetException on errors.
+    void joinGroup(const NetAddress &group);
+
+    //! \brief Joins an IPv4 multicast group on an interface
+    //! \param[in] group the address of the group, its port being ignored
+    //! \param[in] interface the local address of the interface
+    void joinGroup(const NetAddress &group, const NetAddress &interface);
+    void leaveGroup(const NetAddress &group);
+    void leaveGroup(const NetAddress &group, const NetAddress &interface);
+
+    //! \brief Sets the time to live of the multicast datagrams
+    //! \param[in] ttl the number of routers crossed, 1 (the default) to stay
+    //!            on the local network
+    void setMulticastTtl(int ttl);
+
+    //! \brief Sets if the datagrams sent to a group are received by the
+    //!        sockets of this host which joined it (the default)
+    void setMulticastLoop(bool loop);
+
+    //! \brief Sets the interface the datagrams to groups are sent on
+    //! \param[in] interface the local address of the interface
+    void setMulticastInterface(const NetAddress &interface);
+
+    //! \brief Sends an object to a multicast group
+    //! \param[in] object the object
+    //! \param[in] group the address and the port of the group
+    //! \return the number of bytes sent
+    //!
+    //! A single datagram reaches every member of the group. Throws a
+    //! NetSocket::NetException with the code EINVAL if the address is not a
+    //! multicast one.
+    ssize_t writeObjectToGroup(const Serializable &object, const NetAddress &group);
+
     ssize_t writeString(const std::string &string, const NetAddress &addr);
     ssize_t writeBytes(const Buffer<char> &data, const NetAddress &addr, int flags = 0);
 
@@ -0,0 +1,137 @@
+// Benchmark of the delimiter search of the text reads: the former byte by
+// byte CRLF loop, memchr for a single delimiter, and the findDelimiter
+// kernels for a set of them. Then readString and readUntil over a file made
+// of a single multi-megabyte line.
+
+#include <libcomm/libcomm.h>
+#include <libcomm/file.h>
+#include <libcomm/types_utils.h>
+
+#include <iostream>
+#include <iomanip>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DATA_SIZE (16 * 1024 * 1024)
+#define NB_ROUNDS 20
+#define FILE_PATH "/tmp/libcomm_bench_delimiter"
+
+static const char *kernelNames[] = {"scalar", "sse2", "avx2", "neon"};
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void printResult(const std::string &name, double start, double nbBytes) {
+  double elapsed = now() - start;
+
+  std::cout << std::left << std::setw(32) << name << std::right
+    << std::fixed << std::setprecision(1) << std::setw(10)
+    << (nbBytes / elapsed / 1e6) << " MB/s" << std::endl;
+}
+
+// The search as it was done before
+static bool loopContainsCRLF(const char *buff, off_t start, off_t end, size_t *index) {
+  off_t i;
+
+  for (i = start; i < end; ++i) {
+    if (buff[i] == '\r') {
+      if (i < (end-1)) {
+        if (buff[i+1] == '\n') {
+          *index = i+2;
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+static void benchFile(const std::string &content) {
+  FILE *output = fopen(FILE_PATH, "w");
+  double start;
+
+  fwrite(content.data(), 1, content.size(), output);
+  fclose(output);
+
+  {
+    BufferedFile file(FILE_PATH, File::r);
+    String *str;
+
+    start = now();
+    str = file.readString();
+    printResult("readString", start, str->size());
+    delete str;
+    file.closeStream();
+  }
+  {
+    BufferedFile file(FILE_PATH, File::r);
+    String *str;
+
+    start = now();
+    str = file.readUntil(";,\n");
+    printResult("readUntil, 3 delimiters", start, str->size());
+    delete str;
+    file.closeStream();
+  }
+  unlink(FILE_PATH);
+}
+
+int main(int argc, char **argv) {
+  char *data = (char*) malloc(DATA_SIZE);
+  volatile size_t sink = 0;
+  size_t index = 0;
+  double start;
+
+  libcomm::init();
+
+  // Text without delimiter but a last CRLF
+  for (size_t i = 0; i < DATA_SIZE; ++i) data[i] = 'a' + (i % 26);
+  data[DATA_SIZE - 2] = '\r';
+  data[DATA_SIZE - 1] = '\n';
+
+  std::cout << "Default kernel: " << getFindDelimiterKernelName() << std::endl;
+
+  start = now();
+  for (int r = 0; r < NB_ROUNDS; ++r) {
+    loopContainsCRLF(data, 0, DATA_SIZE, &index);
+    sink = sink + index;
+  }
+  printResult("CRLF loop", start, (double) DATA_SIZE * NB_ROUNDS);
+
+  start = now();
+  for (int r = 0; r < NB_ROUNDS; ++r) {
+    sink = sink + (size_t) findDelimiter(data, DATA_SIZE, "\r", 1);
+  }
+  printResult("findDelimiter, memchr", start, (double) DATA_SIZE * NB_ROUNDS);
+
+  for (size_t k = 0; k < sizeof(kernelNames) / sizeof(char*); ++k) {
+    if (!setFindDelimiterKernel(kernelNames[k])) continue;
+    if (findDelimiter(data, DATA_SIZE, ";,\r", 3) != &(data[DATA_SIZE - 2])) {
+      std::cout << kernelNames[k] << " gives wrong results" << std::endl;
+      return 1;
+    }
+    start = now();
+    for (int r = 0; r < NB_ROUNDS; ++r) {
+      sink = sink + (size_t) findDelimiter(data, DATA_SIZE, ";,\r", 3);
+    }
+    printResult(std::string("findDelimiter, 3 ") + kernelNames[k], start,
+      (double) DATA_SIZE * NB_ROUNDS);
+  }
+
+  try {
+    benchFile(std::string(data, DATA_SIZE));
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    return 1;
+  }
+
+  free(data);
+  libcomm::clean();
+  return 0;
+}
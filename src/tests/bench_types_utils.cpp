@@ -0,0 +1,137 @@
+// Benchmark of the byte order conversions of types_utils: the former byte
+// by byte loops, the single value helpers and the array kernels.
+
+#include <libcomm/types_utils.h>
+
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NB_VALUES 4096
+#define NB_ROUNDS 20000
+
+static const char *kernelNames[] = {"scalar", "sse2", "avx2", "neon"};
+
+// The conversion as it was done before, through a union and a loop
+static void loopConvertToChars(uint32_t uint, char *c) {
+  union swap_32 swp32;
+  swp32.uint = uint;
+
+  if (isLittleEndian()) {
+    for (size_t i = 0; i<sizeof(uint32_t); ++i) {
+      c[sizeof(uint32_t)-i-1] = swp32.chars[i];
+    }
+  } else {
+    memcpy(c,swp32.chars,sizeof(uint32_t));
+  }
+}
+
+static void loopConvertToChars(uint64_t uint, char *c) {
+  union swap_64 swp64;
+  swp64.uint = uint;
+
+  if (isLittleEndian()) {
+    for (size_t i = 0; i<sizeof(uint64_t); ++i) {
+      c[sizeof(uint64_t)-i-1] = swp64.chars[i];
+    }
+  } else {
+    memcpy(c,swp64.chars,sizeof(uint64_t));
+  }
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void printResult(const std::string &name, double start, size_t valueSize) {
+  double elapsed = now() - start;
+  double nbValues = (double) NB_VALUES * NB_ROUNDS;
+
+  std::cout << std::left << std::setw(32) << name << std::right
+    << std::fixed << std::setprecision(3) << std::setw(10)
+    << (elapsed * 1e9 / nbValues) << " ns/value "
+    << std::setw(10) << std::setprecision(1)
+    << (nbValues * valueSize / elapsed / 1e6) << " MB/s" << std::endl;
+}
+
+// Every kernel must give the same result as convertToChars, including for
+// the values left to the scalar loop
+template <typename T>
+static bool check(void (*swapArray)(const void*, size_t, void*)) {
+  T values[67];
+  char expected[sizeof(values)];
+  char result[sizeof(values)];
+
+  for (size_t i = 0; i < 67; ++i) {
+    values[i] = (T) (i * 0x0102030405060708ULL);
+    convertToChars(values[i], &(expected[i*sizeof(T)]));
+  }
+  swapArray(values, 67, result);
+  return (memcmp(expected, result, sizeof(values)) == 0);
+}
+
+template <typename T>
+static bool bench(const std::string &typeName, void (*swapArray)(const void*, size_t, void*)) {
+  T *values = (T*) malloc(NB_VALUES * sizeof(T));
+  char *buffer = (char*) malloc(NB_VALUES * sizeof(T));
+  volatile char sink = 0;
+  double start;
+
+  for (size_t i = 0; i < NB_VALUES; ++i) {
+    values[i] = (T) (i * 2654435761U);
+  }
+
+  start = now();
+  for (int r = 0; r < NB_ROUNDS; ++r) {
+    for (size_t i = 0; i < NB_VALUES; ++i) {
+      loopConvertToChars(values[i], &(buffer[i*sizeof(T)]));
+    }
+    sink = sink + buffer[r % NB_VALUES];
+  }
+  printResult(typeName + " loop", start, sizeof(T));
+
+  start = now();
+  for (int r = 0; r < NB_ROUNDS; ++r) {
+    for (size_t i = 0; i < NB_VALUES; ++i) {
+      convertToChars(values[i], &(buffer[i*sizeof(T)]));
+    }
+    sink = sink + buffer[r % NB_VALUES];
+  }
+  printResult(typeName + " convertToChars", start, sizeof(T));
+
+  for (size_t k = 0; k < sizeof(kernelNames) / sizeof(char*); ++k) {
+    if (!setSwapBytesKernel(kernelNames[k])) continue;
+    if (!check<T>(swapArray)) {
+      std::cout << typeName << " " << kernelNames[k] << " gives wrong results" << std::endl;
+      return false;
+    }
+    start = now();
+    for (int r = 0; r < NB_ROUNDS; ++r) {
+      swapArray(values, NB_VALUES, buffer);
+      sink = sink + buffer[r % NB_VALUES];
+    }
+    printResult(typeName + " array " + kernelNames[k], start, sizeof(T));
+  }
+
+  free(values);
+  free(buffer);
+  return true;
+}
+
+int main(int argc, char **argv) {
+  isLittleEndian();
+  std::cout << "Default kernel: " << getSwapBytesKernelName() << std::endl;
+  for (size_t k = 0; k < sizeof(kernelNames) / sizeof(char*); ++k) {
+    if (setSwapBytesKernel(kernelNames[k]) && !check<uint16_t>(&swapBytesArray16)) {
+      std::cout << "uint16_t " << kernelNames[k] << " gives wrong results" << std::endl;
+      return 1;
+    }
+  }
+  if (!bench<uint32_t>("uint32_t", &swapBytesArray32)) return 1;
+  if (!bench<uint64_t>("uint64_t", &swapBytesArray64)) return 1;
+  return 0;
+}
@@ -0,0 +1,165 @@
+// Benchmark of the addressed UDP writes of serialized objects: the former
+// path, with a sendto per fragment and an empty sendto closing the datagram,
+// against UdpSocket::writeObject, which sends each datagram with a single
+// sendmsg. The send calls are counted by wrappers around the libc ones.
+
+#include <libcomm/libcomm.h>
+#include <libcomm/serialization_manager.h>
+#include <libcomm/udp_socket.h>
+#include "test_libcomm_testautoser.h"
+
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define PORT 5580
+#define NB_OBJECTS 20000
+
+static size_t nbSyscalls = 0;
+
+// Called by libcomm as well, in place of the libc functions
+extern "C" ssize_t sendto(int fd, const void *buf, size_t len, int flags,
+                          const struct sockaddr *addr, socklen_t addrLen) {
+  static ssize_t (*next)(int, const void*, size_t, int,
+    const struct sockaddr*, socklen_t) = NULL;
+
+  if (next == NULL) {
+    next = (ssize_t (*)(int, const void*, size_t, int,
+      const struct sockaddr*, socklen_t)) dlsym(RTLD_NEXT, "sendto");
+  }
+  ++nbSyscalls;
+  return next(fd, buf, len, flags, addr, addrLen);
+}
+
+extern "C" ssize_t sendmsg(int fd, const struct msghdr *msg, int flags) {
+  static ssize_t (*next)(int, const struct msghdr*, int) = NULL;
+
+  if (next == NULL) {
+    next = (ssize_t (*)(int, const struct msghdr*, int)) dlsym(RTLD_NEXT, "sendmsg");
+  }
+  ++nbSyscalls;
+  return next(fd, msg, flags);
+}
+
+extern "C" int sendmmsg(int fd, struct mmsghdr *msgs, unsigned int count, int flags) {
+  static int (*next)(int, struct mmsghdr*, unsigned int, int) = NULL;
+
+  if (next == NULL) {
+    next = (int (*)(int, struct mmsghdr*, unsigned int, int)) dlsym(RTLD_NEXT, "sendmmsg");
+  }
+  ++nbSyscalls;
+  return next(fd, msgs, count, flags);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void printResult(const std::string &name, double start, size_t startSyscalls) {
+  double elapsed = now() - start;
+
+  std::cout << std::left << std::setw(24) << name << std::right
+    << std::fixed << std::setprecision(1) << std::setw(10)
+    << (elapsed * 1e9 / NB_OBJECTS) << " ns/object "
+    << std::setw(8) << ((double) (nbSyscalls - startSyscalls) / NB_OBJECTS)
+    << " syscalls/object" << std::endl;
+}
+
+// The writes as they were done before
+static bool legacyWrite(int fd, const Serializable &object, const sockaddr_in &addr) {
+  SerializationManager *serManager = SerializationManager::getSerializationManager();
+  NetMessage *message = serManager->serialize(object, NULL);
+  int iovcnt;
+  struct iovec *iov = (struct iovec*) message->getData(&iovcnt);
+  bool result = true;
+
+  for (int i = 0; result && (i < iovcnt); ++i) {
+    result = (sendto(fd, iov[i].iov_base, iov[i].iov_len, MSG_MORE,
+      (const sockaddr*) &addr, sizeof(addr)) != -1);
+  }
+  result = result && (sendto(fd, NULL, 0, 0, (const sockaddr*) &addr,
+    sizeof(addr)) != -1);
+  free(iov);
+  delete message;
+  return result;
+}
+
+static int countFragments(const Serializable &object) {
+  SerializationManager *serManager = SerializationManager::getSerializationManager();
+  NetMessage *message = serManager->serialize(object, NULL);
+  int iovcnt;
+
+  free(message->getData(&iovcnt));
+  delete message;
+  return iovcnt;
+}
+
+int main(int argc, char **argv) {
+  libcomm::init();
+  libcomm::addSupportForAutoSerializable(MyType<TestAutoSerializable>());
+
+  try {
+    UdpSocket receiver(PORT);
+    UdpSocket sender;
+    NetAddress address("127.0.0.1", PORT);
+    sockaddr_in addr;
+    Vector<TestAutoSerializable*> object;
+    int legacyFd = socket(AF_INET, SOCK_DGRAM, 0);
+    int iovcnt;
+    double start;
+    size_t startSyscalls;
+
+    for (int i = 0; i < 8; ++i) {
+      Vector<char> *v = new Vector<char>();
+
+      v->push_back('a' + i);
+      object.push_back(new TestAutoSerializable(i, new double(i / 3.0),
+        "field", new String("pointed field"), v));
+    }
+    iovcnt = countFragments(object);
+    std::cout << "Fragments per object: " << iovcnt << std::endl;
+
+    // Writes go through the fragments, the datagrams are dropped once the
+    // receive buffer is full
+    sender.setFlattenMaxSize(0);
+    address.getSockAddr(&addr);
+
+    startSyscalls = nbSyscalls;
+    start = now();
+    for (int i = 0; i < NB_OBJECTS; ++i) {
+      if (!legacyWrite(legacyFd, object, addr)) {
+        std::cout << "sendto failed" << std::endl;
+        return 1;
+      }
+    }
+    printResult("sendto per fragment", start, startSyscalls);
+
+    startSyscalls = nbSyscalls;
+    start = now();
+    for (int i = 0; i < NB_OBJECTS; ++i) {
+      sender.writeObject(object, address);
+    }
+    printResult("sendmsg per datagram", start, startSyscalls);
+
+    for (size_t i = 0; i < object.size(); ++i) {
+      delete object[i];
+    }
+    close(legacyFd);
+    receiver.closeStream();
+    sender.closeStream();
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    return 1;
+  }
+
+  libcomm::clean();
+  return 0;
+}
@@ -2,23 +2,33 @@
 #include <time.h>
 #include <sstream>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include <libcomm/libcomm.h>
 #include <libcomm/libcomm_structs.h>
 #include <libcomm/net_address.h>
 #include <libcomm/udp_socket.h>
 #include <libcomm/tcp_socket.h>
+#include <libcomm/tcp_server.h>
+#include <libcomm/reliable_udp_channel.h>
+#include <libcomm/file.h>
 #include <libcomm/thread.h>
 #include <libcomm/mutex.h>
 #include <libcomm/timer.h>
 #include <libcomm/logger.h>
 #include <libcomm/config_loader.h>
+#include <libcomm/object_parser.h>
+#include <libcomm/event_loop.h>
+#include <libcomm/async_event_loop.h>
+#include <libcomm/coroutine_scheduler.h>
+#include <libcomm/arena.h>
 
 #include "test_libcomm_testautoser.h"
 
 #define PORT 5555
 #define ADDRESS NetAddress::getLocalIp()
-#define NUMBER_TEST 30
+#define NUMBER_TEST 33
 
 typedef bool (*CompareFunc) (const void* first, const void* second);
 bool compareString(const void* first, const void* second);
@@ -43,6 +53,7 @@ bool compareBufferUint64t(const void* first, const void* second);
 bool compareMapUin64tBuffer(const void* first, const void* second);
 bool compareMapCharString(const void* first, const void* second);
 bool compareMapCharStringPtr(const void* first, const void* second);
+bool compareMapInt64String(const void* first, const void* second);
 bool compareMapStringPtrChar(const void* first, const void* second);
 bool compareMapStringPtrStringPtr(const void* first, const void* second);
 bool compareTestSerClass(const void* first, const void* second);
@@ -60,6 +71,7 @@ class ReceiverThread : public Thread {
     std::string *testNames;
     bool tcp;
     int port;
+    bool ioUring;
 
   public :
     ReceiverThread( Serializable** receivedData,
@@ -74,6 +86,7 @@ class ReceiverThread : public Thread {
                     bool tcp,
                     int port);
     virtual ~ReceiverThread();
+    void setIoUring(bool ioUring);
     void *run();
 };
 
@@ -83,11 +96,13 @@ class SenderThread : public Thread {
     Serializable **sentData;
     NetAddress *address;
     bool tcp;
+    bool ioUring;
 
   public :
     SenderThread(Serializable** sentData, bool tcp);
     SenderThread(Serializable** sentData, NetAddress *address, bool tcp);
     virtual ~SenderThread();
+    void setIoUring(bool ioUring);
     void *run();
 };
 
@@ -465,6 +480,15 @@ void fillTestData(  Serializable **sentData,
   comparFuncs[i] = &compareVectorUInt64;
   testNames[i] = std::string("Vector<uint64_t>");
 
+  // Sent as a single packed block
+  Vector<uint32_t> *vBig = new Vector<uint32_t>();
+  for (uint32_t j = 0; j < (tcp ? 100000 : 256); ++j) {
+    vBig->push_back(j * 2654435761U);
+  }
+  sentData[++i] = vBig;
+  comparFuncs[i] = &compareVectorUInt32;
+  testNames[i] = std::string("Vector<uint32_t> (big)");
+
   Vector<String> *vStr = new Vector<String>();
   vStr->push_back("String 1 àé$éé$");
   vStr->push_back("String 2 }´[}{");
@@ -602,6 +626,17 @@ void fillTestData(  Serializable **sentData,
   comparFuncs[i] = &compareBufferUint64t;
   testNames[i] = std::string("Buffer<uint64_t>");
 
+  // Bigger than the default flatten maximum size with tcp
+  Buffer<char> *bBig = new Buffer<char>();
+  if (tcp) max = 2 * 1024 * 1024;
+  else max = 1024;
+  for (int i = 0; i<max; ++i) {
+    (*bBig)[i] = (char) (i % 251);
+  }
+  sentData[++i] = bBig;
+  comparFuncs[i] = &compareBufferChars;
+  testNames[i] = std::string("Buffer<char> (big)");
+
   Map<uint64_t, Buffer<char>*> *mapBuf = new Map<uint64_t, Buffer<char>*>();
   Buffer<char> *buffMap = new Buffer<char>();
   buffMap->copyIn(0,test_bch,strlen(test_bch));
@@ -620,6 +655,17 @@ void fillTestData(  Serializable **sentData,
   comparFuncs[i] = &compareMapCharString;
   testNames[i] = std::string("Map<char,String>");
 
+  // Keys are sent as varints with udp
+  Map<int64_t,String> *mapI64Str = new Map<int64_t,String>();
+  (*mapI64Str)[0] = "zero";
+  (*mapI64Str)[-1] = "minus one";
+  (*mapI64Str)[300] = "three hundreds";
+  (*mapI64Str)[INT64_MIN] = "min";
+  (*mapI64Str)[INT64_MAX] = "max";
+  sentData[++i] = mapI64Str;
+  comparFuncs[i] = &compareMapInt64String;
+  testNames[i] = std::string("Map<int64_t,String>");
+
   Map<char,String*> *mapChStrPtr = new Map<char,String*>();
   (*mapChStrPtr)['a'] = new String("String 1 àé$éé$");
   (*mapChStrPtr)['b'] = new String("String 2 }´[}{");
@@ -701,6 +747,987 @@ void fillTestData(  Serializable **sentData,
 
 }
 
+class StringSink : public NetMessageSink {
+  public :
+    std::string data;
+    void write(const char *buff, size_t size) {
+      data.append(buff, size);
+    }
+};
+
+// Feeds all the test objects, serialized one after the other, to an
+// ObjectParser by small pieces
+void testObjectParser(void) {
+  SerializationManager *serManager = SerializationManager::getSerializationManager();
+  Serializable *sentData[NUMBER_TEST];
+  CompareFunc comparFuncs[NUMBER_TEST];
+  std::string testNames[NUMBER_TEST];
+  ObjectParser parser;
+  StringSink sink;
+  bool result = true;
+  int nbObjects = 0;
+
+  fillTestData(sentData, comparFuncs, testNames, true);
+  for (int i = 0; i<NUMBER_TEST; ++i) {
+    ArenaScope arenaScope(Arena::getThreadArena());
+    NetMessage *message = serManager->serialize(*sentData[i], NULL);
+    message->flatten(sink);
+    delete message;
+  }
+
+  try {
+    for (size_t i = 0; i < sink.data.size(); i += 7) {
+      parser.feed(&(sink.data[i]), std::min((size_t) 7, sink.data.size() - i));
+      while (parser.hasObject()) {
+        Serializable *object = parser.nextObject();
+        result = result && (nbObjects < NUMBER_TEST)
+          && comparFuncs[nbObjects](object, sentData[nbObjects]);
+        ++nbObjects;
+      }
+    }
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  printTest("ObjectParser", result && (nbObjects == NUMBER_TEST) && !parser.isParsing());
+}
+
+// Clones all the test objects: the copy of the NetMessage is done in the
+// arena of the thread, the blocks given to the deserializers must not
+void testClone(void) {
+  SerializationManager *serManager = SerializationManager::getSerializationManager();
+  Serializable *sentData[NUMBER_TEST];
+  CompareFunc comparFuncs[NUMBER_TEST];
+  std::string testNames[NUMBER_TEST];
+  bool result = true;
+
+  fillTestData(sentData, comparFuncs, testNames, true);
+  for (int i = 0; i<NUMBER_TEST; ++i) {
+    Serializable *copy = serManager->clone(sentData[i]);
+    result = comparFuncs[i](copy, sentData[i]) && result;
+  }
+
+  {
+    String str("hello world");
+    Buffer<char> buffer(11);
+    String *strCopy;
+    Buffer<char> *bufferCopy;
+
+    buffer.copyIn(0, "hello world", 11);
+    strCopy = (String*) serManager->clone(str);
+    bufferCopy = (Buffer<char>*) serManager->clone(buffer);
+    result = result && (*strCopy == str) && (bufferCopy->size() == 11)
+      && (memcmp(bufferCopy->data(), "hello world", 11) == 0);
+    delete strCopy;
+    delete bufferCopy;
+  }
+  printTest("SerializationManager::clone", result);
+}
+
+// Objects serialized by pieces must give the bytes of their flattened
+// NetMessage. All of them but TestSerClass and TestSimpleSerializable know
+// their size and encode themselves. The big ones are written this way by the
+// tcp exchange, whose sender has a small flatten maximum size.
+void testSerializeTo(void) {
+  SerializationManager *serManager = SerializationManager::getSerializationManager();
+  Serializable *sentData[NUMBER_TEST];
+  CompareFunc comparFuncs[NUMBER_TEST];
+  std::string testNames[NUMBER_TEST];
+  bool result = true;
+
+  fillTestData(sentData, comparFuncs, testNames, false);
+  for (int varint = 0; varint < 2; ++varint) {
+    int streamed = 0;
+
+    for (int i = 0; i<NUMBER_TEST; ++i) {
+      NetMessage *message = serManager->serialize(sentData[i], NULL);
+      StringSink sink;
+      size_t size;
+      size_t knownSize;
+      char *buffer;
+
+      if (varint) {
+        message->setVarintEncoding(true);
+      }
+      size = message->getFlattenedSize();
+      buffer = (char*) malloc(size);
+      message->flatten(buffer);
+      serManager->serializeTo(sentData[i], sink, varint);
+      knownSize = serManager->getSerializedSize(sentData[i], varint);
+      if (knownSize != 0) ++streamed;
+      result = result && (sink.data == std::string(buffer, size))
+        && ((knownSize == 0) || (knownSize == size));
+      free(buffer);
+      delete message;
+    }
+    result = result && (streamed == NUMBER_TEST - 2);
+  }
+  for (int i = 0; i<NUMBER_TEST; ++i) {
+    result = comparFuncs[i](serManager->clone(sentData[i]), sentData[i]) && result;
+  }
+  printTest("SerializationManager::serializeTo", result);
+}
+
+// Waits on two udp sockets, with an EventLoop and with the vector version of
+// waitForReady which is built on it
+void testEventLoop(void) {
+  bool result = true;
+
+  try {
+    UdpSocket receiver(PORT + 1);
+    UdpSocket sender;
+    NetAddress address(ADDRESS, PORT + 1);
+    String message("EventLoop");
+    std::vector<EventLoopEvent> events;
+    std::vector<Stream*> streams;
+    std::vector<StreamWFRResult> wfrResults;
+    EventLoop loop;
+
+    loop.add(&receiver, STREAM_WFR_READ, &receiver);
+    loop.add(&sender, STREAM_WFR_READ, &sender);
+    result = result && (loop.wait(&events, (uint64_t) 0) == 0);
+
+    sender.writeObject(message, address);
+    result = result && (loop.wait(&events, 1, 0) == 1)
+      && (events[0].data == &receiver) && events[0].setIsRead();
+
+    streams.push_back(&sender);
+    streams.push_back(&receiver);
+    Stream::waitForReady(&streams, 1, 0, STREAM_WFR_READ, &wfrResults);
+    result = result && (wfrResults.size() == 1) && (wfrResults[0].index == 1);
+
+    NetAddress from;
+    delete receiver.readObject(&from);
+    loop.remove(&receiver);
+    result = result && (loop.size() == 1);
+    receiver.closeStream();
+    sender.closeStream();
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  printTest("EventLoop", result);
+}
+
+// Connects, accepts and exchanges objects through an AsyncEventLoop running
+// in its own thread, with the callbacks on a worker
+void testAsyncEventLoop(void) {
+  bool result = true;
+
+  try {
+    AsyncEventLoop loop(1);
+    TcpServerSocket server(PORT + 3);
+    TcpSocket client;
+    UdpSocket receiver(PORT + 4);
+    UdpSocket sender;
+    String message("AsyncEventLoop");
+    AsyncFuture accepted, connected, written, read, canceled;
+    AsyncFuture datagramWritten, datagramRead;
+
+    loop.start();
+    server.asyncAccept(loop, &accepted);
+    client.asyncConnect(loop, NetAddress(ADDRESS, PORT + 3), &connected);
+    result = result && !connected.get().failed();
+    AsyncResult acceptResult = accepted.get();
+    TcpSocket *peer = acceptResult.acceptedSocket;
+    result = result && !acceptResult.failed() && (peer != NULL);
+
+    if (peer != NULL) {
+      peer->asyncReadObject(loop, &read);
+      client.asyncWriteObject(loop, message, &written);
+      AsyncResult writeResult = written.get();
+      AsyncResult readResult = read.get();
+      result = result && !writeResult.failed() && (writeResult.size > 0)
+        && !readResult.failed() && (readResult.object != NULL)
+        && (*((String*) readResult.object) == message);
+      delete readResult.object;
+
+      peer->asyncReadObject(loop, &canceled);
+      loop.cancel(peer);
+      result = result && (canceled.get().e.getCode() == ECANCELED);
+      peer->closeStream();
+      delete peer;
+    }
+
+    receiver.asyncReadObject(loop, &datagramRead);
+    sender.asyncWriteObject(loop, message, NetAddress(ADDRESS, PORT + 4),
+      &datagramWritten);
+    AsyncResult datagramResult = datagramRead.get();
+    result = result && !datagramWritten.get().failed()
+      && !datagramResult.failed() && (datagramResult.object != NULL)
+      && (*((String*) datagramResult.object) == message);
+    delete datagramResult.object;
+
+    loop.stop();
+    loop.join();
+    client.closeStream();
+    server.closeServer();
+    receiver.closeStream();
+    sender.closeStream();
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  printTest("AsyncEventLoop", result);
+}
+
+// Sends every object back, and closes the connection on "close"
+class EchoHandler: public TcpServerHandler {
+  public:
+    Mutex mutex;
+    int nbConnected;
+    int nbDisconnected;
+
+    EchoHandler(void): nbConnected(0), nbDisconnected(0) {
+    }
+
+    void connected(TcpServerConnection &connection) {
+      mutex.lock();
+      ++nbConnected;
+      mutex.unlock();
+    }
+
+    void objectReceived(TcpServerConnection &connection, Serializable *object) {
+      connection.send(*object);
+      if (*((String*) object) == "close") connection.close();
+      delete object;
+    }
+
+    void disconnected(TcpServerConnection &connection, Exception &e) {
+      mutex.lock();
+      ++nbDisconnected;
+      mutex.unlock();
+    }
+};
+
+// Two clients of a TcpServer with two SO_REUSEPORT workers
+void testTcpServer(void) {
+  bool result = true;
+
+  try {
+    EchoHandler handler;
+    TcpServer server(PORT + 6, &handler, 2);
+    TcpSocket first;
+    TcpSocket second;
+    String message("TcpServer");
+    String close("close");
+    Serializable *echo;
+
+    server.start();
+    first.connectSocket(NetAddress(ADDRESS, PORT + 6));
+    second.connectSocket(NetAddress(ADDRESS, PORT + 6));
+
+    first.writeObject(message);
+    echo = first.readObject(5, 0);
+    result = result && (echo != NULL) && (*((String*) echo) == message);
+    delete echo;
+
+    second.writeObject(close);
+    echo = second.readObject(5, 0);
+    result = result && (echo != NULL) && (*((String*) echo) == close);
+    delete echo;
+
+    server.stop();
+    result = result && (handler.nbConnected == 2) && (handler.nbDisconnected == 2);
+    first.closeStream();
+    second.closeStream();
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  printTest("TcpServer", result);
+}
+
+// Sends objects of the same size in one batch, with the segmentation
+// offloads, and receives them in batches
+void testUdpBatch(void) {
+  bool result = true;
+
+  try {
+    UdpSocket receiver(PORT + 7);
+    UdpSocket sender;
+    std::vector<String> messages;
+    std::vector<const Serializable*> objects;
+    std::vector<NetAddress> addresses(1, NetAddress(ADDRESS, PORT + 7));
+    std::vector<Serializable*> received;
+    std::vector<NetAddress> from;
+
+    receiver.setGenericOffload(true);
+    sender.setGenericOffload(true);
+    for (int i = 0; i < 20; ++i) {
+      char text[16];
+
+      snprintf(text, sizeof(text), "Datagram %02d", i);
+      messages.push_back(String(text));
+    }
+    messages.push_back(String("Last"));
+    for (size_t i = 0; i < messages.size(); ++i) {
+      objects.push_back(&messages[i]);
+    }
+
+    result = (sender.writeObjects(objects, addresses) == messages.size());
+    while (result && (received.size() < messages.size())) {
+      result = (receiver.readObjects(&received, &from) > 0);
+    }
+    for (size_t i = 0; result && (i < messages.size()); ++i) {
+      result = (*((String*) received[i]) == messages[i])
+        && (from[i].getPort() == sender.getLocalAddress().getPort());
+    }
+    for (size_t i = 0; i < received.size(); ++i) {
+      delete received[i];
+    }
+    receiver.closeStream();
+    sender.closeStream();
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  printTest("UdpSocket batch", result);
+}
+
+// Small objects on two streams and a big one on a third, with a fifth of the
+// datagrams dropped in both directions
+void testReliableUdpChannel(void) {
+  bool result = true;
+
+  try {
+    ReliableUdpChannel first(PORT + 8, NetAddress("127.0.0.1", PORT + 9));
+    ReliableUdpChannel second(PORT + 9, NetAddress("127.0.0.1", PORT + 8));
+    String big(20000, 'x');
+    uint32_t nextIndex[2] = {0, 0};
+    bool bigReceived = false;
+
+    first.setLossRate(0.2, 7);
+    second.setLossRate(0.2, 11);
+    for (uint32_t i = 0; i < 50; ++i) {
+      std::ostringstream text;
+
+      text << i;
+      first.send(String(text.str()), i % 2);
+    }
+    first.send(big, 2);
+
+    for (int i = 0; result && (i < 51); ++i) {
+      uint16_t stream;
+      Serializable *object = second.receive((uint64_t) 10000000000ULL, &stream);
+      String *string = (String*) object;
+
+      if (stream == 2) {
+        bigReceived = (*string == big);
+      } else {
+        std::ostringstream text;
+
+        text << (nextIndex[stream] * 2 + stream);
+        result = (*string == text.str());
+        ++nextIndex[stream];
+      }
+      delete object;
+    }
+    result = result && bigReceived && first.flush(10000000000ULL)
+      && (first.getNbRetransmissions() > 0);
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  printTest("ReliableUdpChannel", result);
+}
+
+// A datagram sent to a group on the loopback interface reaches the member
+void testUdpMulticast(void) {
+  bool result = true;
+
+  try {
+    UdpSocket member(PORT + 10);
+    UdpSocket publisher;
+    NetAddress group("239.255.0.1", PORT + 10);
+    NetAddress loopback("127.0.0.1", 0);
+    String message("Multicast");
+    Serializable *received;
+    NetAddress from;
+
+    member.joinGroup(group, loopback);
+    publisher.setMulticastInterface(loopback);
+    publisher.setMulticastLoop(true);
+    publisher.setMulticastTtl(1);
+    publisher.writeObjectToGroup(message, group);
+    received = member.readObject(&from, 5, 0);
+    result = (received != NULL) && (*((String*) received) == message);
+    delete received;
+
+    try {
+      publisher.writeObjectToGroup(message, NetAddress("127.0.0.1", PORT + 10));
+      result = false;
+    } catch (NetSocket::NetException &e) {
+      result = result && (e.getCode() == EINVAL);
+    }
+
+    member.leaveGroup(group, loopback);
+    member.closeStream();
+    publisher.closeStream();
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  printTest("UdpSocket multicast", result);
+}
+
+// Part of a file sent with sendfile, then a buffer sent with MSG_ZEROCOPY
+void testTcpSendFile(void) {
+  bool result = true;
+  const char *path = "/tmp/libcomm_test_sendfile";
+  const size_t fileSize = 100000;
+  const size_t zeroCopySize = 80000;
+  const char *fifoPath = "/tmp/libcomm_test_sendfile_fifo";
+  const size_t pipeSize = 50000;
+
+  try {
+    TcpServerSocket server(PORT + 11);
+    TcpSocket client;
+    TcpSocket *peer;
+    std::vector<char> content(fileSize);
+    Buffer<char> received(fileSize - 1000);
+    Buffer<char> zeroCopyData(zeroCopySize);
+    Buffer<char> zeroCopyReceived(zeroCopySize);
+    FILE *output = fopen(path, "w");
+
+    for (size_t i = 0; i < fileSize; ++i) content[i] = (char) (i * 7);
+    fwrite(&content[0], 1, fileSize, output);
+    fclose(output);
+
+    client.connectSocket(NetAddress(ADDRESS, PORT + 11));
+    peer = server.acceptConnection(5, 0);
+    {
+      BufferedFile file(path, File::r);
+
+      result = (client.sendFile(file, 1000, fileSize) == (ssize_t) (fileSize - 1000));
+    }
+    peer->readBytes(&received, MSG_WAITALL);
+    result = result && (memcmp(received.data(), &content[1000], fileSize - 1000) == 0);
+
+    // A pipe is spliced from its current position
+    unlink(fifoPath);
+    if (mkfifo(fifoPath, 0600) == 0) {
+      int writer = open(fifoPath, O_RDWR);
+      BufferedFile file(fifoPath, File::r);
+      Buffer<char> fromPipe(pipeSize);
+
+      result = result && (write(writer, &content[0], pipeSize) == (ssize_t) pipeSize);
+      result = result && (client.sendFile(file, 1000, pipeSize) == (ssize_t) pipeSize);
+      peer->readBytes(&fromPipe, MSG_WAITALL);
+      result = result && (memcmp(fromPipe.data(), &content[0], pipeSize) == 0);
+      close(writer);
+      file.closeStream();
+    } else {
+      result = false;
+    }
+
+    // On loopback the kernel copies the data, but still notifies
+    for (size_t i = 0; i < zeroCopySize; ++i) zeroCopyData[i] = (char) i;
+    if (client.setZeroCopyEnabled(true)) {
+      client.setZeroCopyThreshold(1024);
+      result = result && (client.writeBytes(zeroCopyData) == (ssize_t) zeroCopySize);
+    } else {
+      client.writeBytes(zeroCopyData);
+    }
+    peer->readBytes(&zeroCopyReceived, MSG_WAITALL);
+    result = result && (memcmp(zeroCopyReceived.data(), zeroCopyData.data(), zeroCopySize) == 0);
+
+    peer->closeStream();
+    delete peer;
+    client.closeStream();
+    server.closeServer();
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  unlink(path);
+  unlink(fifoPath);
+  printTest("TcpSocket sendFile and zero copy", result);
+}
+
+// Small reads, and a line longer than the capacity, through a small ring
+void testReadBufferRing(void) {
+  bool result = true;
+  const char *path = "/tmp/libcomm_test_ring";
+  std::string content;
+  std::string binary;
+  std::string longLine(300, 'x');
+
+  for (int i = 0; i < 50; ++i) {
+    char line[32];
+
+    snprintf(line, sizeof(line), "line %d\r\n", i);
+    content += line;
+  }
+  content += longLine + "\r\n";
+  for (int i = 0; i < 1000; ++i) binary += (char) (i * 13);
+  content += binary;
+  // Read ahead at the end of the file would reach its end
+  content += std::string(100, '\0');
+
+  try {
+    FILE *output = fopen(path, "w");
+    fwrite(content.data(), 1, content.size(), output);
+    fclose(output);
+
+    BufferedFile file(path, File::r);
+    std::string received;
+
+    file.setReadBufferCapacity(64);
+    file.setReadBufferSize(16);
+    result = (file.getReadBufferCapacity() == 64);
+
+    for (int i = 0; result && (i < 50); ++i) {
+      char line[32];
+      String *str = file.readString();
+
+      snprintf(line, sizeof(line), "line %d", i);
+      result = (*str == line);
+      delete str;
+    }
+
+    String *str = file.readString();
+    result = result && (*str == longLine);
+    delete str;
+
+    while (result && (received.size() < binary.size())) {
+      Buffer<char> buffer(std::min((size_t) 7, binary.size() - received.size()));
+
+      file.readBytes(&buffer);
+      received.append(buffer.data(), buffer.size());
+    }
+    result = result && (received == binary);
+    file.closeStream();
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  unlink(path);
+  printTest("Ring read buffer", result);
+}
+
+// The size announced by the peer is checked before reading the message
+void testMaxMessageSize(void) {
+  bool result = true;
+
+  try {
+    TcpServerSocket server(PORT + 15);
+    TcpSocket client;
+    TcpSocket *peer;
+    Serializable *object;
+
+    client.connectSocket(NetAddress(ADDRESS, PORT + 15));
+    peer = server.acceptConnection(5, 0);
+
+    client.writeObject(String(1000, 'x'));
+    result = (peer->getMaxMessageSize() == DEFAULT_MAX_MESSAGE_SIZE);
+    object = peer->readObject(5, 0);
+    result = result && (*((String*) object) == std::string(1000, 'x'));
+    delete object;
+
+    client.writeObject(String(1000, 'x'));
+    peer->setMaxMessageSize(100);
+    try {
+      object = peer->readObject(5, 0);
+      delete object;
+      result = false;
+    } catch (Exception &e) {
+      result = result && (e.getCode() == EX_MALFORMED_MESSAGE);
+    }
+
+    peer->closeStream();
+    delete peer;
+    client.closeStream();
+    server.closeServer();
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  printTest("readObject maximum message size", result);
+}
+
+// Long lines, through the read buffer and through peeks, with a limit
+void testReadStringLimit(void) {
+  bool result = true;
+  const char *path = "/tmp/libcomm_test_lines";
+  std::string longLine(100000, 'y');
+  std::string content = longLine + "\r\nshort\r\n" + longLine + "\r\nend\r\n";
+
+  try {
+    FILE *output = fopen(path, "w");
+    fwrite(content.data(), 1, content.size(), output);
+    fclose(output);
+
+    BufferedFile file(path, File::r);
+    RandomAccessFile randomFile(path);
+
+    for (int i = 0; i < 2; ++i) {
+      InputStream &input = (i == 0) ? (InputStream&) file : (InputStream&) randomFile;
+      String *str;
+
+      input.setMaxLineLength(1000);
+      try {
+        str = input.readString();
+        delete str;
+        result = false;
+      } catch (Exception &e) {
+        result = result && (e.getCode() == EX_ISTREAM_LINE_TOO_LONG);
+      }
+
+      // The line is still there
+      input.setMaxLineLength(longLine.size());
+      str = input.readString();
+      result = result && (*str == longLine);
+      delete str;
+      str = input.readString();
+      result = result && (*str == "short");
+      delete str;
+
+      input.setMaxLineLength(0);
+      str = input.readString();
+      result = result && (*str == longLine);
+      delete str;
+      str = input.readString();
+      result = result && (*str == "end");
+      delete str;
+    }
+    file.closeStream();
+    randomFile.closeStream();
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  unlink(path);
+  printTest("readString maximum line length", result);
+}
+
+// The delimiter kernels against a plain loop, then readUntil through a
+// socket and a file
+void testReadUntil(void) {
+  bool result = true;
+  // The last one supported, the fastest, stays selected
+  const char *kernels[] = {"scalar", "sse2", "avx2", "neon"};
+  const char *path = "/tmp/libcomm_test_until";
+  std::string data(300, 'a');
+  std::string content;
+
+  for (size_t k = 0; k < sizeof(kernels) / sizeof(char*); ++k) {
+    if (!setFindDelimiterKernel(kernels[k])) continue;
+    for (size_t position = 0; result && (position < 200); position += 7) {
+      for (size_t size = 0; result && (size < 80); size += 13) {
+        std::string buffer = data;
+        const char *found;
+
+        buffer[position] = ';';
+        if (position + 5 < buffer.size()) buffer[position + 5] = ',';
+        found = findDelimiter(buffer.data() + (position - position % 64), size, ",;", 2);
+        result = (found == ((position % 64 < size) ? &(buffer[position]) : NULL));
+      }
+    }
+  }
+
+  content = "key=value;" + data + ",end;";
+  try {
+    TcpServerSocket server(PORT + 12);
+    TcpSocket client;
+    TcpSocket *peer;
+    FILE *output = fopen(path, "w");
+    Buffer<char> buffer(content.size());
+    String *str;
+
+    for (size_t i = 0; i < content.size(); ++i) buffer[i] = content[i];
+    fwrite(content.data(), 1, content.size(), output);
+    fclose(output);
+    RandomAccessFile file(path);
+
+    client.connectSocket(NetAddress(ADDRESS, PORT + 12));
+    peer = server.acceptConnection(5, 0);
+    client.writeBytes(buffer);
+
+    for (int i = 0; i < 2; ++i) {
+      InputStream &input = (i == 0) ? (InputStream&) *peer : (InputStream&) file;
+
+      str = input.readUntil("=");
+      result = result && (*str == "key=");
+      delete str;
+      str = input.readUntil(";,");
+      result = result && (*str == "value;");
+      delete str;
+      str = input.readUntil(";,");
+      result = result && (*str == data + ",");
+      delete str;
+      str = input.readUntil(";");
+      result = result && (*str == "end;");
+      delete str;
+    }
+
+    peer->closeStream();
+    delete peer;
+    client.closeStream();
+    server.closeServer();
+    file.closeStream();
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  unlink(path);
+  printTest("readUntil and delimiter search", result);
+}
+
+// Small writes gathered, big ones written through, then read back
+void testBufferedOutput(void) {
+  bool result = true;
+  const char *path = "/tmp/libcomm_test_output";
+  std::string expected;
+  Buffer<char> big(10000);
+
+  for (size_t i = 0; i < big.size(); ++i) big[i] = (char) ('A' + i % 26);
+
+  try {
+    BufferedFile output(path, File::w, File::create | File::trunc, File::uRW);
+    String text("object");
+
+    for (int i = 0; i < 5000; ++i) {
+      char line[32];
+
+      snprintf(line, sizeof(line), "record %d", i);
+      output.writeString(line);
+      expected += std::string(line) + "\r\n";
+      if (i % 1000 == 0) {
+        output.writeBytes(big);
+        expected.append(big.data(), big.size());
+      }
+    }
+    output.writeObject(text);
+    output.closeStream();
+
+    BufferedFile input(path, File::r);
+    Buffer<char> received(expected.size());
+    Serializable *object;
+
+    input.readBytes(&received, MSG_WAITALL);
+    result = (std::string(received.data(), received.size()) == expected);
+    object = input.readObject();
+    result = result && (*((String*) object) == text);
+    delete object;
+    input.closeStream();
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  unlink(path);
+  printTest("BufferedOutputStream", result);
+}
+
+// A lone write leaves at once, a burst waits for the threshold or the delay
+void testTcpBatching(void) {
+  bool result = true;
+
+  try {
+    TcpServerSocket server(PORT + 13);
+    TcpSocket client;
+    TcpSocket *peer;
+    String *str;
+
+    client.connectSocket(NetAddress(ADDRESS, PORT + 13));
+    peer = server.acceptConnection(5, 0);
+
+    // One second delay: the lone write must not wait for it
+    client.setBatching(1000, 1000000);
+    result = (client.getBatchThreshold() == 1000) && (client.getBatchDelay() == 1000000);
+    client.writeString("lone");
+    str = peer->readString((uint64_t) 500000000);
+    result = result && (*str == "lone");
+    delete str;
+
+    // The burst ends the batch once 1000 bytes are written
+    for (int i = 0; i < 50; ++i) {
+      client.writeString(std::string(98, 'a' + i % 26));
+    }
+    for (int i = 0; result && (i < 50); ++i) {
+      str = peer->readString((uint64_t) 500000000);
+      result = (*str == std::string(98, 'a' + i % 26));
+      delete str;
+    }
+    result = result && (client.getNbBatches() >= 4);
+
+    // The end of the burst is sent by flushBatch
+    client.writeString("last");
+    client.flushBatch();
+    str = peer->readString((uint64_t) 500000000);
+    result = result && (*str == "last");
+    delete str;
+
+    // Or after the delay
+    client.setBatching(1000000, 20000);
+    client.writeString("first");
+    client.writeString("delayed");
+    for (int i = 0; i < 2; ++i) {
+      str = peer->readString((uint64_t) 500000000);
+      result = result && (*str == ((i == 0) ? "first" : "delayed"));
+      delete str;
+    }
+    usleep(50000);
+    result = result && (client.getNbBatchedWrites() == 54)
+      && (client.getNbBatchedBytes() == 6 + 50 * 100 + 6 + 7 + 9)
+      && (client.getMaxBatchBytes() >= 1000);
+
+    peer->closeStream();
+    delete peer;
+    client.closeStream();
+    server.closeServer();
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  printTest("TcpSocket write batching", result);
+}
+
+// A line read ahead with the previous one is returned without waiting, but
+// the timeout still applies to a line only partly read ahead
+void testTimedReadBuffered(void) {
+  bool result = true;
+
+  try {
+    TcpServerSocket server(PORT + 14);
+    TcpSocket client;
+    TcpSocket *peer;
+    Buffer<char> data;
+    String *str;
+
+    client.connectSocket(NetAddress(ADDRESS, PORT + 14));
+    peer = server.acceptConnection(5, 0);
+
+    data.copyIn(0, "one\r\ntwo\r\nth", 12);
+    client.writeBytes(data);
+    for (int i = 0; i < 2; ++i) {
+      str = peer->readString((uint64_t) 500000000);
+      result = result && (*str == ((i == 0) ? "one" : "two"));
+      delete str;
+    }
+    try {
+      str = peer->readString((uint64_t) 100000000);
+      delete str;
+      result = false;
+    } catch (Exception &e) {
+      result = result && (e.getCode() == EX_STREAM_TIMEOUT);
+    }
+
+    client.writeString("ree;four");
+    str = peer->readUntil(";", (uint64_t) 500000000);
+    result = result && (*str == "three;");
+    delete str;
+    str = peer->readString((uint64_t) 500000000);
+    result = result && (*str == "four");
+    delete str;
+
+    peer->closeStream();
+    delete peer;
+    client.closeStream();
+    server.closeServer();
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  printTest("Timed reads of buffered data", result);
+}
+
+// With io_uring, the objects arriving between two reads are still seen by
+// the timed reads and by an EventLoop
+void testTimedReadIoUring(void) {
+  bool result = true;
+
+  try {
+    TcpServerSocket server(PORT + 16);
+    TcpSocket client;
+    TcpSocket *peer;
+    Serializable *object;
+    EventLoop loop;
+    std::vector<EventLoopEvent> events;
+    timespec t = {0, 100000000};
+
+    client.connectSocket(NetAddress(ADDRESS, PORT + 16));
+    peer = server.acceptConnection(5, 0);
+    peer->setIoUringEnabled(true);
+
+    client.writeObject(String("first"));
+    object = peer->readObject(5, 0);
+    result = (*((String*) object) == "first");
+    delete object;
+
+    client.writeObject(String("second"));
+    nanosleep(&t, NULL);
+    object = peer->readObject(2, 0);
+    result = result && (*((String*) object) == "second");
+    delete object;
+
+    loop.add(peer, STREAM_WFR_READ);
+    client.writeObject(String("third"));
+    result = result && (loop.wait(&events, 2, 0) == 1);
+    object = peer->readObject(2, 0);
+    result = result && (*((String*) object) == "third");
+    delete object;
+    loop.remove(peer);
+
+    peer->closeStream();
+    delete peer;
+    client.closeStream();
+    server.closeServer();
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  printTest("Timed reads with io_uring", result);
+}
+
+#ifdef __cpp_impl_coroutine
+CoroutineTask echoLine(CoroutineScheduler &scheduler, TcpSocket &socket) {
+  String *line = co_await scheduler.readString(socket);
+
+  co_await scheduler.writeObject(socket, *line);
+  delete line;
+}
+
+CoroutineTask echoSession(CoroutineScheduler &scheduler, TcpServerSocket &server) {
+  TcpSocket *peer = co_await scheduler.acceptConnection(server);
+
+  co_await echoLine(scheduler, *peer);
+  peer->closeStream();
+  delete peer;
+}
+
+// A coroutine accepts a connection, reads a line and sends it back as an
+// object, while the main thread uses the blocking calls
+void testCoroutineScheduler(void) {
+  bool result = true;
+
+  try {
+    AsyncEventLoop loop;
+    CoroutineScheduler scheduler(loop);
+    TcpServerSocket server(PORT + 5);
+    TcpSocket client;
+    Serializable *echo;
+
+    scheduler.spawn(echoSession(scheduler, server));
+    loop.start();
+    client.connectSocket(NetAddress(ADDRESS, PORT + 5));
+    client.writeString("Coroutine");
+    echo = client.readObject(5, 0);
+    result = (echo != NULL) && (*((String*) echo) == "Coroutine");
+    delete echo;
+
+    loop.stop();
+    loop.join();
+    client.closeStream();
+    server.closeServer();
+  } catch (Exception &e) {
+    e.printCodeAndMessage();
+    result = false;
+  }
+  printTest("CoroutineScheduler", result);
+}
+#endif
+
 int main(int argc, char** argv) {
   if (argc == 2) {
     if (std::string(argv[1]) == "--help") {
@@ -832,6 +1859,53 @@ int main(int argc, char** argv) {
     sender_tcp.join();
     receiver_tcp.join();
 
+    // The same objects again, through io_uring when the kernel has it
+    fillTestData( (Serializable**) &sentData_tcp,
+                  (CompareFunc*) compareFuncs_tcp,
+                  (std::string*) testNames_tcp,
+                  true);
+    ReceiverThread receiver_uring(  (Serializable**) &receivedData_tcp,
+                              (Serializable**) &sentData_tcp,
+                              (CompareFunc*) compareFuncs_tcp,
+                              (std::string*) testNames_tcp,
+                              true, PORT + 2);
+    NetAddress uringAddress(ADDRESS, PORT + 2);
+    SenderThread sender_uring((Serializable**) &sentData_tcp, &uringAddress, true);
+    receiver_uring.setIoUring(true);
+    sender_uring.setIoUring(true);
+
+    Logger::log(INFO) << "Exchanging "<< NUMBER_TEST <<" objects with tcp and io_uring and comparing results..." 
+              << Logger::endmwn("Main");
+    receiver_uring.start();
+    timespec t3 = {0,500000000};
+    nanosleep(&t3,0);
+    sender_uring.start();
+
+    sender_uring.join();
+    receiver_uring.join();
+
+    testObjectParser();
+    testClone();
+    testSerializeTo();
+    testEventLoop();
+    testAsyncEventLoop();
+    testTcpServer();
+    testUdpBatch();
+    testReliableUdpChannel();
+    testUdpMulticast();
+    testTcpSendFile();
+    testReadBufferRing();
+    testMaxMessageSize();
+    testReadStringLimit();
+    testReadUntil();
+    testBufferedOutput();
+    testTcpBatching();
+    testTimedReadBuffered();
+    testTimedReadIoUring();
+#ifdef __cpp_impl_coroutine
+    testCoroutineScheduler();
+#endif
+
     
   } else if (argc == 2) {
     //Receiver
@@ -884,6 +1958,7 @@ ReceiverThread::ReceiverThread( Serializable** receivedData,
   this->sentData = sentData;
   this->tcp = tcp;
   this->port = PORT;
+  this->ioUring = false;
 }
 
 ReceiverThread::ReceiverThread( Serializable** receivedData,
@@ -898,18 +1973,29 @@ ReceiverThread::ReceiverThread( Serializable** receivedData,
   this->sentData = sentData;
   this->tcp = tcp;
   this->port = port;
+  this->ioUring = false;
 }
 
 SenderThread::SenderThread(Serializable** sentData, bool tcp) {
   this->sentData = sentData;
   this->address = (NetAddress*) NULL;
   this->tcp = tcp;
+  this->ioUring = false;
 }
 
 SenderThread::SenderThread(Serializable** sentData, NetAddress *address, bool tcp) {
   this->sentData = sentData;
   this->address = address;
   this->tcp = tcp;
+  this->ioUring = false;
+}
+
+void ReceiverThread::setIoUring(bool ioUring) {
+  this->ioUring = ioUring;
+}
+
+void SenderThread::setIoUring(bool ioUring) {
+  this->ioUring = ioUring;
 }
 
 void *ReceiverThread::run() {
@@ -919,10 +2005,13 @@ void *ReceiverThread::run() {
       TcpSocket *socket;
       
       socket = ssocket.acceptConnection();
+      socket->setZeroCopyParsing(true);
+      socket->setIoUringEnabled(ioUring);
 
       NetAddress addr = socket->getLocalAddress();
       Logger::log(INFO) << "Begin receiving data on " << addr.getAddress() 
-        << ":" << addr.getPort() << " with tcp" << Logger::endm(this);
+        << ":" << addr.getPort() << " with tcp"
+        << (socket->getIoUringEnabled() ? " and io_uring" : "") << Logger::endm(this);
 
       for (int i = 0; i<NUMBER_TEST; ++i) {
         receivedData[i] = socket->readObject();
@@ -961,6 +2050,10 @@ void *SenderThread::run() {
     
     try {
       TcpSocket socket(*address);
+      // Objects over 4KB are streamed through a small write window
+      socket.setFlattenMaxSize(4096);
+      socket.setWriteWindowSize(1024);
+      socket.setIoUringEnabled(ioUring);
 
       NetAddress addr = socket.getLocalAddress();
       Logger::log(INFO) << "Begin sending data from " << addr.getAddress() 
@@ -980,6 +2073,7 @@ void *SenderThread::run() {
   } else {
     UdpSocket socket;
     NetAddress defaultAddress(ADDRESS,PORT); 
+    socket.setVarintEncoding(true);
     NetAddress forGetPort(ADDRESS,1);
     
     NullPlaceholder nullMessage;
@@ -1350,6 +2444,20 @@ bool compareMapCharString(const void* first, const void* second) {
   }
 }
 
+bool compareMapInt64String(const void* first, const void* second) {
+  Map<int64_t,String> *f = (Map<int64_t,String>*) first;
+  Map<int64_t,String> *s = (Map<int64_t,String>*) second;
+  bool returnValue = true;
+  if ((first == NULL) || (second == NULL)) {
+    return false;
+  } else {
+    returnValue = (*f == *s);
+    delete f;
+    delete s;
+    return returnValue;
+  }
+}
+
 bool compareMapCharStringPtr(const void* first, const void* second) {
   Map<char,String*> *f = (Map<char,String*>*) first;
   Map<char,String*> *s = (Map<char,String*>*) second;